@@ -0,0 +1,162 @@
+/*
+ * da16k_agg.c
+ *
+ * IoTConnect via Dialog DA16K module - windowed telemetry aggregation.
+ */
+
+#include "da16k_private.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* Longest "<key>_<statistic>" name that can be emitted, including the null terminator */
+#define DA16K_AGG_KEY_MAX_LENGTH    64
+
+typedef struct {
+    uint8_t     output;
+    const char *suffix;
+} da16k_agg_output_t;
+
+static const da16k_agg_output_t da16k_agg_outputs[] = {
+    { DA16K_AGG_MIN,        "_min"      },
+    { DA16K_AGG_MAX,        "_max"      },
+    { DA16K_AGG_MEAN,       "_mean"     },
+    { DA16K_AGG_LAST,       "_last"     },
+    { DA16K_AGG_COUNT,      "_count"    },
+    { DA16K_AGG_VARIANCE,   "_variance" },
+};
+
+da16k_err_t da16k_agg_init(da16k_agg_t *agg, const da16k_schema_key_t *schema, size_t key_count,
+                           const uint8_t *outputs, da16k_agg_state_t *state) {
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, agg);
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, schema);
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, state);
+
+    agg->schema     = schema;
+    agg->key_count  = key_count;
+    agg->outputs    = outputs;
+    agg->state      = state;
+
+    da16k_agg_reset(agg);
+
+    return DA16K_SUCCESS;
+}
+
+void da16k_agg_reset(da16k_agg_t *agg) {
+    if (agg && agg->state) {
+        memset(agg->state, 0, agg->key_count * sizeof(agg->state[0]));
+    }
+}
+
+da16k_err_t da16k_agg_add(da16k_agg_t *agg, const da16k_schema_key_t *key, double value) {
+    da16k_agg_state_t  *state;
+    double              delta;
+
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, agg);
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, key);
+
+    if (key < agg->schema || key >= (agg->schema + agg->key_count)) {
+        DA16K_ERROR("Key '%s' is not part of the aggregator's schema\r\n", key->key ? key->key : "<null>");
+        return DA16K_INVALID_PARAMETER;
+    }
+
+    if (key->type != DA16K_AT_FLOAT32 && key->type != DA16K_AT_FLOAT64) {
+        DA16K_ERROR("Key '%s' is not numeric\r\n", key->key);
+        return DA16K_INVALID_PARAMETER;
+    }
+
+    state = &agg->state[key - agg->schema];
+
+    if (state->count == 0 || value < state->min) {
+        state->min = value;
+    }
+
+    if (state->count == 0 || value > state->max) {
+        state->max = value;
+    }
+
+    /* Welford's online algorithm: numerically stable without keeping the samples */
+    state->count++;
+    delta        = value - state->mean;
+    state->mean += delta / (double) state->count;
+    state->m2   += delta * (value - state->mean);
+    state->last  = value;
+
+    return DA16K_SUCCESS;
+}
+
+static double da16k_agg_statistic(const da16k_agg_state_t *state, uint8_t output) {
+    switch (output) {
+        case DA16K_AGG_MIN:         return state->min;
+        case DA16K_AGG_MAX:         return state->max;
+        case DA16K_AGG_MEAN:        return state->mean;
+        case DA16K_AGG_LAST:        return state->last;
+        case DA16K_AGG_VARIANCE:    return (state->count > 1) ? (state->m2 / (double) (state->count - 1)) : 0.0;
+        default:                    return 0.0;
+    }
+}
+
+/* Adds the selected statistics of a single key to msg */
+static da16k_err_t da16k_agg_flush_key(da16k_msg_t *msg, const da16k_schema_key_t *key, const da16k_agg_state_t *state,
+                                       uint8_t outputs) {
+    char        name[DA16K_AGG_KEY_MAX_LENGTH];
+    da16k_err_t ret = DA16K_SUCCESS;
+
+    for (size_t i = 0; i < (sizeof(da16k_agg_outputs) / sizeof(da16k_agg_outputs[0])) && ret == DA16K_SUCCESS; i++) {
+        const da16k_agg_output_t   *output = &da16k_agg_outputs[i];
+        int                         length;
+        double                      value;
+
+        if ((outputs & output->output) == 0) {
+            continue;
+        }
+
+        length = snprintf(name, sizeof(name), "%s%s", key->key, output->suffix);
+
+        if (length < 0 || (size_t) length >= sizeof(name)) {
+            DA16K_ERROR("Key '%s' is too long\r\n", key->key);
+            return DA16K_INVALID_PARAMETER;
+        }
+
+        if (output->output == DA16K_AGG_COUNT) {
+            ret = da16k_msg_add_int(msg, name, (int32_t) state->count);
+            continue;
+        }
+
+        /* Statistics are sent with the precision the key was declared with */
+        value = da16k_agg_statistic(state, output->output);
+        ret   = (key->type == DA16K_AT_FLOAT32) ? da16k_msg_add_float32(msg, name, (float) value)
+                                                : da16k_msg_add_num(msg, name, value);
+    }
+
+    return ret;
+}
+
+da16k_err_t da16k_agg_flush(da16k_agg_t *agg, da16k_msg_t *msg) {
+    da16k_msg_mark_t    mark;
+    da16k_err_t         ret;
+
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, agg);
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, msg);
+
+    da16k_msg_mark(msg, &mark);
+
+    for (size_t i = 0; i < agg->key_count; i++) {
+        uint8_t outputs = agg->outputs ? agg->outputs[i] : DA16K_AGG_DEFAULT;
+
+        /* Keys without samples in this window are left out */
+        if (agg->state[i].count == 0 || outputs == 0) {
+            continue;
+        }
+
+        /* All or nothing: the window is kept, so the statistics added so far would be sent twice */
+        if (DA16K_SUCCESS != (ret = da16k_agg_flush_key(msg, &agg->schema[i], &agg->state[i], outputs))) {
+            da16k_msg_rollback(msg, &mark);
+            return ret;
+        }
+    }
+
+    da16k_agg_reset(agg);
+
+    return DA16K_SUCCESS;
+}
@@ -0,0 +1,280 @@
+/*
+ * da16k_async.c
+ *
+ * IoTConnect via Dialog DA16K module - asynchronous telemetry queue & worker task.
+ */
+
+#include "da16k_private.h"
+
+#if defined(DA16K_CONFIG_FREERTOS)
+
+#include <string.h>
+
+#include "task.h"
+
+#if !defined(DA16K_CONFIG_ASYNC_QUEUE_DEPTH)
+#define DA16K_CONFIG_ASYNC_QUEUE_DEPTH          8
+#endif
+
+#if !defined(DA16K_CONFIG_ASYNC_SLOT_SIZE)
+#define DA16K_CONFIG_ASYNC_SLOT_SIZE            DA16K_MSG_ARENA_SIZE(DA16K_MSG_TUPLES_PER_ITERATION, 256)
+#endif
+
+#if !defined(DA16K_CONFIG_ASYNC_TASK_PRIORITY)
+#define DA16K_CONFIG_ASYNC_TASK_PRIORITY        (tskIDLE_PRIORITY + 1)
+#endif
+
+#if !defined(DA16K_CONFIG_ASYNC_TASK_STACK_WORDS)
+#define DA16K_CONFIG_ASYNC_TASK_STACK_WORDS     1024
+#endif
+
+#if (DA16K_CONFIG_ASYNC_QUEUE_DEPTH & (DA16K_CONFIG_ASYNC_QUEUE_DEPTH - 1)) != 0
+#error "DA16K_CONFIG_ASYNC_QUEUE_DEPTH must be a power of 2"
+#endif
+
+#define DA16K_ASYNC_QUEUE_MASK                  (DA16K_CONFIG_ASYNC_QUEUE_DEPTH - 1)
+
+/*  The batch holds the messages of one or more queue slots that go out together. Twice the slot size guarantees
+    that a full frame's worth of tuples can be collected even if slots are only partially filled. */
+#define DA16K_ASYNC_BATCH_SIZE                  (2 * DA16K_CONFIG_ASYNC_SLOT_SIZE)
+
+/*  Queue slot. The sequence number implements a bounded multi-producer queue without locks (D. Vyukov):
+    a slot at position pos is free for writing when sequence == pos, and ready for reading when sequence == pos + 1. */
+typedef struct {
+    uint32_t                sequence;
+    da16k_send_callback_t   callback;
+    void                   *context;
+    da16k_msg_t            *msg;
+    uint8_t                 buffer[DA16K_CONFIG_ASYNC_SLOT_SIZE];
+} da16k_async_slot_t;
+
+/* Completion info of a message that is part of the current batch */
+typedef struct {
+    da16k_send_callback_t   callback;
+    void                   *context;
+} da16k_async_pending_t;
+
+static da16k_async_slot_t       s_slots[DA16K_CONFIG_ASYNC_QUEUE_DEPTH];
+static uint32_t                 s_enqueue_pos   = 0;
+static uint32_t                 s_dequeue_pos   = 0;    /* Only modified by the worker */
+static TaskHandle_t             s_worker_task   = NULL;
+static da16k_async_stats_t      s_stats         = {0};
+
+static uint8_t                  s_batch_buffer[DA16K_ASYNC_BATCH_SIZE];
+static da16k_msg_t             *s_batch         = NULL;
+static da16k_async_pending_t    s_batch_pending[DA16K_CONFIG_ASYNC_QUEUE_DEPTH];
+static size_t                   s_batch_pending_count = 0;
+
+static void da16k_async_stat_add(uint32_t *stat, uint32_t value) {
+    __atomic_fetch_add(stat, value, __ATOMIC_RELAXED);
+}
+
+/* Returns the next slot ready for reading, or NULL if the queue is empty. Single consumer (worker task) only. */
+static da16k_async_slot_t *da16k_async_peek(void) {
+    da16k_async_slot_t *slot = &s_slots[s_dequeue_pos & DA16K_ASYNC_QUEUE_MASK];
+
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != (s_dequeue_pos + 1)) {
+        return NULL;
+    }
+
+    return slot;
+}
+
+/* Hands a slot obtained by da16k_async_peek back to the producers */
+static void da16k_async_release(da16k_async_slot_t *slot) {
+    s_dequeue_pos++;
+    __atomic_store_n(&slot->sequence, s_dequeue_pos + DA16K_ASYNC_QUEUE_MASK, __ATOMIC_RELEASE);
+    __atomic_fetch_sub(&s_stats.depth, 1, __ATOMIC_RELAXED);
+}
+
+/* Sends the current batch and reports the result to every message in it */
+static void da16k_async_flush_batch(void) {
+    da16k_err_t ret;
+    size_t      frames;
+
+    if (s_batch_pending_count == 0) {
+        return;
+    }
+
+    ret = da16k_send_msg_frames(s_batch, &frames);
+
+    s_stats.frames += (uint32_t) frames;
+    da16k_async_stat_add((ret == DA16K_SUCCESS) ? &s_stats.sent : &s_stats.failed, (uint32_t) s_batch_pending_count);
+
+    for (size_t i = 0; i < s_batch_pending_count; i++) {
+        if (s_batch_pending[i].callback) {
+            s_batch_pending[i].callback(ret, s_batch_pending[i].context);
+        }
+    }
+
+    s_batch_pending_count = 0;
+    da16k_msg_reset(s_batch);
+}
+
+/* Whether msg can be added to the batch without the batch taking up more than one frame */
+static bool da16k_async_fits_frame(const da16k_msg_t *msg) {
+    size_t  max_tuples;
+    size_t  max_length;
+    size_t  batch_count = da16k_msg_get_count(s_batch);
+    size_t  msg_count   = da16k_msg_get_count(msg);
+
+    da16k_msg_frame_limits(&max_tuples, &max_length);
+
+    return (batch_count + msg_count) <= max_tuples &&
+           (da16k_msg_encoded_length(s_batch, 0, batch_count) + da16k_msg_encoded_length(msg, 0, msg_count)) <= max_length;
+}
+
+static void da16k_async_worker(void *parameters) {
+    da16k_async_slot_t *slot;
+    size_t              max_tuples;
+
+    (void) parameters;
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        /* Messages stay queued while the link is down, the supervisor wakes us once it is back */
+        if (!da16k_link_usable()) {
+            continue;
+        }
+
+        da16k_msg_frame_limits(&max_tuples, NULL);
+
+        /* Coalesce everything that is queued right now into as few frames as possible */
+        while ((slot = da16k_async_peek()) != NULL) {
+            /* Slot of a message that could not be copied in */
+            if (slot->msg == NULL) {
+                da16k_async_release(slot);
+                continue;
+            }
+
+            /* A message that would overflow the frame being collected starts the next one */
+            if (s_batch_pending_count > 0 && !da16k_async_fits_frame(slot->msg)) {
+                da16k_async_flush_batch();
+            }
+
+            /* Slots always fit into an empty batch, so if this fails, the batch is sent out and the slot retried */
+            if (da16k_msg_append(s_batch, slot->msg) != DA16K_SUCCESS) {
+                da16k_async_flush_batch();
+                continue;
+            }
+
+            s_batch_pending[s_batch_pending_count].callback = slot->callback;
+            s_batch_pending[s_batch_pending_count].context  = slot->context;
+            s_batch_pending_count++;
+
+            da16k_async_release(slot);
+
+            /* Frame is full, there's nothing to gain by waiting for more */
+            if (da16k_msg_get_count(s_batch) >= max_tuples ||
+                s_batch_pending_count == DA16K_CONFIG_ASYNC_QUEUE_DEPTH) {
+                da16k_async_flush_batch();
+            }
+        }
+
+        da16k_async_flush_batch();
+    }
+}
+
+da16k_err_t da16k_async_start(void) {
+    if (s_worker_task) {
+        return DA16K_SUCCESS;
+    }
+
+    for (uint32_t i = 0; i < DA16K_CONFIG_ASYNC_QUEUE_DEPTH; i++) {
+        s_slots[i].sequence = i;
+    }
+
+    s_batch = da16k_create_msg_in_buffer(s_batch_buffer, sizeof(s_batch_buffer));
+    DA16K_RETURN_ON_NULL(DA16K_OUT_OF_MEMORY, s_batch);
+
+    if (pdPASS != xTaskCreate(da16k_async_worker, "da16k_async", DA16K_CONFIG_ASYNC_TASK_STACK_WORDS, NULL,
+                              DA16K_CONFIG_ASYNC_TASK_PRIORITY, &s_worker_task)) {
+        DA16K_ERROR("Failed to create worker task\r\n");
+        s_worker_task = NULL;
+        return DA16K_OUT_OF_MEMORY;
+    }
+
+    return DA16K_SUCCESS;
+}
+
+da16k_err_t da16k_send_msg_async(const da16k_msg_t *msg, da16k_send_callback_t callback, void *context) {
+    da16k_async_slot_t *slot;
+    uint32_t            pos;
+    uint32_t            depth;
+    int32_t             diff;
+    bool                msg_queued;
+
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, msg);
+
+    if (s_worker_task == NULL) {
+        return DA16K_NOT_INITIALIZED;
+    }
+
+    /* Claim a slot */
+    pos = __atomic_load_n(&s_enqueue_pos, __ATOMIC_RELAXED);
+
+    while (true) {
+        slot = &s_slots[pos & DA16K_ASYNC_QUEUE_MASK];
+        diff = (int32_t) (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - pos);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&s_enqueue_pos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+            /* pos was updated by the failed exchange, try again */
+        } else if (diff < 0) {
+            /* Queue is full */
+            da16k_async_stat_add(&s_stats.dropped, 1);
+            return DA16K_OUT_OF_MEMORY;
+        } else {
+            pos = __atomic_load_n(&s_enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    /*  The slot is ours, copy the message in. If it doesn't fit, the slot is still published (without a message)
+        so the queue keeps moving - the worker skips it. */
+    slot->callback  = callback;
+    slot->context   = context;
+    slot->msg       = da16k_create_msg_in_buffer(slot->buffer, sizeof(slot->buffer));
+
+    if (slot->msg && da16k_msg_append(slot->msg, msg) != DA16K_SUCCESS) {
+        slot->msg = NULL;
+    }
+
+    msg_queued = (slot->msg != NULL);
+
+    __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+
+    depth = __atomic_add_fetch(&s_stats.depth, 1, __ATOMIC_RELAXED);
+
+    if (depth > s_stats.max_depth) {
+        s_stats.max_depth = depth;  /* Not exact under contention, good enough for a high watermark */
+    }
+
+    xTaskNotifyGive(s_worker_task);
+
+    if (!msg_queued) {
+        DA16K_ERROR("Message too large for queue slot (%u bytes)\r\n", (unsigned) sizeof(slot->buffer));
+        da16k_async_stat_add(&s_stats.dropped, 1);
+        return DA16K_OUT_OF_MEMORY;
+    }
+
+    da16k_async_stat_add(&s_stats.enqueued, 1);
+
+    return DA16K_SUCCESS;
+}
+
+void da16k_async_wake(void) {
+    if (s_worker_task) {
+        xTaskNotifyGive(s_worker_task);
+    }
+}
+
+void da16k_get_async_stats(da16k_async_stats_t *stats) {
+    if (stats) {
+        *stats = s_stats;
+    }
+}
+
+#endif /* DA16K_CONFIG_FREERTOS */
@@ -4,6 +4,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define DA16K_AT_TX_BUFFER_SIZE 256
 #define DA16K_AT_RX_BUFFER_SIZE 512
@@ -12,214 +13,421 @@ static char da16k_at_send_buffer    [DA16K_AT_TX_BUFFER_SIZE];
 static char da16k_at_receive_buffer [DA16K_AT_RX_BUFFER_SIZE];
 static char da16k_at_saved_response [DA16K_AT_RX_BUFFER_SIZE];
 
-/* Receive a line of AT response from UART with a timeout.
+/* Data received from the UART in bulk that has not been parsed yet */
+#define DA16K_AT_RX_CHUNK_SIZE 128
+static char     da16k_at_rx_chunk[DA16K_AT_RX_CHUNK_SIZE];
+static size_t   da16k_at_rx_chunk_pos       = 0;
+static size_t   da16k_at_rx_chunk_len       = 0;
+
+/*  Line assembly state. A line that is only partially received when a read times out is kept and completed
+    by the next read, so nothing is lost between calls. */
+static size_t   da16k_at_line_len           = 0;
+static bool     da16k_at_line_overflow      = false;
+static bool     da16k_at_line_complete      = false;
+
+static size_t   da16k_at_saved_response_len = 0;
+
+typedef enum {
+    DA16K_AT_LINE_EMPTY,        /* Nothing but whitespace */
+    DA16K_AT_LINE_OK,           /* "OK" */
+    DA16K_AT_LINE_ERROR,        /* "ERROR" or "ERROR:<n>" */
+    DA16K_AT_LINE_RESPONSE,     /* "<expected response>:<data>" */
+    DA16K_AT_LINE_UNSOLICITED,  /* Anything else, usually "+EVENT:<data>" sent by the gateway on its own */
+} da16k_at_line_type_t;
+
+/* Unsolicited result code handlers */
+#if !defined(DA16K_CONFIG_MAX_URC_HANDLERS)
+#define DA16K_CONFIG_MAX_URC_HANDLERS 4
+#endif
+
+typedef struct {
+    const char             *prefix;
+    size_t                  prefix_len;
+    da16k_urc_handler_t     handler;
+    void                   *context;
+} da16k_at_urc_handler_t;
+
+static da16k_at_urc_handler_t da16k_at_urc_handlers[DA16K_CONFIG_MAX_URC_HANDLERS];
+
+/*  Receive a line of AT response from UART with a timeout.
+
+    Data is fetched from the UART in bulk and scanned for the line end, rather than character by character.
+    Lines exceeding the receive buffer are truncated (da16k_at_line_overflow is set), the rest of it is discarded.
+
+    Returns:
+    DA16K_SUCCESS - a complete line is in da16k_at_receive_buffer (da16k_at_line_len characters, EXCLUDING \r\n delimiter).
+    DA16K_TIMEOUT - The specified timeout was reached before the line was complete. The partial line is kept.
+
+    Other errors from the UART may occur. */
+static da16k_err_t da16k_at_read_line(uint32_t timeout_ms) {
+    static const size_t line_max = sizeof(da16k_at_receive_buffer) - 1; /* Room for the null terminator */
+    da16k_err_t         ret;
+
+    /* Start a new line if the previous one was consumed */
+    if (da16k_at_line_complete) {
+        da16k_at_line_len       = 0;
+        da16k_at_line_overflow  = false;
+        da16k_at_line_complete  = false;
+    }
 
-   Returns:
-   DA16K_INVALID_PARAMETER - buf or buf_size are invalid.
-   DA16K_SUCCESS - a line of text is in the buffer, EXCLUDING \r\n delimiter. 
-   DA16K_AT_RESPONSE_TOO_LONG - buf is too small to accommodate the response received.
-        The characters for this line will not be flushed in this case, the remainder can be fetched with another call to da16k_at_get_response_line
-   DA16K_TIMEOUT - The specified timeout was reached before another character could be fetched. There may be response data in the buffer.
+    while (true) {
+        const char *data;
+        const char *line_end;
+        size_t      available;
+        size_t      take;
+        size_t      copy;
 
-   The function will fetch at most buf_size - 1 characters and the retreived data is guaranteed to be null-terminated, even in case of errors.
+        if (da16k_at_rx_chunk_pos >= da16k_at_rx_chunk_len) {
+            da16k_at_rx_chunk_pos = 0;
+            da16k_at_rx_chunk_len = 0;
 
-   Other errors should not occur in normal operation. */
-static da16k_err_t da16k_at_get_response_line(char *buf, size_t buf_size, uint32_t timeout_ms) {
-    char       *write_ptr   = buf;
-    char       *upper_bound = buf + buf_size - 1;
-    char        last_char   = 0x00;
-    da16k_err_t ret         = DA16K_SUCCESS;
+            ret = da16k_uart_read(da16k_at_rx_chunk, sizeof(da16k_at_rx_chunk), &da16k_at_rx_chunk_len, timeout_ms);
 
-    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, buf);
+            if (ret != DA16K_SUCCESS) {
+                return ret;
+            }
 
-    if (buf_size == 0) {
-        return DA16K_INVALID_PARAMETER;
-    }
+            da16k_stats_rx(da16k_at_rx_chunk_len);
+        }
 
-    memset(buf, 0, buf_size);
+        data        = &da16k_at_rx_chunk[da16k_at_rx_chunk_pos];
+        available   = da16k_at_rx_chunk_len - da16k_at_rx_chunk_pos;
+        line_end    = memchr(data, '\n', available);
+        take        = line_end ? (size_t) (line_end - data) + 1 : available;
+        copy        = take;
 
-    while (true) {
-        /* Buffer is full, return & inform */
+        if (copy > (line_max - da16k_at_line_len)) {
+            copy = line_max - da16k_at_line_len;
+
+            if (!da16k_at_line_overflow) {
+                da16k_stats_rx_truncated();
+            }
 
-        if (write_ptr >= upper_bound) {
-            return DA16K_AT_RESPONSE_TOO_LONG;
+            da16k_at_line_overflow = true;
         }
 
-        /* Get next uart char */
-        ret = da16k_uart_get_char(write_ptr, timeout_ms);
+        memcpy(&da16k_at_receive_buffer[da16k_at_line_len], data, copy);
+        da16k_at_line_len       += copy;
+        da16k_at_rx_chunk_pos   += take;
+
+        if (line_end) {
+            /* Strip the delimiter (\r\n, or just \n) */
+            while (da16k_at_line_len > 0 && (da16k_at_receive_buffer[da16k_at_line_len - 1] == '\n' ||
+                                             da16k_at_receive_buffer[da16k_at_line_len - 1] == '\r')) {
+                da16k_at_line_len--;
+            }
+
+            da16k_at_receive_buffer[da16k_at_line_len] = 0x00;
+            da16k_at_line_complete = true;
 
-        if ((last_char == '\r') && (*write_ptr == '\n')) {
-            /* We received a full line ended by \r\n */
-            write_ptr--;
-            write_ptr[0] = 0x00;    /* Replace \r */
-            write_ptr[1] = 0x00;    /* Replace \n */
             return DA16K_SUCCESS;
         }
+    }
+}
 
-        /* Error */
+void da16k_at_discard_input(void) {
+    size_t received;
 
-        if (ret != DA16K_SUCCESS) {
-            return ret;
-        }
+    da16k_at_rx_chunk_pos   = 0;
+    da16k_at_rx_chunk_len   = 0;
+    da16k_at_line_len       = 0;
+    da16k_at_line_overflow  = false;
+    da16k_at_line_complete  = false;
 
-        last_char = *write_ptr;
-        write_ptr++;
+    while (da16k_uart_read(da16k_at_rx_chunk, sizeof(da16k_at_rx_chunk), &received, 0) == DA16K_SUCCESS && received > 0) {
+        da16k_stats_rx(received);
     }
-
-    return ret;
 }
 
-/*  Gets a pointer to the start of AT response data following the colon character. 
-    E.g. for ERROR:<x> or +SOMECOMMAND:<x>) it would return a pointer to <x> given the appropriate start_of_response character, if ERROR or +SOMECOMMAND are given in start_of_response.
-    Returns NULL if not found or out of bounds.
-*/
-static char *da16k_at_get_start_of_response_data(char *buf, size_t buf_size, const char *start_of_response) {
-    char *ret           = NULL;
-    char *upper_bound   = buf + buf_size;
+/* UART transmissions, counted for the statistics */
+static bool da16k_at_uart_send(const char *data, size_t length) {
+    da16k_stats_tx(length);
 
-    DA16K_RETURN_ON_NULL(NULL, buf);
-    DA16K_RETURN_ON_NULL(NULL, start_of_response);
+    return da16k_uart_send(data, length);
+}
 
-    ret = strstr(buf, start_of_response);
+static bool da16k_at_uart_sendv(const da16k_uart_iovec_t *segments, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        da16k_stats_tx(segments[i].length);
+    }
+
+    return da16k_uart_sendv(segments, count);
+}
 
-    if (ret == NULL) {
+/*  Checks whether line starts with prefix, followed by either the end of the line or a colon.
+    Returns a pointer to the data following the colon (or to the end of the line), NULL if there is no match. */
+static const char *da16k_at_match_prefix(const char *line, const char *prefix, size_t prefix_len) {
+    if (strncmp(line, prefix, prefix_len) != 0) {
         return NULL;
     }
 
-    ret += strlen(start_of_response);
-    
-    /* Final check: colon character & bounds check */
-    if (((ret + 1) >= upper_bound) || (*ret != ':')) {
-        return NULL;
+    if (line[prefix_len] == ':') {
+        return &line[prefix_len + 1];
     }
 
-    return ret + 1;
+    return (line[prefix_len] == 0x00) ? &line[prefix_len] : NULL;
 }
 
-/*  analogous to vprintf, this is like da16k_at_send_formatted_msg but takes va_list as parameter to reduce
-    code duplication for other funcs that allow formatted messages to be sent.
+/*  Classifies a received line in a single pass over its start. For OK, ERROR and RESPONSE lines, data points to the
+    response data following the colon (empty string if there is none). */
+static da16k_at_line_type_t da16k_at_classify_line(const char *line, const char *expected_response, const char **data) {
+    /* Skip leading whitespace */
+    while (*line != 0x00 && *line <= ' ') {
+        line++;
+    }
 
-    If add_crlf is true, a \r\n will be added at the end.*/
-static da16k_err_t da16k_at_send_formatted_valist(bool add_crlf, const char *format, va_list args) {
+    *data = line;
+
+    switch (line[0]) {
+        case 0x00:
+            return DA16K_AT_LINE_EMPTY;
+        case 'O':
+            if (line[1] == 'K' && line[2] == 0x00) {
+                *data = &line[2];
+                return DA16K_AT_LINE_OK;
+            }
+            break;
+        case 'E':
+            if ((*data = da16k_at_match_prefix(line, "ERROR", 5)) != NULL) {
+                return DA16K_AT_LINE_ERROR;
+            }
+            break;
+        default:
+            break;
+    }
+
+    if (expected_response && (*data = da16k_at_match_prefix(line, expected_response, strlen(expected_response))) != NULL) {
+        return DA16K_AT_LINE_RESPONSE;
+    }
+
+    *data = line;
+
+    return DA16K_AT_LINE_UNSOLICITED;
+}
+
+/* Routes an unsolicited line to the first handler with a matching prefix */
+static void da16k_at_dispatch_urc(const char *line) {
+    const char *data;
+
+    da16k_stats_urc();
+
+    for (size_t i = 0; i < DA16K_CONFIG_MAX_URC_HANDLERS; i++) {
+        const da16k_at_urc_handler_t *entry = &da16k_at_urc_handlers[i];
+
+        if (entry->handler && (data = da16k_at_match_prefix(line, entry->prefix, entry->prefix_len)) != NULL) {
+            entry->handler(line, data, entry->context);
+            return;
+        }
+    }
+
+    DA16K_DEBUG("Unhandled unsolicited line: %s\r\n", line);
+}
+
+da16k_err_t da16k_register_urc_handler(const char *prefix, da16k_urc_handler_t handler, void *context) {
+    da16k_at_urc_handler_t *free_entry = NULL;
+
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, prefix);
+
+    da16k_at_channel_lock();
+
+    for (size_t i = 0; i < DA16K_CONFIG_MAX_URC_HANDLERS; i++) {
+        da16k_at_urc_handler_t *entry = &da16k_at_urc_handlers[i];
+
+        /* Replace or remove an existing registration */
+        if (entry->handler && strcmp(entry->prefix, prefix) == 0) {
+            free_entry = entry;
+            break;
+        }
+
+        if (entry->handler == NULL && free_entry == NULL) {
+            free_entry = entry;
+        }
+    }
+
+    if (free_entry) {
+        free_entry->prefix      = prefix;
+        free_entry->prefix_len  = strlen(prefix);
+        free_entry->handler     = handler;
+        free_entry->context     = context;
+    }
+
+    da16k_at_channel_unlock();
+
+    return free_entry ? DA16K_SUCCESS : DA16K_OUT_OF_MEMORY;
+}
+
+static da16k_err_t da16k_at_process_urcs_transaction(void *context) {
+    const uint32_t  timeout_ms  = *(const uint32_t *) context;
+    da16k_err_t     ret         = DA16K_SUCCESS;
+    const char     *data;
+
+    while (ret == DA16K_SUCCESS) {
+        ret = da16k_at_read_line(timeout_ms);
+
+        if (ret != DA16K_SUCCESS) {
+            break;
+        }
+
+        switch (da16k_at_classify_line(da16k_at_receive_buffer, NULL, &data)) {
+            case DA16K_AT_LINE_UNSOLICITED:
+                da16k_at_dispatch_urc(data);
+                break;
+            case DA16K_AT_LINE_EMPTY:
+                break;
+            default:
+                /* A late response to an earlier command that timed out */
+                DA16K_WARN("Discarding stray response line: %s\r\n", da16k_at_receive_buffer);
+                break;
+        }
+    }
+
+    /* Running out of data is the normal way for this to end */
+    return (ret == DA16K_TIMEOUT) ? DA16K_SUCCESS : ret;
+}
+
+da16k_err_t da16k_process_urcs(uint32_t timeout_ms) {
+    return da16k_at_transact(DA16K_PRIORITY_NORMAL, da16k_at_process_urcs_transaction, &timeout_ms);
+}
+
+/*  Starts measuring the response time of a command that is about to be sent. After a timeout, the late response may
+    have come in since, it is dropped here so it is not mistaken for the response to this command. */
+static void da16k_at_begin_exchange(da16k_at_class_t at_class) {
+    const uint32_t no_wait = 0;
+
+    if (da16k_timing_begin(at_class)) {
+        (void) da16k_at_process_urcs_transaction((void *) &no_wait);
+    }
+}
+
+/*  Formats a message into dst like vsnprintf, leaving room for the \r\n terminator. If add_crlf is true, it is added.
+    On success, length is set to the message length (excluding the null terminator). */
+static da16k_err_t da16k_at_format_valist(char *dst, size_t size, bool add_crlf, size_t *length, const char *format, va_list args) {
     int at_msg_length;
-    
+
     DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, format);
 
-    at_msg_length = vsnprintf(da16k_at_send_buffer, sizeof(da16k_at_send_buffer), format, args);
+    at_msg_length = vsnprintf(dst, size, format, args);
 
     if (at_msg_length < 0) {
         return DA16K_AT_INVALID_MSG;
     }
 
     /* + 2 for \r\n terminator*/
-    if ((size_t) (at_msg_length + 2) >= sizeof(da16k_at_send_buffer)) { 
+    if ((size_t) (at_msg_length + 2) >= size) { 
         return DA16K_AT_MESSAGE_TOO_LONG;
     }
 
     if (add_crlf) {
         /* Add \r\n to terminate the message */
-        at_msg_length += sprintf(&da16k_at_send_buffer[at_msg_length], "\r\n");
+        at_msg_length += sprintf(&dst[at_msg_length], "\r\n");
     }
 
-    DA16K_DEBUG("TX buffer: '%s'", da16k_at_send_buffer);
+    *length = (size_t) at_msg_length;
 
-    return da16k_uart_send(da16k_at_send_buffer, (size_t) at_msg_length) ? DA16K_SUCCESS : DA16K_UART_ERROR;
+    return DA16K_SUCCESS;
 }
 
-/* checks if any non-space or valid ascii characters are in a response string */
-static bool da16k_at_is_line_only_whitespace(const char *str) {
-    DA16K_RETURN_ON_NULL(true, str);
+/*  analogous to vprintf, this is like da16k_at_send_formatted_msg but takes va_list as parameter to reduce
+    code duplication for other funcs that allow formatted messages to be sent.
+
+    If add_crlf is true, a \r\n will be added at the end.*/
+static da16k_err_t da16k_at_send_formatted_valist(bool add_crlf, const char *format, va_list args) {
+    size_t      at_msg_length;
+    da16k_err_t ret;
 
-    if (strlen(str) == 0) {
-        return true;
-    }
+    ret = da16k_at_format_valist(da16k_at_send_buffer, sizeof(da16k_at_send_buffer), add_crlf, &at_msg_length, format, args);
 
-    while (*str != 0x00) {
-        if (*str > ' ') { /* everything above the space character makes the string valid. */
-            return false;
-        }
-        str++;
+    if (ret != DA16K_SUCCESS) {
+        return ret;
     }
 
-    return true;
-}
+    DA16K_DEBUG("TX buffer: '%s'", da16k_at_send_buffer);
 
-da16k_err_t da16k_at_receive_and_validate_response(bool error_possible, const char *expected_response, uint32_t timeout_ms) {
-    bool error_received             = false;
-    bool ok_received                = false;
-    bool response_received          = false;
+    da16k_at_begin_exchange(da16k_timing_classify(da16k_at_send_buffer));
+
+    return da16k_at_uart_send(da16k_at_send_buffer, at_msg_length) ? DA16K_SUCCESS : DA16K_UART_ERROR;
+}
 
-    static const size_t buf_size    = sizeof(da16k_at_receive_buffer);
+/* Stores response data so it can be retrieved after further lines have been received */
+static void da16k_at_save_response(const char *data) {
+    size_t length = strlen(data); /* always fits, both buffers have the same size */
 
-    char *upper_bound               = da16k_at_receive_buffer + buf_size;
-    char *response_data_start       = NULL;
+    memcpy(da16k_at_saved_response, data, length + 1);
+    da16k_at_saved_response_len = length;
+}
 
+static da16k_err_t da16k_at_receive_response(bool error_possible, const char *expected_response, uint32_t timeout_ms) {
+    bool        ok_received         = false;
+    bool        response_received   = false;
+    bool        overflow            = false;
+    const char *data                = NULL;
     da16k_err_t ret                 = DA16K_SUCCESS;
-    
-    memset(da16k_at_saved_response, 0, buf_size);
 
-    while (ret == DA16K_SUCCESS) {
-        ret = da16k_at_get_response_line(da16k_at_receive_buffer, buf_size, timeout_ms);
+    da16k_at_saved_response[0]  = 0x00;
+    da16k_at_saved_response_len = 0;
 
-        if (ret == DA16K_AT_RESPONSE_TOO_LONG) {
-            DA16K_WARN("WARNING! RX buffer overflow!\r\nRX Buffer contents:\r\n%s\r\n", da16k_at_receive_buffer);
-        }
+    while (true) {
+        ret = da16k_at_read_line(timeout_ms);
 
-        /* Ignore lines that don't have anything parseable (just to clean up the output a little) */
-        if (da16k_at_is_line_only_whitespace(da16k_at_receive_buffer)) {
-            continue;
+        if (ret != DA16K_SUCCESS) {
+            /* "OK\r\n" was missing. In case of no response when expected, return last error code */
+            return response_received ? DA16K_AT_NO_OK : ret;
         }
 
-        DA16K_DEBUG("Respone line received: %s\r\n", da16k_at_receive_buffer);
-
-        /* Look for proper response, if one is expected */
-        if (!response_received && expected_response != NULL) {
-            response_data_start = da16k_at_get_start_of_response_data(da16k_at_receive_buffer, buf_size, expected_response);
+        if (da16k_at_line_overflow) {
+            DA16K_WARN("WARNING! RX buffer overflow!\r\nRX Buffer contents:\r\n%s\r\n", da16k_at_receive_buffer);
+            overflow = true;
         }
 
-        /* If we can't find the expected response, but an ERROR:<x> is possible and we haven't rcv'd one yet, flag and look for the error response */
-        if (error_possible && !error_received && response_data_start == NULL) {
-            response_data_start = da16k_at_get_start_of_response_data(da16k_at_receive_buffer, buf_size, "ERROR");
-            if (response_data_start != NULL) {
-                error_received = true;
-            }
+        switch (da16k_at_classify_line(da16k_at_receive_buffer, response_received ? NULL : expected_response, &data)) {
+            case DA16K_AT_LINE_EMPTY:
+                /* Ignore lines that don't have anything parseable */
+                continue;
+
+            case DA16K_AT_LINE_OK:
+                DA16K_DEBUG("Response line received: %s\r\n", da16k_at_receive_buffer);
+                ok_received = true;
+                break;
+
+            case DA16K_AT_LINE_RESPONSE:
+                DA16K_DEBUG("Response line received: %s\r\n", da16k_at_receive_buffer);
+                da16k_at_save_response(data);
+                response_received = true;
+                break;
+
+            case DA16K_AT_LINE_ERROR:
+                /* An error always terminates the response. The error code is kept as response data. */
+                DA16K_DEBUG("Response line received: %s\r\n", da16k_at_receive_buffer);
+                da16k_at_save_response(data);
+
+                if (!error_possible) {
+                    DA16K_ERROR("AT gateway returned an error: %s\r\n", da16k_at_receive_buffer);
+                }
+
+                return overflow ? DA16K_AT_RESPONSE_TOO_LONG : DA16K_AT_ERROR_CODE;
+
+            case DA16K_AT_LINE_UNSOLICITED:
+            default:
+                da16k_at_dispatch_urc(data);
+                continue;
         }
 
-        /* Mark whether the OK\r\n part of the response was received. */
-        if (strstr(da16k_at_receive_buffer, "OK") != NULL) {
-            ok_received = true;
+        /* If we have no expected response, an OK is enough. Otherwise, we need both (in any order). */
+        if (ok_received && (response_received || expected_response == NULL)) {
+            break;
         }
+    }
 
-        /* We received a valid response / error response relevant to us */
-        if (!response_received && response_data_start != NULL) {
-            /* Move all response data to the final response output buffer */
-            memmove(da16k_at_saved_response, response_data_start, (size_t) (upper_bound - response_data_start));
-            response_received = true;
-        }
+    DA16K_DEBUG("da16k_at_saved_response %s\r\n", da16k_at_saved_response);
 
-        /* If we have no expected response, an OK is enough, so we pretend a response was received. */
-        if (ok_received && expected_response == NULL) {
-            response_received = true;
-        }
+    return overflow ? DA16K_AT_RESPONSE_TOO_LONG : DA16K_SUCCESS;
+}
 
-        /* If OK *or* ERROR and the response data (if any) is received, we break. */
-        if (response_received && (error_received || ok_received)) {
-            break;
-        }
-    }
+da16k_err_t da16k_at_receive_and_validate_response(bool error_possible, const char *expected_response, uint32_t timeout_ms) {
+    da16k_err_t ret = da16k_at_receive_response(error_possible, expected_response, timeout_ms ? timeout_ms : da16k_timing_timeout_ms());
+
+    da16k_timing_end(ret);
 
-    if (response_received) {
-        DA16K_PRINT("da16k_at_saved_response %s\r\n", da16k_at_saved_response);
-        if (error_received) {
-            ret = DA16K_AT_ERROR_CODE;  /* So caller can handle this case properly */
-        } else if (ok_received) {
-            ret = DA16K_SUCCESS;        /* Everything is OK */
-        } else {
-            ret = DA16K_AT_NO_OK;       /* "OK\r\n" was missing */
-        }
-    }
-    
-    /* In case of no response when expected, return last error code */
     return ret;
 }
 
@@ -249,14 +457,55 @@ da16k_err_t da16k_at_send_formatted_raw_no_crlf(const char *format, ...) {
     return ret;
 }
 
+/* Validates the response to a command expecting a simple +EXAMPLE:<x> response with <x> = 1, or just an "OK" if expected_response is NULL */
+static da16k_err_t da16k_at_check_success(uint32_t timeout_ms, const char *expected_response) {
+    da16k_err_t ret = da16k_at_receive_and_validate_response(false, expected_response, timeout_ms);
+
+    /* Only check the return code if we have an expected response. */
+
+    if (expected_response) {
+        if (ret == DA16K_SUCCESS && da16k_at_get_response_code() != 1) {
+            DA16K_ERROR("AT command not successful. Return code: %d\r\n", da16k_at_get_response_code());
+            ret = DA16K_AT_FAIL;
+        }
+    }
+
+    return ret;
+}
+
+/* A preformatted command for da16k_at_command_transaction */
+typedef struct {
+    const char *command;
+    size_t      length;
+    const char *expected_response;
+    uint32_t    timeout_ms;
+} da16k_at_command_t;
+
+static da16k_err_t da16k_at_command_transaction(void *context) {
+    const da16k_at_command_t *command = context;
+
+    DA16K_DEBUG("TX buffer: '%s'", command->command);
+
+    da16k_at_begin_exchange(da16k_timing_classify(command->command));
+
+    if (!da16k_at_uart_send(command->command, command->length)) {
+        DA16K_ERROR("Error sending message: %d\r\n", (int) DA16K_UART_ERROR);
+        return DA16K_UART_ERROR;
+    }
+
+    return da16k_at_check_success(command->timeout_ms, command->expected_response);
+}
+
 da16k_err_t da16k_at_send_formatted_and_check_success(uint32_t timeout_ms, const char *expected_response, const char *format, ...) {
-    da16k_err_t ret = DA16K_SUCCESS;
-    va_list fmt_args;
+    char                buffer[DA16K_AT_TX_BUFFER_SIZE];    /* The shared send buffer may only be used within a transaction */
+    da16k_at_command_t  command;
+    da16k_err_t         ret = DA16K_SUCCESS;
+    va_list             fmt_args;
 
     DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, format);
 
     va_start(fmt_args, format);
-    ret = da16k_at_send_formatted_valist(true, format, fmt_args);
+    ret = da16k_at_format_valist(buffer, sizeof(buffer), true, &command.length, format, fmt_args);
     va_end(fmt_args);
 
     if (ret != DA16K_SUCCESS) {
@@ -264,44 +513,334 @@ da16k_err_t da16k_at_send_formatted_and_check_success(uint32_t timeout_ms, const
         return ret;
     }
 
-    ret = da16k_at_receive_and_validate_response(false, expected_response, timeout_ms);
+    command.command             = buffer;
+    command.expected_response   = expected_response;
+    command.timeout_ms          = timeout_ms;
 
-    /* Only check the return code if we have an expected response. */
+    return da16k_at_transact(DA16K_PRIORITY_NORMAL, da16k_at_command_transaction, &command);
+}
 
-    if (expected_response) {
-        if (ret == DA16K_SUCCESS && da16k_at_get_response_code() != 1) {
-            DA16K_ERROR("AT command not successful. Return code: %d\r\n", da16k_at_get_response_code());
-            ret = DA16K_AT_FAIL;
+static da16k_err_t da16k_at_execute_transaction(void *context) {
+    da16k_at_request_t *request = context;
+    da16k_uart_iovec_t  segments[2];
+    da16k_err_t         ret;
+
+    segments[0].data = request->command;    segments[0].length = strlen(request->command);
+    segments[1].data = "\r\n";              segments[1].length = 2;
+
+    DA16K_DEBUG("TX: '%s'\r\n", request->command);
+
+    da16k_at_begin_exchange(da16k_timing_classify(request->command));
+
+    if (!da16k_at_uart_sendv(segments, 2)) {
+        return DA16K_UART_ERROR;
+    }
+
+    ret = da16k_at_receive_and_validate_response(true, request->expected_response, request->timeout_ms);
+
+    /* Hand the response (or error code) back to the submitter */
+    if (request->response && request->response_size > 0) {
+        size_t length = da16k_at_saved_response_len;
+
+        if (length >= request->response_size) {
+            length = request->response_size - 1;
+
+            if (ret == DA16K_SUCCESS) {
+                ret = DA16K_AT_RESPONSE_TOO_LONG;
+            }
         }
+
+        memcpy(request->response, da16k_at_saved_response, length);
+        request->response[length] = 0x00;
+    }
+
+    return ret;
+}
+
+da16k_err_t da16k_at_execute(da16k_at_request_t *request) {
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, request);
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, request->command);
+
+    return da16k_at_transact(request->priority, da16k_at_execute_transaction, request);
+}
+
+void da16k_at_frame_init(da16k_at_frame_t *frame) {
+    if (frame) {
+        frame->segment_count    = 0;
+        frame->length           = 0;
+        frame->scratch_used     = 0;
+        frame->overflow         = false;
+    }
+}
+
+void da16k_at_frame_add(da16k_at_frame_t *frame, const char *data, size_t length) {
+    if (frame == NULL || data == NULL || length == 0) {
+        return;
+    }
+
+    /* One slot is always kept free for the \r\n terminator */
+    if (frame->segment_count >= (DA16K_AT_FRAME_MAX_SEGMENTS - 1)) {
+        frame->overflow = true;
+        return;
+    }
+
+    frame->segments[frame->segment_count].data      = data;
+    frame->segments[frame->segment_count].length    = length;
+    frame->segment_count++;
+    frame->length += length;
+}
+
+void da16k_at_frame_add_str(da16k_at_frame_t *frame, const char *str) {
+    if (str) {
+        da16k_at_frame_add(frame, str, strlen(str));
+    }
+}
+
+char *da16k_at_frame_scratch(da16k_at_frame_t *frame, size_t size) {
+    char *ret;
+
+    DA16K_RETURN_ON_NULL(NULL, frame);
+
+    if ((sizeof(frame->scratch) - frame->scratch_used) < size) {
+        frame->overflow = true;
+        return NULL;
+    }
+
+    ret = &frame->scratch[frame->scratch_used];
+    frame->scratch_used += size;
+
+    return ret;
+}
+
+/* Terminates the frame with \r\n and sends it. begin starts measuring the response time. */
+static da16k_err_t da16k_at_transmit_frame(da16k_at_frame_t *frame, bool begin) {
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, frame);
+
+    if (frame->overflow || frame->segment_count == 0) {
+        return DA16K_AT_MESSAGE_TOO_LONG;
+    }
+
+    /* The terminator slot is reserved by da16k_at_frame_add */
+    frame->segments[frame->segment_count].data      = "\r\n";
+    frame->segments[frame->segment_count].length    = 2;
+    frame->segment_count++;
+    frame->length += 2;
+
+    DA16K_DEBUG("TX frame: %u bytes in %u segments\r\n", (unsigned) frame->length, (unsigned) frame->segment_count);
+
+    if (begin) {
+        da16k_at_begin_exchange(da16k_timing_classify(frame->segments[0].data));
+    }
+
+    if (!da16k_at_uart_sendv(frame->segments, frame->segment_count)) {
+        DA16K_ERROR("Error sending frame\r\n");
+        return DA16K_UART_ERROR;
+    }
+
+    return DA16K_SUCCESS;
+}
+
+da16k_err_t da16k_at_send_frame_and_check_success(da16k_at_frame_t *frame, uint32_t timeout_ms, const char *expected_response) {
+    da16k_err_t ret = da16k_at_transmit_frame(frame, true);
+
+    if (ret != DA16K_SUCCESS) {
+        return ret;
+    }
+
+    return da16k_at_check_success(timeout_ms, expected_response);
+}
+
+da16k_err_t da16k_at_send_frame(da16k_at_frame_t *frame, uint32_t *sent_ms) {
+    /* Timed when its response is received, other frames may be answered first */
+    da16k_err_t ret = da16k_at_transmit_frame(frame, false);
+
+    if (sent_ms) {
+        *sent_ms = da16k_get_time_ms();
     }
 
     return ret;
 }
 
-da16k_err_t da16k_at_send_certificate(da16k_cert_type_t type, const char *cert) {
-    char        command_sequence[]  = AT_ESC "C0,";
-    bool        tx_success          = true;
+da16k_err_t da16k_at_receive_frame_response(da16k_at_class_t at_class, uint32_t sent_ms, const char *expected_response) {
+    uint32_t timeout_ms;
+    uint32_t elapsed_ms;
+
+    (void) da16k_timing_begin_at(at_class, sent_ms);
 
-    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, cert);
+    timeout_ms = da16k_timing_timeout_ms();
+    elapsed_ms = da16k_get_time_ms() - sent_ms;
+
+    /* Even if its time is up, the response may have been received in the meantime */
+    return da16k_at_check_success((elapsed_ms < timeout_ms) ? (timeout_ms - elapsed_ms) : 1, expected_response);
+}
+
+void da16k_at_drop_late_responses(void) {
+    const uint32_t no_wait = 0;
+
+    (void) da16k_at_process_urcs_transaction((void *) &no_wait);
+}
+
+/*  Certificates are streamed in chunks of this size. When the source is a read callback, this is also the size of
+    the static buffer the chunks are read into, for hashing and uploading. */
+#if !defined(DA16K_CONFIG_CERT_CHUNK_SIZE)
+#define DA16K_CONFIG_CERT_CHUNK_SIZE        256
+#endif
+
+/*  Pause between certificate chunks, for gateways that cannot keep up with a whole PEM file at once (0 = none) */
+#if !defined(DA16K_CONFIG_CERT_CHUNK_DELAY_MS)
+#define DA16K_CONFIG_CERT_CHUNK_DELAY_MS    0
+#endif
+
+typedef struct {
+    da16k_cert_type_t           type;
+    const da16k_cert_source_t  *source;
+    size_t                      length;
+    uint8_t                    *digest;
+} da16k_at_certificate_t;
+
+static char da16k_at_cert_chunk[DA16K_CONFIG_CERT_CHUNK_SIZE];
+
+static da16k_err_t da16k_at_certificate_transaction(void *context) {
+    const da16k_at_certificate_t   *cert                = context;
+    char                            command_sequence[]  = AT_ESC "C0,";
+    da16k_sha256_t                  sha;
+    da16k_err_t                     ret                 = DA16K_SUCCESS;
+    da16k_err_t                     response_ret;
+    size_t                          offset;
 
     /* A bit hackish, but the number after the 'C' denotes the certificate type, so we adjust it. */
-    command_sequence[2] += (char) type;
+    command_sequence[2] += (char) cert->type;
+
+    /* Enter Certificate Command Mode */
+    if (!da16k_at_uart_send(command_sequence, strlen(command_sequence))) {
+        return DA16K_UART_ERROR;
+    }
+
+    da16k_sha256_init(&sha);
+
+    for (offset = 0; offset < cert->length; offset += DA16K_CONFIG_CERT_CHUNK_SIZE) {
+        size_t      chunk_length    = cert->length - offset;
+        const char *chunk           = &da16k_at_cert_chunk[0];
+
+        if (chunk_length > DA16K_CONFIG_CERT_CHUNK_SIZE) {
+            chunk_length = DA16K_CONFIG_CERT_CHUNK_SIZE;
+        }
 
-    tx_success &= da16k_uart_send(command_sequence, strlen(command_sequence));  /* Enter Certificate Command Mode */
-    tx_success &= da16k_uart_send(cert,             strlen(cert));              /* Actual certificate */
-    tx_success &= da16k_uart_send(AT_ETX,           1);                         /* End of text marker */
+        if (cert->source->data) {
+            chunk = &cert->source->data[offset];
+        } else if (DA16K_SUCCESS != cert->source->read(cert->source->context, offset, da16k_at_cert_chunk, chunk_length)) {
+            DA16K_ERROR("Reading certificate failed at offset %u\r\n", (unsigned) offset);
+            ret = DA16K_STORAGE_ERROR;
+            break;
+        }
+
+        if (!da16k_at_uart_send(chunk, chunk_length)) {
+            return DA16K_UART_ERROR;
+        }
 
-    if (!tx_success) {
+        da16k_sha256_update(&sha, chunk, chunk_length);
+
+        if (DA16K_CONFIG_CERT_CHUNK_DELAY_MS > 0 && (offset + chunk_length) < cert->length) {
+            da16k_sleep_ms(DA16K_CONFIG_CERT_CHUNK_DELAY_MS);
+        }
+    }
+
+    /*  The gateway stays in certificate mode until it sees the end of text marker, so it is sent even if the upload
+        was aborted. Whatever it stored then is caught by the digest check afterwards. */
+    da16k_at_begin_exchange(DA16K_AT_CLASS_CERT);
+
+    if (!da16k_at_uart_send(AT_ETX, 1)) {
         return DA16K_UART_ERROR;
     }
 
-    return da16k_at_receive_and_validate_response(false, NULL, DA16K_UART_TIMEOUT_MS);
+    da16k_sha256_final(&sha, cert->digest);
+
+    /* The response is consumed in any case so it is not mistaken for the next command's */
+    response_ret = da16k_at_receive_and_validate_response(false, NULL, 0);
+
+    return (DA16K_SUCCESS != ret) ? ret : response_ret;
+}
+
+/* Hashes a certificate without sending it. Read callbacks share the chunk buffer with uploads, hence the transaction. */
+static da16k_err_t da16k_at_certificate_digest_transaction(void *context) {
+    const da16k_at_certificate_t   *cert    = context;
+    da16k_sha256_t                  sha;
+
+    da16k_sha256_init(&sha);
+
+    if (cert->source->data) {
+        da16k_sha256_update(&sha, cert->source->data, cert->length);
+    } else {
+        for (size_t offset = 0; offset < cert->length; offset += DA16K_CONFIG_CERT_CHUNK_SIZE) {
+            size_t chunk_length = cert->length - offset;
+
+            if (chunk_length > DA16K_CONFIG_CERT_CHUNK_SIZE) {
+                chunk_length = DA16K_CONFIG_CERT_CHUNK_SIZE;
+            }
+
+            if (DA16K_SUCCESS != cert->source->read(cert->source->context, offset, da16k_at_cert_chunk, chunk_length)) {
+                return DA16K_STORAGE_ERROR;
+            }
+
+            da16k_sha256_update(&sha, da16k_at_cert_chunk, chunk_length);
+        }
+    }
+
+    da16k_sha256_final(&sha, cert->digest);
+
+    return DA16K_SUCCESS;
+}
+
+da16k_err_t da16k_at_certificate_digest(const da16k_cert_source_t *source, uint8_t digest[DA16K_SHA256_SIZE]) {
+    da16k_at_certificate_t cert;
+
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, source);
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, digest);
+
+    if (source->data == NULL && source->read == NULL) {
+        return DA16K_INVALID_PARAMETER;
+    }
+
+    cert.type   = DA16K_CERT_MQTT_ROOT_CA;  /* Not used */
+    cert.source = source;
+    cert.length = (source->length == 0 && source->data) ? strlen(source->data) : source->length;
+    cert.digest = digest;
+
+    return da16k_at_transact(DA16K_PRIORITY_NORMAL, da16k_at_certificate_digest_transaction, &cert);
+}
+
+da16k_err_t da16k_at_send_certificate(da16k_cert_type_t type, const da16k_cert_source_t *source, uint8_t digest[DA16K_SHA256_SIZE]) {
+    da16k_at_certificate_t cert;
+
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, source);
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, digest);
+
+    if (source->data == NULL && source->read == NULL) {
+        return DA16K_INVALID_PARAMETER;
+    }
+
+    cert.type   = type;
+    cert.source = source;
+    cert.length = (source->length == 0 && source->data) ? strlen(source->data) : source->length;
+    cert.digest = digest;
+
+    DA16K_DEBUG("TX certificate %d: %u bytes in chunks of %u\r\n", (int) type, (unsigned) cert.length, (unsigned) DA16K_CONFIG_CERT_CHUNK_SIZE);
+
+    return da16k_at_transact(DA16K_PRIORITY_NORMAL, da16k_at_certificate_transaction, &cert);
 }
 
 char *da16k_at_get_response_str(void) {
     return da16k_strdup(da16k_at_saved_response);
 }
 
+const char *da16k_at_get_response_view(size_t *length) {
+    if (length) {
+        *length = da16k_at_saved_response_len;
+    }
+
+    return da16k_at_saved_response;
+}
+
 int da16k_at_get_response_code(void) {
     /* TODO: Make this less error-prone */
     return atoi(da16k_at_saved_response);
@@ -0,0 +1,341 @@
+/*
+ * da16k_cmd.c
+ *
+ * IoTConnect via Dialog DA16K module - cloud command handler registry & listener.
+ */
+
+#include "da16k_private.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(DA16K_CONFIG_MAX_CMD_HANDLERS)
+#define DA16K_CONFIG_MAX_CMD_HANDLERS           32
+#endif
+
+/* Open addressing hash table, kept at most half full so probe sequences stay short */
+#define DA16K_CMD_TABLE_SIZE                    (2 * DA16K_CONFIG_MAX_CMD_HANDLERS)
+
+typedef struct {
+    const char                     *name;       /* NULL = free slot */
+    uint32_t                        hash;
+    da16k_cmd_handler_t             handler;    /* NULL = unregistered */
+    const da16k_cmd_param_parser_t *parser;
+} da16k_cmd_entry_t;
+
+static da16k_cmd_entry_t    s_cmd_table[DA16K_CMD_TABLE_SIZE];
+static size_t               s_cmd_count = 0;
+
+const da16k_cmd_param_parser_t da16k_cmd_param_string   = { DA16K_CMD_PARAM_STRING, NULL };
+const da16k_cmd_param_parser_t da16k_cmd_param_int      = { DA16K_CMD_PARAM_INT,    NULL };
+const da16k_cmd_param_parser_t da16k_cmd_param_bool     = { DA16K_CMD_PARAM_BOOL,   NULL };
+
+/* FNV-1a */
+static uint32_t da16k_cmd_hash(const char *name) {
+    uint32_t hash = 2166136261u;
+
+    while (*name) {
+        hash ^= (uint8_t) *name++;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/*  Returns the slot holding name, or the free slot it would go into. The table is never full, so this always
+    terminates. */
+static da16k_cmd_entry_t *da16k_cmd_find_slot(const char *name, uint32_t hash) {
+    size_t index = hash % DA16K_CMD_TABLE_SIZE;
+
+    while (s_cmd_table[index].name != NULL) {
+        if (s_cmd_table[index].hash == hash && strcmp(s_cmd_table[index].name, name) == 0) {
+            break;
+        }
+
+        index = (index + 1) % DA16K_CMD_TABLE_SIZE;
+    }
+
+    return &s_cmd_table[index];
+}
+
+da16k_err_t da16k_register_cmd_handler(const char *name, da16k_cmd_handler_t handler, const da16k_cmd_param_parser_t *param_parser) {
+    uint32_t            hash;
+    da16k_cmd_entry_t  *entry;
+
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, name);
+
+    if (param_parser && param_parser->type == DA16K_CMD_PARAM_ENUM) {
+        DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, param_parser->enum_names);
+    }
+
+    hash    = da16k_cmd_hash(name);
+    entry   = da16k_cmd_find_slot(name, hash);
+
+    if (entry->name == NULL) {
+        if (s_cmd_count >= DA16K_CONFIG_MAX_CMD_HANDLERS) {
+            DA16K_ERROR("Too many command handlers (DA16K_CONFIG_MAX_CMD_HANDLERS = %u)\r\n", (unsigned) DA16K_CONFIG_MAX_CMD_HANDLERS);
+            return DA16K_OUT_OF_MEMORY;
+        }
+
+        entry->name = name;
+        entry->hash = hash;
+        s_cmd_count++;
+    }
+
+    /* Slots are never freed, unregistering only removes the handler */
+    entry->handler  = handler;
+    entry->parser   = param_parser;
+
+    return DA16K_SUCCESS;
+}
+
+static bool da16k_cmd_parse_int(const char *str, int32_t *value) {
+    char   *end;
+    long    result;
+
+    errno   = 0;
+    result  = strtol(str, &end, 10);
+
+    if (end == str || *end != 0x00 || errno == ERANGE || result < INT32_MIN || result > INT32_MAX) {
+        return false;
+    }
+
+    *value = (int32_t) result;
+
+    return true;
+}
+
+static bool da16k_cmd_parse_bool(const char *str, bool *value) {
+    static const char * const true_names[]  = { "1", "true",  "on"  };
+    static const char * const false_names[] = { "0", "false", "off" };
+
+    for (size_t i = 0; i < (sizeof(true_names) / sizeof(true_names[0])); i++) {
+        if (strcmp(str, true_names[i]) == 0) {
+            *value = true;
+            return true;
+        }
+
+        if (strcmp(str, false_names[i]) == 0) {
+            *value = false;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool da16k_cmd_parse_enum(const char *str, const char * const *names, size_t *index) {
+    for (size_t i = 0; names[i] != NULL; i++) {
+        if (strcmp(str, names[i]) == 0) {
+            *index = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static da16k_err_t da16k_cmd_parse_param(const da16k_cmd_param_parser_t *parser, const char *str, da16k_cmd_param_t *param) {
+    bool valid = true;
+
+    memset(param, 0, sizeof(*param));
+    param->string = str;
+
+    if (parser == NULL) {
+        return DA16K_SUCCESS;
+    }
+
+    if (str == NULL) {
+        return DA16K_INVALID_PARAMETER;
+    }
+
+    switch (parser->type) {
+        case DA16K_CMD_PARAM_INT:
+            valid = da16k_cmd_parse_int(str, &param->integer);
+            break;
+        case DA16K_CMD_PARAM_BOOL:
+            valid = da16k_cmd_parse_bool(str, &param->boolean);
+            break;
+        case DA16K_CMD_PARAM_ENUM:
+            valid = da16k_cmd_parse_enum(str, parser->enum_names, &param->index);
+            break;
+        case DA16K_CMD_PARAM_STRING:
+        default:
+            break;
+    }
+
+    return valid ? DA16K_SUCCESS : DA16K_INVALID_PARAMETER;
+}
+
+da16k_err_t da16k_dispatch_cmd(const da16k_cmd_t *cmd) {
+    const da16k_cmd_entry_t    *entry;
+    da16k_cmd_param_t           param;
+
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, cmd);
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, cmd->command);
+
+    entry = da16k_cmd_find_slot(cmd->command, da16k_cmd_hash(cmd->command));
+
+    if (entry->handler == NULL) {
+        DA16K_WARN("No handler for command: %s\r\n", cmd->command);
+        return DA16K_UNKNOWN_CMD;
+    }
+
+    if (da16k_cmd_parse_param(entry->parser, cmd->parameters, &param) != DA16K_SUCCESS) {
+        DA16K_ERROR("Invalid parameter for command %s: %s\r\n", cmd->command, cmd->parameters ? cmd->parameters : "<none>");
+        return DA16K_INVALID_PARAMETER;
+    }
+
+    entry->handler(cmd, &param);
+
+    return DA16K_SUCCESS;
+}
+
+#if defined(DA16K_CONFIG_FREERTOS)
+
+#include "task.h"
+
+#if !defined(DA16K_CONFIG_CMD_POLL_MIN_MS)
+#define DA16K_CONFIG_CMD_POLL_MIN_MS            250
+#endif
+
+#if !defined(DA16K_CONFIG_CMD_POLL_MAX_MS)
+#define DA16K_CONFIG_CMD_POLL_MAX_MS            5000
+#endif
+
+#if !defined(DA16K_CONFIG_CMD_TASK_PRIORITY)
+#define DA16K_CONFIG_CMD_TASK_PRIORITY          (tskIDLE_PRIORITY + 1)
+#endif
+
+#if !defined(DA16K_CONFIG_CMD_TASK_STACK_WORDS)
+#define DA16K_CONFIG_CMD_TASK_STACK_WORDS       1024
+#endif
+
+static TaskHandle_t             s_listener_task     = NULL;
+static da16k_cmd_callback_t     s_callback          = NULL;
+static void                    *s_callback_context  = NULL;
+static da16k_cmd_stats_t        s_stats             = {0};
+static uint64_t                 s_latency_total_ms  = 0;
+
+/* Set by the URC handler (owner task) when the gateway announces a command */
+static bool                     s_notified          = false;
+static TickType_t               s_notified_tick     = 0;
+
+#if defined(DA16K_CONFIG_CMD_URC_PREFIX)
+static void da16k_cmd_on_urc(const char *line, const char *data, void *context) {
+    (void) line;
+    (void) data;
+    (void) context;
+
+    /* Keep the earliest notification if several arrive before the listener gets to run */
+    if (!__atomic_load_n(&s_notified, __ATOMIC_ACQUIRE)) {
+        s_notified_tick = xTaskGetTickCount();
+        __atomic_store_n(&s_notified, true, __ATOMIC_RELEASE);
+    }
+
+    xTaskNotifyGive(s_listener_task);
+}
+#endif
+
+static void da16k_cmd_record_latency(TickType_t ticks) {
+    uint32_t latency_ms = (uint32_t) ticks * portTICK_PERIOD_MS;
+
+    s_stats.latency_last_ms = latency_ms;
+
+    if (latency_ms > s_stats.latency_max_ms) {
+        s_stats.latency_max_ms = latency_ms;
+    }
+
+    s_latency_total_ms += latency_ms;
+}
+
+/* da16k_get_cmds callback, context is the arrival tick of the commands */
+static void da16k_cmd_dispatch(const da16k_cmd_t *cmd, void *context) {
+    da16k_cmd_record_latency(xTaskGetTickCount() - *(const TickType_t *) context);
+    s_callback(cmd, s_callback_context);
+}
+
+static void da16k_cmd_listener(void *parameters) {
+    const TickType_t    min_interval    = pdMS_TO_TICKS(DA16K_CONFIG_CMD_POLL_MIN_MS);
+    const TickType_t    max_interval    = pdMS_TO_TICKS(DA16K_CONFIG_CMD_POLL_MAX_MS);
+    TickType_t          interval        = min_interval;
+    TickType_t          last_poll_tick  = xTaskGetTickCount();
+    TickType_t          arrival_tick;
+    size_t              count;
+    da16k_err_t         ret;
+
+    (void) parameters;
+
+    while (true) {
+        (void) ulTaskNotifyTake(pdTRUE, interval);
+
+        if (__atomic_exchange_n(&s_notified, false, __ATOMIC_ACQ_REL)) {
+            arrival_tick = s_notified_tick;
+            s_stats.notifications++;
+        } else {
+            /* The command could have arrived at any time since the previous poll - assume the worst case */
+            arrival_tick = last_poll_tick;
+        }
+
+        /* Nothing to fetch while the link is down, check again at the slowest rate */
+        if (!da16k_link_usable()) {
+            interval = max_interval;
+            continue;
+        }
+
+        last_poll_tick = xTaskGetTickCount();
+        s_stats.polls++;
+
+        ret = da16k_get_cmds(da16k_cmd_dispatch, &arrival_tick, 0, 0, &count);
+
+        if (ret != DA16K_SUCCESS) {
+            DA16K_WARN("Fetching commands failed: %d\r\n", (int) ret);
+        }
+
+        /* Poll quickly while commands are coming in, back off while there are none */
+        if (count > 0) {
+            s_stats.received += (uint32_t) count;
+            interval = min_interval;
+        } else {
+            s_stats.empty_polls++;
+            interval = (interval < (max_interval / 2)) ? (interval * 2) : max_interval;
+        }
+
+        s_stats.poll_interval_ms = (uint32_t) interval * portTICK_PERIOD_MS;
+    }
+}
+
+da16k_err_t da16k_cmd_listener_start(da16k_cmd_callback_t callback, void *context) {
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, callback);
+
+    if (s_listener_task) {
+        return DA16K_SUCCESS;
+    }
+
+    s_callback          = callback;
+    s_callback_context  = context;
+
+    if (pdPASS != xTaskCreate(da16k_cmd_listener, "da16k_cmd", DA16K_CONFIG_CMD_TASK_STACK_WORDS, NULL,
+                              DA16K_CONFIG_CMD_TASK_PRIORITY, &s_listener_task)) {
+        DA16K_ERROR("Failed to create listener task\r\n");
+        s_listener_task = NULL;
+        return DA16K_OUT_OF_MEMORY;
+    }
+
+#if defined(DA16K_CONFIG_CMD_URC_PREFIX)
+    return da16k_register_urc_handler(DA16K_CONFIG_CMD_URC_PREFIX, da16k_cmd_on_urc, NULL);
+#else
+    return DA16K_SUCCESS;
+#endif
+}
+
+void da16k_get_cmd_stats(da16k_cmd_stats_t *stats) {
+    if (stats) {
+        *stats = s_stats;
+        stats->latency_avg_ms = s_stats.received ? (uint32_t) (s_latency_total_ms / s_stats.received) : 0;
+    }
+}
+
+#endif /* DA16K_CONFIG_FREERTOS */
@@ -16,6 +16,7 @@
 #include <stdarg.h>
 
 #include <string.h>
+#include <ctype.h>
 #include <inttypes.h>
 #include <assert.h>
 
@@ -23,13 +24,6 @@
 
 #pragma GCC diagnostic error "-Wextra"
 
-typedef enum e_da16k_msg_data_type {
-    DA16K_AT_STRING = 0,
-    DA16K_AT_BOOL,
-    DA16K_AT_FLOAT32,
-    DA16K_AT_FLOAT64
-} da16k_msg_data_type_t;
-
 typedef union {
     char       *d_string;
     bool        d_bool;
@@ -38,29 +32,136 @@ typedef union {
 } da16k_value_t;
 
 typedef struct {
-    da16k_msg_data_type_t   type;
-    const char             *key;
-    da16k_value_t           value;
+    da16k_msg_data_type_t       type;
+    const char                 *key;
+    da16k_value_t               value;
+    const da16k_schema_key_t   *schema;     /* Pre-registered key (NULL = key was copied into the message) */
 } da16k_msg_data_t;
 
 struct da16k_msg_t {
     size_t                  data_count;
     size_t                  data_capacity;
     da16k_msg_data_t       *data;
+
+    /*  Buffer-backed messages only: tuples grow upwards from the start of the buffer, while key & value strings
+        are stacked downwards from the end of it. The message is full once both meet. */
+    bool                    in_buffer;
+    char                   *string_top;     /* Lowest string byte in use */
+    char                   *buffer_end;
 };
 
-static char da16k_value_buffer[64] = {0};
+/* Receive buffer size for da16k_get_cmds (command + parameters + null terminator) */
+#if !defined(DA16K_CONFIG_CMD_BUFFER_SIZE)
+#define DA16K_CONFIG_CMD_BUFFER_SIZE    256
+#endif
+
+/* Baud rate negotiation. The command takes the new rate, the gateway confirms with "OK" before switching. */
+#if !defined(DA16K_CONFIG_BAUD_COMMAND)
+#define DA16K_CONFIG_BAUD_COMMAND           "AT+UART1=%lu,8,n,1,n"
+#endif
+
+#if !defined(DA16K_CONFIG_BAUD_PROBE_TIMEOUT_MS)
+#define DA16K_CONFIG_BAUD_PROBE_TIMEOUT_MS  100
+#endif
+
+#if !defined(DA16K_CONFIG_BAUD_PROBE_ATTEMPTS)
+#define DA16K_CONFIG_BAUD_PROBE_ATTEMPTS    3
+#endif
+
+/*  Warm start: define DA16K_CONFIG_WARM_START for da16k_init to read back the WiFi network, the IoTC settings and the
+    session state, and only send what differs. Stock gateways reject these queries, so it is off by default and
+    everything is sent, as with da16k_cfg_t.full_setup. */
+#if defined(DA16K_CONFIG_WARM_START)
+#define DA16K_WARM_START                    true
+#else
+#define DA16K_WARM_START                    false
+#endif
+
+/*  Warm start: settings are read back by sending their set command followed by this suffix, the gateway answers with
+    "+<command>:<value>". A setting that cannot be read back is sent again. */
+#if !defined(DA16K_CONFIG_QUERY_SUFFIX)
+#define DA16K_CONFIG_QUERY_SUFFIX           "?"
+#endif
+
+/* IoTC session state, answered with "+NWICSTATUS:<state>" */
+#if !defined(DA16K_CONFIG_IOTC_STATUS_COMMAND)
+#define DA16K_CONFIG_IOTC_STATUS_COMMAND    "AT+NWICSTATUS"
+#endif
+
+#if !defined(DA16K_CONFIG_IOTC_STATUS_CONNECTED)
+#define DA16K_CONFIG_IOTC_STATUS_CONNECTED  1
+#endif
+
+/* WiFi state, answered with "+WFJAP:<state>,<ssid>[,...]" (state 1 = connected) */
+#if !defined(DA16K_CONFIG_WIFI_QUERY_COMMAND)
+#define DA16K_CONFIG_WIFI_QUERY_COMMAND     "AT+WFJAP?"
+#endif
+
+/*  DA16K_CONFIG_CERT_DIGEST_COMMAND: certificate fingerprint of a type, e.g. "AT+NWICCERTSHA=%u", answered with
+    "+NWICCERTSHA:<SHA-256 as hex>". Stock gateways reject it, so it is not defined by default and certificates are
+    always uploaded. */
+
+#if !defined(DA16K_CONFIG_CERT_UPLOAD_ATTEMPTS)
+#define DA16K_CONFIG_CERT_UPLOAD_ATTEMPTS   3
+#endif
+
+/*  DA16K_CONFIG_MSG_CAPS_COMMAND: telemetry frame limits, e.g. "AT+NWICMSGCAPS?", answered with
+    "+NWICMSGCAPS:<tuples per frame>,<line length>" (0 = no limit). Stock gateways reject it, so it is not defined by
+    default and the limits below are used. */
+
+/* Line length limit of AT+NWICEXMSG commands if the gateway does not report one (0 = no limit) */
+#if !defined(DA16K_CONFIG_MSG_MAX_LINE_LENGTH)
+#define DA16K_CONFIG_MSG_MAX_LINE_LENGTH    0
+#endif
+
+/*  AT+NWICEXMSG frames of a message that are sent before the first one has been answered (1 = no pipelining).
+    Only for gateways that accept commands while they are still working on earlier ones. */
+#if !defined(DA16K_CONFIG_MSG_WINDOW)
+#define DA16K_CONFIG_MSG_WINDOW             1
+#endif
+
+/* Largest window da16k_set_msg_window accepts, sizes the in-flight bookkeeping on the stack */
+#if !defined(DA16K_CONFIG_MSG_MAX_WINDOW)
+#define DA16K_CONFIG_MSG_MAX_WINDOW         8
+#endif
+
+#if (DA16K_CONFIG_MSG_WINDOW < 1) || (DA16K_CONFIG_MSG_WINDOW > DA16K_CONFIG_MSG_MAX_WINDOW)
+#error "DA16K_CONFIG_MSG_WINDOW must be between 1 and DA16K_CONFIG_MSG_MAX_WINDOW"
+#endif
+
+/* Times a pipelined message goes back to a failed frame and sends it (and everything after it) again */
+#if !defined(DA16K_CONFIG_MSG_PIPELINE_RETRIES)
+#define DA16K_CONFIG_MSG_PIPELINE_RETRIES   2
+#endif
+
+/* Longest setting value that is read back (CPID, DUID, environment, SSID) */
+#define DA16K_SETTING_VALUE_SIZE            128
+
+/* Frame that telemetry messages are assembled in before being sent out (only used within transactions) */
+static da16k_at_frame_t s_msg_frame;
 
 static uint32_t s_network_timeout_ms        = DA16K_DEFAULT_IOTC_TIMEOUT_MS;
 static uint32_t s_iotc_connect_timeout_ms   = DA16K_DEFAULT_IOTC_CONNECT_TIMEOUT_MS;
+static uint32_t s_baud_rate                 = DA16K_UART_BAUD_RATE;
 
-da16k_err_t da16k_get_cmd(da16k_cmd_t *cmd) {
-    const char  expected_response[] = "+NWICGETCMD";
-    const char  at_message[]        = "AT+NWICGETCMD";
-    char       *param_ptr           = NULL;
-    da16k_err_t ret                 = DA16K_SUCCESS;
+static uint32_t s_msg_window                = DA16K_CONFIG_MSG_WINDOW;
 
-    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, cmd);
+static da16k_setup_stats_t s_setup_stats;
+
+static const da16k_msg_caps_t   s_msg_caps_default  = { DA16K_MSG_TUPLES_PER_ITERATION, DA16K_CONFIG_MSG_MAX_LINE_LENGTH, false };
+static da16k_msg_caps_t         s_msg_caps          = { DA16K_MSG_TUPLES_PER_ITERATION, DA16K_CONFIG_MSG_MAX_LINE_LENGTH, false };
+
+static bool         da16k_wifi_joined   (const char *ssid);
+
+/* Fetches the next command and splits it into views of the response buffer, nothing is copied */
+static da16k_err_t da16k_get_cmd_view_transaction(void *context) {
+    const char          expected_response[] = "+NWICGETCMD";
+    const char          at_message[]        = "AT+NWICGETCMD";
+    da16k_cmd_view_t   *view                = context;
+    const char         *response;
+    const char         *param_ptr;
+    size_t              length;
+    da16k_err_t         ret;
 
     ret = da16k_at_send_formatted_msg(at_message);
 
@@ -69,7 +170,7 @@ da16k_err_t da16k_get_cmd(da16k_cmd_t *cmd) {
         return ret;
     }
     
-    ret = da16k_at_receive_and_validate_response(true, expected_response, DA16K_UART_TIMEOUT_MS);
+    ret = da16k_at_receive_and_validate_response(true, expected_response, 0);
 
     if (ret != DA16K_SUCCESS && ret != DA16K_AT_ERROR_CODE) {
         return ret;
@@ -87,32 +188,60 @@ da16k_err_t da16k_get_cmd(da16k_cmd_t *cmd) {
         }
     }
 
-    /* Now we need to extract the command and parameter (if applicable) */
-    cmd->command = da16k_at_get_response_str();
-    DA16K_RETURN_ON_NULL(DA16K_OUT_OF_MEMORY, cmd->command);
+    /* Now we need to extract the command and parameter (if applicable), separated by the first space */
+    response    = da16k_at_get_response_view(&length);
+    param_ptr   = memchr(response, ' ', length);
 
-    ret = DA16K_SUCCESS;
+    view->command.data          = response;
+    view->command.length        = param_ptr ? (size_t) (param_ptr - response) : length;
+    view->parameters.data       = param_ptr ? (param_ptr + 1) : NULL;
+    view->parameters.length     = param_ptr ? (length - view->command.length - 1) : 0;
 
-    /* Find space to determine whether we have params or not. We can use strchr here as we're guaranteed a null terminator within the buffer */
-    param_ptr = strchr(cmd->command, ' ');
+    return DA16K_SUCCESS;
+}
 
-    if (param_ptr != NULL) {
-        /* We have params, split the strings */
-        *param_ptr = 0x00; /* Null terminate via the space so we can simply use strdup */
-        param_ptr++; /* Skip space/null */
+/* Copies the command out while still in the transaction, i.e. before the next command can overwrite the response */
+static da16k_err_t da16k_get_cmd_transaction(void *context) {
+    da16k_cmd_t        *cmd     = context;
+    da16k_cmd_view_t    view;
+    da16k_err_t         ret     = da16k_get_cmd_view_transaction(&view);
 
-        /* cmd->command stays as-is and now termintes after the command itself. We *do* waste a few bytes of memory */
-        cmd->parameters = da16k_strdup(param_ptr);
+    if (ret != DA16K_SUCCESS) {
+        return ret;
+    }
 
-        if (cmd->parameters == NULL) {
-            da16k_destroy_cmd(*cmd);
-            ret = DA16K_OUT_OF_MEMORY;
-        }
-    } else {
-        /* No parameter, just command */
+    cmd->command    = da16k_strndup(view.command.data, view.command.length);
+    cmd->parameters = view.parameters.data ? da16k_strndup(view.parameters.data, view.parameters.length) : NULL;
+
+    if (cmd->command == NULL || (view.parameters.data && cmd->parameters == NULL)) {
+        da16k_destroy_cmd(*cmd);
+        cmd->command    = NULL;
         cmd->parameters = NULL;
+        return DA16K_OUT_OF_MEMORY;
     }
 
+    return DA16K_SUCCESS;
+}
+
+da16k_err_t da16k_get_cmd_view(da16k_cmd_view_t *view) {
+    da16k_err_t ret;
+
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, view);
+
+    ret = da16k_at_transact(DA16K_PRIORITY_INTERACTIVE, da16k_get_cmd_view_transaction, view);
+    da16k_link_report(ret);
+
+    return ret;
+}
+
+da16k_err_t da16k_get_cmd(da16k_cmd_t *cmd) {
+    da16k_err_t ret;
+
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, cmd);
+
+    ret = da16k_at_transact(DA16K_PRIORITY_INTERACTIVE, da16k_get_cmd_transaction, cmd);
+    da16k_link_report(ret);
+
     return ret;
 }
 
@@ -123,11 +252,75 @@ void da16k_destroy_cmd(da16k_cmd_t cmd) {
         da16k_free(cmd.parameters);
 }
 
-da16k_err_t da16k_init(const da16k_cfg_t *cfg) {
-    da16k_err_t ret = DA16K_SUCCESS;
+/*  Fetches the next command into buffer. The response is copied out by the transaction, so buffer stays valid
+    when other transactions run in the meantime. */
+static da16k_err_t da16k_get_cmd_into(char *buffer, size_t size) {
+    da16k_at_request_t  request = { "AT+NWICGETCMD", "+NWICGETCMD", DA16K_PRIORITY_INTERACTIVE, 0, buffer, size };
+    da16k_err_t         ret     = da16k_at_execute(&request);
 
-    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, cfg);
+    if (ret == DA16K_AT_ERROR_CODE) {
+        /* We have received an error response, which usually means there are no commands ("ERROR:-7"). */
+        if (atoi(buffer) == -7) {
+            ret = DA16K_NO_CMDS;
+        } else {
+            DA16K_ERROR("Bad response, error code %d\r\n", atoi(buffer));
+            ret = DA16K_AT_FAIL;
+        }
+    }
+
+    da16k_link_report(ret);
+
+    return ret;
+}
+
+/* Splits "<command> <parameters>" in place */
+static void da16k_cmd_split(char *buffer, da16k_cmd_t *cmd) {
+    char *param_ptr = strchr(buffer, ' ');
+
+    cmd->command    = buffer;
+    cmd->parameters = NULL;
+
+    if (param_ptr != NULL) {
+        *param_ptr      = 0x00;
+        cmd->parameters = param_ptr + 1;
+    }
+}
+
+da16k_err_t da16k_get_cmds(da16k_cmd_callback_t callback, void *context, size_t max, uint32_t budget_ms, size_t *handled) {
+    char        buffer[DA16K_CONFIG_CMD_BUFFER_SIZE];
+    uint32_t    start   = da16k_get_time_ms();
+    size_t      count   = 0;
+    da16k_err_t ret     = DA16K_SUCCESS;
+
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, callback);
+
+    while (max == 0 || count < max) {
+        da16k_cmd_t cmd;
+
+        if (budget_ms > 0 && (da16k_get_time_ms() - start) >= budget_ms) {
+            ret = DA16K_TIMEOUT;
+            break;
+        }
+
+        ret = da16k_get_cmd_into(buffer, sizeof(buffer));
+
+        if (ret != DA16K_SUCCESS) {
+            break;
+        }
+
+        da16k_cmd_split(buffer, &cmd);
+        callback(&cmd, context);
+        count++;
+    }
+
+    if (handled) {
+        *handled = count;
+    }
+
+    return (ret == DA16K_NO_CMDS) ? DA16K_SUCCESS : ret;
+}
 
+da16k_err_t da16k_init_local(const da16k_cfg_t *cfg) {
 #if defined(static_assert)
     static_assert(sizeof(double) == 8 && sizeof(float) == 4, "Unexpected floating point size, check your compiler/c-library!");
 #else
@@ -139,38 +332,99 @@ da16k_err_t da16k_init(const da16k_cfg_t *cfg) {
     }
 #endif
 
+    /* AT channel lock for multi-task use */
+    if (!da16k_at_channel_init()) {
+        return DA16K_OUT_OF_MEMORY;
+    }
+
     /* UART Init */
     if (!da16k_uart_init()) {
         return DA16K_UART_ERROR;
     }
 
+    s_baud_rate = DA16K_UART_BAUD_RATE;
+    s_msg_caps  = s_msg_caps_default;
+
+    /* External network timeout override */
+    if (cfg->network_timeout_ms) {
+        s_network_timeout_ms = cfg->network_timeout_ms;
+    }
+
+    if (cfg->iotc_config && cfg->iotc_config->iotc_connect_timeout_ms) {
+        s_iotc_connect_timeout_ms = cfg->iotc_config->iotc_connect_timeout_ms;
+    }
+
+    da16k_timing_init(s_network_timeout_ms);
+
+    return DA16K_SUCCESS;
+}
+
+static da16k_err_t da16k_init_steps(const da16k_cfg_t *cfg) {
+    da16k_err_t ret = da16k_init_local(cfg);
+
+    if (ret != DA16K_SUCCESS) {
+        return ret;
+    }
+
+    /* Faster UART (if requested). Failing to switch is not fatal, the default rate is still usable. */
+    if (cfg->baud_rate && cfg->baud_rate != s_baud_rate) {
+        if (DA16K_SUCCESS != (ret = da16k_set_baud_rate(cfg->baud_rate))) {
+            DA16K_WARN("Staying at %lu bps (%d)\r\n", (unsigned long) s_baud_rate, (int) ret);
+            ret = DA16K_SUCCESS;
+        }
+    }
+
+#if defined(DA16K_CONFIG_MSG_CAPS_COMMAND)
+    /* Frame limits for telemetry. Not fatal either, the defaults work with every gateway. */
+    (void) da16k_discover_msg_caps();
+#endif
+
     /* WiFi init (if requested) */
     if (cfg->wifi_config) {
-        if (DA16K_SUCCESS != (ret = da16k_set_wifi_config(cfg->wifi_config))) {
+        if (DA16K_WARM_START && !cfg->full_setup && cfg->wifi_config->ssid && da16k_wifi_joined(cfg->wifi_config->ssid)) {
+            DA16K_DEBUG("Already joined to %s\r\n", cfg->wifi_config->ssid);
+            s_setup_stats.commands_skipped++;
+        } else if (DA16K_SUCCESS != (ret = da16k_set_wifi_config(cfg->wifi_config))) {
             DA16K_ERROR("WiFi connection failed (%d)\r\n", (int) ret);
             return ret;
+        } else {
+            s_setup_stats.commands_sent += 2;   /* Stop and join */
         }
     }
 
     /* IoTC init (if requested) */
     if (cfg->iotc_config) {
-        if (DA16K_SUCCESS != (ret = da16k_setup_iotc_and_connect(cfg->iotc_config))) {
+        if (DA16K_SUCCESS != (ret = da16k_setup_iotc(cfg->iotc_config, cfg->full_setup))) {
             DA16K_ERROR("IoTC connection failed (%d)\r\n", (int) ret);
             return ret;
         }
-        if (cfg->iotc_config->iotc_connect_timeout_ms) {
-            s_iotc_connect_timeout_ms = cfg->iotc_config->iotc_connect_timeout_ms;
-        }
-    }
-
-    /* External network timeout override */
-    if (cfg->network_timeout_ms) {
-        s_network_timeout_ms = cfg->network_timeout_ms;
     }
 
     return ret; /* TODO: Check if IoTC is actually connected. */
 }
 
+da16k_err_t da16k_init(const da16k_cfg_t *cfg) {
+    uint32_t    start_ms;
+    da16k_err_t ret;
+
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, cfg);
+
+    memset(&s_setup_stats, 0, sizeof(s_setup_stats));
+    start_ms = da16k_get_time_ms();
+
+    ret = da16k_init_steps(cfg);
+
+    s_setup_stats.duration_ms = da16k_get_time_ms() - start_ms;
+
+    return ret;
+}
+
+void da16k_get_setup_stats(da16k_setup_stats_t *stats) {
+    if (stats) {
+        *stats = s_setup_stats;
+    }
+}
+
 void da16k_deinit() {
     da16k_uart_close();
 }
@@ -185,9 +439,95 @@ da16k_msg_t *da16k_create_msg(void) {
     return ret;
 }
 
+da16k_msg_t *da16k_create_msg_in_buffer(void *buffer, size_t buffer_size) {
+    uintptr_t       start   = (uintptr_t) buffer;
+    uintptr_t       end     = start + buffer_size;
+    da16k_msg_t    *ret     = NULL;
+
+    DA16K_RETURN_ON_NULL(NULL, buffer);
+
+    if (sizeof(da16k_msg_t) > DA16K_MSG_ARENA_HEADER_SIZE || sizeof(da16k_msg_data_t) > DA16K_MSG_ARENA_TUPLE_SIZE) {
+        DA16K_ERROR("Arena sizing constants are too small for this platform!\r\n");
+        return NULL;
+    }
+
+    /* The tuple array holds doubles and pointers, so align the start of the buffer accordingly. */
+    start = (start + (DA16K_MSG_ARENA_ALIGNMENT - 1)) & ~((uintptr_t) DA16K_MSG_ARENA_ALIGNMENT - 1);
+
+    if (start + sizeof(da16k_msg_t) > end) {
+        DA16K_ERROR("Message buffer too small (%u bytes)\r\n", (unsigned) buffer_size);
+        return NULL;
+    }
+
+    ret = (da16k_msg_t *) start;
+
+    memset(ret, 0, sizeof(da16k_msg_t));
+
+    ret->in_buffer  = true;
+    ret->data       = (da16k_msg_data_t *) (start + sizeof(da16k_msg_t));
+    ret->buffer_end = (char *) end;
+    ret->string_top = ret->buffer_end;
+
+    return ret;
+}
+
+/* Number of tuples that still fit into a buffer-backed message's tuple array alongside the strings stored so far */
+static size_t da16k_msg_buffer_capacity(const da16k_msg_t *msg) {
+    uintptr_t tuples_start = (uintptr_t) msg->data;
+    uintptr_t strings_start = (uintptr_t) msg->string_top;
+
+    if (strings_start < tuples_start) {
+        return 0;
+    }
+
+    return (strings_start - tuples_start) / sizeof(da16k_msg_data_t);
+}
+
+/*  Copies a string into a message's storage - the heap for regular messages, or the buffer for buffer-backed ones.
+    Returns NULL if out of memory. */
+static char *da16k_msg_strdup(da16k_msg_t *msg, const char *src) {
+    size_t      str_size;
+    uintptr_t   tuples_end;
+    char       *ret;
+
+    if (!msg->in_buffer) {
+        return da16k_strdup(src);
+    }
+
+    str_size    = strlen(src) + 1;
+    tuples_end  = (uintptr_t) msg->data + ((msg->data_count + 1) * sizeof(da16k_msg_data_t));
+
+    /* Strings must not grow into the tuple array, including the slot required by the tuple being added. */
+    if ((uintptr_t) msg->string_top < tuples_end || ((uintptr_t) msg->string_top - tuples_end) < str_size) {
+        return NULL;
+    }
+
+    msg->string_top -= str_size;
+    ret = msg->string_top;
+    memcpy(ret, src, str_size);
+
+    return ret;
+}
+
+/* Releases the strings owned by a single tuple (heap-backed messages only) */
+static void da16k_msg_free_data_strings(const da16k_msg_t *msg, const da16k_msg_data_t *data) {
+    if (msg->in_buffer) {
+        return;
+    }
+
+    /* Schema keys are constant and never copied */
+    if (data->schema == NULL) {
+        da16k_free((void*) data->key);
+    }
+
+    if (data->type == DA16K_AT_STRING) {
+        da16k_free((void*) data->value.d_string);
+    }
+}
+
 /*  Adds a da16k_msg_data_t entryto a da16k_msg_t's data array.
 
-    Will (re-) allocate if capacity is exceeded.
+    Will (re-) allocate if capacity is exceeded. Buffer-backed messages never allocate.
 
     In an out of memory condition, the data is not added, but the previous data remains valid.
 
@@ -198,11 +538,17 @@ static da16k_err_t da16k_msg_add_internal(da16k_msg_t *msg, const da16k_msg_data
 
     DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, msg);
 
-    /* If we're out of capacity for data, we need to realloc with bigger capacity */
-    if (msg->data_count == msg->data_capacity) {
+    if (msg->in_buffer) {
+        if (msg->data_count >= da16k_msg_buffer_capacity(msg)) {
+            DA16K_ERROR("Message buffer full!\r\n");
+            return DA16K_OUT_OF_MEMORY;
+        }
+    } else if (msg->data_count == msg->data_capacity) {
+        /* If we're out of capacity for data, we need to realloc with bigger capacity */
         DA16K_DEBUG("msg->data capacity reached, reallocating...\r\n");
 
-        new_capacity = msg->data_capacity + 10;
+        /* Grow geometrically so long-lived messages settle on their final size after a few sends */
+        new_capacity = msg->data_capacity ? (msg->data_capacity * 2) : DA16K_MSG_TUPLES_PER_ITERATION;
         new_data = da16k_malloc(sizeof(da16k_msg_data_t) * new_capacity);
 
         if (new_data == NULL) {
@@ -227,6 +573,38 @@ static da16k_err_t da16k_msg_add_internal(da16k_msg_t *msg, const da16k_msg_data
     return DA16K_SUCCESS;
 }
 
+/* Copies the key (and string value, if applicable) of data into msg's storage and adds the tuple. Cleans up on failure. */
+static da16k_err_t da16k_msg_add_copy(da16k_msg_t *msg, const char *key, da16k_msg_data_t *data) {
+    char       *saved_string_top;
+    da16k_err_t ret;
+
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, msg);
+
+    saved_string_top    = msg->string_top;
+    data->key           = da16k_msg_strdup(msg, key);
+
+    if (data->key && data->type == DA16K_AT_STRING) {
+        data->value.d_string = da16k_msg_strdup(msg, data->value.d_string);
+    }
+
+    if (data->key == NULL || (data->type == DA16K_AT_STRING && data->value.d_string == NULL)) {
+        ret = DA16K_OUT_OF_MEMORY;
+    } else {
+        ret = da16k_msg_add_internal(msg, data);
+    }
+
+    if (ret != DA16K_SUCCESS) {
+        DA16K_ERROR("Failed to add data for '%s' (%d)\r\n", key, (int) ret);
+
+        if (data->key) {
+            da16k_msg_free_data_strings(msg, data);
+        }
+
+        msg->string_top = saved_string_top;
+    }
+
+    return ret;
+}
 
 da16k_err_t da16k_msg_add_str(da16k_msg_t *msg, const char *key, const char *value) {
     da16k_msg_data_t data = {0};
@@ -235,14 +613,10 @@ da16k_err_t da16k_msg_add_str(da16k_msg_t *msg, const char *key, const char *val
     DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, key);
     DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, value);
 
-    data.key                = da16k_strdup(key);
     data.type               = DA16K_AT_STRING;
-    data.value.d_string     = data.key ? da16k_strdup(value) : NULL; /* little hack so we can use the helper macro to exit the function cleanly on OOM */
+    data.value.d_string     = (char *) value; /* copied by da16k_msg_add_copy */
 
-    DA16K_RETURN_ON_NULL(DA16K_OUT_OF_MEMORY, key);
-    DA16K_RETURN_ON_NULL(DA16K_OUT_OF_MEMORY, data.value.d_string);
-
-    return da16k_msg_add_internal(msg, &data);
+    return da16k_msg_add_copy(msg, key, &data);
 }
 
 da16k_err_t da16k_msg_add_bool(da16k_msg_t *msg, const char *key, bool value) {
@@ -251,13 +625,10 @@ da16k_err_t da16k_msg_add_bool(da16k_msg_t *msg, const char *key, bool value) {
     DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, msg);
     DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, key);
 
-    data.key                = da16k_strdup(key);
     data.type               = DA16K_AT_BOOL;
     data.value.d_bool       = value;
 
-    DA16K_RETURN_ON_NULL(DA16K_OUT_OF_MEMORY, key);
-
-    return da16k_msg_add_internal(msg, &data);
+    return da16k_msg_add_copy(msg, key, &data);
 }
 
 da16k_err_t da16k_msg_add_num(da16k_msg_t *msg, const char *key, double value) {
@@ -266,90 +637,619 @@ da16k_err_t da16k_msg_add_num(da16k_msg_t *msg, const char *key, double value) {
     DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, msg);
     DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, key);
 
-    data.key                = da16k_strdup(key);
     data.type               = DA16K_AT_FLOAT64;
     data.value.d_float64    = value;
 
-    DA16K_RETURN_ON_NULL(DA16K_OUT_OF_MEMORY, key);
+    return da16k_msg_add_copy(msg, key, &data);
+}
+
+da16k_err_t da16k_msg_add_float32(da16k_msg_t *msg, const char *key, float value) {
+    da16k_msg_data_t data = {0};
+
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, msg);
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, key);
 
-    return da16k_msg_add_internal(msg, &data);
+    data.type               = DA16K_AT_FLOAT32;
+    data.value.d_float32    = value;
+
+    return da16k_msg_add_copy(msg, key, &data);
 }
 
-/* Sends a single piece of telemetry data as part of a larger command transmission */
-static da16k_err_t da16k_send_msg_data(const da16k_msg_data_t *data) {
-    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, data);
-    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, data->key);
+/*  There is no integer type in the AT protocol, so integers are sent as the smallest float type that holds them
+    exactly: single precision up to +/- 2^24, double precision beyond. */
+da16k_err_t da16k_msg_add_int(da16k_msg_t *msg, const char *key, int32_t value) {
+    static const int32_t float32_exact_max = (1L << 24);
 
-    switch (data->type) {
-        case DA16K_AT_STRING:
-            DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, data->value.d_string);
-            return      da16k_at_send_formatted_raw_no_crlf("%d,%s,%s,", (int) data->type, data->key, data->value.d_string);
-        case DA16K_AT_BOOL:
-            if (da16k_bool_to_ascii_hex(da16k_value_buffer, data->value.d_bool))
-                return  da16k_at_send_formatted_raw_no_crlf("%d,%s,%s,", (int) data->type, data->key, da16k_value_buffer);
-            break;
-        case DA16K_AT_FLOAT64:
-            if (da16k_double_to_ascii_hex(da16k_value_buffer, data->value.d_float64))
-                return  da16k_at_send_formatted_raw_no_crlf("%d,%s,%s,", (int) data->type, data->key, da16k_value_buffer);
-            break;
-        default:
-            break;
+    if (value >= -float32_exact_max && value <= float32_exact_max) {
+        return da16k_msg_add_float32(msg, key, (float) value);
     }
 
-    return DA16K_INVALID_PARAMETER;
+    return da16k_msg_add_num(msg, key, (double) value);
 }
 
-da16k_err_t da16k_send_msg (const da16k_msg_t *msg) {
-    da16k_err_t ret = DA16K_SUCCESS;
+/*  Binds a tuple to a pre-registered schema key. Numbers are narrowed to the precision the key was declared with.
+    Returns DA16K_INVALID_PARAMETER if the value type does not match the type the key was declared with. */
+static da16k_err_t da16k_msg_data_set_schema(da16k_msg_data_t *data, const da16k_schema_key_t *key) {
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, key);
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, key->key);
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, key->prefix);
+
+    if (data->type == DA16K_AT_FLOAT64 && key->type == DA16K_AT_FLOAT32) {
+        data->type              = DA16K_AT_FLOAT32;
+        data->value.d_float32   = (float) data->value.d_float64;
+    }
+
+    if (key->type != data->type) {
+        DA16K_ERROR("Type mismatch for schema key '%s' (%d != %d)\r\n", key->key, (int) data->type, (int) key->type);
+        return DA16K_INVALID_PARAMETER;
+    }
+
+    data->key       = key->key;
+    data->schema    = key;
+
+    return DA16K_SUCCESS;
+}
+
+/*  Adds a tuple for a pre-registered schema key. The key itself is never copied, only string values are. */
+static da16k_err_t da16k_msg_add_schema_internal(da16k_msg_t *msg, const da16k_schema_key_t *key, da16k_msg_data_t *data) {
+    char       *saved_string_top;
+    da16k_err_t ret;
 
     DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, msg);
-    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, msg->data);
 
-    /* Iterate through all data tuples */
-    for (size_t i = 0; i < msg->data_count; i++) {
-        /* If we're at the start of a bulk message initiate it, note that no CRLF is sent here. Space is important...*/
-        if ((i % DA16K_MSG_TUPLES_PER_ITERATION) == 0 && DA16K_SUCCESS != (ret = da16k_at_send_formatted_raw_no_crlf("AT+NWICEXMSG "))) {
-            DA16K_ERROR("Failed to initiate message\r\n");
-            break;
-        }
+    if (DA16K_SUCCESS != (ret = da16k_msg_data_set_schema(data, key))) {
+        return ret;
+    }
 
-        /* Send actual tuple data */
-        if (DA16K_SUCCESS != (ret = da16k_send_msg_data(&msg->data[i]))) {
-            DA16K_ERROR("Failed to send message tuple data\r\n");
-            break;
-        }
+    saved_string_top = msg->string_top;
 
-        /* Maximum of DA16K_MSG_TUPLES_PER_ITERATION tuples at a time & force send if it's the last message */
-        if ((i % DA16K_MSG_TUPLES_PER_ITERATION) == (DA16K_MSG_TUPLES_PER_ITERATION - 1) || i == (msg->data_count - 1)) {
-            /* Finalize with empty string, \r\n will be added by this function */
-            if (DA16K_SUCCESS != (ret = da16k_at_send_formatted_and_check_success(s_network_timeout_ms, "+NWICEXMSG", ""))) {
-                DA16K_ERROR("Failed to finalize/validate message\r\n");
-                break;
-            }
-        }
+    if (data->type == DA16K_AT_STRING) {
+        data->value.d_string = da16k_msg_strdup(msg, data->value.d_string);
+        DA16K_RETURN_ON_NULL(DA16K_OUT_OF_MEMORY, data->value.d_string);
+    }
+
+    ret = da16k_msg_add_internal(msg, data);
+
+    if (ret != DA16K_SUCCESS) {
+        da16k_msg_free_data_strings(msg, data);
+        msg->string_top = saved_string_top;
     }
 
     return ret;
 }
 
-void da16k_destroy_msg(da16k_msg_t *msg) {
-    if (msg) {
-        if (msg->data) {
-            for (size_t i = 0; i < msg->data_count; i++) {
-                da16k_free((void*) msg->data[i].key);
+da16k_err_t da16k_msg_add_schema_str(da16k_msg_t *msg, const da16k_schema_key_t *key, const char *value) {
+    da16k_msg_data_t data = {0};
 
-                if (msg->data[i].type == DA16K_AT_STRING) {
-                    da16k_free((void*) msg->data[i].value.d_string);
-                }
-            }
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, value);
 
-            da16k_free(msg->data);
-        }
-        da16k_free(msg);
-    }
+    data.type               = DA16K_AT_STRING;
+    data.value.d_string     = (char *) value; /* copied by da16k_msg_add_schema_internal */
+
+    return da16k_msg_add_schema_internal(msg, key, &data);
 }
 
-/* Helper functions for direct sending (for basic, non-threaded applications) */
+da16k_err_t da16k_msg_add_schema_bool(da16k_msg_t *msg, const da16k_schema_key_t *key, bool value) {
+    da16k_msg_data_t data = {0};
+
+    data.type               = DA16K_AT_BOOL;
+    data.value.d_bool       = value;
+
+    return da16k_msg_add_schema_internal(msg, key, &data);
+}
+
+da16k_err_t da16k_msg_add_schema_num(da16k_msg_t *msg, const da16k_schema_key_t *key, double value) {
+    da16k_msg_data_t data = {0};
+
+    data.type               = DA16K_AT_FLOAT64;
+    data.value.d_float64    = value;
+
+    return da16k_msg_add_schema_internal(msg, key, &data);
+}
+
+/* Protocol type IDs including the separator, indexed by da16k_msg_data_type_t */
+static const char * const da16k_msg_type_prefixes[] = {
+    DA16K_SCHEMA_TYPE_ID_STRING     ",",
+    DA16K_SCHEMA_TYPE_ID_BOOL       ",",
+    DA16K_SCHEMA_TYPE_ID_FLOAT32    ",",
+    DA16K_SCHEMA_TYPE_ID_FLOAT64    ",",
+};
+
+/* Large enough for the biggest encoded type (16 hex characters for a double) and a null terminator */
+#define DA16K_MSG_VALUE_BUFFER_SIZE     17
+
+/*  Renders the value of a tuple for the AT protocol. Strings are referenced as-is, everything else is
+    encoded as ASCII hex into value_buffer (DA16K_MSG_VALUE_BUFFER_SIZE bytes). Returns NULL if the data is invalid. */
+static const char *da16k_msg_data_value_str(char *value_buffer, const da16k_msg_data_t *data) {
+    if (data->type == DA16K_AT_STRING) {
+        return data->value.d_string;
+    }
+
+    DA16K_RETURN_ON_NULL(NULL, value_buffer);
+
+    switch (data->type) {
+        case DA16K_AT_BOOL:
+            return da16k_bool_to_ascii_hex(value_buffer, data->value.d_bool)        ? value_buffer : NULL;
+        case DA16K_AT_FLOAT32:
+            return da16k_float_to_ascii_hex(value_buffer, data->value.d_float32)    ? value_buffer : NULL;
+        case DA16K_AT_FLOAT64:
+            return da16k_double_to_ascii_hex(value_buffer, data->value.d_float64)   ? value_buffer : NULL;
+        default:
+            return NULL;
+    }
+}
+
+/* Appends a single piece of telemetry data to a message frame as "<type>,<key>,<value>," */
+static da16k_err_t da16k_msg_data_to_frame(da16k_at_frame_t *frame, const da16k_msg_data_t *data) {
+    const char *value_str;
+
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, data);
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, data->key);
+
+    if ((size_t) data->type >= (sizeof(da16k_msg_type_prefixes) / sizeof(da16k_msg_type_prefixes[0]))) {
+        return DA16K_INVALID_PARAMETER;
+    }
+
+    value_str = da16k_msg_data_value_str((data->type == DA16K_AT_STRING) ? NULL
+                                         : da16k_at_frame_scratch(frame, DA16K_MSG_VALUE_BUFFER_SIZE), data);
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, value_str);
+
+    /* Schema keys come with a pre-rendered "<type>,<key>," prefix, so only the value needs to be rendered */
+    if (data->schema) {
+        da16k_at_frame_add(frame, data->schema->prefix, data->schema->prefix_length);
+    } else {
+        da16k_at_frame_add(frame, da16k_msg_type_prefixes[data->type], 2);
+        da16k_at_frame_add_str(frame, data->key);
+        da16k_at_frame_add(frame, ",", 1);
+    }
+
+    da16k_at_frame_add_str(frame, value_str);
+    da16k_at_frame_add(frame, ",", 1);
+
+    return frame->overflow ? DA16K_AT_MESSAGE_TOO_LONG : DA16K_SUCCESS;
+}
+
+/* Characters a tuple takes up in a frame: "<type>,<key>,<value>," */
+static size_t da16k_msg_data_length(const da16k_msg_data_t *data) {
+    size_t length = data->schema ? data->schema->prefix_length : (2 + (data->key ? strlen(data->key) : 0) + 1);
+
+    switch (data->type) {
+        case DA16K_AT_STRING:   length += data->value.d_string ? strlen(data->value.d_string) : 0;   break;
+        case DA16K_AT_BOOL:     length += 2;                                                            break;
+        case DA16K_AT_FLOAT32:  length += 8;                                                            break;
+        case DA16K_AT_FLOAT64:  length += 16;                                                           break;
+        default:                                                                                        break;
+    }
+
+    return length + 1;
+}
+
+size_t da16k_msg_encoded_length(const da16k_msg_t *msg, size_t first, size_t count) {
+    size_t length = 0;
+
+    for (size_t i = first; msg && i < (first + count) && i < msg->data_count; i++) {
+        length += da16k_msg_data_length(&msg->data[i]);
+    }
+
+    return length;
+}
+
+void da16k_msg_frame_limits(size_t *max_tuples, size_t *max_length) {
+    static const size_t prefix_length   = sizeof(DA16K_MSG_FRAME_PREFIX) - 1;
+    uint32_t            line_length     = s_msg_caps.max_line_length;
+
+    if (max_tuples) {
+        *max_tuples = s_msg_caps.max_tuples;
+    }
+
+    if (max_length) {
+        *max_length = (line_length == 0) ? SIZE_MAX : ((line_length > prefix_length) ? (line_length - prefix_length) : 0);
+    }
+}
+
+/*  Number of tuples from first on that go into the next frame. Frames are filled in order (next fit): a frame ends
+    where the next tuple would exceed the line length or the tuple limit. Returns 0 if not even the first tuple fits. */
+static size_t da16k_msg_frame_fill(const da16k_msg_t *msg, size_t first) {
+    size_t  max_tuples;
+    size_t  max_length;
+    size_t  length      = 0;
+    size_t  count       = 0;
+
+    da16k_msg_frame_limits(&max_tuples, &max_length);
+
+    while ((first + count) < msg->data_count && count < max_tuples) {
+        size_t tuple_length = da16k_msg_data_length(&msg->data[first + count]);
+
+        if (tuple_length > (max_length - length)) {
+            break;
+        }
+
+        length += tuple_length;
+        count++;
+    }
+
+    return count;
+}
+
+/* One AT+NWICEXMSG frame's worth of a message */
+typedef struct {
+    const da16k_msg_t  *msg;
+    size_t              first;      /* Index of the first tuple in the frame */
+    size_t              count;
+} da16k_msg_frame_t;
+
+/* Assembles a frame in s_msg_frame */
+static da16k_err_t da16k_msg_frame_build(const da16k_msg_frame_t *frame) {
+    static const char   cmd_prefix[]    = DA16K_MSG_FRAME_PREFIX;
+    da16k_err_t         ret             = DA16K_SUCCESS;
+
+    da16k_at_frame_init(&s_msg_frame);
+    da16k_at_frame_add(&s_msg_frame, cmd_prefix, sizeof(cmd_prefix) - 1);
+
+    /* Add actual tuple data */
+    for (size_t i = frame->first; i < (frame->first + frame->count); i++) {
+        if (DA16K_SUCCESS != (ret = da16k_msg_data_to_frame(&s_msg_frame, &frame->msg->data[i]))) {
+            DA16K_ERROR("Failed to add message tuple data\r\n");
+            return ret;
+        }
+    }
+
+    return ret;
+}
+
+static da16k_err_t da16k_send_msg_frame_transaction(void *context) {
+    da16k_err_t ret = da16k_msg_frame_build(context);
+
+    if (ret != DA16K_SUCCESS) {
+        return ret;
+    }
+
+    /* The whole frame goes out in a single transmission, \r\n will be added by this function */
+    if (DA16K_SUCCESS != (ret = da16k_at_send_frame_and_check_success(&s_msg_frame, 0, "+NWICEXMSG"))) {
+        DA16K_ERROR("Failed to send/validate message\r\n");
+    }
+
+    return ret;
+}
+
+/* A whole message for da16k_send_msg_pipelined_transaction */
+typedef struct {
+    const da16k_msg_t  *msg;
+    size_t              frames;     /* Frames sent, including those sent again */
+} da16k_msg_pipeline_t;
+
+/*  Sends the frames of a message with up to s_msg_window of them awaiting their response (go-back-N). The gateway
+    answers in order, so the oldest frame in flight is always the one the next response belongs to. */
+static da16k_err_t da16k_send_msg_pipelined_transaction(void *context) {
+    da16k_msg_pipeline_t   *pipeline                                = context;
+    const da16k_msg_t      *msg                                     = pipeline->msg;
+    da16k_msg_frame_t       frames[DA16K_CONFIG_MSG_MAX_WINDOW];    /* In flight, oldest at head */
+    uint32_t                sent_ms[DA16K_CONFIG_MSG_MAX_WINDOW];
+    size_t                  head                                    = 0;
+    size_t                  in_flight                               = 0;
+    size_t                  next                                    = 0;    /* First tuple not sent yet */
+    uint32_t                window                                  = s_msg_window;
+    unsigned                retries                                 = 0;
+    bool                    too_long                                = false;
+    da16k_err_t             ret                                     = DA16K_SUCCESS;
+
+    /* A response to an earlier command that timed out would be taken for the response to the first frame */
+    da16k_at_drop_late_responses();
+
+    while (in_flight > 0 || (next < msg->data_count && !too_long)) {
+        /* Fill the window */
+        while (in_flight < window && next < msg->data_count && !too_long) {
+            size_t              slot    = (head + in_flight) % DA16K_CONFIG_MSG_MAX_WINDOW;
+            da16k_msg_frame_t  *frame   = &frames[slot];
+
+            frame->msg      = msg;
+            frame->first    = next;
+            frame->count    = da16k_msg_frame_fill(msg, next);
+
+            /* The frames before it still go out, like they would without pipelining */
+            if (frame->count == 0) {
+                DA16K_ERROR("Tuple %u exceeds the gateway's line length\r\n", (unsigned) next);
+                too_long = true;
+                break;
+            }
+
+            if (DA16K_SUCCESS != (ret = da16k_msg_frame_build(frame)) ||
+                DA16K_SUCCESS != (ret = da16k_at_send_frame(&s_msg_frame, &sent_ms[slot]))) {
+                return ret;
+            }
+
+            next += frame->count;
+            in_flight++;
+            pipeline->frames++;
+        }
+
+        if (in_flight == 0) {
+            break;
+        }
+
+        ret = da16k_at_receive_frame_response(DA16K_AT_CLASS_TELEMETRY, sent_ms[head], "+NWICEXMSG");
+
+        if (ret == DA16K_SUCCESS) {
+            head    = (head + 1) % DA16K_CONFIG_MSG_MAX_WINDOW;
+            retries = 0;
+            in_flight--;
+            continue;
+        }
+
+        DA16K_WARN("Frame at tuple %u failed (%d) with %u frames in flight\r\n", (unsigned) frames[head].first,
+                   (int) ret, (unsigned) in_flight);
+
+        if (ret == DA16K_TIMEOUT || ret == DA16K_AT_NO_OK) {
+            /* The responses to the frames after it can no longer be told apart, drop what has arrived of them */
+            da16k_at_drop_late_responses();
+        } else {
+            /* Still in step: collect the responses to the frames after it, they are sent again in any case */
+            for (size_t i = 1; i < in_flight; i++) {
+                size_t slot = (head + i) % DA16K_CONFIG_MSG_MAX_WINDOW;
+
+                if (da16k_at_receive_frame_response(DA16K_AT_CLASS_TELEMETRY, sent_ms[slot], "+NWICEXMSG") == DA16K_TIMEOUT) {
+                    da16k_at_drop_late_responses();
+                    break;
+                }
+            }
+        }
+
+        if (retries++ >= DA16K_CONFIG_MSG_PIPELINE_RETRIES) {
+            return ret;
+        }
+
+        /* Go back to the failed frame */
+        next        = frames[head].first;
+        in_flight   = 0;
+        too_long    = false;
+    }
+
+    return too_long ? DA16K_AT_MESSAGE_TOO_LONG : ret;
+}
+
+da16k_err_t da16k_send_msg_frames(const da16k_msg_t *msg, size_t *frames) {
+    da16k_msg_frame_t   frame;
+    da16k_err_t         ret     = DA16K_SUCCESS;
+
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, msg);
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, msg->data);
+
+    frame.msg = msg;
+
+    if (frames) {
+        *frames = 0;
+    }
+
+    /* Pipelined, the message is a single transaction, as the frames in flight must not be interleaved with others */
+    if (s_msg_window > 1 && msg->data_count > 0) {
+        da16k_msg_pipeline_t pipeline = { msg, 0 };
+
+        ret = da16k_at_transact(DA16K_PRIORITY_BULK, da16k_send_msg_pipelined_transaction, &pipeline);
+
+        if (frames) {
+            *frames = pipeline.frames;
+        }
+
+        da16k_link_report(ret);
+
+        return ret;
+    }
+
+    /* Each frame is a transaction of its own, so more urgent requests can be served in between */
+    for (frame.first = 0; frame.first < msg->data_count && ret == DA16K_SUCCESS; frame.first += frame.count) {
+        if ((frame.count = da16k_msg_frame_fill(msg, frame.first)) == 0) {
+            DA16K_ERROR("Tuple %u exceeds the gateway's line length\r\n", (unsigned) frame.first);
+            ret = DA16K_AT_MESSAGE_TOO_LONG;
+            break;
+        }
+
+        ret = da16k_at_transact(DA16K_PRIORITY_BULK, da16k_send_msg_frame_transaction, &frame);
+
+        if (frames) {
+            (*frames)++;
+        }
+    }
+
+    da16k_link_report(ret);
+
+    return ret;
+}
+
+da16k_err_t da16k_set_msg_window(uint32_t window) {
+    if (window < 1 || window > DA16K_CONFIG_MSG_MAX_WINDOW) {
+        return DA16K_INVALID_PARAMETER;
+    }
+
+    s_msg_window = window;
+
+    return DA16K_SUCCESS;
+}
+
+uint32_t da16k_get_msg_window(void) {
+    return s_msg_window;
+}
+
+da16k_err_t da16k_send_msg (const da16k_msg_t *msg) {
+    return da16k_send_msg_frames(msg, NULL);
+}
+
+/* Copies a tuple into dst, which has room for da16k_msg_data_length characters */
+static da16k_err_t da16k_msg_data_render(const da16k_msg_data_t *data, char *dst) {
+    char        value_buffer[DA16K_MSG_VALUE_BUFFER_SIZE];
+    const char *value_str;
+    size_t      length;
+
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, data->key);
+
+    if ((size_t) data->type >= (sizeof(da16k_msg_type_prefixes) / sizeof(da16k_msg_type_prefixes[0]))) {
+        return DA16K_INVALID_PARAMETER;
+    }
+
+    value_str = da16k_msg_data_value_str(value_buffer, data);
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, value_str);
+
+    if (data->schema) {
+        memcpy(dst, data->schema->prefix, data->schema->prefix_length);
+        dst += data->schema->prefix_length;
+    } else {
+        length = strlen(data->key);
+
+        memcpy(dst, da16k_msg_type_prefixes[data->type], 2);
+        memcpy(&dst[2], data->key, length);
+        dst[2 + length] = ',';
+        dst += 2 + length + 1;
+    }
+
+    length = strlen(value_str);
+
+    memcpy(dst, value_str, length);
+    dst[length] = ',';
+
+    return DA16K_SUCCESS;
+}
+
+da16k_err_t da16k_msg_render(const da16k_msg_t *msg, size_t first, size_t max_count, char *dst, size_t size,
+                             size_t *length, size_t *count) {
+    size_t              end;
+    da16k_err_t         ret     = DA16K_SUCCESS;
+
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, msg);
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, dst);
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, length);
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, count);
+
+    *length = 0;
+    *count  = 0;
+
+    if (first >= msg->data_count) {
+        return DA16K_SUCCESS;
+    }
+
+    end     = (max_count < (msg->data_count - first)) ? (first + max_count) : msg->data_count;
+
+    /* One tuple at a time, so a tuple that does not fit anymore leaves the previous ones intact */
+    for (size_t i = first; i < end; i++) {
+        size_t tuple_length = da16k_msg_data_length(&msg->data[i]);
+
+        if (tuple_length > (size - *length)) {
+            ret = (*count == 0) ? DA16K_AT_MESSAGE_TOO_LONG : DA16K_SUCCESS;
+            break;
+        }
+
+        if (DA16K_SUCCESS != (ret = da16k_msg_data_render(&msg->data[i], &dst[*length]))) {
+            break;
+        }
+
+        *length += tuple_length;
+        (*count)++;
+    }
+
+    return ret;
+}
+
+/* Pre-rendered tuples for da16k_send_msg_rendered_transaction */
+typedef struct {
+    const char         *tuples;
+    size_t              length;
+} da16k_msg_rendered_t;
+
+static da16k_err_t da16k_send_msg_rendered_transaction(void *context) {
+    static const char           cmd_prefix[]    = DA16K_MSG_FRAME_PREFIX;
+    const da16k_msg_rendered_t *rendered        = context;
+
+    da16k_at_frame_init(&s_msg_frame);
+    da16k_at_frame_add(&s_msg_frame, cmd_prefix, sizeof(cmd_prefix) - 1);
+    da16k_at_frame_add(&s_msg_frame, rendered->tuples, rendered->length);
+
+    return da16k_at_send_frame_and_check_success(&s_msg_frame, 0, "+NWICEXMSG");
+}
+
+da16k_err_t da16k_send_msg_rendered(const char *tuples, size_t length) {
+    da16k_msg_rendered_t    rendered = { tuples, length };
+    da16k_err_t             ret;
+
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, tuples);
+
+    ret = da16k_at_transact(DA16K_PRIORITY_BULK, da16k_send_msg_rendered_transaction, &rendered);
+    da16k_link_report(ret);
+
+    return ret;
+}
+
+void da16k_msg_mark(const da16k_msg_t *msg, da16k_msg_mark_t *mark) {
+    mark->count         = msg->data_count;
+    mark->string_top    = msg->string_top;
+}
+
+void da16k_msg_rollback(da16k_msg_t *msg, const da16k_msg_mark_t *mark) {
+    for (size_t i = mark->count; i < msg->data_count; i++) {
+        da16k_msg_free_data_strings(msg, &msg->data[i]);
+    }
+
+    msg->data_count = mark->count;
+    msg->string_top = mark->string_top;
+}
+
+da16k_err_t da16k_msg_append(da16k_msg_t *dst, const da16k_msg_t *src) {
+    da16k_msg_mark_t    mark;
+    da16k_err_t         ret = DA16K_SUCCESS;
+
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, dst);
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, src);
+
+    da16k_msg_mark(dst, &mark);
+
+    for (size_t i = 0; i < src->data_count && ret == DA16K_SUCCESS; i++) {
+        da16k_msg_data_t data = src->data[i];
+
+        if (data.schema) {
+            ret = da16k_msg_add_schema_internal(dst, data.schema, &data);
+        } else {
+            ret = da16k_msg_add_copy(dst, src->data[i].key, &data);
+        }
+    }
+
+    /* All or nothing: remove what has been added so far */
+    if (ret != DA16K_SUCCESS) {
+        da16k_msg_rollback(dst, &mark);
+    }
+
+    return ret;
+}
+
+size_t da16k_msg_get_count(const da16k_msg_t *msg) {
+    return msg ? msg->data_count : 0;
+}
+
+void da16k_msg_reset(da16k_msg_t *msg) {
+    if (msg == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < msg->data_count; i++) {
+        da16k_msg_free_data_strings(msg, &msg->data[i]);
+    }
+
+    msg->data_count = 0;
+    msg->string_top = msg->buffer_end;
+}
+
+void da16k_destroy_msg(da16k_msg_t *msg) {
+    if (msg) {
+        /* The data and header of buffer-backed messages live in the caller's buffer */
+        if (msg->in_buffer) {
+            return;
+        }
+
+        if (msg->data) {
+            da16k_msg_reset(msg);
+            da16k_free(msg->data);
+        }
+        da16k_free(msg);
+    }
+}
+
+/* Helper functions for direct sending (for basic, non-threaded applications) */
 
 da16k_err_t da16k_send_msg_direct_str(const char *key, const char *value) {
     da16k_msg_data_t    data    = { .key = key,
@@ -383,27 +1283,60 @@ da16k_err_t da16k_send_msg_direct_num(const char *key, double value) {
     return da16k_send_msg(&msg);
 }
 
+da16k_err_t da16k_send_msg_direct_schema_str(const da16k_schema_key_t *key, const char *value) {
+    da16k_msg_data_t    data    = { .type = DA16K_AT_STRING,
+                                    .value.d_string = (char *) value };
+    da16k_msg_t         msg     = { .data = &data,
+                                    .data_capacity = 1,
+                                    .data_count = 1 };
+    da16k_err_t         ret     = da16k_msg_data_set_schema(&data, key);
+
+    return (ret == DA16K_SUCCESS) ? da16k_send_msg(&msg) : ret;
+}
+
+da16k_err_t da16k_send_msg_direct_schema_bool(const da16k_schema_key_t *key, bool value) {
+    da16k_msg_data_t    data    = { .type = DA16K_AT_BOOL,
+                                    .value.d_bool = value };
+    da16k_msg_t         msg     = { .data = &data,
+                                    .data_capacity = 1,
+                                    .data_count = 1 };
+    da16k_err_t         ret     = da16k_msg_data_set_schema(&data, key);
+
+    return (ret == DA16K_SUCCESS) ? da16k_send_msg(&msg) : ret;
+}
+
+da16k_err_t da16k_send_msg_direct_schema_num(const da16k_schema_key_t *key, double value) {
+    da16k_msg_data_t    data    = { .type = DA16K_AT_FLOAT64,
+                                    .value.d_float64 = value };
+    da16k_msg_t         msg     = { .data = &data,
+                                    .data_capacity = 1,
+                                    .data_count = 1 };
+    da16k_err_t         ret     = da16k_msg_data_set_schema(&data, key);
+
+    return (ret == DA16K_SUCCESS) ? da16k_send_msg(&msg) : ret;
+}
+
 da16k_err_t da16k_set_iotc_connection_type(da16k_iotc_mode_t type) {
-    return da16k_at_send_formatted_and_check_success(DA16K_UART_TIMEOUT_MS, NULL, "AT+NWICCT %u", (unsigned) type);
+    return da16k_at_send_formatted_and_check_success(0, NULL, "AT+NWICCT %u", (unsigned) type);
 }
 
 da16k_err_t da16k_set_iotc_auth_type(da16k_iotc_auth_type_t type) {
-    return da16k_at_send_formatted_and_check_success(DA16K_UART_TIMEOUT_MS, NULL, "AT+NWICAT %u", (unsigned) type);
+    return da16k_at_send_formatted_and_check_success(0, NULL, "AT+NWICAT %u", (unsigned) type);
 }
 
 da16k_err_t da16k_set_iotc_cpid(const char *cpid) {
     DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, cpid);
-    return da16k_at_send_formatted_and_check_success(DA16K_UART_TIMEOUT_MS, NULL, "AT+NWICCPID %s", cpid);
+    return da16k_at_send_formatted_and_check_success(0, NULL, "AT+NWICCPID %s", cpid);
 }
 
 da16k_err_t da16k_set_iotc_duid(const char *duid) {
     DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, duid);
-    return da16k_at_send_formatted_and_check_success(DA16K_UART_TIMEOUT_MS, NULL, "AT+NWICDUID %s", duid);
+    return da16k_at_send_formatted_and_check_success(0, NULL, "AT+NWICDUID %s", duid);
 }
 
 da16k_err_t da16k_set_iotc_env(const char *env) {
     DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, env);
-    return da16k_at_send_formatted_and_check_success(DA16K_UART_TIMEOUT_MS, NULL, "AT+NWICENV %s", env);
+    return da16k_at_send_formatted_and_check_success(0, NULL, "AT+NWICENV %s", env);
 }
 
 da16k_err_t da16k_iotc_start(void) {
@@ -412,7 +1345,7 @@ da16k_err_t da16k_iotc_start(void) {
     /* Starting consists of two parts: the setup and the actual start. Since decoupling the two from our POV is pointless,
        we do both of these in this wrapper. */
 
-    ret = da16k_at_send_formatted_and_check_success(s_network_timeout_ms, "+NWICSETUPEND", "AT+NWICSETUP");
+    ret = da16k_at_send_formatted_and_check_success(0, "+NWICSETUPEND", "AT+NWICSETUP");
     if (ret == DA16K_SUCCESS) {
         ret = da16k_at_send_formatted_and_check_success(s_iotc_connect_timeout_ms, "+NWICSTARTEND", "AT+NWICSTART");
     }
@@ -420,11 +1353,11 @@ da16k_err_t da16k_iotc_start(void) {
 }
 
 da16k_err_t da16k_iotc_stop(void) {
-    return da16k_at_send_formatted_and_check_success(s_network_timeout_ms, "+NWICSTOPEND", "AT+NWICSTOP");
+    return da16k_at_send_formatted_and_check_success(0, "+NWICSTOPEND", "AT+NWICSTOP");
 }
 
 da16k_err_t da16k_iotc_reset(void) {
-    return da16k_at_send_formatted_and_check_success(s_network_timeout_ms, "+NWICRESETEND", "AT+NWICRESET");
+    return da16k_at_send_formatted_and_check_success(0, "+NWICRESETEND", "AT+NWICRESET");
 }
 
 da16k_err_t da16k_set_wifi_config(const da16k_wifi_cfg_t *cfg) {
@@ -443,8 +1376,311 @@ da16k_err_t da16k_set_wifi_config(const da16k_wifi_cfg_t *cfg) {
         cfg->hidden ? 1 : 0);           /* Hidden network flag */
 }
 
+/* Checks whether the gateway responds at the current baud rate */
+static bool da16k_baud_probe(void) {
+    for (unsigned i = 0; i < DA16K_CONFIG_BAUD_PROBE_ATTEMPTS; i++) {
+        /* Anything received around the switch is garbage */
+        da16k_at_discard_input();
+
+        if (da16k_at_send_formatted_msg("AT") == DA16K_SUCCESS &&
+            da16k_at_receive_and_validate_response(true, NULL, DA16K_CONFIG_BAUD_PROBE_TIMEOUT_MS) == DA16K_SUCCESS) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool da16k_baud_set_local(uint32_t baud_rate) {
+    if (!da16k_uart_set_baud(baud_rate)) {
+        return false;
+    }
+
+    s_baud_rate = baud_rate;
+
+    return true;
+}
+
+/* Asks the gateway to switch to baud_rate, follows it and verifies the link */
+static bool da16k_baud_switch(uint32_t baud_rate) {
+    if (da16k_at_send_formatted_msg(DA16K_CONFIG_BAUD_COMMAND, (unsigned long) baud_rate) != DA16K_SUCCESS ||
+        da16k_at_receive_and_validate_response(true, NULL, DA16K_UART_TIMEOUT_MS) != DA16K_SUCCESS) {
+        return false;   /* Rejected, the gateway stays where it is */
+    }
+
+    return da16k_baud_set_local(baud_rate) && da16k_baud_probe();
+}
+
+/* All steps run in one transaction, so nothing else is sent while the two ends might disagree on the rate */
+static da16k_err_t da16k_set_baud_rate_transaction(void *context) {
+    uint32_t baud_rate  = *(const uint32_t *) context;
+    uint32_t previous   = s_baud_rate;
+
+    /* The gateway may still be at the requested rate from an earlier session, e.g. before an MCU reset */
+    if (!da16k_baud_probe() && !(baud_rate != previous && da16k_baud_set_local(baud_rate) && da16k_baud_probe())) {
+        (void) da16k_baud_set_local(previous);
+        DA16K_ERROR("No response from gateway\r\n");
+        return DA16K_TIMEOUT;
+    }
+
+    if (s_baud_rate == baud_rate || da16k_baud_switch(baud_rate)) {
+        return DA16K_SUCCESS;
+    }
+
+    DA16K_WARN("Gateway did not switch to %lu bps, falling back to %lu bps\r\n", (unsigned long) baud_rate,
+               (unsigned long) DA16K_UART_BAUD_RATE);
+
+    /* Unless the switch was rejected outright, the gateway may be at either rate. Ask it to return from the new one,
+       then look for it at the default one. */
+    if (s_baud_rate != DA16K_UART_BAUD_RATE && da16k_baud_switch(DA16K_UART_BAUD_RATE)) {
+        return DA16K_AT_FAIL;
+    }
+
+    return (da16k_baud_set_local(DA16K_UART_BAUD_RATE) && da16k_baud_probe()) ? DA16K_AT_FAIL : DA16K_TIMEOUT;
+}
+
+da16k_err_t da16k_set_baud_rate(uint32_t baud_rate) {
+    if (baud_rate == 0) {
+        return DA16K_INVALID_PARAMETER;
+    }
+
+    return da16k_at_transact(DA16K_PRIORITY_NORMAL, da16k_set_baud_rate_transaction, &baud_rate);
+}
+
+uint32_t da16k_get_baud_rate(void) {
+    return s_baud_rate;
+}
+
+/* Runs a query and copies the value following the colon into value, without surrounding quotes */
+static da16k_err_t da16k_query(const char *command, char *value, size_t size) {
+    char                expected[24];
+    size_t              length  = strcspn(&command[2], "?= ");   /* "AT+NWICCPID?" is answered with "+NWICCPID:" */
+    da16k_at_request_t  request = { command, expected, DA16K_PRIORITY_NORMAL, 0, value, size };
+
+    da16k_err_t         ret;
+
+    if (length >= sizeof(expected)) {
+        return DA16K_INVALID_PARAMETER;
+    }
+
+    memcpy(expected, &command[2], length);
+    expected[length] = 0x00;
+
+    if (DA16K_SUCCESS != (ret = da16k_at_execute(&request))) {
+        return ret;
+    }
+
+    length = strlen(value);
+
+    if (length >= 2 && (value[0] == '"' || value[0] == '\'') && value[length - 1] == value[0]) {
+        memmove(value, &value[1], length - 2);
+        value[length - 2] = 0x00;
+    }
+
+    return DA16K_SUCCESS;
+}
+
+/* Checks whether the gateway reports value for the setting that command (e.g. "AT+NWICCPID") sets */
+static bool da16k_setting_matches(const char *command, const char *value) {
+    char query[24];
+    char current[DA16K_SETTING_VALUE_SIZE];
+
+    if (snprintf(query, sizeof(query), "%s" DA16K_CONFIG_QUERY_SUFFIX, command) >= (int) sizeof(query)) {
+        return false;
+    }
+
+    return da16k_query(query, current, sizeof(current)) == DA16K_SUCCESS && strcmp(current, value) == 0;
+}
+
+da16k_err_t da16k_discover_msg_caps(void) {
+#if defined(DA16K_CONFIG_MSG_CAPS_COMMAND)
+    char            value[32];
+    char           *end;
+    unsigned long   tuples;
+    unsigned long   line_length;
+    da16k_err_t     ret         = da16k_query(DA16K_CONFIG_MSG_CAPS_COMMAND, value, sizeof(value));
+
+    if (ret != DA16K_SUCCESS) {
+        DA16K_DEBUG("No frame limits reported (%d), sending %u tuples per frame\r\n", (int) ret,
+                    (unsigned) s_msg_caps.max_tuples);
+        return ret;
+    }
+
+    tuples = strtoul(value, &end, 10);
+
+    if (*end != ',') {
+        DA16K_WARN("Invalid frame limits '%s'\r\n", value);
+        return DA16K_AT_FAIL;
+    }
+
+    line_length = strtoul(end + 1, NULL, 10);
+
+    s_msg_caps.max_tuples       = (tuples == 0 || tuples > DA16K_CONFIG_MSG_MAX_TUPLES_PER_FRAME) ?
+                                  DA16K_CONFIG_MSG_MAX_TUPLES_PER_FRAME : (uint32_t) tuples;
+    s_msg_caps.max_line_length  = (uint32_t) line_length;
+    s_msg_caps.reported         = true;
+
+    DA16K_DEBUG("Frame limits: %u tuples, %lu characters\r\n", (unsigned) s_msg_caps.max_tuples, line_length);
+
+    return DA16K_SUCCESS;
+#else
+    return DA16K_AT_FAIL;
+#endif
+}
+
+void da16k_get_msg_caps(da16k_msg_caps_t *caps) {
+    if (caps) {
+        *caps = s_msg_caps;
+    }
+}
+
+da16k_err_t da16k_get_iotc_status(bool *connected) {
+    char        state[16];
+    da16k_err_t ret = da16k_query(DA16K_CONFIG_IOTC_STATUS_COMMAND, state, sizeof(state));
+
+    *connected = (ret == DA16K_SUCCESS) && atoi(state) == DA16K_CONFIG_IOTC_STATUS_CONNECTED;
+
+    return ret;
+}
+
+da16k_err_t da16k_get_wifi_status(const char *ssid, bool *joined) {
+    char        state[DA16K_SETTING_VALUE_SIZE];
+    char       *current;
+    size_t      length;
+    da16k_err_t ret     = da16k_query(DA16K_CONFIG_WIFI_QUERY_COMMAND, state, sizeof(state));
+
+    *joined = false;
+
+    if (ret != DA16K_SUCCESS || strtol(state, &current, 10) != 1 || (*current != ',' && *current != 0x00)) {
+        return ret;
+    }
+
+    if (ssid == NULL) {
+        *joined = true;
+        return ret;
+    }
+
+    if (*current++ != ',') {
+        return ret;
+    }
+
+    /* The SSID may be quoted, further fields follow after a comma */
+    if (*current == '"' || *current == '\'') {
+        char *end = strchr(current + 1, *current);
+
+        if (end == NULL) {
+            return ret;
+        }
+
+        current++;
+        length = (size_t) (end - current);
+    } else {
+        length = strcspn(current, ",");
+    }
+
+    *joined = (length == strlen(ssid) && strncmp(current, ssid, length) == 0);
+
+    return ret;
+}
+
+/* Checks whether the gateway reports digest as the fingerprint of its certificate of type */
+static da16k_err_t da16k_cert_fingerprint_matches(da16k_cert_type_t type, const uint8_t digest[DA16K_SHA256_SIZE], bool *matches) {
+#if defined(DA16K_CONFIG_CERT_DIGEST_COMMAND)
+    char        query[32];
+    char        local[DA16K_SHA256_SIZE * 2 + 1];
+    char        remote[DA16K_SETTING_VALUE_SIZE];
+    da16k_err_t ret;
+
+    *matches = false;
+
+    snprintf(query, sizeof(query), DA16K_CONFIG_CERT_DIGEST_COMMAND, (unsigned) type);
+
+    if (DA16K_SUCCESS != (ret = da16k_query(query, remote, sizeof(remote)))) {
+        return ret;
+    }
+
+    da16k_sha256_to_hex(local, digest);
+
+    *matches = (strlen(remote) == (sizeof(local) - 1));
+
+    for (size_t i = 0; *matches && i < (sizeof(local) - 1); i++) {
+        *matches = (tolower((unsigned char) remote[i]) == local[i]);
+    }
+
+    return DA16K_SUCCESS;
+#else
+    (void) type;
+    (void) digest;
+
+    *matches = false;
+
+    return DA16K_AT_FAIL;
+#endif
+}
+
+/* Uploads a certificate until the gateway confirms it */
+static da16k_err_t da16k_upload_cert(da16k_cert_type_t type, const da16k_cert_source_t *source, const uint8_t digest[DA16K_SHA256_SIZE]) {
+    uint8_t     sent[DA16K_SHA256_SIZE];
+    bool        matches;
+    da16k_err_t ret = DA16K_AT_FAIL;
+
+    for (unsigned attempt = 0; attempt < DA16K_CONFIG_CERT_UPLOAD_ATTEMPTS; attempt++) {
+        if (attempt > 0) {
+            DA16K_WARN("Certificate %d upload failed (%d), retrying\r\n", (int) type, (int) ret);
+        }
+
+        if (DA16K_SUCCESS != (ret = da16k_at_send_certificate(type, source, sent))) {
+            continue;
+        }
+
+        /* The source changed between hashing and sending, e.g. a flash read error */
+        if (memcmp(sent, digest, sizeof(sent)) != 0) {
+            ret = DA16K_STORAGE_ERROR;
+            continue;
+        }
+
+        /* Gateways without the fingerprint query are trusted with their OK */
+        if (da16k_cert_fingerprint_matches(type, digest, &matches) != DA16K_SUCCESS || matches) {
+            return DA16K_SUCCESS;
+        }
+
+        ret = DA16K_AT_FAIL;
+    }
+
+    return ret;
+}
+
+da16k_err_t da16k_provision_cert(da16k_cert_type_t type, const da16k_cert_source_t *source, bool *uploaded) {
+    uint8_t     digest[DA16K_SHA256_SIZE];
+    bool        matches;
+    da16k_err_t ret;
+
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, source);
+
+    if (uploaded) {
+        *uploaded = false;
+    }
+
+    if (DA16K_SUCCESS != (ret = da16k_at_certificate_digest(source, digest))) {
+        return ret;
+    }
+
+    if (da16k_cert_fingerprint_matches(type, digest, &matches) == DA16K_SUCCESS && matches) {
+        DA16K_DEBUG("Certificate %d already on the gateway\r\n", (int) type);
+        return DA16K_SUCCESS;
+    }
+
+    if (uploaded) {
+        *uploaded = true;
+    }
+
+    return da16k_upload_cert(type, source, digest);
+}
+
 da16k_err_t da16k_set_device_cert(const char *cert, const char *key) {
-    da16k_err_t ret = DA16K_SUCCESS;
+    da16k_cert_source_t cert_source = { cert, 0, NULL, NULL };
+    da16k_cert_source_t key_source  = { key, 0, NULL, NULL };
+    da16k_err_t         ret         = DA16K_SUCCESS;
 
     DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, cert);
     DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, key);
@@ -452,35 +1688,139 @@ da16k_err_t da16k_set_device_cert(const char *cert, const char *key) {
     DA16K_WARN("WARNING: Client certificate transmission via the AT command protocol is *INSECURE* and may ONLY be used for testing / development purposes!\r\n");
 
     /* MQTT Client Certificate */
-    if (DA16K_SUCCESS != (ret = da16k_at_send_certificate(DA16K_CERT_MQTT_DEV_CERT, cert))) { return ret; }
+    if (DA16K_SUCCESS != (ret = da16k_provision_cert(DA16K_CERT_MQTT_DEV_CERT, &cert_source, NULL)))   { return ret; }
     /* MQTT Client Private Key */
-    if (DA16K_SUCCESS != (ret = da16k_at_send_certificate(DA16K_CERT_MQTT_DEV_KEY, key)))   { return ret; }
+    if (DA16K_SUCCESS != (ret = da16k_provision_cert(DA16K_CERT_MQTT_DEV_KEY, &key_source, NULL)))     { return ret; }
 
     return ret;
 }
 
-da16k_err_t da16k_setup_iotc_and_connect(const da16k_iotc_cfg_t *cfg) {
-    da16k_err_t ret = DA16K_SUCCESS;
+static bool da16k_iotc_connected(void) {
+    bool connected;
+
+    return da16k_get_iotc_status(&connected) == DA16K_SUCCESS && connected;
+}
+
+static bool da16k_wifi_joined(const char *ssid) {
+    bool joined;
+
+    return da16k_get_wifi_status(ssid, &joined) == DA16K_SUCCESS && joined;
+}
+
+/*  Only the settings the gateway does not already have are sent (all of them with full_setup or without
+    DA16K_CONFIG_WARM_START). If none changed, a running IoTC session is kept and a stopped one is only started. */
+da16k_err_t da16k_setup_iotc(const da16k_iotc_cfg_t *cfg, bool full_setup) {
+    enum { CT, CPID, DUID, ENV, AT, SETTING_COUNT };
+    enum { CERT, KEY, CERT_COUNT };
+
+    static const char  *commands[SETTING_COUNT] = { "AT+NWICCT", "AT+NWICCPID", "AT+NWICDUID", "AT+NWICENV", "AT+NWICAT" };
+    char                mode[12];
+    char                auth[12];
+    const char         *values[SETTING_COUNT];
+    bool                differs[SETTING_COUNT];
+    da16k_cert_source_t certs[CERT_COUNT];
+    uint8_t             digests[CERT_COUNT][DA16K_SHA256_SIZE];
+    bool                cert_differs[CERT_COUNT]    = { false, false };
+    bool                changed;
+    da16k_err_t         ret     = DA16K_SUCCESS;
 
     DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, cfg);
     DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, cfg->cpid);
     DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, cfg->duid);
     DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, cfg->env);
 
+    full_setup  = full_setup || !DA16K_WARM_START;
+    changed     = full_setup;
+
+    /* Certificates cannot be read back, only their fingerprints */
+    if (cfg->device_cert) {
+        static const da16k_cert_type_t cert_types[CERT_COUNT] = { DA16K_CERT_MQTT_DEV_CERT, DA16K_CERT_MQTT_DEV_KEY };
+
+        DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, cfg->device_key);
+
+        certs[CERT] = (da16k_cert_source_t) { cfg->device_cert, 0, NULL, NULL };
+        certs[KEY]  = (da16k_cert_source_t) { cfg->device_key, 0, NULL, NULL };
+
+        for (unsigned i = 0; i < CERT_COUNT; i++) {
+            bool matches = false;
+
+            (void) da16k_at_certificate_digest(&certs[i], digests[i]);
+
+            cert_differs[i] = full_setup ||
+                              da16k_cert_fingerprint_matches(cert_types[i], digests[i], &matches) != DA16K_SUCCESS || !matches;
+
+            if (cert_differs[i]) {
+                changed = true;
+            } else {
+                s_setup_stats.commands_skipped++;
+            }
+        }
+    }
+
+    snprintf(mode, sizeof(mode), "%u", (unsigned) cfg->mode);
+    snprintf(auth, sizeof(auth), "%u", (unsigned) DA16K_IOTC_AT_X509);
+
+    values[CT]      = mode;
+    values[CPID]    = cfg->cpid;
+    values[DUID]    = cfg->duid;
+    values[ENV]     = cfg->env;
+    values[AT]      = auth;
+
+    for (unsigned i = 0; i < SETTING_COUNT; i++) {
+        differs[i] = full_setup || !da16k_setting_matches(commands[i], values[i]);
+
+        if (differs[i]) {
+            changed = true;
+        } else {
+            s_setup_stats.commands_skipped++;
+        }
+    }
+
+    if (!changed) {
+        if (da16k_iotc_connected()) {
+            DA16K_DEBUG("IoTC settings unchanged, keeping the session\r\n");
+            s_setup_stats.commands_skipped += 4;    /* Stop, reset, setup and start */
+            s_setup_stats.warm              = true;
+            return DA16K_SUCCESS;
+        }
+
+        s_setup_stats.commands_skipped += 2;        /* Stop and reset */
+        s_setup_stats.commands_sent    += 2;        /* Setup and start */
+        return da16k_iotc_start();
+    }
+
     if (DA16K_SUCCESS != (ret = da16k_iotc_stop()))                                             { return ret; }
+    s_setup_stats.commands_sent++;
 
-    if (DA16K_SUCCESS != (ret = da16k_set_iotc_connection_type(cfg->mode)))                     { return ret; }
-    if (DA16K_SUCCESS != (ret = da16k_set_iotc_cpid(cfg->cpid)))                                { return ret; }
-    if (DA16K_SUCCESS != (ret = da16k_set_iotc_duid(cfg->duid)))                                { return ret; }
-    if (DA16K_SUCCESS != (ret = da16k_set_iotc_env(cfg->env)))                                  { return ret; }
-    if (DA16K_SUCCESS != (ret = da16k_set_iotc_auth_type(DA16K_IOTC_AT_X509)))                  { return ret; }
+    for (unsigned i = 0; i < SETTING_COUNT; i++) {
+        if (differs[i]) {
+            ret = da16k_at_send_formatted_and_check_success(0, NULL, "%s %s", commands[i], values[i]);
+            if (ret != DA16K_SUCCESS)                                                           { return ret; }
+            s_setup_stats.commands_sent++;
+        }
+    }
 
-    if (cfg->device_cert) {
-        if (DA16K_SUCCESS != (ret = da16k_set_device_cert(cfg->device_cert, cfg->device_key)))  { return ret; }
+    if (cert_differs[CERT] || cert_differs[KEY]) {
+        DA16K_WARN("WARNING: Client certificate transmission via the AT command protocol is *INSECURE* and may ONLY be used for testing / development purposes!\r\n");
+    }
+
+    if (cert_differs[CERT]) {
+        if (DA16K_SUCCESS != (ret = da16k_upload_cert(DA16K_CERT_MQTT_DEV_CERT, &certs[CERT], digests[CERT])))  { return ret; }
+        s_setup_stats.commands_sent++;
+    }
+
+    if (cert_differs[KEY]) {
+        if (DA16K_SUCCESS != (ret = da16k_upload_cert(DA16K_CERT_MQTT_DEV_KEY, &certs[KEY], digests[KEY])))     { return ret; }
+        s_setup_stats.commands_sent++;
     }
 
     if (DA16K_SUCCESS != (ret = da16k_iotc_reset()))                                            { return ret; }
     if (DA16K_SUCCESS != (ret = da16k_iotc_start()))                                            { return ret; }
+    s_setup_stats.commands_sent += 3;
 
     return ret;
 }
+
+da16k_err_t da16k_setup_iotc_and_connect(const da16k_iotc_cfg_t *cfg) {
+    return da16k_setup_iotc(cfg, false);
+}
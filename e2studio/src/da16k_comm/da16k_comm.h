@@ -12,6 +12,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #if defined(DA16K_CONFIG_FILE)
 #include DA16K_CONFIG_FILE
@@ -87,10 +88,23 @@ typedef struct {
     da16k_iotc_cfg_t   *iotc_config;    /* IoTConnect device config (NULL = rely on existing AT gateway configuration) */
     da16k_wifi_cfg_t   *wifi_config;    /* (NULL = rely on existing AT gateway configuration) */
 
-    uint32_t            network_timeout_ms;             /* Timeout for network operations e.g. confirmation on sending telemetry (0=Default) */
+    uint32_t            network_timeout_ms;             /* Timeout for network operations e.g. confirmation on sending telemetry (0=Default, adapted later on) */
 #define DA16K_DEFAULT_IOTC_TIMEOUT_MS           2000    /* Default: 2 seconds */
+
+    uint32_t            baud_rate;                      /* UART baud rate to switch to, e.g. 921600 (0 = stay at DA16K_UART_BAUD_RATE) */
+
+    bool                full_setup;     /* Send all settings and restart the IoTC session, even if the gateway already has them (see da16k_init) */
 } da16k_cfg_t;
 
+typedef enum {
+    DA16K_CERT_MQTT_ROOT_CA     = 0,
+    DA16K_CERT_MQTT_DEV_CERT    = 1,
+    DA16K_CERT_MQTT_DEV_KEY     = 2,
+    DA16K_CERT_HTTP_ROOT_CA     = 3,
+    DA16K_CERT_HTTP_DEV_CERT    = 4,
+    DA16K_CERT_HTTP_DEV_KEY     = 5,
+} da16k_cert_type_t;
+
 typedef enum e_da16k_err {
     DA16K_SUCCESS               = 0,    /* Operation was sucecssful */
     DA16K_OUT_OF_MEMORY         = 1,    /* A memory allocation in the requested operation has failed */
@@ -105,6 +119,8 @@ typedef enum e_da16k_err {
     DA16K_NO_CMDS               = 10,   /* No new C2D commands have been sent to the device */
     DA16K_INVALID_PARAMETER     = 11,   /* The function was called with an invalid parameter */
     DA16K_NOT_INITIALIZED       = 12,   /* The initialization has failed or not occured yet */
+    DA16K_UNKNOWN_CMD           = 13,   /* No handler has been registered for the received C2D command */
+    DA16K_STORAGE_ERROR         = 14,   /* Reading, programming or erasing the journal's flash memory has failed */
 } da16k_err_t;
 
 
@@ -113,28 +129,474 @@ typedef struct {
     char *parameters;
 } da16k_cmd_t;
 
+/*  Part of a string, not null-terminated */
+typedef struct {
+    const char *data;
+    size_t      length;
+} da16k_str_view_t;
+
+/*  A command as returned by da16k_get_cmd_view, borrowed from the library's receive buffer */
+typedef struct {
+    da16k_str_view_t    command;
+    da16k_str_view_t    parameters;     /* data is NULL if no parameters were sent */
+} da16k_cmd_view_t;
+
+/* Telemetry data types as defined by the AT command protocol */
+typedef enum e_da16k_msg_data_type {
+    DA16K_AT_STRING = 0,
+    DA16K_AT_BOOL,
+    DA16K_AT_FLOAT32,
+    DA16K_AT_FLOAT64
+} da16k_msg_data_type_t;
+
+/*  Pre-registered telemetry key (see DA16K_SCHEMA_DEFINE).
+    The "<type>,<key>," part of the AT protocol tuple is rendered at compile time, so only the value has to be
+    formatted when sending. */
+typedef struct {
+    da16k_msg_data_type_t   type;
+    const char             *key;
+    const char             *prefix;         /* "<type>,<key>," */
+    size_t                  prefix_length;
+} da16k_schema_key_t;
+
+/* Protocol type IDs as strings for DA16K_SCHEMA_KEY - must match da16k_msg_data_type_t */
+#define DA16K_SCHEMA_TYPE_ID_STRING             "0"
+#define DA16K_SCHEMA_TYPE_ID_BOOL               "1"
+#define DA16K_SCHEMA_TYPE_ID_FLOAT32            "2"
+#define DA16K_SCHEMA_TYPE_ID_FLOAT64            "3"
+
+/*  Initializer for a single da16k_schema_key_t. type is one of STRING, BOOL, FLOAT32 or FLOAT64. */
+#define DA16K_SCHEMA_KEY(key, type)             { DA16K_AT_##type, #key, DA16K_SCHEMA_TYPE_ID_##type "," #key ",", \
+                                                  sizeof(DA16K_SCHEMA_TYPE_ID_##type "," #key ",") - 1 }
+
+/*  Defines a telemetry schema from an X-macro list of (key, type) pairs, e.g.:
+
+        #define MY_TELEMETRY(X)                 \
+            X(cpu_temperature,  FLOAT64)        \
+            X(door_open,        BOOL)
+
+        DA16K_SCHEMA_DEFINE(my_schema, MY_TELEMETRY);
+
+    This creates a const array my_schema[] of da16k_schema_key_t, the indices DA16K_KEY_cpu_temperature and
+    DA16K_KEY_door_open, as well as my_schema_key_count. */
+#define DA16K_SCHEMA_X_INDEX(key, type)         DA16K_KEY_##key,
+#define DA16K_SCHEMA_X_ENTRY(key, type)         DA16K_SCHEMA_KEY(key, type),
+#define DA16K_SCHEMA_DEFINE(name, LIST)         enum { LIST(DA16K_SCHEMA_X_INDEX) name##_key_count }; \
+                                                static const da16k_schema_key_t name[] = { LIST(DA16K_SCHEMA_X_ENTRY) }
+
 typedef struct da16k_msg_t da16k_msg_t;
 
-/*  Init/deinit the library */
+/*  Sizing helpers for arena-backed messages (see da16k_create_msg_in_buffer).
+    The header and tuple sizes are upper bounds for all supported platforms. */
+#define DA16K_MSG_ARENA_HEADER_SIZE             48
+#define DA16K_MSG_ARENA_TUPLE_SIZE              32
+#define DA16K_MSG_ARENA_ALIGNMENT               8
+/*  Buffer size needed for a message holding up to max_tuples tuples with string_bytes bytes of key/value strings
+    (including null terminators) */
+#define DA16K_MSG_ARENA_SIZE(max_tuples, string_bytes)  (DA16K_MSG_ARENA_HEADER_SIZE + ((max_tuples) * DA16K_MSG_ARENA_TUPLE_SIZE) + \
+                                                         (string_bytes) + DA16K_MSG_ARENA_ALIGNMENT)
+
+typedef struct {
+    uint32_t            alloc_count;    /* Number of successful heap allocations made by the library */
+    uint32_t            free_count;     /* Number of heap blocks released by the library */
+    uint32_t            alloc_failures; /* Number of failed heap allocations */
+} da16k_heap_stats_t;
+
+typedef struct {
+    uint32_t            duration_ms;        /* Time da16k_init took */
+    uint32_t            commands_sent;      /* Configuration and session commands sent */
+    uint32_t            commands_skipped;   /* Commands left out because the gateway was already in the requested state */
+    bool                warm;               /* The running IoTC session was kept */
+} da16k_setup_stats_t;
+
+/*  Init/deinit the library.
+    After an MCU reset, the gateway usually still has its configuration and connections. With DA16K_CONFIG_WARM_START
+    defined, da16k_init reads back the WiFi network, the IoTC settings and the session state, and only sends what
+    differs. If nothing does, the running session is kept. Set da16k_cfg_t.full_setup to configure everything
+    regardless. Without it (the default, as stock gateways reject the queries), everything is always sent. */
 da16k_err_t da16k_init                      (const da16k_cfg_t *cfg);
 void        da16k_deinit                    (void);
+/*  Figures of the last da16k_init call */
+void        da16k_get_setup_stats           (da16k_setup_stats_t *stats);
+
+/*  Asks the gateway to switch its UART to baud_rate, follows it and verifies the link. If this fails, both ends fall back
+    to DA16K_UART_BAUD_RATE and DA16K_AT_FAIL is returned (DA16K_TIMEOUT if the gateway does not respond at all).
+    Called by da16k_init if da16k_cfg_t.baud_rate is set. */
+da16k_err_t da16k_set_baud_rate             (uint32_t baud_rate);
+/*  The baud rate currently used to talk to the gateway */
+uint32_t    da16k_get_baud_rate             (void);
+
+/*  Telemetry frame limits of the gateway. If DA16K_CONFIG_MSG_CAPS_COMMAND is defined (e.g. "AT+NWICMSGCAPS?",
+    answered with "+NWICMSGCAPS:<tuples>,<line length>", 0 = no limit), da16k_init asks the gateway for them.
+    Otherwise, and for gateways that do not support it, frames take DA16K_MSG_TUPLES_PER_ITERATION (8) tuples, with
+    no length limit unless DA16K_CONFIG_MSG_MAX_LINE_LENGTH is set. Tuples are never more than DA16K_CONFIG_MSG_MAX_TUPLES_PER_FRAME (32), which sizes the frame buffer. */
+typedef struct {
+    uint32_t            max_tuples;         /* Tuples per AT+NWICEXMSG frame */
+    uint32_t            max_line_length;    /* Longest AT+NWICEXMSG command, without \r\n (0 = no limit) */
+    bool                reported;           /* The gateway reported its limits, otherwise these are the defaults */
+} da16k_msg_caps_t;
+
+/*  Asks the gateway for its limits (called by da16k_init). Returns DA16K_AT_ERROR_CODE if it does not support the
+    query and DA16K_AT_FAIL without DA16K_CONFIG_MSG_CAPS_COMMAND, the defaults are used then. */
+da16k_err_t da16k_discover_msg_caps         (void);
+void        da16k_get_msg_caps              (da16k_msg_caps_t *caps);
+
+/*  Connection supervisor
+
+    Instead of da16k_init, which fails if the gateway cannot be reached, da16k_link_init only sets up the library and
+    returns right away. The supervisor then brings the link up step by step (UART, WiFi, IoTC session, following
+    da16k_cfg_t like da16k_init) and keeps it up:
+
+    - While connected, the session state is probed every DA16K_CONFIG_LINK_PROBE_INTERVAL_MS milliseconds (default
+      30000). The probe is skipped if telemetry or commands went through in the meantime.
+    - After DA16K_CONFIG_LINK_FAILURE_THRESHOLD (default 3) consecutive failed operations, the link is degraded.
+      If the probe confirms the session is down, it is reconnected from the state found, otherwise the session is
+      restarted unless an operation succeeds in the meantime.
+    - Failed attempts are retried with exponential backoff between DA16K_CONFIG_LINK_BACKOFF_MIN_MS (1000) and
+      DA16K_CONFIG_LINK_BACKOFF_MAX_MS (60000), with up to half of each delay taken off at random.
+
+    da16k_send_msg_async keeps queueing while the link is down, the worker holds the messages back until it is up
+    again. The command listener does not poll while it is down.
+
+    On FreeRTOS, da16k_link_start runs the supervisor in a task (DA16K_CONFIG_LINK_TASK_PRIORITY,
+    DA16K_CONFIG_LINK_TASK_STACK_WORDS). Otherwise, da16k_link_poll must be called regularly. */
+
+typedef enum {
+    DA16K_LINK_DOWN             = 0,    /* The gateway does not respond */
+    DA16K_LINK_UART_UP          = 1,    /* The gateway responds, but has not joined the WiFi network */
+    DA16K_LINK_WIFI_JOINED      = 2,    /* WiFi network joined, no IoTC session */
+    DA16K_LINK_CONNECTED        = 3,    /* IoTC session up */
+    DA16K_LINK_DEGRADED         = 4,    /* IoTC session up as far as known, but operations keep failing */
+} da16k_link_state_t;
+
+/*  Called on every state change, from the task running the supervisor */
+typedef void (*da16k_link_callback_t)(da16k_link_state_t previous, da16k_link_state_t state, void *context);
+
+typedef struct {
+    da16k_link_state_t  state;
+    uint32_t            transitions;        /* State changes */
+    uint32_t            recoveries;         /* Changes from below to connected or degraded */
+    uint32_t            attempts;           /* Reconnection steps taken */
+    uint32_t            probes;             /* Health probes sent */
+    uint32_t            probes_skipped;     /* Health probes left out because of successful traffic */
+    uint32_t            failures;           /* Operations that failed because of the link */
+    uint32_t            backoff_ms;         /* Delay before the next attempt (0 = connected or no delay) */
+} da16k_link_stats_t;
+
+/*  Sets up the library for supervision. cfg must stay valid, callback may be NULL. Nothing is sent to the gateway
+    before the supervisor runs. */
+da16k_err_t         da16k_link_init         (const da16k_cfg_t *cfg, da16k_link_callback_t callback, void *context);
+/*  Carries out whatever is due (a probe or a reconnection step) and returns the number of milliseconds until the
+    next call is due. Blocks while talking to the gateway. */
+uint32_t            da16k_link_poll         (void);
+da16k_link_state_t  da16k_link_get_state    (void);
+void                da16k_get_link_stats    (da16k_link_stats_t *stats);
+#if defined(DA16K_CONFIG_FREERTOS)
+/*  Starts the supervisor task. Must be called after da16k_link_init. */
+da16k_err_t         da16k_link_start        (void);
+#endif
+
+/*  Response timing
+
+    The time from sending an AT command to receiving its complete response is measured per class of command. As in
+    TCP, a smoothed round-trip time (srtt) and its variation (rttvar) are kept, and the response timeout is
+    srtt + 4 * rttvar. Each timeout doubles it until a response arrives in time again. The result is kept between
+    DA16K_CONFIG_LOCAL_TIMEOUT_FLOOR_MS (100) and DA16K_CONFIG_LOCAL_TIMEOUT_CEILING_MS (2000) for commands the
+    gateway answers by itself, and DA16K_CONFIG_NETWORK_TIMEOUT_FLOOR_MS (250) and
+    DA16K_CONFIG_NETWORK_TIMEOUT_CEILING_MS (10000) for those that wait for the network.
+
+    Until a class has been measured, DA16K_UART_TIMEOUT_MS or network_timeout_ms is used. WiFi joins and IoTC
+    session starts are measured, but keep their configured timeouts. DA16K_CONFIG_ADAPTIVE_TIMEOUTS 0 turns the
+    adaptation off. */
+
+typedef enum {
+    DA16K_AT_CLASS_CONTROL      = 0,    /* Settings, queries and probes */
+    DA16K_AT_CLASS_COMMAND      = 1,    /* AT+NWICGETCMD */
+    DA16K_AT_CLASS_TELEMETRY    = 2,    /* AT+NWICEXMSG */
+    DA16K_AT_CLASS_SESSION      = 3,    /* AT+NWICSETUP, AT+NWICSTOP, AT+NWICRESET */
+    DA16K_AT_CLASS_CONNECT      = 4,    /* AT+WFJAPA, AT+NWICSTART */
+    DA16K_AT_CLASS_CERT         = 5,    /* Certificate uploads, from the end of the upload */
+    DA16K_AT_CLASS_COUNT
+} da16k_at_class_t;
+
+typedef struct {
+    uint32_t            samples;            /* Responses measured */
+    uint32_t            timeouts;           /* Responses that did not arrive in time */
+    uint32_t            srtt_ms;            /* Smoothed round-trip time */
+    uint32_t            rttvar_ms;          /* Round-trip time variation */
+    uint32_t            last_rtt_ms;        /* Latest round-trip time */
+    uint32_t            timeout_ms;         /* Current response timeout */
+} da16k_timing_stats_t;
+
+da16k_err_t         da16k_get_timing_stats  (da16k_at_class_t at_class, da16k_timing_stats_t *stats);
+
+/*  AT layer statistics
+
+    Every command sent through the library is counted per class with its outcome, and its response time is sorted
+    into a histogram with power-of-two buckets: bucket 0 holds responses within less than 1 ms, bucket i those
+    within [2^(i-1), 2^i) ms, and the last bucket everything slower. Recording takes a few increments, so the
+    statistics are always on. */
+
+#define DA16K_STATS_LATENCY_BUCKETS     16
+
+typedef struct {
+    uint32_t            commands;           /* Commands sent */
+    uint32_t            ok;                 /* Answered successfully */
+    uint32_t            timeouts;           /* Not answered in time */
+    uint32_t            errors;             /* Answered with "ERROR" or "ERROR:<n>" */
+    uint32_t            failures;           /* Anything else, e.g. UART errors or responses without "OK" */
+    int32_t             last_error_code;    /* <n> of the latest "ERROR:<n>" (0 = none yet) */
+    uint32_t            latency[DA16K_STATS_LATENCY_BUCKETS];   /* Answered commands by response time */
+} da16k_class_stats_t;
+
+typedef struct {
+    da16k_class_stats_t classes[DA16K_AT_CLASS_COUNT];
+    uint64_t            bytes_tx;           /* Sent to the gateway */
+    uint64_t            bytes_rx;           /* Received from the gateway */
+    uint32_t            rx_overruns;        /* Bytes lost by the UART port, see da16k_uart_rx_overruns */
+    uint32_t            rx_truncated;       /* Lines longer than the receive buffer */
+    uint32_t            urcs;               /* Unsolicited lines received */
+} da16k_stats_t;
+
+/*  Copies the statistics gathered since the start or the last reset */
+void                da16k_get_stats         (da16k_stats_t *stats);
+void                da16k_reset_stats       (void);
+/*  Lower bound of a latency bucket in milliseconds */
+uint32_t            da16k_stats_bucket_ms   (unsigned bucket);
 
 /* Create message */
 da16k_msg_t *da16k_create_msg               (void);
+/*  Create message inside a caller-supplied buffer. No heap allocations are made for this message, ever.
+    Keys and string values are copied into the buffer; adding data fails with DA16K_OUT_OF_MEMORY once it is full.
+    The buffer must outlive the message. Returns NULL if the buffer is too small to hold an empty message. */
+da16k_msg_t *da16k_create_msg_in_buffer     (void *buffer, size_t buffer_size);
 /* Add data to message */
 da16k_err_t da16k_msg_add_str               (da16k_msg_t *msg, const char *key, const char *value);
 da16k_err_t da16k_msg_add_bool              (da16k_msg_t *msg, const char *key, bool value);
 da16k_err_t da16k_msg_add_num               (da16k_msg_t *msg, const char *key, double value);
-/*  Send data out via AT Commands (does not destroy the message!) */
+/*  Single precision numbers take 8 instead of 16 hex characters on the wire. */
+da16k_err_t da16k_msg_add_float32           (da16k_msg_t *msg, const char *key, float value);
+/*  Integers are sent as single precision if that is exact (+/- 2^24), otherwise as double precision. */
+da16k_err_t da16k_msg_add_int               (da16k_msg_t *msg, const char *key, int32_t value);
+/*  Add data for a pre-registered schema key to message. The key is referenced, never copied.
+    DA16K_INVALID_PARAMETER is returned if the key was declared with a different type. */
+da16k_err_t da16k_msg_add_schema_str        (da16k_msg_t *msg, const da16k_schema_key_t *key, const char *value);
+da16k_err_t da16k_msg_add_schema_bool       (da16k_msg_t *msg, const da16k_schema_key_t *key, bool value);
+da16k_err_t da16k_msg_add_schema_num        (da16k_msg_t *msg, const da16k_schema_key_t *key, double value);
+/*  Returns the number of tuples in a message */
+size_t      da16k_msg_get_count             (const da16k_msg_t *msg);
+/*  Send data out via AT Commands (does not destroy the message!). The tuples are sent in order, each frame is filled
+    up to the gateway's limits (see da16k_msg_caps_t) by encoded size. */
 da16k_err_t da16k_send_msg                  (const da16k_msg_t *msg);
-/*  Destroy message & data */
+/*  Pipelined telemetry: up to window frames of a message are sent before the first one has been answered
+    (1 = every frame waits for the response to the one before, the default). Responses are matched to the frames in
+    order. If a frame fails or its response times out, sending goes back to that frame and repeats it and all frames
+    after it, up to DA16K_CONFIG_MSG_PIPELINE_RETRIES (2) times in a row. Only for gateways that accept commands while
+    they are still working on earlier ones. window is at most DA16K_CONFIG_MSG_MAX_WINDOW (8). */
+da16k_err_t da16k_set_msg_window            (uint32_t window);
+uint32_t    da16k_get_msg_window            (void);
+/*  Remove all data from a message but keep its capacity, so it can be refilled for the next transmission */
+void        da16k_msg_reset                 (da16k_msg_t *msg);
+/*  Destroy message & data (for buffer-backed messages, this does not touch the buffer itself) */
 void        da16k_destroy_msg               (da16k_msg_t *msg);
 
+/*  Telemetry filter
+
+    Keeps the last sent value and time for each key of a schema and only adds a tuple to the message if the value
+    has moved past the key's deadband since it was last sent, or if the key's heartbeat interval has elapsed. A
+    value counts as sent once da16k_filter_commit is called with the result of sending the message.
+    Booleans are sent when they change. Both deadbands are measured against the last sent value; if neither is set,
+    any change is sent. If both are set, exceeding either is enough.
+
+    Storage is provided by the caller, e.g. for a schema defined with DA16K_SCHEMA_DEFINE(my_schema, ...):
+
+        static const da16k_filter_rule_t    my_rules[my_schema_key_count] = { [DA16K_KEY_temperature] = { 0.5, 0, 60000 } };
+        static da16k_filter_state_t         my_state[my_schema_key_count];
+        static da16k_filter_t               my_filter;
+
+        da16k_filter_init(&my_filter, my_schema, my_schema_key_count, my_rules, my_state);
+        da16k_filter_add_num(&my_filter, msg, &my_schema[DA16K_KEY_temperature], value);
+        da16k_filter_commit(&my_filter, da16k_send_msg(msg)); */
+typedef struct {
+    double              deadband;           /* Absolute change needed to send (0 = not used) */
+    double              deadband_percent;   /* Change relative to the last sent value, in percent (0 = not used) */
+    uint32_t            heartbeat_ms;       /* Send regardless of changes after this long (0 = never) */
+} da16k_filter_rule_t;
+
+typedef struct {
+    double              value;              /* Last sent value */
+    uint32_t            sent_ms;
+    bool                valid;              /* A value has been sent */
+    double              pending_value;      /* Added to a message that has not been committed yet */
+    bool                pending;
+} da16k_filter_state_t;
+
+typedef struct {
+    const da16k_schema_key_t   *schema;
+    size_t                      key_count;
+    const da16k_filter_rule_t  *rules;      /* One per key, NULL = send changes only */
+    da16k_filter_state_t       *state;      /* One per key */
+    uint32_t                    sent;       /* Tuples committed as sent */
+    uint32_t                    suppressed; /* Tuples filtered out */
+} da16k_filter_t;
+
+da16k_err_t da16k_filter_init               (da16k_filter_t *filter, const da16k_schema_key_t *schema, size_t key_count,
+                                             const da16k_filter_rule_t *rules, da16k_filter_state_t *state);
+/*  Add the value to msg if it passes the filter. Returns DA16K_SUCCESS both if the tuple was added and if it was
+    suppressed. The key must be part of the filter's schema. */
+da16k_err_t da16k_filter_add_num            (da16k_filter_t *filter, da16k_msg_t *msg, const da16k_schema_key_t *key, double value);
+da16k_err_t da16k_filter_add_bool           (da16k_filter_t *filter, da16k_msg_t *msg, const da16k_schema_key_t *key, bool value);
+/*  Call with the result of sending the message the values were added to. On DA16K_SUCCESS they become the last sent
+    values, otherwise they are discarded and compared against the previous ones again next time. With
+    da16k_send_msg_async, the result of queueing is not the send result: commit from the send callback instead, and
+    do not add values to the filter until then. */
+void        da16k_filter_commit             (da16k_filter_t *filter, da16k_err_t result);
+/*  Forget all last sent values, so every key is sent next time (e.g. after a reconnect). Counters are kept. */
+void        da16k_filter_reset              (da16k_filter_t *filter);
+
+/*  Telemetry aggregator
+
+    Accumulates samples of the numeric keys of a schema over a window with constant memory per key, and adds the
+    selected statistics to a message at the end of the window. Each statistic is sent as "<key>_<statistic>",
+    e.g. "temperature_min", with the precision the key was declared with. The variance is the sample variance
+    (Welford's algorithm), 0 for less than two samples.
+
+    Storage is provided by the caller, e.g. for a schema defined with DA16K_SCHEMA_DEFINE(my_schema, ...):
+
+        static const uint8_t        my_outputs[my_schema_key_count] = { [DA16K_KEY_temperature] = DA16K_AGG_MIN | DA16K_AGG_MAX };
+        static da16k_agg_state_t    my_state[my_schema_key_count];
+        static da16k_agg_t          my_agg;
+
+        da16k_agg_init(&my_agg, my_schema, my_schema_key_count, my_outputs, my_state);
+        da16k_agg_add(&my_agg, &my_schema[DA16K_KEY_temperature], value);  (for every sample)
+        da16k_agg_flush(&my_agg, msg);                                      (at the end of the window)
+
+    The aggregator is not thread-safe, samples should be added and flushed by the same task. */
+#define DA16K_AGG_MIN               (1 << 0)
+#define DA16K_AGG_MAX               (1 << 1)
+#define DA16K_AGG_MEAN              (1 << 2)
+#define DA16K_AGG_LAST              (1 << 3)
+#define DA16K_AGG_COUNT             (1 << 4)
+#define DA16K_AGG_VARIANCE          (1 << 5)
+#define DA16K_AGG_DEFAULT           (DA16K_AGG_MIN | DA16K_AGG_MAX | DA16K_AGG_MEAN)
+
+typedef struct {
+    uint32_t            count;
+    double              min;
+    double              max;
+    double              mean;
+    double              m2;                 /* Sum of squared differences from the mean */
+    double              last;
+} da16k_agg_state_t;
+
+typedef struct {
+    const da16k_schema_key_t   *schema;
+    size_t                      key_count;
+    const uint8_t              *outputs;    /* DA16K_AGG_* flags per key, NULL = DA16K_AGG_DEFAULT for all keys */
+    da16k_agg_state_t          *state;      /* One per key */
+} da16k_agg_t;
+
+da16k_err_t da16k_agg_init                  (da16k_agg_t *agg, const da16k_schema_key_t *schema, size_t key_count,
+                                             const uint8_t *outputs, da16k_agg_state_t *state);
+/*  Adds a sample. The key must be a FLOAT32 or FLOAT64 key of the aggregator's schema. */
+da16k_err_t da16k_agg_add                   (da16k_agg_t *agg, const da16k_schema_key_t *key, double value);
+/*  Adds the statistics of all keys that received samples to msg and starts a new window. If the message runs out
+    of space, the error is returned, the window is kept and nothing is added to the message. */
+da16k_err_t da16k_agg_flush                 (da16k_agg_t *agg, da16k_msg_t *msg);
+/*  Discards all samples of the current window */
+void        da16k_agg_reset                 (da16k_agg_t *agg);
+
+/*  Telemetry journal (store-and-forward)
+
+    Keeps telemetry that could not be sent in an append-only log on flash memory and replays it once the gateway
+    is reachable again. Records hold up to one AT+NWICEXMSG frame of tuples, exactly as they are sent, framed by a
+    header with a sequence number and a CRC-32. Nothing is ever rewritten in place: replayed records are marked by
+    appending an acknowledgement record, and the oldest sector is erased for reuse once the others are full
+    (dropping whatever it still held if the journal overflows).
+
+    On open, the journal is recovered from flash. A record torn by a reset or power loss while being written fails
+    its CRC and closes its sector, new records then go to the next sector. Replay is at-least-once: records sent
+    right before a reset may be sent again.
+
+    The flash is accessed through callbacks, offsets are relative to the start of the journal area. program must
+    only be called on erased memory and must handle page boundaries itself. Records start at multiples of
+    program_unit and no unit is programmed twice, as required by flash with ECC (e.g. 16 bytes for the S28HS/HL).
+
+        static const da16k_journal_flash_t  my_flash = { my_read, my_program, my_erase, NULL, 4096, 16, 16 };
+        static da16k_journal_t              my_journal;
+
+        da16k_journal_open(&my_journal, &my_flash, 2);          (replay at 2 frames per second)
+        da16k_journal_send_msg(&my_journal, msg);               (instead of da16k_send_msg)
+        da16k_journal_replay(&my_journal, 1000, NULL);          (periodically, spends at most 1000 ms)
+
+    The journal is not thread-safe, it should be used by a single task. Replayed telemetry is timestamped by the
+    cloud on arrival, add a timestamp tuple to messages if the time of measurement matters. */
+#if !defined(DA16K_CONFIG_JOURNAL_RECORD_SIZE)
+#define DA16K_CONFIG_JOURNAL_RECORD_SIZE    512     /* Largest record including its 16 byte header */
+#endif
+
+typedef struct {
+    da16k_err_t       (*read)           (void *context, uint32_t offset, void *dst, size_t length);
+    da16k_err_t       (*program)        (void *context, uint32_t offset, const void *src, size_t length);
+    da16k_err_t       (*erase)          (void *context, uint32_t offset);   /* Erases the sector starting at offset */
+    void               *context;
+    uint32_t            sector_size;    /* Erase unit in bytes */
+    uint32_t            sector_count;   /* Sectors in the journal area, at least 2 */
+    uint32_t            program_unit;   /* Power of 2 (1 = any alignment) */
+} da16k_journal_flash_t;
+
+typedef struct {
+    uint32_t            appended;       /* Data records written */
+    uint32_t            replayed;       /* Data records sent from the journal */
+    uint32_t            frames;         /* AT+NWICEXMSG frames sent by da16k_journal_replay */
+    uint32_t            dropped;        /* Data records lost because the journal was full */
+    uint32_t            corrupted;      /* Damaged records found, e.g. torn by a power loss */
+    uint32_t            erases;         /* Sectors erased */
+    uint32_t            pending;        /* Data records waiting to be replayed */
+} da16k_journal_stats_t;
+
+typedef struct {
+    const da16k_journal_flash_t    *flash;
+    uint32_t                        frames_per_second;  /* Replay rate, 0 = unlimited */
+
+    /* Internal state, see da16k_journal.c */
+    uint32_t                        write_sector;
+    uint32_t                        write_offset;       /* 0 = no open sector */
+    uint32_t                        write_sector_seq;
+    uint32_t                        read_sector;
+    uint32_t                        read_offset;
+    uint32_t                        next_seq;           /* Sequence number of the next data record */
+    uint32_t                        acked_seq;          /* Data records up to here have been replayed */
+    uint32_t                        tokens;             /* Replay budget in 1/1000 frames */
+    uint32_t                        refill_ms;
+    da16k_journal_stats_t           stats;
+    uint8_t                         buffer[DA16K_CONFIG_JOURNAL_RECORD_SIZE];
+} da16k_journal_t;
+
+/*  Recovers the journal from flash, or formats the area if it holds no journal. The flash descriptor must remain
+    valid. Replay is limited to frames_per_second AT+NWICEXMSG frames (bursts of up to one second's worth). */
+da16k_err_t da16k_journal_open              (da16k_journal_t *journal, const da16k_journal_flash_t *flash, uint32_t frames_per_second);
+/*  Stores all tuples of msg in the journal */
+da16k_err_t da16k_journal_append            (da16k_journal_t *journal, const da16k_msg_t *msg);
+/*  Sends msg like da16k_send_msg. Frames that cannot be sent are stored in the journal, along with the rest of the
+    message. Returns DA16K_SUCCESS if all tuples have been either sent or stored. */
+da16k_err_t da16k_journal_send_msg          (da16k_journal_t *journal, const da16k_msg_t *msg);
+/*  Sends stored records, packed into frames of up to 8 tuples, as the replay rate allows and for up to budget_ms
+    milliseconds (0 = no limit). Stops at the first frame that fails and returns its error, the frame is retried
+    next time. frames receives the number of frames sent (may be NULL). */
+da16k_err_t da16k_journal_replay            (da16k_journal_t *journal, uint32_t budget_ms, size_t *frames);
+/*  Number of data records waiting to be replayed */
+size_t      da16k_journal_pending           (const da16k_journal_t *journal);
+void        da16k_journal_get_stats         (const da16k_journal_t *journal, da16k_journal_stats_t *stats);
+
 /*  Create message struct with given key and value, send it out, and destroy it. Can be used directly.
     This is intended for basic, non-threaded applications with ease-of-implementation in mind. */
 da16k_err_t da16k_send_msg_direct_str       (const char *key, const char *value);
 da16k_err_t da16k_send_msg_direct_bool      (const char *key, bool value);
 da16k_err_t da16k_send_msg_direct_num       (const char *key, double value);
+da16k_err_t da16k_send_msg_direct_schema_str    (const da16k_schema_key_t *key, const char *value);
+da16k_err_t da16k_send_msg_direct_schema_bool   (const da16k_schema_key_t *key, bool value);
+da16k_err_t da16k_send_msg_direct_schema_num    (const da16k_schema_key_t *key, double value);
 
 /*  IoTConnect configuration/setup
     These do not have to be called manually unless changed at runtime.
@@ -149,8 +611,33 @@ da16k_err_t da16k_iotc_stop                 (void);
 da16k_err_t da16k_iotc_reset                (void);
 da16k_err_t da16k_set_wifi_config           (const da16k_wifi_cfg_t *cfg);
 da16k_err_t da16k_set_device_cert           (const char *cert, const char *key);
+/*  Sends the settings the gateway does not have yet (all of them without DA16K_CONFIG_WARM_START), then (re)starts
+    the session unless nothing changed and it is already connected. Device certificates are compared by fingerprint,
+    see da16k_provision_cert. */
 da16k_err_t da16k_setup_iotc_and_connect    (const da16k_iotc_cfg_t *cfg);
 
+/*  Certificate provisioning
+
+    WARNING: CLIENT CERTIFICATE TRANSMISSION IS INSECURE AND THE FUNCTIONALITY IS ONLY PROVIDED FOR TESTING PURPOSES.
+
+    A certificate is either in memory (data, e.g. a const array in code flash) or read piece by piece through the read
+    callback (e.g. from external flash), into a buffer of DA16K_CONFIG_CERT_CHUNK_SIZE bytes. It is streamed to the
+    gateway in chunks of that size and hashed on the way (SHA-256). */
+typedef struct {
+    const char         *data;           /* PEM data in memory (NULL = use read) */
+    size_t              length;         /* PEM length in bytes (0 = strlen(data), required for read) */
+    /* Copies length bytes starting at offset into dst */
+    da16k_err_t       (*read)(void *context, size_t offset, char *dst, size_t length);
+    void               *context;        /* Passed to read */
+} da16k_cert_source_t;
+
+/*  Uploads the certificate, unless the gateway reports the same fingerprint for type already (only with
+    DA16K_CONFIG_CERT_DIGEST_COMMAND defined). uploaded (may be NULL) tells whether it was sent. Failed uploads are
+    repeated up to DA16K_CONFIG_CERT_UPLOAD_ATTEMPTS times, with the query an upload only succeeds once the gateway
+    confirmed the fingerprint.
+    Returns DA16K_STORAGE_ERROR if read fails or delivers different data in the upload than while hashing. */
+da16k_err_t da16k_provision_cert            (da16k_cert_type_t type, const da16k_cert_source_t *source, bool *uploaded);
+
 /*  Receives the next command from the AT command gateway.
     If DA16K_SUCCESS is returned, a command was fetched successfully (the struct must be destroyed after use).
     If DA16K_NO_CMDS is returned, no commands are available at this time.
@@ -158,5 +645,248 @@ da16k_err_t da16k_setup_iotc_and_connect    (const da16k_iotc_cfg_t *cfg);
 da16k_err_t da16k_get_cmd                   (da16k_cmd_t *cmd);
 /*  Destroy command */
 void        da16k_destroy_cmd               (da16k_cmd_t cmd);
+/*  Like da16k_get_cmd, but nothing is allocated or copied: view points into the library's receive buffer. It remains
+    valid until the library sends the next AT command, from whichever task. Use da16k_get_cmd or da16k_get_cmds
+    instead if other tasks may talk to the gateway in the meantime. */
+da16k_err_t da16k_get_cmd_view              (da16k_cmd_view_t *view);
+
+/*  Called for each fetched command. cmd and its strings are only valid until the callback returns. */
+typedef void (*da16k_cmd_callback_t)(const da16k_cmd_t *cmd, void *context);
+
+/*  Fetches commands until the gateway has none left, max commands were handled (0 = no limit) or budget_ms
+    milliseconds have passed (0 = no limit), and passes each one to callback as soon as it has been received.
+    All commands are received into the same buffer (DA16K_CONFIG_CMD_BUFFER_SIZE bytes), nothing is allocated.
+    The number of commands handled is stored in handled (may be NULL).
+    Returns DA16K_SUCCESS if there are no commands left or max was reached, DA16K_TIMEOUT if the budget ran out.
+    Other communication-related error codes may occur. */
+da16k_err_t da16k_get_cmds                  (da16k_cmd_callback_t callback, void *context, size_t max, uint32_t budget_ms, size_t *handled);
+
+/*  Command handler registry
+
+    Handlers are registered per command name and looked up by exact name in a hash table, so dispatching does not
+    get slower with the number of commands. Before a handler is called, the command's parameter is parsed according
+    to its param_parser:
+
+        NULL                    - no parsing, the parameter string (possibly NULL) is passed as-is
+        &da16k_cmd_param_string - a parameter is required, passed as-is
+        &da16k_cmd_param_int    - a decimal 32-bit integer
+        &da16k_cmd_param_bool   - "1"/"true"/"on" or "0"/"false"/"off"
+        enum parser             - one of the names in enum_names, passed as index, e.g.:
+
+            static const char * const               modes[]     = { "eco", "normal", "boost", NULL };
+            static const da16k_cmd_param_parser_t   mode_param  = { DA16K_CMD_PARAM_ENUM, modes };
+
+    Up to DA16K_CONFIG_MAX_CMD_HANDLERS (default: 32) commands can be registered. Handlers should be registered
+    before commands are being dispatched. */
+typedef enum {
+    DA16K_CMD_PARAM_STRING  = 0,
+    DA16K_CMD_PARAM_INT     = 1,
+    DA16K_CMD_PARAM_BOOL    = 2,
+    DA16K_CMD_PARAM_ENUM    = 3,
+} da16k_cmd_param_type_t;
+
+typedef struct {
+    da16k_cmd_param_type_t  type;
+    const char * const     *enum_names;     /* DA16K_CMD_PARAM_ENUM only: NULL-terminated list of names */
+} da16k_cmd_param_parser_t;
+
+extern const da16k_cmd_param_parser_t da16k_cmd_param_string;
+extern const da16k_cmd_param_parser_t da16k_cmd_param_int;
+extern const da16k_cmd_param_parser_t da16k_cmd_param_bool;
+
+typedef struct {
+    const char         *string;         /* Parameter as received (NULL if none) */
+    int32_t             integer;        /* DA16K_CMD_PARAM_INT */
+    bool                boolean;        /* DA16K_CMD_PARAM_BOOL */
+    size_t              index;          /* DA16K_CMD_PARAM_ENUM: index into enum_names */
+} da16k_cmd_param_t;
+
+typedef void (*da16k_cmd_handler_t)(const da16k_cmd_t *cmd, const da16k_cmd_param_t *param);
+
+/*  Registers handler for the command name. name and param_parser must remain valid. Registering a name again
+    replaces its handler, a NULL handler unregisters it. */
+da16k_err_t da16k_register_cmd_handler      (const char *name, da16k_cmd_handler_t handler, const da16k_cmd_param_parser_t *param_parser);
+/*  Calls the handler registered for cmd. Returns DA16K_UNKNOWN_CMD if there is none and DA16K_INVALID_PARAMETER
+    if the parameter could not be parsed (the handler is not called in either case). */
+da16k_err_t da16k_dispatch_cmd              (const da16k_cmd_t *cmd);
+
+/*  Unsolicited result codes (URCs)
+
+    Lines the AT gateway sends on its own accord (e.g. "+EVENT:<data>") are routed to the handler registered for
+    their prefix ("+EVENT"), whether they arrive in the middle of a command's response or in between commands.
+    data points to whatever follows the colon (empty string if there is nothing).
+
+    Handlers are called from the task that is communicating with the gateway at that time (the owner task if the
+    scheduler is running). They must return quickly and must not call any library functions that communicate with
+    the gateway - defer such work instead.
+
+    Up to DA16K_CONFIG_MAX_URC_HANDLERS (default: 4) handlers can be registered. */
+typedef void (*da16k_urc_handler_t)(const char *line, const char *data, void *context);
+
+/*  Registers a handler for prefix. The prefix string must remain valid. Registering the same prefix again replaces
+    the handler, a NULL handler removes it. Returns DA16K_OUT_OF_MEMORY if all handler slots are in use. */
+da16k_err_t da16k_register_urc_handler      (const char *prefix, da16k_urc_handler_t handler, void *context);
+/*  Receives and dispatches unsolicited lines until no further data arrives for timeout_ms milliseconds.
+    Use this to consume gateway events while no other commands are being sent. */
+da16k_err_t da16k_process_urcs              (uint32_t timeout_ms);
+
+/*  AT transaction scheduling
+
+    Every AT transaction (a command and its complete response) is carried out as one unit, so the library can be
+    used from several tasks at once. Without the scheduler, transactions run in the calling task, one after another.
+
+    Once da16k_scheduler_start has been called (FreeRTOS only), a single owner task talks to the gateway instead:
+    transactions are queued by priority and carried out one by one while the submitting task waits for its result.
+    Higher priorities go first, equal priorities in submission order. Telemetry messages are sent as one transaction
+    per AT+NWICEXMSG frame, so interactive requests get in between the frames of long messages.
+
+    The owner task is configured with DA16K_CONFIG_SCHED_TASK_PRIORITY and DA16K_CONFIG_SCHED_TASK_STACK_WORDS.
+    While idle, it dispatches unsolicited lines every DA16K_CONFIG_SCHED_IDLE_POLL_MS milliseconds (0 = never). */
+typedef enum {
+    DA16K_PRIORITY_BULK         = 0,    /* Telemetry (da16k_send_msg and everything built on it) */
+    DA16K_PRIORITY_NORMAL       = 1,    /* Configuration and connection management */
+    DA16K_PRIORITY_INTERACTIVE  = 2,    /* Cloud commands (da16k_get_cmd) and other latency-sensitive requests */
+} da16k_priority_t;
+
+/*  Descriptor of a single AT command for da16k_at_execute */
+typedef struct {
+    const char         *command;            /* Without \r\n terminator, e.g. "AT+NWICGETCMD" */
+    const char         *expected_response;  /* e.g. "+NWICGETCMD", NULL if nothing but an "OK" is expected */
+    da16k_priority_t    priority;
+    uint32_t            timeout_ms;         /* Response timeout, 0 = adaptive (see da16k_get_timing_stats) */
+    char               *response;           /* Receives the response data following the colon, may be NULL */
+    size_t              response_size;
+} da16k_at_request_t;
+
+/*  Sends request->command and waits for its response, which is copied into request->response.
+    Returns DA16K_SUCCESS if the response was complete, DA16K_AT_ERROR_CODE if the gateway returned an error
+    (the error code is copied into request->response) and DA16K_AT_RESPONSE_TOO_LONG if the response was truncated.
+    Other communication-related error codes may occur. */
+da16k_err_t da16k_at_execute                (da16k_at_request_t *request);
+
+#if defined(DA16K_CONFIG_FREERTOS)
+/*  Starts the gateway owner task. Must be called after da16k_init. */
+da16k_err_t da16k_scheduler_start           (void);
+
+/*  Asynchronous telemetry (FreeRTOS only)
+
+    da16k_send_msg_async copies the message into a bounded, lock-free queue and returns immediately.
+    A background worker task drains the queue, packs the tuples of consecutive messages into full AT+NWICEXMSG
+    frames and reports the result of each message through its callback (called from the worker task).
+
+    The queue can be dimensioned with DA16K_CONFIG_ASYNC_QUEUE_DEPTH (power of 2) and DA16K_CONFIG_ASYNC_SLOT_SIZE
+    (bytes per queued message, see DA16K_MSG_ARENA_SIZE). The worker task is configured with
+    DA16K_CONFIG_ASYNC_TASK_PRIORITY and DA16K_CONFIG_ASYNC_TASK_STACK_WORDS. */
+
+typedef void (*da16k_send_callback_t)(da16k_err_t result, void *context);
+
+typedef struct {
+    uint32_t            enqueued;       /* Messages accepted into the queue */
+    uint32_t            dropped;        /* Messages rejected because the queue was full or the message too large */
+    uint32_t            sent;           /* Messages confirmed by the AT gateway */
+    uint32_t            failed;         /* Messages that could not be sent */
+    uint32_t            frames;         /* AT+NWICEXMSG frames sent by the worker */
+    uint32_t            depth;          /* Messages currently queued */
+    uint32_t            max_depth;      /* Highest queue depth observed */
+} da16k_async_stats_t;
+
+/*  Starts the worker task. Must be called after da16k_init. */
+da16k_err_t da16k_async_start              (void);
+/*  Queues a copy of msg for transmission. msg can be reset or destroyed right after this returns.
+    Returns DA16K_OUT_OF_MEMORY if the queue is full or the message does not fit into a queue slot.
+    Must not be called from an ISR. callback may be NULL. */
+da16k_err_t da16k_send_msg_async           (const da16k_msg_t *msg, da16k_send_callback_t callback, void *context);
+void        da16k_get_async_stats          (da16k_async_stats_t *stats);
+
+/*  Cloud command listener (FreeRTOS only)
+
+    Instead of polling da16k_get_cmd, a listener task fetches all available commands with da16k_get_cmds and
+    passes each one to a callback (called from the listener task). The listener polls every
+    DA16K_CONFIG_CMD_POLL_MIN_MS milliseconds while commands are coming in and backs off to
+    DA16K_CONFIG_CMD_POLL_MAX_MS while idle. If DA16K_CONFIG_CMD_URC_PREFIX is defined, the unsolicited line with
+    that prefix that the gateway sends for a new command triggers an immediate fetch (requires the scheduler to run).
+
+    Command latency is measured from the gateway's notification to the callback. Without a notification, the time
+    of the previous poll is used, i.e. the worst case.
+
+    The listener task is configured with DA16K_CONFIG_CMD_TASK_PRIORITY and DA16K_CONFIG_CMD_TASK_STACK_WORDS. */
+
+typedef struct {
+    uint32_t            received;           /* Commands passed to the callback */
+    uint32_t            polls;              /* Fetch rounds */
+    uint32_t            empty_polls;        /* Fetch rounds without any commands */
+    uint32_t            notifications;      /* Fetch rounds triggered by the gateway */
+    uint32_t            poll_interval_ms;   /* Current polling interval */
+    uint32_t            latency_last_ms;    /* Arrival to callback, last command */
+    uint32_t            latency_max_ms;
+    uint32_t            latency_avg_ms;
+} da16k_cmd_stats_t;
+
+/*  Starts the listener task. Must be called after da16k_init. Commands must not be fetched by other means
+    while the listener is running. */
+da16k_err_t da16k_cmd_listener_start       (da16k_cmd_callback_t callback, void *context);
+void        da16k_get_cmd_stats            (da16k_cmd_stats_t *stats);
+#endif
+
+/*  Heap usage counters of the library, e.g. to verify that a send path is allocation-free. */
+void        da16k_get_heap_stats            (da16k_heap_stats_t *stats);
+void        da16k_reset_heap_stats          (void);
+
+/*  Logging
+
+    Library messages are compiled in up to DA16K_CONFIG_LOG_LEVEL (default: DA16K_LOG_LEVEL_WARN), the others
+    are removed by the preprocessor. They are printed right away with DA16K_PRINT, unless DA16K_CONFIG_LOG_DEFERRED
+    is defined: then each message is stored as a binary record (format string, raw arguments and a copy of string
+    arguments) in a lock-free ring of DA16K_CONFIG_LOG_RING_SIZE records (power of 2) without any formatting, and
+    printed later by da16k_log_flush, e.g. from the log task. When the ring is full, new records are dropped.
+
+    String arguments share DA16K_CONFIG_LOG_STRING_SIZE bytes per record and are cut off if they do not fit,
+    arguments after the first DA16K_CONFIG_LOG_MAX_ARGS are rendered as "<?>". */
+
+#define DA16K_LOG_LEVEL_NONE            0
+#define DA16K_LOG_LEVEL_ERROR           1
+#define DA16K_LOG_LEVEL_WARN            2
+#define DA16K_LOG_LEVEL_DEBUG           3
+
+#if !defined(DA16K_CONFIG_LOG_RING_SIZE)
+#define DA16K_CONFIG_LOG_RING_SIZE      16
+#endif
+
+#if !defined(DA16K_CONFIG_LOG_MAX_ARGS)
+#define DA16K_CONFIG_LOG_MAX_ARGS       6
+#endif
+
+#if !defined(DA16K_CONFIG_LOG_STRING_SIZE)
+#define DA16K_CONFIG_LOG_STRING_SIZE    48
+#endif
+
+#define DA16K_LOG_ARGS_MISSING          0x01    /* Not all arguments could be stored */
+#define DA16K_LOG_STRING_CUT            0x02    /* A string argument was cut off */
+
+typedef struct {
+    const char         *format;         /* Format ID: the address of the format string literal in the firmware */
+    const char         *function;
+    uint32_t            timestamp_ms;
+    uint16_t            line;
+    uint8_t             level;          /* DA16K_LOG_LEVEL_... */
+    uint8_t             flags;          /* DA16K_LOG_ARGS_MISSING, DA16K_LOG_STRING_CUT */
+    uint64_t            args[DA16K_CONFIG_LOG_MAX_ARGS];    /* In the order of the format, widened to 64 bits */
+    char                strings[DA16K_CONFIG_LOG_STRING_SIZE];
+} da16k_log_record_t;
+
+/*  Removes the oldest record from the ring. Returns false if there is none. Records must be read by one task only. */
+bool        da16k_log_read                  (da16k_log_record_t *record);
+/*  Renders a record as "[function:line] message" into dst (always null-terminated). Returns the length. */
+size_t      da16k_log_format                (const da16k_log_record_t *record, char *dst, size_t size);
+/*  Prints up to max_records records (0 = all) with DA16K_PRINT and reports dropped ones. Returns the number printed. */
+size_t      da16k_log_flush                 (size_t max_records);
+/*  Records lost because the ring was full */
+uint32_t    da16k_log_dropped               (void);
+
+#if defined(DA16K_CONFIG_FREERTOS) && defined(DA16K_CONFIG_LOG_DEFERRED)
+/*  Starts a task that flushes the ring every DA16K_CONFIG_LOG_FLUSH_INTERVAL_MS milliseconds, configured with
+    DA16K_CONFIG_LOG_TASK_PRIORITY (default: idle priority) and DA16K_CONFIG_LOG_TASK_STACK_WORDS. */
+da16k_err_t da16k_log_start                 (void);
+#endif
 
 #endif /* DA16K_COMM_DA16K_COMM_H_ */
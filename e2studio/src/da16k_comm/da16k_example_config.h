@@ -8,6 +8,10 @@
 /* Define a custom printf-style print function for debug messages (default is printf) */
 #define DA16K_PRINT DebugPrint
 
+/* Print warnings & errors only (default), and store them for da16k_log_flush instead of printing them right away */
+#define DA16K_CONFIG_LOG_LEVEL DA16K_LOG_LEVEL_WARN
+#define DA16K_CONFIG_LOG_DEFERRED
+
 /* Default allocator functions are malloc and free, however... */
 
 /* This enables vpPortMalloc and vPortFree */
@@ -0,0 +1,144 @@
+/*
+ * da16k_filter.c
+ *
+ * IoTConnect via Dialog DA16K module - deadband & heartbeat telemetry filter.
+ */
+
+#include "da16k_private.h"
+
+#include <string.h>
+
+static double da16k_filter_abs(double value) {
+    return (value < 0.0) ? -value : value;
+}
+
+da16k_err_t da16k_filter_init(da16k_filter_t *filter, const da16k_schema_key_t *schema, size_t key_count,
+                              const da16k_filter_rule_t *rules, da16k_filter_state_t *state) {
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, filter);
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, schema);
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, state);
+
+    filter->schema      = schema;
+    filter->key_count   = key_count;
+    filter->rules       = rules;
+    filter->state       = state;
+    filter->sent        = 0;
+    filter->suppressed  = 0;
+
+    da16k_filter_reset(filter);
+
+    return DA16K_SUCCESS;
+}
+
+void da16k_filter_reset(da16k_filter_t *filter) {
+    if (filter && filter->state) {
+        memset(filter->state, 0, filter->key_count * sizeof(filter->state[0]));
+    }
+}
+
+/* Returns the index of key within the filter's schema, or key_count if it is not part of it */
+static size_t da16k_filter_index(const da16k_filter_t *filter, const da16k_schema_key_t *key) {
+    if (key < filter->schema || key >= (filter->schema + filter->key_count)) {
+        return filter->key_count;
+    }
+
+    return (size_t) (key - filter->schema);
+}
+
+/* Decides whether a value has to be sent. Deadbands only apply to numbers, booleans are sent on change. */
+static bool da16k_filter_pass(const da16k_filter_t *filter, size_t index, double value, bool numeric) {
+    const da16k_filter_state_t *state   = &filter->state[index];
+    const da16k_filter_rule_t  *rule    = filter->rules ? &filter->rules[index] : NULL;
+    double                      delta;
+    bool                        deadband_used = false;
+    bool                        exceeded      = false;
+
+    if (!state->valid) {
+        return true;
+    }
+
+    if (rule && rule->heartbeat_ms > 0 && (da16k_get_time_ms() - state->sent_ms) >= rule->heartbeat_ms) {
+        return true;
+    }
+
+    delta = da16k_filter_abs(value - state->value);
+
+    if (numeric && rule) {
+        if (rule->deadband > 0.0) {
+            deadband_used   = true;
+            exceeded       |= (delta > rule->deadband);
+        }
+
+        if (rule->deadband_percent > 0.0) {
+            deadband_used   = true;
+            exceeded       |= (delta > (da16k_filter_abs(state->value) * rule->deadband_percent / 100.0));
+        }
+    }
+
+    return deadband_used ? exceeded : (delta != 0.0);
+}
+
+static da16k_err_t da16k_filter_add(da16k_filter_t *filter, da16k_msg_t *msg, const da16k_schema_key_t *key,
+                                    double value, bool numeric) {
+    size_t      index;
+    da16k_err_t ret;
+
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, filter);
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, key);
+
+    index = da16k_filter_index(filter, key);
+
+    if (index >= filter->key_count) {
+        DA16K_ERROR("Key '%s' is not part of the filter's schema\r\n", key->key ? key->key : "<null>");
+        return DA16K_INVALID_PARAMETER;
+    }
+
+    if (!da16k_filter_pass(filter, index, value, numeric)) {
+        filter->suppressed++;
+        return DA16K_SUCCESS;
+    }
+
+    ret = numeric ? da16k_msg_add_schema_num(msg, key, value) : da16k_msg_add_schema_bool(msg, key, value != 0.0);
+
+    /* The value only becomes the last sent value once da16k_filter_commit confirms that the message went out */
+    if (ret == DA16K_SUCCESS) {
+        filter->state[index].pending_value  = value;
+        filter->state[index].pending        = true;
+    }
+
+    return ret;
+}
+
+da16k_err_t da16k_filter_add_num(da16k_filter_t *filter, da16k_msg_t *msg, const da16k_schema_key_t *key, double value) {
+    return da16k_filter_add(filter, msg, key, value, true);
+}
+
+da16k_err_t da16k_filter_add_bool(da16k_filter_t *filter, da16k_msg_t *msg, const da16k_schema_key_t *key, bool value) {
+    return da16k_filter_add(filter, msg, key, value ? 1.0 : 0.0, false);
+}
+
+void da16k_filter_commit(da16k_filter_t *filter, da16k_err_t result) {
+    uint32_t now = da16k_get_time_ms();
+
+    if (filter == NULL || filter->state == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < filter->key_count; i++) {
+        da16k_filter_state_t *state = &filter->state[i];
+
+        if (!state->pending) {
+            continue;
+        }
+
+        /* A failed send leaves the last sent value as it was, so the key is compared against it again next time */
+        if (result == DA16K_SUCCESS) {
+            state->value    = state->pending_value;
+            state->sent_ms  = now;
+            state->valid    = true;
+            filter->sent++;
+        }
+
+        state->pending = false;
+    }
+}
@@ -0,0 +1,680 @@
+/*
+ * da16k_journal.c
+ *
+ * IoTConnect via Dialog DA16K module - store-and-forward telemetry journal on flash.
+ *
+ * Layout of every sector in use:
+ *
+ *      sector header   magic (4), sector sequence number (4), CRC-32 of the previous 8 bytes (4), unused (4)
+ *      records         header (16) + payload, each starting at a multiple of the program unit
+ *      erased space
+ *
+ * Record header: magic (2), type (1), tuple count (1), payload length (2), unused (2), sequence number (4),
+ * CRC-32 of the first 12 header bytes and the payload (4). All numbers are little endian.
+ *
+ * Sectors are used round robin with increasing sector sequence numbers. Data records are numbered consecutively,
+ * acknowledgement records carry the number of the last replayed data record. Every new sector starts with an
+ * acknowledgement record, so the replay progress survives the erasure of older sectors. Records dropped from a full
+ * journal are only acknowledged by that record, after the erasure, so recovery also counts everything before the
+ * oldest data record left as replayed.
+ */
+
+#include "da16k_private.h"
+
+#include <string.h>
+
+#define DA16K_JOURNAL_SECTOR_MAGIC      0x4C4E4A44u     /* "DJNL" */
+#define DA16K_JOURNAL_RECORD_MAGIC      0xDA1Eu
+#define DA16K_JOURNAL_HEADER_SIZE       16
+#define DA16K_JOURNAL_MAX_PAYLOAD       (DA16K_CONFIG_JOURNAL_RECORD_SIZE - DA16K_JOURNAL_HEADER_SIZE)
+
+#define DA16K_JOURNAL_TYPE_DATA         0x01
+#define DA16K_JOURNAL_TYPE_ACK          0x02
+
+/* Replay token bucket: one frame costs 1000 tokens */
+#define DA16K_JOURNAL_FRAME_TOKENS      1000u
+
+typedef struct {
+    uint8_t     type;
+    uint8_t     tuples;
+    uint16_t    length;
+    uint32_t    seq;
+    uint32_t    crc;
+    uint32_t    size;       /* Space taken on flash including alignment */
+} da16k_journal_record_t;
+
+typedef enum {
+    DA16K_JOURNAL_RECORD_VALID,
+    DA16K_JOURNAL_RECORD_BLANK,     /* Erased memory: end of the sector's records */
+    DA16K_JOURNAL_RECORD_INVALID,   /* Damaged, nothing after it can be trusted */
+} da16k_journal_record_state_t;
+
+#if (DA16K_CONFIG_JOURNAL_RECORD_SIZE <= DA16K_JOURNAL_HEADER_SIZE) || (DA16K_CONFIG_JOURNAL_RECORD_SIZE > 65535)
+#error "DA16K_CONFIG_JOURNAL_RECORD_SIZE is out of range"
+#endif
+
+static void da16k_journal_put_le16(uint8_t *dst, uint16_t value) {
+    dst[0] = (uint8_t) value;
+    dst[1] = (uint8_t) (value >> 8);
+}
+
+static void da16k_journal_put_le32(uint8_t *dst, uint32_t value) {
+    dst[0] = (uint8_t) value;
+    dst[1] = (uint8_t) (value >> 8);
+    dst[2] = (uint8_t) (value >> 16);
+    dst[3] = (uint8_t) (value >> 24);
+}
+
+static uint16_t da16k_journal_get_le16(const uint8_t *src) {
+    return (uint16_t) (src[0] | (src[1] << 8));
+}
+
+static uint32_t da16k_journal_get_le32(const uint8_t *src) {
+    return (uint32_t) src[0] | ((uint32_t) src[1] << 8) | ((uint32_t) src[2] << 16) | ((uint32_t) src[3] << 24);
+}
+
+static uint32_t da16k_journal_align(const da16k_journal_t *journal, uint32_t size) {
+    uint32_t unit = journal->flash->program_unit;
+
+    return (size + unit - 1) & ~(unit - 1);
+}
+
+/* Offset of the first record within a sector */
+static uint32_t da16k_journal_first_record(const da16k_journal_t *journal) {
+    return da16k_journal_align(journal, DA16K_JOURNAL_HEADER_SIZE);
+}
+
+static uint32_t da16k_journal_sector_offset(const da16k_journal_t *journal, uint32_t sector) {
+    return sector * journal->flash->sector_size;
+}
+
+static bool da16k_journal_is_blank(const uint8_t *data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] != 0xFF) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool da16k_journal_read_sector_seq(da16k_journal_t *journal, uint32_t sector, uint32_t *seq) {
+    const da16k_journal_flash_t    *flash = journal->flash;
+    uint8_t                         header[DA16K_JOURNAL_HEADER_SIZE];
+
+    if (flash->read(flash->context, da16k_journal_sector_offset(journal, sector), header, sizeof(header)) != DA16K_SUCCESS) {
+        return false;
+    }
+
+    if (da16k_journal_get_le32(&header[0]) != DA16K_JOURNAL_SECTOR_MAGIC ||
+        da16k_journal_get_le32(&header[8]) != da16k_crc32(0, header, 8)) {
+        return false;
+    }
+
+    *seq = da16k_journal_get_le32(&header[4]);
+
+    return true;
+}
+
+/*  Reads the record at offset of sector. The payload is read into payload (if not NULL) and checked against the
+    CRC, which requires it to fit into size bytes. Without a payload buffer, only the header is checked. */
+static da16k_journal_record_state_t da16k_journal_read_record(da16k_journal_t *journal, uint32_t sector, uint32_t offset,
+                                                              da16k_journal_record_t *record, uint8_t *payload, size_t size) {
+    const da16k_journal_flash_t    *flash   = journal->flash;
+    uint32_t                        address = da16k_journal_sector_offset(journal, sector) + offset;
+    uint8_t                         header[DA16K_JOURNAL_HEADER_SIZE];
+    uint32_t                        crc;
+
+    if ((offset + DA16K_JOURNAL_HEADER_SIZE) > flash->sector_size) {
+        return DA16K_JOURNAL_RECORD_BLANK;
+    }
+
+    if (flash->read(flash->context, address, header, sizeof(header)) != DA16K_SUCCESS) {
+        return DA16K_JOURNAL_RECORD_INVALID;
+    }
+
+    if (da16k_journal_is_blank(header, sizeof(header))) {
+        return DA16K_JOURNAL_RECORD_BLANK;
+    }
+
+    record->type    = header[2];
+    record->tuples  = header[3];
+    record->length  = da16k_journal_get_le16(&header[4]);
+    record->seq     = da16k_journal_get_le32(&header[8]);
+    record->crc     = da16k_journal_get_le32(&header[12]);
+    record->size    = da16k_journal_align(journal, DA16K_JOURNAL_HEADER_SIZE + record->length);
+
+    if (da16k_journal_get_le16(&header[0]) != DA16K_JOURNAL_RECORD_MAGIC ||
+        (record->type != DA16K_JOURNAL_TYPE_DATA && record->type != DA16K_JOURNAL_TYPE_ACK) ||
+        record->length > DA16K_JOURNAL_MAX_PAYLOAD || record->tuples > DA16K_MSG_TUPLES_PER_ITERATION ||
+        (offset + record->size) > flash->sector_size) {
+        return DA16K_JOURNAL_RECORD_INVALID;
+    }
+
+    if (payload == NULL) {
+        return DA16K_JOURNAL_RECORD_VALID;
+    }
+
+    if (record->length > size ||
+        flash->read(flash->context, address + DA16K_JOURNAL_HEADER_SIZE, payload, record->length) != DA16K_SUCCESS) {
+        return DA16K_JOURNAL_RECORD_INVALID;
+    }
+
+    crc = da16k_crc32(0, header, 12);
+    crc = da16k_crc32(crc, payload, record->length);
+
+    return (crc == record->crc) ? DA16K_JOURNAL_RECORD_VALID : DA16K_JOURNAL_RECORD_INVALID;
+}
+
+/*  Writes a record into the open sector. The payload must already be in the journal's buffer, right after the
+    space for the header. */
+static da16k_err_t da16k_journal_program_record(da16k_journal_t *journal, uint8_t type, uint8_t tuples, uint16_t length, uint32_t seq) {
+    const da16k_journal_flash_t    *flash   = journal->flash;
+    uint8_t                        *record  = journal->buffer;
+    da16k_err_t                     ret;
+
+    da16k_journal_put_le16(&record[0], DA16K_JOURNAL_RECORD_MAGIC);
+    record[2] = type;
+    record[3] = tuples;
+    da16k_journal_put_le16(&record[4], length);
+    da16k_journal_put_le16(&record[6], 0xFFFF);
+    da16k_journal_put_le32(&record[8], seq);
+    da16k_journal_put_le32(&record[12], da16k_crc32(da16k_crc32(0, record, 12), &record[DA16K_JOURNAL_HEADER_SIZE], length));
+
+    ret = flash->program(flash->context, da16k_journal_sector_offset(journal, journal->write_sector) + journal->write_offset,
+                         record, DA16K_JOURNAL_HEADER_SIZE + length);
+
+    /*  Whatever was programmed of a failed record cannot be overwritten, so the sector is closed either way.
+        If the record made it after all, the next recovery finds it. */
+    if (ret != DA16K_SUCCESS) {
+        journal->write_offset = 0;
+        return ret;
+    }
+
+    journal->write_offset += da16k_journal_align(journal, DA16K_JOURNAL_HEADER_SIZE + length);
+
+    if ((journal->write_offset + DA16K_JOURNAL_HEADER_SIZE) > flash->sector_size) {
+        journal->write_offset = 0;
+    }
+
+    return DA16K_SUCCESS;
+}
+
+/*  Marks every data record of sector that has not been replayed as lost, so the sector can be erased.
+    The read position moves on to the following sector. */
+static void da16k_journal_drop_sector(da16k_journal_t *journal, uint32_t sector) {
+    da16k_journal_record_t  record;
+    uint32_t                offset      = da16k_journal_first_record(journal);
+    uint32_t                dropped     = 0;
+    uint32_t                last_seq    = journal->acked_seq;
+
+    while (da16k_journal_read_record(journal, sector, offset, &record, NULL, 0) == DA16K_JOURNAL_RECORD_VALID) {
+        if (record.type == DA16K_JOURNAL_TYPE_DATA && record.seq > journal->acked_seq) {
+            dropped++;
+            last_seq = record.seq;
+        }
+
+        offset += record.size;
+    }
+
+    if (dropped) {
+        DA16K_WARN("Journal full, dropping %lu records\r\n", (unsigned long) dropped);
+    }
+
+    journal->stats.dropped += dropped;
+    journal->acked_seq      = last_seq;
+    journal->read_sector    = (sector + 1) % journal->flash->sector_count;
+    journal->read_offset    = da16k_journal_first_record(journal);
+}
+
+/* Erases the sector after the current one and starts writing there */
+static da16k_err_t da16k_journal_next_sector(da16k_journal_t *journal) {
+    const da16k_journal_flash_t    *flash   = journal->flash;
+    uint32_t                        sector  = (journal->write_sector + 1) % flash->sector_count;
+    uint32_t                        seq     = journal->write_sector_seq + 1;
+    uint8_t                         header[DA16K_JOURNAL_HEADER_SIZE];
+    da16k_err_t                     ret;
+
+    /* The oldest sector is being reused while it still holds records to replay */
+    if (da16k_journal_pending(journal) > 0 && journal->read_sector == sector) {
+        da16k_journal_drop_sector(journal, sector);
+    }
+
+    journal->write_offset = 0;
+
+    if (DA16K_SUCCESS != (ret = flash->erase(flash->context, da16k_journal_sector_offset(journal, sector)))) {
+        DA16K_ERROR("Journal sector erase failed\r\n");
+        return ret;
+    }
+
+    journal->stats.erases++;
+
+    memset(header, 0xFF, sizeof(header));
+    da16k_journal_put_le32(&header[0], DA16K_JOURNAL_SECTOR_MAGIC);
+    da16k_journal_put_le32(&header[4], seq);
+    da16k_journal_put_le32(&header[8], da16k_crc32(0, header, 8));
+
+    if (DA16K_SUCCESS != (ret = flash->program(flash->context, da16k_journal_sector_offset(journal, sector), header, sizeof(header)))) {
+        DA16K_ERROR("Journal sector header write failed\r\n");
+        return ret;
+    }
+
+    journal->write_sector       = sector;
+    journal->write_sector_seq   = seq;
+    journal->write_offset       = da16k_journal_first_record(journal);
+
+    /* Checkpoint of the replay progress, older acknowledgements may be erased from now on */
+    return da16k_journal_program_record(journal, DA16K_JOURNAL_TYPE_ACK, 0, 0, journal->acked_seq);
+}
+
+/* Appends a record with the payload in the journal's buffer, starting a new sector if needed */
+static da16k_err_t da16k_journal_write(da16k_journal_t *journal, uint8_t type, uint8_t tuples, uint16_t length, uint32_t seq) {
+    uint32_t    size    = da16k_journal_align(journal, DA16K_JOURNAL_HEADER_SIZE + length);
+    da16k_err_t ret;
+
+    if (journal->write_offset == 0 || (journal->write_offset + size) > journal->flash->sector_size) {
+        if (DA16K_SUCCESS != (ret = da16k_journal_next_sector(journal))) {
+            return ret;
+        }
+    }
+
+    return da16k_journal_program_record(journal, type, tuples, length, seq);
+}
+
+/*  Scans a sector during recovery. Returns the offset after the last valid record. first_seq receives the lowest
+    data record number seen so far (0 = none). */
+static uint32_t da16k_journal_recover_sector(da16k_journal_t *journal, uint32_t sector, bool *sealed, uint32_t *first_seq) {
+    da16k_journal_record_t          record;
+    da16k_journal_record_state_t    state;
+    uint32_t                        offset = da16k_journal_first_record(journal);
+
+    while (DA16K_JOURNAL_RECORD_VALID == (state = da16k_journal_read_record(journal, sector, offset, &record, journal->buffer,
+                                                                            sizeof(journal->buffer)))) {
+        if (record.type == DA16K_JOURNAL_TYPE_DATA) {
+            if (record.seq >= journal->next_seq) {
+                journal->next_seq = record.seq + 1;
+            }
+
+            if (*first_seq == 0 || record.seq < *first_seq) {
+                *first_seq = record.seq;
+            }
+        } else if (record.seq > journal->acked_seq) {
+            journal->acked_seq = record.seq;
+        }
+
+        offset += record.size;
+    }
+
+    *sealed = (state == DA16K_JOURNAL_RECORD_INVALID);
+
+    if (*sealed) {
+        DA16K_WARN("Journal sector %lu damaged at offset %lu\r\n", (unsigned long) sector, (unsigned long) offset);
+        journal->stats.corrupted++;
+    }
+
+    return offset;
+}
+
+da16k_err_t da16k_journal_open(da16k_journal_t *journal, const da16k_journal_flash_t *flash, uint32_t frames_per_second) {
+    uint32_t    newest      = 0;
+    uint32_t    newest_seq  = 0;
+    uint32_t    oldest;
+    uint32_t    seq;
+    uint32_t    first_seq   = 0;
+    bool        found       = false;
+    bool        sealed      = false;
+
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, journal);
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, flash);
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, flash->read);
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, flash->program);
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, flash->erase);
+
+    memset(journal, 0, sizeof(*journal));
+
+    journal->flash              = flash;
+    journal->frames_per_second  = frames_per_second;
+    journal->tokens             = frames_per_second * DA16K_JOURNAL_FRAME_TOKENS;
+    journal->refill_ms          = da16k_get_time_ms();
+    journal->next_seq           = 1;
+
+    /* A sector must take its header, the checkpoint and the largest record */
+    if (flash->sector_count < 2 || flash->program_unit == 0 || (flash->program_unit & (flash->program_unit - 1)) != 0 ||
+        flash->sector_size < (da16k_journal_first_record(journal) + da16k_journal_align(journal, DA16K_JOURNAL_HEADER_SIZE) +
+                              da16k_journal_align(journal, DA16K_CONFIG_JOURNAL_RECORD_SIZE))) {
+        DA16K_ERROR("Unsupported journal flash geometry\r\n");
+        return DA16K_INVALID_PARAMETER;
+    }
+
+    for (uint32_t sector = 0; sector < flash->sector_count; sector++) {
+        if (da16k_journal_read_sector_seq(journal, sector, &seq) && (!found || seq > newest_seq)) {
+            newest      = sector;
+            newest_seq  = seq;
+            found       = true;
+        }
+    }
+
+    if (!found) {
+        /* Blank or foreign content: the first append erases sector 0 */
+        DA16K_DEBUG("No journal found, starting a new one\r\n");
+        journal->write_sector   = flash->sector_count - 1;
+        return DA16K_SUCCESS;
+    }
+
+    /*  The journal consists of the newest sector and the ones before it with consecutive sequence numbers.
+        Anything else is left over from before the last wrap-around, or was being erased. */
+    oldest = newest;
+
+    for (uint32_t i = 1; i < flash->sector_count; i++) {
+        uint32_t sector = (newest + flash->sector_count - i) % flash->sector_count;
+
+        if (!da16k_journal_read_sector_seq(journal, sector, &seq) || seq != (newest_seq - i)) {
+            break;
+        }
+
+        oldest = sector;
+    }
+
+    for (uint32_t sector = oldest; ; sector = (sector + 1) % flash->sector_count) {
+        uint32_t end = da16k_journal_recover_sector(journal, sector, &sealed, &first_seq);
+
+        if (sector == newest) {
+            /* A damaged record closes the sector, writing continues in the next one */
+            journal->write_offset = (sealed || (end + DA16K_JOURNAL_HEADER_SIZE) > flash->sector_size) ? 0 : end;
+            break;
+        }
+    }
+
+    journal->write_sector       = newest;
+    journal->write_sector_seq   = newest_seq;
+    journal->read_sector        = oldest;
+    journal->read_offset        = da16k_journal_first_record(journal);
+
+    /*  Data records are numbered consecutively, so the ones before the oldest left were either replayed or dropped.
+        The latter are not acknowledged on flash if power was lost between erasing their sector and writing the
+        checkpoint of the next one. */
+    if (first_seq > (journal->acked_seq + 1)) {
+        journal->acked_seq = first_seq - 1;
+    }
+
+    if (journal->acked_seq >= journal->next_seq) {
+        journal->next_seq = journal->acked_seq + 1;
+    }
+
+    DA16K_DEBUG("Journal recovered: %lu records pending\r\n", (unsigned long) da16k_journal_pending(journal));
+
+    return DA16K_SUCCESS;
+}
+
+/* Stores count tuples of msg rendered into the journal's buffer as one data record */
+static da16k_err_t da16k_journal_write_data(da16k_journal_t *journal, size_t length, size_t count) {
+    da16k_err_t ret;
+
+    /* Nothing left to replay: replay starts with this record */
+    if (da16k_journal_pending(journal) == 0) {
+        if (journal->write_offset == 0 ||
+            (journal->write_offset + da16k_journal_align(journal, DA16K_JOURNAL_HEADER_SIZE + length)) > journal->flash->sector_size) {
+            if (DA16K_SUCCESS != (ret = da16k_journal_next_sector(journal))) {
+                return ret;
+            }
+        }
+
+        journal->read_sector = journal->write_sector;
+        journal->read_offset = journal->write_offset;
+    }
+
+    if (DA16K_SUCCESS != (ret = da16k_journal_write(journal, DA16K_JOURNAL_TYPE_DATA, (uint8_t) count, (uint16_t) length, journal->next_seq))) {
+        DA16K_ERROR("Journal write failed\r\n");
+        return ret;
+    }
+
+    journal->next_seq++;
+    journal->stats.appended++;
+
+    return DA16K_SUCCESS;
+}
+
+/*  Limits of the data in one frame for the journal: the gateway's, and what fits into the record buffer. Records
+    themselves hold at most DA16K_MSG_TUPLES_PER_ITERATION tuples (record_tuples), replayed frames may combine them. */
+static void da16k_journal_frame_limits(size_t record_tuples, size_t *max_tuples, size_t *max_length) {
+    da16k_msg_frame_limits(max_tuples, max_length);
+
+    if (*max_tuples > record_tuples) {
+        *max_tuples = record_tuples;
+    }
+
+    if (*max_length > DA16K_JOURNAL_MAX_PAYLOAD) {
+        *max_length = DA16K_JOURNAL_MAX_PAYLOAD;
+    }
+}
+
+/* Stores the tuples of msg from first onwards */
+static da16k_err_t da16k_journal_append_from(da16k_journal_t *journal, const da16k_msg_t *msg, size_t first) {
+    char       *payload     = (char *) &journal->buffer[DA16K_JOURNAL_HEADER_SIZE];
+    size_t      total       = da16k_msg_get_count(msg);
+    size_t      length;
+    size_t      count;
+    size_t      max_tuples;
+    size_t      max_length;
+    da16k_err_t ret;
+
+    da16k_journal_frame_limits(DA16K_MSG_TUPLES_PER_ITERATION, &max_tuples, &max_length);
+
+    while (first < total) {
+        ret = da16k_msg_render(msg, first, max_tuples, payload, max_length, &length, &count);
+
+        if (ret != DA16K_SUCCESS) {
+            return ret;
+        }
+
+        if (DA16K_SUCCESS != (ret = da16k_journal_write_data(journal, length, count))) {
+            return ret;
+        }
+
+        first += count;
+    }
+
+    return DA16K_SUCCESS;
+}
+
+da16k_err_t da16k_journal_append(da16k_journal_t *journal, const da16k_msg_t *msg) {
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, journal);
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, journal->flash);
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, msg);
+
+    return da16k_journal_append_from(journal, msg, 0);
+}
+
+da16k_err_t da16k_journal_send_msg(da16k_journal_t *journal, const da16k_msg_t *msg) {
+    char       *payload     = (char *) &journal->buffer[DA16K_JOURNAL_HEADER_SIZE];
+    size_t      total;
+    size_t      first       = 0;
+    size_t      length;
+    size_t      count;
+    size_t      max_tuples;
+    size_t      max_length;
+    da16k_err_t ret;
+
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, journal);
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, journal->flash);
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, msg);
+
+    total = da16k_msg_get_count(msg);
+
+    da16k_journal_frame_limits(DA16K_MSG_TUPLES_PER_ITERATION, &max_tuples, &max_length);
+
+    /*  Rendered into the record buffer, so a frame that fails is stored exactly as it was sent.
+        A frame is kept to the size of a record for the same reason. */
+    while (first < total) {
+        ret = da16k_msg_render(msg, first, max_tuples, payload, max_length, &length, &count);
+
+        if (ret != DA16K_SUCCESS) {
+            return ret;
+        }
+
+        if (da16k_send_msg_rendered(payload, length) != DA16K_SUCCESS) {
+            DA16K_WARN("Gateway unavailable, storing telemetry in the journal\r\n");
+
+            if (DA16K_SUCCESS != (ret = da16k_journal_write_data(journal, length, count))) {
+                return ret;
+            }
+
+            return da16k_journal_append_from(journal, msg, first + count);
+        }
+
+        first += count;
+    }
+
+    return DA16K_SUCCESS;
+}
+
+/* Adds the tokens for the time passed since the last refill, up to one second's worth */
+static void da16k_journal_refill(da16k_journal_t *journal) {
+    uint32_t    now     = da16k_get_time_ms();
+    uint32_t    limit   = journal->frames_per_second * DA16K_JOURNAL_FRAME_TOKENS;
+    uint64_t    tokens  = (uint64_t) journal->tokens + (uint64_t) (now - journal->refill_ms) * journal->frames_per_second;
+
+    journal->tokens     = (tokens > limit) ? limit : (uint32_t) tokens;
+    journal->refill_ms  = now;
+}
+
+/*  Collects consecutive records from the read position into the journal's buffer, up to a frame's worth.
+    Replayed data, acknowledgements and the end of sectors are skipped. On return, *end_sector and *end_offset
+    point behind the last record taken and *last_seq holds its sequence number. */
+static void da16k_journal_collect(da16k_journal_t *journal, size_t *length, size_t *tuples, uint32_t *records,
+                                  uint32_t *end_sector, uint32_t *end_offset, uint32_t *last_seq) {
+    da16k_journal_record_t          record;
+    da16k_journal_record_state_t    state;
+    uint32_t                        sector  = journal->read_sector;
+    uint32_t                        offset  = journal->read_offset;
+    size_t                          max_tuples;
+    size_t                          max_length;
+
+    da16k_journal_frame_limits(SIZE_MAX, &max_tuples, &max_length);
+
+    *length     = 0;
+    *tuples     = 0;
+    *records    = 0;
+    *end_sector = sector;
+    *end_offset = offset;
+    *last_seq   = journal->acked_seq;
+
+    while (*records < da16k_journal_pending(journal)) {
+        if (sector == journal->write_sector && journal->write_offset != 0 && offset >= journal->write_offset) {
+            break;
+        }
+
+        /* Headers first, the payload is read straight into place once it is known to fit */
+        state = da16k_journal_read_record(journal, sector, offset, &record, NULL, 0);
+
+        if (state == DA16K_JOURNAL_RECORD_VALID && record.type == DA16K_JOURNAL_TYPE_DATA && record.seq > *last_seq) {
+            /* A record always goes out, even one stored before the gateway reported smaller limits */
+            if (*records > 0 && ((*tuples + record.tuples) > max_tuples || (*length + record.length) > max_length)) {
+                break;
+            }
+
+            state = da16k_journal_read_record(journal, sector, offset, &record, &journal->buffer[*length],
+                                              DA16K_JOURNAL_MAX_PAYLOAD - *length);
+
+            if (state == DA16K_JOURNAL_RECORD_VALID) {
+                *length    += record.length;
+                *tuples    += record.tuples;
+                *last_seq   = record.seq;
+                (*records)++;
+            }
+        }
+
+        if (state == DA16K_JOURNAL_RECORD_VALID) {
+            offset += record.size;
+        } else {
+            /* End of this sector's records (or a damaged one, which ends them just the same) */
+            if (sector == journal->write_sector) {
+                break;
+            }
+
+            sector = (sector + 1) % journal->flash->sector_count;
+            offset = da16k_journal_first_record(journal);
+        }
+
+        if (*records > 0) {
+            *end_sector = sector;
+            *end_offset = offset;
+        }
+    }
+}
+
+da16k_err_t da16k_journal_replay(da16k_journal_t *journal, uint32_t budget_ms, size_t *frames) {
+    uint32_t    start   = da16k_get_time_ms();
+    uint32_t    sent    = 0;
+    da16k_err_t ret     = DA16K_SUCCESS;
+
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, journal);
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, journal->flash);
+
+    da16k_journal_refill(journal);
+
+    while (da16k_journal_pending(journal) > 0) {
+        size_t      length;
+        size_t      tuples;
+        uint32_t    records;
+        uint32_t    end_sector;
+        uint32_t    end_offset;
+        uint32_t    last_seq;
+
+        if ((journal->frames_per_second > 0 && journal->tokens < DA16K_JOURNAL_FRAME_TOKENS) ||
+            (budget_ms > 0 && (da16k_get_time_ms() - start) >= budget_ms)) {
+            break;
+        }
+
+        da16k_journal_collect(journal, &length, &tuples, &records, &end_sector, &end_offset, &last_seq);
+
+        if (records == 0) {
+            /* The remaining records cannot be read anymore */
+            DA16K_WARN("Journal records unreadable, skipping\r\n");
+            journal->stats.dropped += da16k_journal_pending(journal);
+            journal->acked_seq      = journal->next_seq - 1;
+            break;
+        }
+
+        if (DA16K_SUCCESS != (ret = da16k_send_msg_rendered((const char *) journal->buffer, length))) {
+            break;
+        }
+
+        if (journal->frames_per_second > 0) {
+            journal->tokens -= DA16K_JOURNAL_FRAME_TOKENS;
+        }
+
+        journal->read_sector        = end_sector;
+        journal->read_offset        = end_offset;
+        journal->acked_seq          = last_seq;
+        journal->stats.replayed    += records;
+        journal->stats.frames++;
+        sent++;
+    }
+
+    /* One acknowledgement per call rather than per frame spares the flash */
+    if (sent > 0) {
+        da16k_err_t ack_ret = da16k_journal_write(journal, DA16K_JOURNAL_TYPE_ACK, 0, 0, journal->acked_seq);
+
+        if (ret == DA16K_SUCCESS) {
+            ret = ack_ret;
+        }
+    }
+
+    if (frames) {
+        *frames = sent;
+    }
+
+    return ret;
+}
+
+size_t da16k_journal_pending(const da16k_journal_t *journal) {
+    return journal ? (size_t) (journal->next_seq - 1 - journal->acked_seq) : 0;
+}
+
+void da16k_journal_get_stats(const da16k_journal_t *journal, da16k_journal_stats_t *stats) {
+    if (journal && stats) {
+        *stats          = journal->stats;
+        stats->pending  = (uint32_t) da16k_journal_pending(journal);
+    }
+}
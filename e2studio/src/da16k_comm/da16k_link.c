@@ -0,0 +1,374 @@
+/*
+ * da16k_link.c
+ *
+ * IoTConnect via Dialog DA16K module - connection supervisor.
+ */
+
+#include "da16k_private.h"
+
+#include <string.h>
+
+#if !defined(DA16K_CONFIG_LINK_PROBE_INTERVAL_MS)
+#define DA16K_CONFIG_LINK_PROBE_INTERVAL_MS     30000
+#endif
+
+#if !defined(DA16K_CONFIG_LINK_FAILURE_THRESHOLD)
+#define DA16K_CONFIG_LINK_FAILURE_THRESHOLD     3
+#endif
+
+#if !defined(DA16K_CONFIG_LINK_BACKOFF_MIN_MS)
+#define DA16K_CONFIG_LINK_BACKOFF_MIN_MS        1000
+#endif
+
+#if !defined(DA16K_CONFIG_LINK_BACKOFF_MAX_MS)
+#define DA16K_CONFIG_LINK_BACKOFF_MAX_MS        60000
+#endif
+
+#if defined(DA16K_CONFIG_FREERTOS)
+
+#include "task.h"
+
+#if !defined(DA16K_CONFIG_LINK_TASK_PRIORITY)
+#define DA16K_CONFIG_LINK_TASK_PRIORITY         (tskIDLE_PRIORITY + 1)
+#endif
+
+#if !defined(DA16K_CONFIG_LINK_TASK_STACK_WORDS)
+#define DA16K_CONFIG_LINK_TASK_STACK_WORDS      1024
+#endif
+
+static TaskHandle_t             s_link_task     = NULL;
+#endif
+
+static const da16k_cfg_t       *s_cfg           = NULL;     /* NULL = no supervision */
+static da16k_link_callback_t    s_callback      = NULL;
+static void                    *s_context       = NULL;
+static da16k_link_state_t       s_state         = DA16K_LINK_DOWN;
+static da16k_link_stats_t       s_stats         = {0};
+static uint32_t                 s_next_ms       = 0;        /* Time of the next probe or reconnection attempt */
+static uint32_t                 s_attempts      = 0;        /* Failed attempts since the last success, for the backoff */
+static uint32_t                 s_random        = 0;
+
+/* Reported by other tasks */
+static uint32_t                 s_failure_run   = 0;        /* Consecutive failed operations */
+static bool                     s_activity      = false;    /* An operation succeeded since the last probe */
+
+static const char * const       s_state_names[] = { "down", "uart up", "wifi joined", "connected", "degraded" };
+
+static const char *da16k_link_state_name(da16k_link_state_t state) {
+    return ((size_t) state < (sizeof(s_state_names) / sizeof(s_state_names[0]))) ? s_state_names[state] : "?";
+}
+
+/* xorshift32, only used to spread out reconnection attempts of devices that lost the link at the same time */
+static uint32_t da16k_link_random(void) {
+    s_random ^= s_random << 13;
+    s_random ^= s_random >> 17;
+    s_random ^= s_random << 5;
+
+    return s_random;
+}
+
+/*  Exponential backoff with jitter: the delay doubles with every failed attempt up to the maximum, and a random
+    delay of up to half of it is taken off so that devices do not retry in lockstep. */
+static uint32_t da16k_link_backoff_ms(void) {
+    uint32_t delay = DA16K_CONFIG_LINK_BACKOFF_MIN_MS;
+
+    for (uint32_t i = 1; i < s_attempts && delay < DA16K_CONFIG_LINK_BACKOFF_MAX_MS; i++) {
+        delay *= 2;
+    }
+
+    if (delay > DA16K_CONFIG_LINK_BACKOFF_MAX_MS) {
+        delay = DA16K_CONFIG_LINK_BACKOFF_MAX_MS;
+    }
+
+    return delay - (da16k_link_random() % (delay / 2 + 1));
+}
+
+static void da16k_link_set_state(da16k_link_state_t state) {
+    da16k_link_state_t previous = s_state;
+
+    if (state == previous) {
+        return;
+    }
+
+    __atomic_store_n(&s_state, state, __ATOMIC_RELEASE);
+    s_stats.transitions++;
+
+    DA16K_DEBUG("Link %s -> %s\r\n", da16k_link_state_name(previous), da16k_link_state_name(state));
+
+    /* Failures from before do not count against a fresh session */
+    if (state == DA16K_LINK_CONNECTED) {
+        __atomic_store_n(&s_failure_run, 0, __ATOMIC_RELAXED);
+    }
+
+    /* Queued telemetry can go out again */
+    if (state >= DA16K_LINK_CONNECTED && previous < DA16K_LINK_CONNECTED) {
+        s_stats.recoveries++;
+#if defined(DA16K_CONFIG_FREERTOS)
+        da16k_async_wake();
+#endif
+    }
+
+    if (s_callback) {
+        s_callback(previous, state, s_context);
+    }
+}
+
+/*  Finds out how far the link is up, from the top: IoTC session, WiFi, UART. A gateway that cannot tell the session
+    state is assumed to be connected, failing operations still mark the link as degraded then. */
+static da16k_link_state_t da16k_link_probe(void) {
+    bool        up  = false;
+    da16k_err_t ret;
+
+    s_stats.probes++;
+
+    ret = da16k_get_iotc_status(&up);
+
+    if (up || ret == DA16K_AT_ERROR_CODE) {
+        return DA16K_LINK_CONNECTED;
+    }
+
+    if (da16k_get_wifi_status(NULL, &up) == DA16K_SUCCESS) {
+        return up ? DA16K_LINK_WIFI_JOINED : DA16K_LINK_UART_UP;
+    }
+
+    /* An unsupported WiFi query still shows that the gateway responds */
+    return (da16k_at_send_formatted_and_check_success(DA16K_UART_TIMEOUT_MS, NULL, "AT") == DA16K_SUCCESS)
+           ? DA16K_LINK_UART_UP : DA16K_LINK_DOWN;
+}
+
+/* One step towards a connected link. Returns the state reached. */
+static da16k_link_state_t da16k_link_reconnect(da16k_link_state_t state) {
+    da16k_err_t ret;
+    bool        joined = false;
+
+    s_stats.attempts++;
+
+    switch (state) {
+        case DA16K_LINK_DOWN:
+            /* After a gateway reset, it is back at the default rate. Negotiating looks for it at both rates. */
+            if (s_cfg->baud_rate) {
+                ret = da16k_set_baud_rate(s_cfg->baud_rate);
+                return (ret == DA16K_SUCCESS || ret == DA16K_AT_FAIL) ? DA16K_LINK_UART_UP : DA16K_LINK_DOWN;
+            }
+
+            ret = da16k_at_send_formatted_and_check_success(DA16K_UART_TIMEOUT_MS, NULL, "AT");
+
+            return (ret == DA16K_SUCCESS) ? DA16K_LINK_UART_UP : DA16K_LINK_DOWN;
+
+        case DA16K_LINK_UART_UP:
+            if (s_cfg->wifi_config) {
+                ret = da16k_get_wifi_status(s_cfg->wifi_config->ssid, &joined);
+
+                if (!joined) {
+                    ret = da16k_set_wifi_config(s_cfg->wifi_config);
+                    joined = (ret == DA16K_SUCCESS);
+                }
+            } else {
+                /* Provisioned gateways join on their own, just wait for it */
+                ret = da16k_get_wifi_status(NULL, &joined);
+            }
+
+            if (ret == DA16K_TIMEOUT) {
+                return DA16K_LINK_DOWN;
+            }
+
+            return joined ? DA16K_LINK_WIFI_JOINED : DA16K_LINK_UART_UP;
+
+        case DA16K_LINK_WIFI_JOINED:
+        case DA16K_LINK_DEGRADED:
+            /* A degraded session is restarted. Otherwise, the settings are only sent if the gateway does not have
+               them and a running session is kept. */
+            if (state == DA16K_LINK_DEGRADED) {
+                (void) da16k_iotc_stop();
+            }
+
+            if (s_cfg->iotc_config) {
+                ret = da16k_setup_iotc(s_cfg->iotc_config, false);
+            } else if (state == DA16K_LINK_WIFI_JOINED && da16k_get_iotc_status(&joined) == DA16K_SUCCESS && joined) {
+                ret = DA16K_SUCCESS;
+            } else {
+                ret = da16k_iotc_start();
+            }
+
+            if (ret == DA16K_SUCCESS) {
+                return DA16K_LINK_CONNECTED;
+            }
+
+            /* Find out why it failed, a lost WiFi connection needs to be dealt with first */
+            state = da16k_link_probe();
+
+            return (state == DA16K_LINK_CONNECTED) ? DA16K_LINK_DEGRADED : state;
+
+        case DA16K_LINK_CONNECTED:
+        default:
+            return state;
+    }
+}
+
+da16k_err_t da16k_link_init(const da16k_cfg_t *cfg, da16k_link_callback_t callback, void *context) {
+    da16k_err_t ret;
+
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, cfg);
+
+    if (DA16K_SUCCESS != (ret = da16k_init_local(cfg))) {
+        return ret;
+    }
+
+    s_callback  = callback;
+    s_context   = context;
+    s_state     = DA16K_LINK_DOWN;
+    s_attempts  = 0;
+    s_next_ms   = da16k_get_time_ms();
+    s_random    = s_next_ms ^ 0x9E3779B9u;  /* Must not be 0 */
+    memset(&s_stats, 0, sizeof(s_stats));
+
+    __atomic_store_n(&s_cfg, cfg, __ATOMIC_RELEASE);
+
+    return DA16K_SUCCESS;
+}
+
+uint32_t da16k_link_poll(void) {
+    da16k_link_state_t  state;
+    uint32_t            now;
+    int32_t             wait;
+    bool                advanced = true;
+
+    if (s_cfg == NULL) {
+        return DA16K_CONFIG_LINK_PROBE_INTERVAL_MS;
+    }
+
+    now     = da16k_get_time_ms();
+    wait    = (int32_t) (s_next_ms - now);
+
+    /* Operations failing while connected call for a closer look right away */
+    if (s_state == DA16K_LINK_CONNECTED &&
+        __atomic_load_n(&s_failure_run, __ATOMIC_RELAXED) >= DA16K_CONFIG_LINK_FAILURE_THRESHOLD) {
+        da16k_link_set_state(DA16K_LINK_DEGRADED);
+        wait = 0;
+    }
+
+    /* An operation went through since the link was degraded */
+    if (s_state == DA16K_LINK_DEGRADED && __atomic_load_n(&s_failure_run, __ATOMIC_RELAXED) == 0) {
+        da16k_link_set_state(DA16K_LINK_CONNECTED);
+        s_attempts  = 0;
+        wait        = 0;
+    }
+
+    if (wait > 0) {
+        return (uint32_t) wait;
+    }
+
+    if (s_state == DA16K_LINK_CONNECTED) {
+        /* Traffic going through is proof enough, a probe is only needed on a quiet link */
+        if (__atomic_exchange_n(&s_activity, false, __ATOMIC_RELAXED)) {
+            s_stats.probes_skipped++;
+        } else {
+            da16k_link_set_state(da16k_link_probe());
+        }
+    } else {
+        if (s_state == DA16K_LINK_DEGRADED && s_attempts == 0) {
+            /* Before restarting the session, find out whether it is down at all */
+            state = da16k_link_probe();
+            state = (state == DA16K_LINK_CONNECTED) ? DA16K_LINK_DEGRADED : state;
+        } else {
+            state = da16k_link_reconnect(s_state);
+        }
+
+        /*  The backoff grows with every attempt that does not lead to a step up, and is only reset once connected.
+            A step up is followed by the next step right away. */
+        if (state == DA16K_LINK_CONNECTED) {
+            s_attempts  = 0;
+        } else if (state == DA16K_LINK_DEGRADED || state <= s_state) {
+            s_attempts++;
+            advanced    = false;
+        }
+
+        da16k_link_set_state(state);
+    }
+
+    if (s_state == DA16K_LINK_CONNECTED) {
+        s_next_ms           = da16k_get_time_ms() + DA16K_CONFIG_LINK_PROBE_INTERVAL_MS;
+        s_stats.backoff_ms  = 0;
+    } else {
+        s_stats.backoff_ms  = advanced ? 0 : da16k_link_backoff_ms();
+        s_next_ms           = da16k_get_time_ms() + s_stats.backoff_ms;
+    }
+
+    return (uint32_t) (s_next_ms - da16k_get_time_ms());
+}
+
+da16k_link_state_t da16k_link_get_state(void) {
+    return __atomic_load_n(&s_state, __ATOMIC_ACQUIRE);
+}
+
+void da16k_get_link_stats(da16k_link_stats_t *stats) {
+    if (stats) {
+        *stats          = s_stats;
+        stats->state    = da16k_link_get_state();
+    }
+}
+
+void da16k_link_report(da16k_err_t result) {
+    switch (result) {
+        case DA16K_SUCCESS:
+        case DA16K_NO_CMDS:
+            __atomic_store_n(&s_failure_run, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&s_activity, true, __ATOMIC_RELAXED);
+            break;
+
+        case DA16K_UART_ERROR:
+        case DA16K_TIMEOUT:
+        case DA16K_AT_FAIL:
+        case DA16K_AT_ERROR_CODE:
+        case DA16K_AT_NO_OK:
+            __atomic_fetch_add(&s_stats.failures, 1, __ATOMIC_RELAXED);
+
+            if (__atomic_add_fetch(&s_failure_run, 1, __ATOMIC_RELAXED) == DA16K_CONFIG_LINK_FAILURE_THRESHOLD) {
+#if defined(DA16K_CONFIG_FREERTOS)
+                if (s_link_task) {
+                    xTaskNotifyGive(s_link_task);
+                }
+#endif
+            }
+            break;
+
+        default:
+            /* Not the link's fault, e.g. an invalid message */
+            break;
+    }
+}
+
+bool da16k_link_usable(void) {
+    return __atomic_load_n(&s_cfg, __ATOMIC_ACQUIRE) == NULL || da16k_link_get_state() >= DA16K_LINK_CONNECTED;
+}
+
+#if defined(DA16K_CONFIG_FREERTOS)
+
+static void da16k_link_supervisor(void *parameters) {
+    (void) parameters;
+
+    while (true) {
+        (void) ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(da16k_link_poll()));
+    }
+}
+
+da16k_err_t da16k_link_start(void) {
+    if (s_cfg == NULL) {
+        return DA16K_NOT_INITIALIZED;
+    }
+
+    if (s_link_task) {
+        return DA16K_SUCCESS;
+    }
+
+    if (pdPASS != xTaskCreate(da16k_link_supervisor, "da16k_link", DA16K_CONFIG_LINK_TASK_STACK_WORDS, NULL,
+                              DA16K_CONFIG_LINK_TASK_PRIORITY, &s_link_task)) {
+        DA16K_ERROR("Failed to create supervisor task\r\n");
+        s_link_task = NULL;
+        return DA16K_OUT_OF_MEMORY;
+    }
+
+    return DA16K_SUCCESS;
+}
+
+#endif /* DA16K_CONFIG_FREERTOS */
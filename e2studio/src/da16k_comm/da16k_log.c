@@ -0,0 +1,604 @@
+/*
+ * da16k_log.c
+ *
+ * IoTConnect via Dialog DA16K module - deferred logging into a ring of binary records.
+ */
+
+#include "da16k_private.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(DA16K_CONFIG_FREERTOS)
+#include "task.h"
+#endif
+
+#if !defined(DA16K_CONFIG_LOG_FLUSH_INTERVAL_MS)
+#define DA16K_CONFIG_LOG_FLUSH_INTERVAL_MS      100
+#endif
+
+#if !defined(DA16K_CONFIG_LOG_TASK_PRIORITY)
+#define DA16K_CONFIG_LOG_TASK_PRIORITY          tskIDLE_PRIORITY
+#endif
+
+#if !defined(DA16K_CONFIG_LOG_TASK_STACK_WORDS)
+#define DA16K_CONFIG_LOG_TASK_STACK_WORDS       1024
+#endif
+
+/* Longest line printed by da16k_log_flush, longer ones are cut off */
+#if !defined(DA16K_CONFIG_LOG_LINE_SIZE)
+#define DA16K_CONFIG_LOG_LINE_SIZE              256
+#endif
+
+#if (DA16K_CONFIG_LOG_RING_SIZE < 2) || ((DA16K_CONFIG_LOG_RING_SIZE & (DA16K_CONFIG_LOG_RING_SIZE - 1)) != 0)
+#error "DA16K_CONFIG_LOG_RING_SIZE must be a power of 2, at least 2"
+#endif
+
+#define DA16K_LOG_RING_MASK                     (DA16K_CONFIG_LOG_RING_SIZE - 1)
+
+/* Stored instead of a string offset for NULL strings */
+#define DA16K_LOG_NULL_STRING                   UINT64_MAX
+
+/* What a conversion takes from the argument list */
+typedef enum {
+    DA16K_LOG_ARG_NONE,         /* %% */
+    DA16K_LOG_ARG_SIGNED,
+    DA16K_LOG_ARG_UNSIGNED,
+    DA16K_LOG_ARG_DOUBLE,
+    DA16K_LOG_ARG_STRING,
+    DA16K_LOG_ARG_POINTER,
+    DA16K_LOG_ARG_COUNT,        /* %n, takes a pointer but prints nothing */
+    DA16K_LOG_ARG_UNKNOWN,      /* Unknown conversion, the arguments after it cannot be located */
+} da16k_log_arg_t;
+
+typedef enum {
+    DA16K_LOG_LENGTH_NONE,
+    DA16K_LOG_LENGTH_HH,
+    DA16K_LOG_LENGTH_H,
+    DA16K_LOG_LENGTH_L,
+    DA16K_LOG_LENGTH_LL,
+    DA16K_LOG_LENGTH_J,
+    DA16K_LOG_LENGTH_Z,
+    DA16K_LOG_LENGTH_T,
+    DA16K_LOG_LENGTH_LONG_DOUBLE,
+} da16k_log_length_t;
+
+/* A parsed conversion specification, e.g. "%-08.*lx" */
+typedef struct {
+    const char         *flags;
+    size_t              flags_length;
+    const char         *width;              /* Digits, unless width_star */
+    size_t              width_length;
+    bool                width_star;
+    const char         *precision;          /* Digits after the '.', unless precision_star */
+    size_t              precision_length;
+    bool                has_precision;
+    bool                precision_star;
+    da16k_log_length_t  length;
+    char                conversion;
+    da16k_log_arg_t     arg;
+} da16k_log_spec_t;
+
+/* Parses the conversion specification after a '%' and returns the character following it */
+static const char *da16k_log_parse_spec(const char *p, da16k_log_spec_t *spec) {
+    memset(spec, 0, sizeof(*spec));
+
+    spec->flags = p;
+    while (*p && strchr("-+ #0", *p)) {
+        p++;
+    }
+    spec->flags_length = (size_t) (p - spec->flags);
+
+    spec->width = p;
+    if (*p == '*') {
+        spec->width_star = true;
+        p++;
+    } else {
+        while (*p >= '0' && *p <= '9') {
+            p++;
+        }
+    }
+    spec->width_length = (size_t) (p - spec->width);
+
+    if (*p == '.') {
+        spec->has_precision = true;
+        spec->precision     = ++p;
+
+        if (*p == '*') {
+            spec->precision_star = true;
+            p++;
+        } else {
+            while (*p >= '0' && *p <= '9') {
+                p++;
+            }
+        }
+        spec->precision_length = (size_t) (p - spec->precision);
+    }
+
+    switch (*p) {
+        case 'h':   spec->length = (p[1] == 'h') ? DA16K_LOG_LENGTH_HH : DA16K_LOG_LENGTH_H;    break;
+        case 'l':   spec->length = (p[1] == 'l') ? DA16K_LOG_LENGTH_LL : DA16K_LOG_LENGTH_L;    break;
+        case 'j':   spec->length = DA16K_LOG_LENGTH_J;                                          break;
+        case 'z':   spec->length = DA16K_LOG_LENGTH_Z;                                          break;
+        case 't':   spec->length = DA16K_LOG_LENGTH_T;                                          break;
+        case 'L':   spec->length = DA16K_LOG_LENGTH_LONG_DOUBLE;                                break;
+        default:                                                                                break;
+    }
+
+    if (spec->length == DA16K_LOG_LENGTH_HH || spec->length == DA16K_LOG_LENGTH_LL) {
+        p += 2;
+    } else if (spec->length != DA16K_LOG_LENGTH_NONE) {
+        p++;
+    }
+
+    spec->conversion = *p;
+
+    switch (*p) {
+        case '%':                                       spec->arg = DA16K_LOG_ARG_NONE;     break;
+        case 'd': case 'i': case 'c':                   spec->arg = DA16K_LOG_ARG_SIGNED;   break;
+        case 'u': case 'o': case 'x': case 'X':         spec->arg = DA16K_LOG_ARG_UNSIGNED; break;
+        case 'f': case 'F': case 'e': case 'E':
+        case 'g': case 'G': case 'a': case 'A':         spec->arg = DA16K_LOG_ARG_DOUBLE;   break;
+        case 's':                                       spec->arg = DA16K_LOG_ARG_STRING;   break;
+        case 'p':                                       spec->arg = DA16K_LOG_ARG_POINTER;  break;
+        case 'n':                                       spec->arg = DA16K_LOG_ARG_COUNT;    break;
+        default:                                        spec->arg = DA16K_LOG_ARG_UNKNOWN;  return p;
+    }
+
+    return p + 1;
+}
+
+/* Appends formatted text to dst, which holds length characters. Returns the new length, at most size - 1. */
+static size_t da16k_log_append(char *dst, size_t size, size_t length, const char *format, ...) {
+    va_list args;
+    int     written;
+
+    if (length + 1 >= size) {
+        return length;
+    }
+
+    va_start(args, format);
+    written = vsnprintf(dst + length, size - length, format, args);
+    va_end(args);
+
+    if (written < 0) {
+        return length;
+    }
+
+    return ((length + (size_t) written) < size) ? (length + (size_t) written) : (size - 1);
+}
+
+/*  Renders a single conversion. The specification is rebuilt with the stored '*' values filled in, and with the
+    length modifier of the widened argument. */
+static size_t da16k_log_render_spec(char *dst, size_t size, size_t length, const da16k_log_spec_t *spec,
+                                    const da16k_log_record_t *record, const uint64_t *values) {
+    char        format[32];
+    size_t      format_length;
+    size_t      value_index = 0;
+    const char *modifier    = "";
+    int         width       = 0;
+    int         precision   = -1;
+    double      value_double;
+
+    if (spec->width_star) {
+        width = (int) (int64_t) values[value_index++];
+    }
+
+    if (spec->precision_star) {
+        precision = (int) (int64_t) values[value_index++];
+    }
+
+    format_length = da16k_log_append(format, sizeof(format), 0, "%%%.*s", (int) spec->flags_length, spec->flags);
+
+    if (spec->width_star) {
+        format_length = da16k_log_append(format, sizeof(format), format_length, "%d", width);
+    } else {
+        format_length = da16k_log_append(format, sizeof(format), format_length, "%.*s", (int) spec->width_length,
+                                         spec->width);
+    }
+
+    if (spec->precision_star) {
+        /* A negative precision counts as omitted */
+        if (precision >= 0) {
+            format_length = da16k_log_append(format, sizeof(format), format_length, ".%d", precision);
+        }
+    } else if (spec->has_precision) {
+        format_length = da16k_log_append(format, sizeof(format), format_length, ".%.*s",
+                                         (int) spec->precision_length, spec->precision);
+    }
+
+    if ((spec->arg == DA16K_LOG_ARG_SIGNED || spec->arg == DA16K_LOG_ARG_UNSIGNED) && spec->conversion != 'c') {
+        modifier = "ll";
+    }
+
+    (void) da16k_log_append(format, sizeof(format), format_length, "%s%c", modifier, spec->conversion);
+
+    switch (spec->arg) {
+        case DA16K_LOG_ARG_SIGNED:
+            if (spec->conversion == 'c') {
+                return da16k_log_append(dst, size, length, format, (int) (int64_t) values[value_index]);
+            }
+            return da16k_log_append(dst, size, length, format, (long long) (int64_t) values[value_index]);
+
+        case DA16K_LOG_ARG_UNSIGNED:
+            return da16k_log_append(dst, size, length, format, (unsigned long long) values[value_index]);
+
+        case DA16K_LOG_ARG_DOUBLE:
+            memcpy(&value_double, &values[value_index], sizeof(value_double));
+            return da16k_log_append(dst, size, length, format, value_double);
+
+        case DA16K_LOG_ARG_POINTER:
+            return da16k_log_append(dst, size, length, format, (void *) (uintptr_t) values[value_index]);
+
+        case DA16K_LOG_ARG_STRING:
+            if (values[value_index] == DA16K_LOG_NULL_STRING) {
+                return da16k_log_append(dst, size, length, format, "(null)");
+            }
+            return da16k_log_append(dst, size, length, format, &record->strings[values[value_index]]);
+
+        default:
+            return length;
+    }
+}
+
+size_t da16k_log_format(const da16k_log_record_t *record, char *dst, size_t size) {
+    const char         *p;
+    const char         *literal;
+    da16k_log_spec_t    spec;
+    size_t              length;
+    size_t              arg     = 0;
+    size_t              needed;
+
+    if (record == NULL || dst == NULL || size == 0) {
+        return 0;
+    }
+
+    dst[0] = '\0';
+    length = da16k_log_append(dst, size, 0, "[%s:%u] ", record->function ? record->function : "?",
+                              (unsigned) record->line);
+
+    for (p = record->format; p && *p; ) {
+        if (*p != '%') {
+            literal = p;
+            while (*p && *p != '%') {
+                p++;
+            }
+            length = da16k_log_append(dst, size, length, "%.*s", (int) (p - literal), literal);
+            continue;
+        }
+
+        p = da16k_log_parse_spec(p + 1, &spec);
+
+        if (spec.arg == DA16K_LOG_ARG_NONE) {
+            length = da16k_log_append(dst, size, length, "%%");
+            continue;
+        }
+
+        if (spec.arg == DA16K_LOG_ARG_UNKNOWN) {
+            length = da16k_log_append(dst, size, length, "<?>");
+            break;
+        }
+
+        needed = (spec.width_star ? 1 : 0) + (spec.precision_star ? 1 : 0) + (spec.arg != DA16K_LOG_ARG_COUNT ? 1 : 0);
+
+        if (arg + needed > DA16K_CONFIG_LOG_MAX_ARGS) {
+            length = da16k_log_append(dst, size, length, "<?>");
+            arg    = DA16K_CONFIG_LOG_MAX_ARGS;
+            continue;
+        }
+
+        length  = da16k_log_render_spec(dst, size, length, &spec, record, &record->args[arg]);
+        arg    += needed;
+    }
+
+    return length;
+}
+
+#if defined(DA16K_CONFIG_LOG_DEFERRED)
+
+/*  Ring slot. Producers claim slots without locks like the asynchronous telemetry queue (da16k_async.c), but the
+    sequence numbers are kept relative to the slot index so the zero-initialized ring is ready before anything ran:
+    a slot is free for position pos when sequence == lap(pos), and holds a record when sequence == lap(pos) + 1. */
+typedef struct {
+    uint32_t            sequence;
+    da16k_log_record_t  record;
+} da16k_log_slot_t;
+
+static da16k_log_slot_t s_slots[DA16K_CONFIG_LOG_RING_SIZE];
+static uint32_t         s_write_pos         = 0;
+static uint32_t         s_read_pos          = 0;    /* Only modified by the reader */
+static uint32_t         s_dropped           = 0;
+static uint32_t         s_dropped_reported  = 0;    /* Only modified by the reader */
+
+#if defined(DA16K_CONFIG_FREERTOS)
+static TaskHandle_t     s_log_task          = NULL;
+#endif
+
+static uint32_t da16k_log_lap(uint32_t pos) {
+    return pos & ~((uint32_t) DA16K_LOG_RING_MASK);
+}
+
+/* Stores one argument, returns false once the record is full */
+static bool da16k_log_store(da16k_log_record_t *record, size_t *count, uint64_t value) {
+    if (*count >= DA16K_CONFIG_LOG_MAX_ARGS) {
+        record->flags |= DA16K_LOG_ARGS_MISSING;
+        return false;
+    }
+
+    record->args[(*count)++] = value;
+    return true;
+}
+
+/* Copies a string argument into the record and returns its offset */
+static uint64_t da16k_log_store_string(da16k_log_record_t *record, size_t *strings_used, const char *string) {
+    size_t  available   = DA16K_CONFIG_LOG_STRING_SIZE - *strings_used;
+    size_t  length      = 0;
+    size_t  offset      = *strings_used;
+
+    if (string == NULL) {
+        return DA16K_LOG_NULL_STRING;
+    }
+
+    if (available == 0) {
+        /* The terminator of the previous string doubles as an empty one */
+        record->flags |= DA16K_LOG_STRING_CUT;
+        return DA16K_CONFIG_LOG_STRING_SIZE - 1;
+    }
+
+    while (string[length] && length < (available - 1)) {
+        length++;
+    }
+
+    if (string[length]) {
+        record->flags |= DA16K_LOG_STRING_CUT;
+    }
+
+    memcpy(&record->strings[offset], string, length);
+    record->strings[offset + length] = '\0';
+    *strings_used += length + 1;
+
+    return offset;
+}
+
+static int64_t da16k_log_signed_arg(da16k_log_length_t length, va_list *args) {
+    switch (length) {
+        case DA16K_LOG_LENGTH_HH:   return (signed char) va_arg(*args, int);
+        case DA16K_LOG_LENGTH_H:    return (short) va_arg(*args, int);
+        case DA16K_LOG_LENGTH_L:    return va_arg(*args, long);
+        case DA16K_LOG_LENGTH_LL:   return va_arg(*args, long long);
+        case DA16K_LOG_LENGTH_J:    return va_arg(*args, intmax_t);
+        case DA16K_LOG_LENGTH_Z:    return (int64_t) va_arg(*args, size_t);
+        case DA16K_LOG_LENGTH_T:    return va_arg(*args, ptrdiff_t);
+        default:                    return va_arg(*args, int);
+    }
+}
+
+static uint64_t da16k_log_unsigned_arg(da16k_log_length_t length, va_list *args) {
+    switch (length) {
+        case DA16K_LOG_LENGTH_HH:   return (unsigned char) va_arg(*args, unsigned int);
+        case DA16K_LOG_LENGTH_H:    return (unsigned short) va_arg(*args, unsigned int);
+        case DA16K_LOG_LENGTH_L:    return va_arg(*args, unsigned long);
+        case DA16K_LOG_LENGTH_LL:   return va_arg(*args, unsigned long long);
+        case DA16K_LOG_LENGTH_J:    return va_arg(*args, uintmax_t);
+        case DA16K_LOG_LENGTH_Z:    return va_arg(*args, size_t);
+        case DA16K_LOG_LENGTH_T:    return (uint64_t) va_arg(*args, ptrdiff_t);
+        default:                    return va_arg(*args, unsigned int);
+    }
+}
+
+/*  Takes the arguments off the list in the order of the format. Only the conversion specifications are looked at,
+    nothing is formatted, and the work is bounded by DA16K_CONFIG_LOG_MAX_ARGS and DA16K_CONFIG_LOG_STRING_SIZE. */
+static void da16k_log_pack(da16k_log_record_t *record, va_list *args) {
+    const char         *p               = record->format;
+    da16k_log_spec_t    spec;
+    size_t              count           = 0;
+    size_t              strings_used    = 0;
+    double              value_double;
+    uint64_t            value;
+
+    while ((p = strchr(p, '%')) != NULL) {
+        p = da16k_log_parse_spec(p + 1, &spec);
+
+        if (spec.arg == DA16K_LOG_ARG_NONE) {
+            continue;
+        }
+
+        if (spec.arg == DA16K_LOG_ARG_UNKNOWN) {
+            record->flags |= DA16K_LOG_ARGS_MISSING;
+            return;
+        }
+
+        if (spec.width_star && !da16k_log_store(record, &count, (uint64_t) (int64_t) va_arg(*args, int))) {
+            return;
+        }
+
+        if (spec.precision_star && !da16k_log_store(record, &count, (uint64_t) (int64_t) va_arg(*args, int))) {
+            return;
+        }
+
+        switch (spec.arg) {
+            case DA16K_LOG_ARG_SIGNED:
+                value = (uint64_t) da16k_log_signed_arg(spec.length, args);
+                break;
+
+            case DA16K_LOG_ARG_UNSIGNED:
+                value = da16k_log_unsigned_arg(spec.length, args);
+                break;
+
+            case DA16K_LOG_ARG_DOUBLE:
+                value_double = (spec.length == DA16K_LOG_LENGTH_LONG_DOUBLE) ? (double) va_arg(*args, long double)
+                                                                             : va_arg(*args, double);
+                memcpy(&value, &value_double, sizeof(value));
+                break;
+
+            case DA16K_LOG_ARG_STRING:
+                value = da16k_log_store_string(record, &strings_used, va_arg(*args, const char *));
+                break;
+
+            case DA16K_LOG_ARG_POINTER:
+                value = (uint64_t) (uintptr_t) va_arg(*args, void *);
+                break;
+
+            default:
+                (void) va_arg(*args, void *);   /* %n is not rendered */
+                continue;
+        }
+
+        if (!da16k_log_store(record, &count, value)) {
+            return;
+        }
+    }
+}
+
+void da16k_log_write(uint8_t level, const char *function, int line, const char *format, ...) {
+    da16k_log_slot_t   *slot;
+    uint32_t            pos;
+    int32_t             diff;
+    va_list             args;
+
+    /* Claim a slot */
+    pos = __atomic_load_n(&s_write_pos, __ATOMIC_RELAXED);
+
+    while (true) {
+        slot = &s_slots[pos & DA16K_LOG_RING_MASK];
+        diff = (int32_t) (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - da16k_log_lap(pos));
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&s_write_pos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            /* Ring is full */
+            __atomic_fetch_add(&s_dropped, 1, __ATOMIC_RELAXED);
+            return;
+        } else {
+            pos = __atomic_load_n(&s_write_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->record.format         = format;
+    slot->record.function       = function;
+    slot->record.timestamp_ms   = da16k_get_time_ms();
+    slot->record.line           = (uint16_t) line;
+    slot->record.level          = level;
+    slot->record.flags          = 0;
+
+    va_start(args, format);
+    da16k_log_pack(&slot->record, &args);
+    va_end(args);
+
+    __atomic_store_n(&slot->sequence, da16k_log_lap(pos) + 1, __ATOMIC_RELEASE);
+}
+
+/* Returns the oldest record's slot, or NULL if there is none */
+static da16k_log_slot_t *da16k_log_peek(void) {
+    da16k_log_slot_t *slot = &s_slots[s_read_pos & DA16K_LOG_RING_MASK];
+
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != (da16k_log_lap(s_read_pos) + 1)) {
+        return NULL;
+    }
+
+    return slot;
+}
+
+/* Hands a slot obtained by da16k_log_peek back to the producers */
+static void da16k_log_release(da16k_log_slot_t *slot) {
+    s_read_pos++;
+    __atomic_store_n(&slot->sequence, da16k_log_lap(s_read_pos - 1) + DA16K_CONFIG_LOG_RING_SIZE, __ATOMIC_RELEASE);
+}
+
+bool da16k_log_read(da16k_log_record_t *record) {
+    da16k_log_slot_t *slot;
+
+    if (record == NULL || (slot = da16k_log_peek()) == NULL) {
+        return false;
+    }
+
+    *record = slot->record;
+    da16k_log_release(slot);
+
+    return true;
+}
+
+size_t da16k_log_flush(size_t max_records) {
+    static char         line[DA16K_CONFIG_LOG_LINE_SIZE];
+    da16k_log_slot_t   *slot;
+    const char         *color;
+    size_t              length;
+    size_t              count   = 0;
+    uint32_t            dropped = da16k_log_dropped();
+
+    if (dropped != s_dropped_reported) {
+        DA16K_PRINT(YELLOW_COLOR "[%s] %lu log records dropped\r\n" CLEAR_COLOR, __func__,
+                    (unsigned long) (dropped - s_dropped_reported));
+        s_dropped_reported = dropped;
+    }
+
+    while ((max_records == 0 || count < max_records) && (slot = da16k_log_peek()) != NULL) {
+        length = da16k_log_format(&slot->record, line, sizeof(line));
+        color  = (slot->record.level == DA16K_LOG_LEVEL_ERROR) ? RED_COLOR
+               : (slot->record.level == DA16K_LOG_LEVEL_WARN)  ? YELLOW_COLOR : GREEN_COLOR;
+
+        da16k_log_release(slot);
+
+        /* Keep the line break of a line that was cut off */
+        if (length == sizeof(line) - 1) {
+            line[length - 2] = '\r';
+            line[length - 1] = '\n';
+        }
+
+        DA16K_PRINT("%s%s" CLEAR_COLOR, color, line);
+        count++;
+    }
+
+    return count;
+}
+
+uint32_t da16k_log_dropped(void) {
+    return __atomic_load_n(&s_dropped, __ATOMIC_RELAXED);
+}
+
+#if defined(DA16K_CONFIG_FREERTOS)
+static void da16k_log_task(void *parameters) {
+    (void) parameters;
+
+    while (true) {
+        (void) da16k_log_flush(0);
+        vTaskDelay(pdMS_TO_TICKS(DA16K_CONFIG_LOG_FLUSH_INTERVAL_MS));
+    }
+}
+
+da16k_err_t da16k_log_start(void) {
+    if (s_log_task) {
+        return DA16K_SUCCESS;
+    }
+
+    if (pdPASS != xTaskCreate(da16k_log_task, "da16k_log", DA16K_CONFIG_LOG_TASK_STACK_WORDS, NULL,
+                              DA16K_CONFIG_LOG_TASK_PRIORITY, &s_log_task)) {
+        DA16K_ERROR("Failed to create log task\r\n");
+        s_log_task = NULL;
+        return DA16K_OUT_OF_MEMORY;
+    }
+
+    return DA16K_SUCCESS;
+}
+#endif
+
+#else /* Messages are printed right away */
+
+bool da16k_log_read(da16k_log_record_t *record) {
+    (void) record;
+    return false;
+}
+
+size_t da16k_log_flush(size_t max_records) {
+    (void) max_records;
+    return 0;
+}
+
+uint32_t da16k_log_dropped(void) {
+    return 0;
+}
+
+#endif /* DA16K_CONFIG_LOG_DEFERRED */
@@ -0,0 +1,296 @@
+/*
+ * IoTConnect DA16K AT Command Library
+ * Platform functions implementation for POSIX hosts (Linux)
+ *
+ * The AT channel is a file descriptor: a serial port or pty opened by da16k_uart_init, or any descriptor
+ * (e.g. one end of a socketpair connected to the gateway simulator) handed over with da16k_posix_uart_attach.
+ */
+
+#include "da16k_comm.h"
+
+#if defined(DA16K_CONFIG_POSIX)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "da16k_uart.h"
+
+/* Received data is buffered here until a complete line is available, like the ring buffer of the RA6Mx port */
+#define POSIX_UART_RX_BUFFER_SIZE   1024
+#define POSIX_UART_RX_WAKEUP_LEVEL  (POSIX_UART_RX_BUFFER_SIZE / 2)
+
+/* Segments handed to a single writev call */
+#define POSIX_UART_MAX_IOV          64
+
+/* Environment variable overriding DA16K_CONFIG_POSIX_UART_DEVICE */
+#define POSIX_UART_DEVICE_ENV       "DA16K_UART_DEVICE"
+
+static int      s_fd            = -1;
+static bool     s_fd_attached   = false;    /* Descriptor is owned by the application, not closed by us */
+static char     s_rx_buffer[POSIX_UART_RX_BUFFER_SIZE];
+static size_t   s_rx_fill       = 0;
+
+uint32_t da16k_posix_time_ms(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint32_t) ((uint64_t) now.tv_sec * 1000u + (uint64_t) now.tv_nsec / 1000000u);
+}
+
+void da16k_posix_uart_attach(int fd) {
+    s_fd            = fd;
+    s_fd_attached   = (fd >= 0);
+    s_rx_fill       = 0;
+}
+
+static bool posix_uart_speed(uint32_t baud_rate, speed_t *speed) {
+    switch (baud_rate) {
+        case 9600:      *speed = B9600;     return true;
+        case 19200:     *speed = B19200;    return true;
+        case 38400:     *speed = B38400;    return true;
+        case 57600:     *speed = B57600;    return true;
+        case 115200:    *speed = B115200;   return true;
+        case 230400:    *speed = B230400;   return true;
+        case 460800:    *speed = B460800;   return true;
+        case 921600:    *speed = B921600;   return true;
+        default:        return false;
+    }
+}
+
+/* 8-n-1, raw mode. Nothing to do for pipes and sockets. */
+static bool posix_uart_configure(int fd, uint32_t baud_rate, bool drain) {
+    struct termios  tty;
+    speed_t         speed;
+
+    if (!isatty(fd)) {
+        return true;
+    }
+
+    if (!posix_uart_speed(baud_rate, &speed) || tcgetattr(fd, &tty) != 0) {
+        return false;
+    }
+
+    cfmakeraw(&tty);
+    cfsetispeed(&tty, speed);
+    cfsetospeed(&tty, speed);
+    tty.c_cflag |= (CLOCAL | CREAD);
+
+    return tcsetattr(fd, drain ? TCSADRAIN : TCSANOW, &tty) == 0;
+}
+
+bool da16k_uart_init(void) {
+    const char *device = getenv(POSIX_UART_DEVICE_ENV);
+
+    s_rx_fill = 0;
+
+    if (s_fd >= 0) {
+        return posix_uart_configure(s_fd, DA16K_UART_BAUD_RATE, false);
+    }
+
+#if defined(DA16K_CONFIG_POSIX_UART_DEVICE)
+    if (device == NULL) {
+        device = DA16K_CONFIG_POSIX_UART_DEVICE;
+    }
+#endif
+
+    if (device == NULL) {
+        DA16K_PRINT("No AT channel: attach a descriptor or set " POSIX_UART_DEVICE_ENV "\r\n");
+        return false;
+    }
+
+    s_fd = open(device, O_RDWR | O_NOCTTY);
+
+    if (s_fd < 0) {
+        DA16K_PRINT("Cannot open %s: %s\r\n", device, strerror(errno));
+        return false;
+    }
+
+    return posix_uart_configure(s_fd, DA16K_UART_BAUD_RATE, false);
+}
+
+bool da16k_uart_send(const char *src, size_t length) {
+    da16k_uart_iovec_t iov = { src, length };
+
+    return da16k_uart_sendv(&iov, 1);
+}
+
+bool da16k_uart_sendv(const da16k_uart_iovec_t *iov, size_t count) {
+    struct iovec    vec[POSIX_UART_MAX_IOV];
+    size_t          first = 0;
+
+    if (iov == NULL || s_fd < 0) {
+        return false;
+    }
+
+    while (first < count) {
+        size_t  n = count - first;
+        ssize_t written;
+
+        if (n > POSIX_UART_MAX_IOV) {
+            n = POSIX_UART_MAX_IOV;
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            vec[i].iov_base = (void *) iov[first + i].data;
+            vec[i].iov_len  = iov[first + i].length;
+        }
+
+        /* The kernel gathers the segments; partial writes are resumed where they left off */
+        for (size_t i = 0; i < n; ) {
+            written = writev(s_fd, &vec[i], (int) (n - i));
+
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+
+            while (i < n && (size_t) written >= vec[i].iov_len) {
+                written -= (ssize_t) vec[i].iov_len;
+                i++;
+            }
+
+            if (i < n) {
+                vec[i].iov_base  = (char *) vec[i].iov_base + written;
+                vec[i].iov_len  -= (size_t) written;
+            }
+        }
+
+        first += n;
+    }
+
+    return true;
+}
+
+/* Reads whatever is available into the RX buffer, waiting up to timeout_ms for it. Returns false on timeout or error. */
+static bool posix_uart_fill(uint32_t timeout_ms) {
+    struct pollfd   pfd = { .fd = s_fd, .events = POLLIN };
+    ssize_t         count;
+    int             ret;
+
+    if (s_rx_fill >= sizeof(s_rx_buffer)) {
+        return false;
+    }
+
+    ret = poll(&pfd, 1, (int) timeout_ms);
+
+    if (ret <= 0) {
+        return false;
+    }
+
+    count = read(s_fd, &s_rx_buffer[s_rx_fill], sizeof(s_rx_buffer) - s_rx_fill);
+
+    if (count <= 0) {
+        return false;
+    }
+
+    s_rx_fill += (size_t) count;
+
+    return true;
+}
+
+/*  Waits until the RX buffer holds at least one complete line (or enough data to pass the wakeup level) when
+    wait_for_line is set, or any data at all otherwise. Returns the number of bytes available (0 on timeout). */
+static size_t posix_uart_rx_wait(bool wait_for_line, uint32_t timeout_ms) {
+    uint32_t start = da16k_posix_time_ms();
+    uint32_t elapsed;
+
+    while (true) {
+        if (s_rx_fill > 0 && (!wait_for_line || memchr(s_rx_buffer, '\n', s_rx_fill) != NULL ||
+                              s_rx_fill >= POSIX_UART_RX_WAKEUP_LEVEL)) {
+            break;
+        }
+
+        elapsed = da16k_posix_time_ms() - start;
+
+        /* Data that has arrived already is picked up even without any time left */
+        if (!posix_uart_fill((elapsed < timeout_ms) ? (timeout_ms - elapsed) : 0) || elapsed >= timeout_ms) {
+            break;
+        }
+    }
+
+    return s_rx_fill;
+}
+
+static size_t posix_uart_rx_pop(char *dst, size_t length) {
+    size_t count = (length < s_rx_fill) ? length : s_rx_fill;
+
+    memcpy(dst, s_rx_buffer, count);
+    memmove(s_rx_buffer, &s_rx_buffer[count], s_rx_fill - count);
+    s_rx_fill -= count;
+
+    return count;
+}
+
+da16k_err_t da16k_uart_read(char *dst, size_t length, size_t *received, uint32_t timeout_ms) {
+    if (dst == NULL || received == NULL || length == 0) {
+        return DA16K_INVALID_PARAMETER;
+    }
+
+    *received = 0;
+
+    if (s_fd < 0) {
+        return DA16K_NOT_INITIALIZED;
+    }
+
+    /* A partial line is returned if the timeout elapses before the line is complete */
+    if (posix_uart_rx_wait(true, timeout_ms) == 0) {
+        return DA16K_TIMEOUT;
+    }
+
+    *received = posix_uart_rx_pop(dst, length);
+
+    return DA16K_SUCCESS;
+}
+
+da16k_err_t da16k_uart_get_char(char *dst, uint32_t timeout_ms) {
+    if (dst == NULL) {
+        return DA16K_INVALID_PARAMETER;
+    }
+
+    if (s_fd < 0) {
+        return DA16K_NOT_INITIALIZED;
+    }
+
+    if (posix_uart_rx_wait(false, timeout_ms) == 0) {
+        return DA16K_TIMEOUT;
+    }
+
+    posix_uart_rx_pop(dst, 1);
+
+    return DA16K_SUCCESS;
+}
+
+bool da16k_uart_set_baud(uint32_t baud_rate) {
+    if (s_fd < 0) {
+        return false;
+    }
+
+    /* Pipes and sockets accept any rate, the gateway simulator paces itself */
+    return posix_uart_configure(s_fd, baud_rate, true);
+}
+
+uint32_t da16k_uart_rx_overruns(void) {
+    /* Nothing is lost, data that does not fit into the RX buffer stays in the kernel's */
+    return 0;
+}
+
+void da16k_uart_close(void) {
+    if (s_fd >= 0 && !s_fd_attached) {
+        close(s_fd);
+        s_fd = -1;
+    }
+
+    s_rx_fill = 0;
+}
+
+#endif /* DA16K_CONFIG_POSIX */
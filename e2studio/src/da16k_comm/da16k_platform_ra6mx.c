@@ -20,7 +20,7 @@
 #include "da16k_comm/da16k_uart.h"
 
 #include "FreeRTOS.h"
-#include "queue.h"
+#include "semphr.h"
 #include "task.h"
 
 #define _SCI_VECTOR(channel, interrupt) VECTOR_NUMBER_SCI ## channel ## _ ## interrupt
@@ -30,7 +30,23 @@
 
 #define RA6MX_UART_TIMEOUT_MS       DA16K_UART_TIMEOUT_MS
 
-#define RA6MX_UART_RX_FIFO_SIZE     1024
+/*  Received bytes are stored in a ring buffer by the UART ISR. The reading task is only woken up once a complete
+    line has arrived or the ring buffer has filled up to the wakeup threshold, instead of once per byte. */
+#define RA6MX_UART_RX_FIFO_SIZE     1024    /* Must be a power of 2 */
+#define RA6MX_UART_RX_WAKEUP_LEVEL  (RA6MX_UART_RX_FIFO_SIZE / 2)
+
+/*  Scatter-gather transmissions are gathered here so a whole AT frame goes out with a single R_SCI_B_UART_Write.
+    Larger frames are sent in chunks. Without DA16K_CONFIG_RENESAS_SCI_TRANSFER_TX, the bytes are fed to the SCI by
+    its TXI interrupt; with it, by a single DTC/DMAC transfer per chunk. */
+#define RA6MX_UART_TX_BUFFER_SIZE   1024
+
+#if defined(DA16K_CONFIG_RENESAS_SCI_TRANSFER_TX)
+/* Transfer instance (r_dtc or r_dmac) set up for the SCI's TXI in the project stack, declared by hal_data.h */
+extern const transfer_instance_t DA16K_CONFIG_RENESAS_SCI_TRANSFER_TX;
+#define RA6MX_UART_TRANSFER_TX      (&DA16K_CONFIG_RENESAS_SCI_TRANSFER_TX)
+#else
+#define RA6MX_UART_TRANSFER_TX      NULL
+#endif
 
 static sci_b_uart_instance_ctrl_t ra6_uart_ctrl = {0};
 
@@ -52,13 +68,47 @@ static sci_b_uart_extended_cfg_t ra6_uart_cfg_extend = {
                                                     },
 };
 
-static bool             g_tx_complete = false;
-static QueueHandle_t    g_rx_char_fifo;
+static SemaphoreHandle_t    g_tx_complete   = NULL;
+static uint8_t              g_tx_buffer[RA6MX_UART_TX_BUFFER_SIZE];
+
+/* RX ring buffer: head is only written by the ISR, tail only by the reader. Both are free-running. */
+static uint8_t              g_rx_fifo[RA6MX_UART_RX_FIFO_SIZE];
+static volatile uint32_t    g_rx_head       = 0;
+static volatile uint32_t    g_rx_tail       = 0;
+static volatile uint32_t    g_rx_lines      = 0;    /* Number of '\n' characters in the ring buffer */
+static volatile uint32_t    g_rx_overruns   = 0;    /* Bytes lost due to a full ring buffer or hardware overrun */
+static volatile bool        g_rx_waiting    = false; /* A task is blocked in ra6mx_uart_rx_wait */
+static SemaphoreHandle_t    g_rx_available  = NULL; /* Given from the ISR while a task is waiting */
+static bool                 g_rx_ready      = false;
+
+/* Called from the ISR for every received byte */
+static void ra6mx_uart_rx_push(uint8_t received_char) {
+    uint32_t    head    = g_rx_head;
+    uint32_t    fill    = head - g_rx_tail;
+    BaseType_t  higher_priority_task_woken = pdFALSE;
+
+    if (fill >= RA6MX_UART_RX_FIFO_SIZE) {
+        g_rx_overruns++;
+        return;
+    }
+
+    g_rx_fifo[head & (RA6MX_UART_RX_FIFO_SIZE - 1)] = received_char;
+    g_rx_head = head + 1;
+    fill++;
+
+    if (received_char == '\n') {
+        __atomic_fetch_add(&g_rx_lines, 1, __ATOMIC_RELAXED);
+    }
+
+    /* Line-level wakeup */
+    if ((received_char == '\n' || fill >= RA6MX_UART_RX_WAKEUP_LEVEL) && g_rx_waiting) {
+        xSemaphoreGiveFromISR(g_rx_available, &higher_priority_task_woken);
+        portYIELD_FROM_ISR(higher_priority_task_woken);
+    }
+}
 
 static void ra6mx_uart_callback (uart_callback_args_t * p_args)
 {
-    char received_char;
-
     if (p_args == NULL) {
         /* something went *very* wrong */
         return;
@@ -69,13 +119,19 @@ static void ra6mx_uart_callback (uart_callback_args_t * p_args)
     {
         case UART_EVENT_RX_CHAR:
         {
-            received_char = (char) p_args->data;
-            xQueueSendToBackFromISR(g_rx_char_fifo, &received_char, NULL);
+            ra6mx_uart_rx_push((uint8_t) p_args->data);
+            break;
+        }
+        case UART_EVENT_ERR_OVERFLOW:
+        {
+            g_rx_overruns++;
             break;
         }
         case UART_EVENT_TX_COMPLETE:
         {
-            g_tx_complete = true;
+            BaseType_t higher_priority_task_woken = pdFALSE;
+            xSemaphoreGiveFromISR(g_tx_complete, &higher_priority_task_woken);
+            portYIELD_FROM_ISR(higher_priority_task_woken);
             break;
         }
         default:
@@ -94,7 +150,7 @@ static uart_cfg_t ra6_uart_cfg = {
                                 .p_callback = ra6mx_uart_callback,
                                 .p_context = NULL,
                                 .p_extend = &ra6_uart_cfg_extend,
-                                .p_transfer_tx = NULL,
+                                .p_transfer_tx = RA6MX_UART_TRANSFER_TX,
                                 .p_transfer_rx = NULL,
                                 .rxi_ipl = (12),
                                 .txi_ipl = (12),
@@ -110,11 +166,26 @@ bool da16k_uart_init(void) {
 
     fsp_err_t ret = FSP_SUCCESS;
 
-    /* implement char FIFO using a FreeRTOS queue */
+    /* RX ring buffer starts out empty */
+
+    g_rx_head       = 0;
+    g_rx_tail       = 0;
+    g_rx_lines      = 0;
+    g_rx_waiting    = false;
 
-    g_rx_char_fifo = xQueueCreate(RA6MX_UART_RX_FIFO_SIZE, sizeof(char));
+    /*  RX data and TX completion are signalled from the UART ISR. These use their own semaphores rather than task
+        notifications, which the library's tasks already use for their own wakeups. They are created once and kept
+        when the UART is initialized again (da16k_init, da16k_link_init). */
 
-    if (g_rx_char_fifo == NULL) {
+    if (g_rx_available == NULL) {
+        g_rx_available = xSemaphoreCreateBinary();
+    }
+
+    if (g_tx_complete == NULL) {
+        g_tx_complete = xSemaphoreCreateBinary();
+    }
+
+    if (g_rx_available == NULL || g_tx_complete == NULL) {
         return false;
     }
 
@@ -133,42 +204,191 @@ bool da16k_uart_init(void) {
 
     ret = R_SCI_B_UART_CallbackSet(&ra6_uart_ctrl, ra6mx_uart_callback, NULL, NULL);
 
-    return (ret == FSP_SUCCESS);
+    g_rx_ready = (ret == FSP_SUCCESS);
+
+    return g_rx_ready;
 }
 
-bool da16k_uart_send(const char *src, size_t length) {
+/* Writes a contiguous block and blocks the calling task (without spinning) until transmission is complete */
+static bool ra6mx_uart_write_blocking(const uint8_t *src, size_t length) {
     fsp_err_t err;
 
-    g_tx_complete = false;
+    if (length == 0) {
+        return true;
+    }
 
-    err = R_SCI_B_UART_Write(&ra6_uart_ctrl, (const uint8_t *) src, length);
+    /* Clear any stale completion from a previous, timed out transmission */
+    xSemaphoreTake(g_tx_complete, 0);
 
-    while (err == FSP_SUCCESS && !g_tx_complete) { taskYIELD(); }
+    err = R_SCI_B_UART_Write(&ra6_uart_ctrl, src, length);
 
-    return (err == FSP_SUCCESS);
+    if (err != FSP_SUCCESS) {
+        return false;
+    }
+
+    return xSemaphoreTake(g_tx_complete, pdMS_TO_TICKS(RA6MX_UART_TIMEOUT_MS)) == pdTRUE;
 }
 
-da16k_err_t da16k_uart_get_char(char *dst, uint32_t timeout_ms) {
+bool da16k_uart_send(const char *src, size_t length) {
+    return ra6mx_uart_write_blocking((const uint8_t *) src, length);
+}
+
+bool da16k_uart_sendv(const da16k_uart_iovec_t *iov, size_t count) {
+    size_t fill = 0;
+
+    if (iov == NULL) {
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const char *src         = iov[i].data;
+        size_t      remaining   = iov[i].length;
+
+        while (remaining > 0) {
+            size_t chunk = RA6MX_UART_TX_BUFFER_SIZE - fill;
+
+            if (chunk > remaining) {
+                chunk = remaining;
+            }
+
+            memcpy(&g_tx_buffer[fill], src, chunk);
+            fill        += chunk;
+            src         += chunk;
+            remaining   -= chunk;
+
+            /* Only flush early if the frame doesn't fit into the TX buffer */
+            if (fill == RA6MX_UART_TX_BUFFER_SIZE) {
+                if (!ra6mx_uart_write_blocking(g_tx_buffer, fill)) {
+                    return false;
+                }
+                fill = 0;
+            }
+        }
+    }
+
+    return ra6mx_uart_write_blocking(g_tx_buffer, fill);
+}
+
+/*  Waits until the RX ring buffer holds at least one complete line (or enough data to pass the wakeup level) when
+    wait_for_line is set, or any data at all otherwise. Returns the number of bytes available (0 on timeout). */
+static uint32_t ra6mx_uart_rx_wait(bool wait_for_line, uint32_t timeout_ms) {
+    TickType_t  start       = xTaskGetTickCount();
+    TickType_t  timeout     = pdMS_TO_TICKS(timeout_ms);
+    TickType_t  elapsed;
+    uint32_t    available;
+
+    /* Drop a wakeup left over from an earlier wait */
+    xSemaphoreTake(g_rx_available, 0);
+    g_rx_waiting = true;
+
+    while (true) {
+        available = g_rx_head - g_rx_tail;
+
+        if (available > 0 && (!wait_for_line || g_rx_lines > 0 || available >= RA6MX_UART_RX_WAKEUP_LEVEL)) {
+            break;
+        }
+
+        elapsed = xTaskGetTickCount() - start;
 
-    BaseType_t ret;
+        if (elapsed >= timeout) {
+            break;
+        }
+
+        /* Data arriving between the check above and this call leaves the semaphore given, so it is not missed */
+        xSemaphoreTake(g_rx_available, timeout - elapsed);
+    }
+
+    g_rx_waiting = false;
+
+    return available;
+}
+
+/* Copies up to length bytes out of the RX ring buffer */
+static size_t ra6mx_uart_rx_pop(char *dst, size_t length) {
+    uint32_t    tail        = g_rx_tail;
+    uint32_t    available   = g_rx_head - tail;
+    uint32_t    lines       = 0;
+    size_t      count       = (length < available) ? length : available;
+
+    for (size_t i = 0; i < count; i++) {
+        dst[i] = (char) g_rx_fifo[(tail + i) & (RA6MX_UART_RX_FIFO_SIZE - 1)];
+
+        if (dst[i] == '\n') {
+            lines++;
+        }
+    }
+
+    g_rx_tail = tail + count;
+    __atomic_fetch_sub(&g_rx_lines, lines, __ATOMIC_RELAXED);
+
+    return count;
+}
+
+da16k_err_t da16k_uart_read(char *dst, size_t length, size_t *received, uint32_t timeout_ms) {
+    if (dst == NULL || received == NULL || length == 0) {
+        return DA16K_INVALID_PARAMETER;
+    }
 
-    if (g_rx_char_fifo == NULL) {
+    *received = 0;
+
+    if (!g_rx_ready) {
         return DA16K_NOT_INITIALIZED;
     }
 
-    ret = xQueueReceive(g_rx_char_fifo, dst, pdMS_TO_TICKS(timeout_ms));
+    /* A partial line is returned if the timeout elapses before the line is complete */
+    if (ra6mx_uart_rx_wait(true, timeout_ms) == 0) {
+        return DA16K_TIMEOUT;
+    }
 
-    if (ret == pdFALSE) {
+    *received = ra6mx_uart_rx_pop(dst, length);
+
+    return DA16K_SUCCESS;
+}
+
+da16k_err_t da16k_uart_get_char(char *dst, uint32_t timeout_ms) {
+    if (dst == NULL) {
+        return DA16K_INVALID_PARAMETER;
+    }
+
+    if (!g_rx_ready) {
+        return DA16K_NOT_INITIALIZED;
+    }
+
+    if (ra6mx_uart_rx_wait(false, timeout_ms) == 0) {
         return DA16K_TIMEOUT;
     }
 
+    ra6mx_uart_rx_pop(dst, 1);
+
     return DA16K_SUCCESS;
 }
 
 void da16k_uart_close(void) {
+    g_rx_ready = false;
     R_SCI_B_UART_Close(&ra6_uart_ctrl);
 }
 
+uint32_t da16k_uart_rx_overruns(void) {
+    return g_rx_overruns;
+}
+
+bool da16k_uart_set_baud(uint32_t baud_rate) {
+    sci_b_baud_setting_t baud_setting = {0};
+
+    /* Transmissions are complete when da16k_uart_send(v) returns, so nothing is cut off here */
+    if (R_SCI_B_UART_BaudCalculate(baud_rate, false, 5*1000, &baud_setting) != FSP_SUCCESS) {
+        return false;
+    }
+
+    if (R_SCI_B_UART_BaudSet(&ra6_uart_ctrl, &baud_setting) != FSP_SUCCESS) {
+        return false;
+    }
+
+    ra6_uart_baud_setting = baud_setting;
+
+    return true;
+}
+
 #if defined(DA16K_CONFIG_EK_RA6M4)
 #include "usb_console_main.h"
 #define EK_RA6M4_PRINTF_BUFFER_SIZE 512
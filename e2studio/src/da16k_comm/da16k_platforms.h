@@ -23,6 +23,12 @@
 
         On EK_RA6M4: PMOD1 - 9  | PMOD2 - 0
         On CK_RA6M5: PMOD1 - 9  | PMOD2 - 0
+
+    The configuration MAY define the following value:
+        DA16K_CONFIG_RENESAS_SCI_TRANSFER_TX
+
+        Name of a transfer instance (r_dtc or r_dmac, e.g. g_transfer_da16k_tx) set up in the stack for the UART
+        channel's TXI, so that transmissions are done by one transfer each instead of an interrupt per byte.
 */
 
 /* Renesas CK-RA6M5 config helper */
@@ -46,6 +52,15 @@ void ek_ra6m4_printf(const char *format, ...);
 #define DA16K_CONFIG_FREERTOS
 #endif
 
+/* POSIX host (Linux) config helper, see da16k_platform_posix.c */
+#if defined(DA16K_CONFIG_POSIX)
+#include <stdint.h>
+uint32_t da16k_posix_time_ms(void);
+#if !defined(DA16K_CONFIG_TIME_MS_FN)
+#define DA16K_CONFIG_TIME_MS_FN                 da16k_posix_time_ms
+#endif
+#endif
+
 /* System endianness helper */
 # if    (defined(__BIG_ENDIAN__)) || \
         (defined(__BYTE_ORDER__)  && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__) || \
@@ -11,15 +11,7 @@
 #define DA16K_COMM_DA16K_PRIVATE_H_
 
 #include "da16k_comm.h"
-
-typedef enum {
-    DA16K_CERT_MQTT_ROOT_CA     = 0,
-    DA16K_CERT_MQTT_DEV_CERT    = 1,
-    DA16K_CERT_MQTT_DEV_KEY     = 2,
-    DA16K_CERT_HTTP_ROOT_CA     = 3,
-    DA16K_CERT_HTTP_DEV_CERT    = 4,
-    DA16K_CERT_HTTP_DEV_KEY     = 5,
-} da16k_cert_type_t;
+#include "da16k_uart.h"
 
 /* AT helper macros */
 #define AT_ESC                  "\x1B"
@@ -31,27 +23,80 @@ typedef enum {
 #define YELLOW_COLOR            "\33[1;33m"
 #define CLEAR_COLOR             "\33[0m"
 
-/* Refer to AT Command protocol */
+/* Refer to AT Command protocol. Tuples per frame if the gateway does not report its limits. */
 #define DA16K_MSG_TUPLES_PER_ITERATION (8)
 
-#define DA16K_CONFIG_PRINT_DEBUG
-#define DA16K_CONFIG_PRINT_WARN
+/*  Upper bound of the tuples per frame, whatever the gateway reports. Sizes the frame buffer below. */
+#if !defined(DA16K_CONFIG_MSG_MAX_TUPLES_PER_FRAME)
+#define DA16K_CONFIG_MSG_MAX_TUPLES_PER_FRAME   32
+#endif
+
+#if DA16K_CONFIG_MSG_MAX_TUPLES_PER_FRAME < DA16K_MSG_TUPLES_PER_ITERATION
+#error "DA16K_CONFIG_MSG_MAX_TUPLES_PER_FRAME must be at least DA16K_MSG_TUPLES_PER_ITERATION"
+#endif
+
+/* Telemetry frames start with this, the tuples follow */
+#define DA16K_MSG_FRAME_PREFIX          "AT+NWICEXMSG "     /* Space is important... */
 
-#define DA16K_DEBUG(...) do {} while (0)
-#define DA16K_WARN( ...) do {} while (0)
+/*  Scatter-gather AT frame sizing: command prefix, CRLF and up to 5 segments per tuple (type, key, comma, value, comma)
+    The scratch area holds encoded (hex) values, 16 characters + null terminator for the largest type. */
+#define DA16K_AT_FRAME_MAX_SEGMENTS     (2 + (DA16K_CONFIG_MSG_MAX_TUPLES_PER_FRAME * 5))
+#define DA16K_AT_FRAME_SCRATCH_SIZE     (DA16K_CONFIG_MSG_MAX_TUPLES_PER_FRAME * 17)
 
+/*  An AT command that is assembled from segments referencing existing memory and sent out in one go
+    using da16k_uart_sendv. There is no limit to the overall length other than what the AT gateway accepts. */
+typedef struct {
+    da16k_uart_iovec_t  segments[DA16K_AT_FRAME_MAX_SEGMENTS];
+    size_t              segment_count;
+    size_t              length;
+    char                scratch[DA16K_AT_FRAME_SCRATCH_SIZE];
+    size_t              scratch_used;
+    bool                overflow;       /* Set if a segment or scratch space did not fit */
+} da16k_at_frame_t;
+
+/*  Log level. The former switches DA16K_CONFIG_PRINT_DEBUG and DA16K_CONFIG_PRINT_WARN select the levels as before. */
+#if !defined(DA16K_CONFIG_LOG_LEVEL)
 #if defined(DA16K_CONFIG_PRINT_DEBUG)
+#define DA16K_CONFIG_LOG_LEVEL  DA16K_LOG_LEVEL_DEBUG
+#else
+#define DA16K_CONFIG_LOG_LEVEL  DA16K_LOG_LEVEL_WARN
+#endif
+#endif
+
+#if defined(DA16K_CONFIG_LOG_DEFERRED)
+/* Stores a log record for da16k_log_flush (da16k_log.c) */
+#if defined(__GNUC__)
+__attribute__((format(printf, 4, 5)))
+#endif
+void        da16k_log_write             (uint8_t level, const char *function, int line, const char *format, ...);
+
+#define DA16K_LOG(level, color, fmt, ...) do { da16k_log_write(level, __func__, __LINE__, fmt, ##__VA_ARGS__); } while (0)
+#else
+#define DA16K_LOG(level, color, fmt, ...) do { DA16K_PRINT(color "[%s:%d] " fmt CLEAR_COLOR, __func__, __LINE__, ##__VA_ARGS__); } while (0)
+#endif
+
+/* Levels that are compiled out still see their arguments, so nothing is left unused, but generate no code */
+#define DA16K_LOG_NOTHING(...) do { if (0) { DA16K_PRINT(__VA_ARGS__); } } while (0)
+
+#define DA16K_DEBUG(...) DA16K_LOG_NOTHING(__VA_ARGS__)
+#define DA16K_WARN( ...) DA16K_LOG_NOTHING(__VA_ARGS__)
+#define DA16K_ERROR(...) DA16K_LOG_NOTHING(__VA_ARGS__)
+
+#if DA16K_CONFIG_LOG_LEVEL >= DA16K_LOG_LEVEL_DEBUG
 #undef  DA16K_DEBUG
-#define DA16K_DEBUG(fmt, ...) do { DA16K_PRINT(GREEN_COLOR  "[%s:%d] " fmt CLEAR_COLOR, __func__, __LINE__, ##__VA_ARGS__); } while (0)
+#define DA16K_DEBUG(fmt, ...) DA16K_LOG(DA16K_LOG_LEVEL_DEBUG, GREEN_COLOR,  fmt, ##__VA_ARGS__)
 #endif
 
-#if defined(DA16K_CONFIG_PRINT_WARN)
+#if DA16K_CONFIG_LOG_LEVEL >= DA16K_LOG_LEVEL_WARN
 #undef  DA16K_WARN
-#define DA16K_WARN( fmt, ...) do { DA16K_PRINT(YELLOW_COLOR "[%s:%d] " fmt CLEAR_COLOR, __func__, __LINE__, ##__VA_ARGS__); } while (0)
+#define DA16K_WARN( fmt, ...) DA16K_LOG(DA16K_LOG_LEVEL_WARN,  YELLOW_COLOR, fmt, ##__VA_ARGS__)
 #endif
 
-/* Errors should always be printed. */
-#define DA16K_ERROR(fmt, ...) do { DA16K_PRINT(RED_COLOR    "[%s:%d] " fmt CLEAR_COLOR, __func__, __LINE__, ##__VA_ARGS__); } while (0)
+/* Errors are printed unless logging is turned off completely (DA16K_LOG_LEVEL_NONE) */
+#if DA16K_CONFIG_LOG_LEVEL >= DA16K_LOG_LEVEL_ERROR
+#undef  DA16K_ERROR
+#define DA16K_ERROR(fmt, ...) DA16K_LOG(DA16K_LOG_LEVEL_ERROR, RED_COLOR,    fmt, ##__VA_ARGS__)
+#endif
 
 /* Helper macro to cleanly return a meaningful error on NULL whilst informing user properly */
 #define DA16K_RETURN_ON_NULL(return_value, ptr) if (ptr == NULL) { DA16K_ERROR("ERROR - '" #ptr "' is NULL! Result = '" #return_value "'\r\n"); return return_value; }
@@ -62,41 +107,167 @@ void       *da16k_malloc                (size_t size);
 void        da16k_free                  (void *ptr);
 char       *da16k_strdup                (const char *src);
 char       *da16k_strndup               (const char *src, size_t size);
+/*  Monotonic time in milliseconds (wraps around), see DA16K_CONFIG_TIME_MS_FN. */
+uint32_t    da16k_get_time_ms           (void);
+/*  AT channel lock, held by da16k_at_transact while a transaction runs and by anything else touching the AT state.
+    The lock is recursive. Without an RTOS, these are no-ops. */
+bool        da16k_at_channel_init       (void);
+void        da16k_at_channel_lock       (void);
+void        da16k_at_channel_unlock     (void);
+/*  CRC-32 (IEEE 802.3, as used by zlib) of length bytes. Start with crc = 0, pass the previous result to continue. */
+uint32_t    da16k_crc32                 (uint32_t crc, const void *data, size_t length);
+/*  Waits for ms milliseconds, yielding to other tasks if there is an RTOS */
+void        da16k_sleep_ms              (uint32_t ms);
+
+#define DA16K_SHA256_SIZE               32
+
+typedef struct {
+    uint32_t            state[8];
+    uint64_t            length;
+    uint8_t             block[64];
+    size_t              used;
+} da16k_sha256_t;
+
+/*  SHA-256, fed in pieces of any size */
+void        da16k_sha256_init           (da16k_sha256_t *sha);
+void        da16k_sha256_update         (da16k_sha256_t *sha, const void *data, size_t length);
+void        da16k_sha256_final          (da16k_sha256_t *sha, uint8_t digest[DA16K_SHA256_SIZE]);
+/* Encodes a digest as lower case ASCII hex in byte order. dst MUST be 65 (64 + null terminator) bytes long at least. */
+void        da16k_sha256_to_hex         (char *dst, const uint8_t digest[DA16K_SHA256_SIZE]);
 /* Encodes a boolean to ASCII hex. dst MUST be 3 (2 + null terminator) bytes long at least. */
 bool        da16k_bool_to_ascii_hex     (char *dst, bool value);
+/* Encodes a float to ASCII hex. dst MUST be 9 (8 + null terminator) bytes long at least. */
+bool        da16k_float_to_ascii_hex    (char *dst, float value);
 /* Encodes a double to ASCII hex. dst MUST be 17 (16 + null terminator) bytes long at least. */
 bool        da16k_double_to_ascii_hex   (char *dst, double value);
 
+/* internal message functionality (da16k_comm.c) */
+
+/*  Library state and UART setup of da16k_init, without talking to the gateway */
+da16k_err_t da16k_init_local            (const da16k_cfg_t *cfg);
+/*  Configures the IoTC settings the gateway does not have yet (all with full_setup or without
+    DA16K_CONFIG_WARM_START) and (re)starts the session as needed, see da16k_setup_iotc_and_connect. */
+da16k_err_t da16k_setup_iotc            (const da16k_iotc_cfg_t *cfg, bool full_setup);
+/*  Queries the IoTC session state. Returns DA16K_AT_ERROR_CODE if the gateway does not support the query. */
+da16k_err_t da16k_get_iotc_status       (bool *connected);
+/*  Queries whether the gateway has joined the WiFi network ssid (NULL = any network). */
+da16k_err_t da16k_get_wifi_status       (const char *ssid, bool *joined);
+/*  Appends copies of all tuples of src to dst. Either all tuples are added or none. */
+da16k_err_t da16k_msg_append            (da16k_msg_t *dst, const da16k_msg_t *src);
+/*  Fill level of a message, to remove the tuples added after it with da16k_msg_rollback */
+typedef struct {
+    size_t      count;
+    char       *string_top;
+} da16k_msg_mark_t;
+
+void        da16k_msg_mark              (const da16k_msg_t *msg, da16k_msg_mark_t *mark);
+void        da16k_msg_rollback          (da16k_msg_t *msg, const da16k_msg_mark_t *mark);
+/*  Renders up to max_count tuples of msg, starting with tuple first, into dst the way they are sent in an
+    AT+NWICEXMSG frame ("<type>,<key>,<value>,..."). Stops at the first tuple that does not fit into size bytes.
+    length receives the number of characters written (no null terminator), count the number of tuples.
+    Returns DA16K_AT_MESSAGE_TOO_LONG if not even the first tuple fits. */
+da16k_err_t da16k_msg_render            (const da16k_msg_t *msg, size_t first, size_t max_count, char *dst, size_t size,
+                                         size_t *length, size_t *count);
+/*  Sends tuples rendered by da16k_msg_render (within the limits of da16k_msg_frame_limits) as one AT+NWICEXMSG
+    frame, in a transaction of bulk priority. */
+da16k_err_t da16k_send_msg_rendered     (const char *tuples, size_t length);
+/*  Limits of a single AT+NWICEXMSG frame: tuples, and characters of tuple data (SIZE_MAX = no limit) */
+void        da16k_msg_frame_limits      (size_t *max_tuples, size_t *max_length);
+/*  Number of characters tuples first to first + count - 1 take up in a frame */
+size_t      da16k_msg_encoded_length    (const da16k_msg_t *msg, size_t first, size_t count);
+/*  Like da16k_send_msg, frames receives the number of frames sent */
+da16k_err_t da16k_send_msg_frames       (const da16k_msg_t *msg, size_t *frames);
+
+/* Connection supervisor (da16k_link.c) */
+
+/*  Operations report their results here, so the supervisor notices a failing link without probing */
+void        da16k_link_report           (da16k_err_t result);
+/*  False while the supervisor runs and the IoTC session is known to be down */
+bool        da16k_link_usable           (void);
+
+/* Response timing (da16k_timing.c) */
+
+/*  Forgets all measurements. network_timeout_ms is used for network commands until they have been measured. */
+void                da16k_timing_init       (uint32_t network_timeout_ms);
+/*  Class of an AT command line */
+da16k_at_class_t    da16k_timing_classify   (const char *command);
+/*  An AT command of at_class is sent out / its response has been received with result. Only called within
+    transactions, da16k_at.c does this for everything sent through it. begin returns true if the previous command
+    timed out, its response may still arrive. */
+bool                da16k_timing_begin      (da16k_at_class_t at_class);
+/*  Like da16k_timing_begin for a command that was sent at start_ms already (pipelined frames) */
+bool                da16k_timing_begin_at   (da16k_at_class_t at_class, uint32_t start_ms);
+void                da16k_timing_end        (da16k_err_t result);
+/*  Response timeout for the command that has just been sent out */
+uint32_t            da16k_timing_timeout_ms (void);
+
+/* AT layer statistics (da16k_stats.c), only recorded within transactions */
+
+/*  A command of at_class has been sent out / its response has been received with result after elapsed_ms.
+    da16k_timing.c records these along with its measurements. */
+void        da16k_stats_command         (da16k_at_class_t at_class);
+void        da16k_stats_response        (da16k_at_class_t at_class, da16k_err_t result, uint32_t elapsed_ms);
+/*  Bytes sent to and received from the UART, lines truncated and unsolicited lines received by da16k_at.c */
+void        da16k_stats_tx              (size_t bytes);
+void        da16k_stats_rx              (size_t bytes);
+void        da16k_stats_rx_truncated    (void);
+void        da16k_stats_urc             (void);
+
+#if defined(DA16K_CONFIG_FREERTOS)
+/* Asynchronous telemetry (da16k_async.c) */
+
+/*  Lets the worker task look at the queue again, e.g. once the link is back up */
+void        da16k_async_wake            (void);
+#endif
+
+/* AT transaction scheduling (da16k_sched.c) */
+
+/*  A transaction sends one AT command and receives its complete response. It has exclusive use of the AT channel,
+    i.e. the functions & buffers in da16k_at.c and the telemetry frame, for as long as it runs. */
+typedef da16k_err_t (*da16k_at_transaction_t)(void *context);
+
+/*  Runs a transaction and returns its result. If the scheduler is running, the owner task carries it out according
+    to its priority while the caller waits, otherwise it runs in the calling task. Transactions started from within
+    a transaction run immediately. */
+da16k_err_t da16k_at_transact           (da16k_priority_t priority, da16k_at_transaction_t transaction, void *context);
+
 /* internal AT protocol functionality (da16k_at.c) */
 
-/*  Wait for, receive and validate an AT response with a given timeout in milliseconds.
+/*  Wait for, receive and validate an AT response with a given timeout in milliseconds (0 = adaptive, see
+    da16k_get_timing_stats). The round-trip time is measured from the command sent before.
 
     Example for the following call:
-        da16k_at_receive_and_validate_response(buf, buf_size, true, "+NWICGETCMD:");
+        da16k_at_receive_and_validate_response(true, "+NWICGETCMD", timeout_ms);
     with the response: 
         > +NWICGETCMD:set_red_led on
         > OK
     would put "set_red_led on" into the internal response buffer. The same call with the response:
         > ERROR:7
-        > OK
-    would put "7" into the internal response buffer. 
+    would put "7" into the internal response buffer and return DA16K_AT_ERROR_CODE.
+
+    The expected response and the "OK" may arrive in any order. An "ERROR" always ends the response.
+    Unsolicited lines received in between are passed on to the registered URC handlers.
 
     If expected_response is NULL, only an incoming "OK" will be verified, nothing else.
     In this case, an incoming OK will automatically be interpreted as success and response parsing will stop there.
     This is useful for commands that expect nothing other than an "OK".
 
+    If error_possible is false, an "ERROR" is additionally reported as an error in the debug output.
+
     On DA16K_SUCCESS, the response can then be obtained either as a string or integer. */
 da16k_err_t da16k_at_receive_and_validate_response          (bool error_possible, const char *expected_response, uint32_t timeout_ms);
 /*  Send a printf-style formatted string to the DA16K module. This string would contain a valid AT command of some sort. 
 
     \r\n is added by this function automatically.
 
-    The caller must receive and validate the response using da16k_at_receive_and_validate_response. */
+    The caller must receive and validate the response using da16k_at_receive_and_validate_response,
+    within the same transaction. */
 da16k_err_t da16k_at_send_formatted_msg                     (const char *format, ...);
 /*  Send a printf-style formatted string to the DA16K module.
     Does not add a \r\n at the end.
 
-    Can be used in multi-part command sending. Beware that at the end you still need to send a \r\n and validate the response.
+    Can be used in multi-part command sending within a transaction. Beware that at the end you still need to send a \r\n
+    and validate the response.
 
     You may also finalize the command by calling da16k_at_send_formatted_and_check_success with an empty format string. */
 da16k_err_t da16k_at_send_formatted_raw_no_crlf             (const char *format, ...);
@@ -106,17 +277,49 @@ da16k_err_t da16k_at_send_formatted_raw_no_crlf             (const char *format,
     It can also be used by commands that do not return a response other than "OK".
     In this case, expected_response may be set to NULL, and only an incoming "OK" will be verified, nothing else.
 
-    The repsonse does not to be validated or retreived by the caller.
+    The repsonse does not to be validated or retreived by the caller. Runs as a transaction of normal priority.
 
     \r\n is added by this function automatically.
 
     returns DA16K_SUCCESS if the command was sent out successfully, the response was proper and had a return code of 1. */
 da16k_err_t da16k_at_send_formatted_and_check_success       (uint32_t timeout_ms, const char *expected_response, const char *format, ...);
-/*  Sends a PEM format certificate to the DA16K. See da16k_cert_type_t enum for supported types. */
-da16k_err_t da16k_at_send_certificate                       (da16k_cert_type_t type, const char *cert);
+/*  Streams a PEM format certificate to the DA16K in chunks of DA16K_CONFIG_CERT_CHUNK_SIZE bytes. See
+    da16k_cert_type_t enum for supported types. digest receives the SHA-256 of what was actually sent. */
+da16k_err_t da16k_at_send_certificate                       (da16k_cert_type_t type, const da16k_cert_source_t *source,
+                                                             uint8_t digest[DA16K_SHA256_SIZE]);
+/*  SHA-256 of a PEM format certificate as da16k_at_send_certificate would send it, without sending anything. Read
+    callbacks fill the same buffer of DA16K_CONFIG_CERT_CHUNK_SIZE bytes as for uploads. */
+da16k_err_t da16k_at_certificate_digest                     (const da16k_cert_source_t *source, uint8_t digest[DA16K_SHA256_SIZE]);
+/*  Resets a frame so a new command can be assembled in it */
+void        da16k_at_frame_init                             (da16k_at_frame_t *frame);
+/*  Appends a segment to the frame. The data is referenced, not copied, and must remain valid until the frame is sent. */
+void        da16k_at_frame_add                              (da16k_at_frame_t *frame, const char *data, size_t length);
+/*  Appends a null-terminated string to the frame. The string is referenced, not copied. */
+void        da16k_at_frame_add_str                          (da16k_at_frame_t *frame, const char *str);
+/*  Reserves size bytes of scratch space in the frame, e.g. to encode values into before adding them as segment.
+    Returns NULL if the scratch space is exhausted. */
+char       *da16k_at_frame_scratch                          (da16k_at_frame_t *frame, size_t size);
+/*  Terminates the frame with \r\n, sends it in a single UART transmission and validates the response like
+    da16k_at_send_formatted_and_check_success would. */
+da16k_err_t da16k_at_send_frame_and_check_success           (da16k_at_frame_t *frame, uint32_t timeout_ms, const char *expected_response);
+/*  Sends a frame like da16k_at_send_frame_and_check_success, but does not wait for the response, so further frames
+    can be sent in the meantime (pipelining). sent_ms receives the time it was sent. */
+da16k_err_t da16k_at_send_frame                             (da16k_at_frame_t *frame, uint32_t *sent_ms);
+/*  Receives and validates the response to the oldest frame sent with da16k_at_send_frame that has not been answered
+    yet, like da16k_at_send_frame_and_check_success would. The response timeout of at_class counts from sent_ms. */
+da16k_err_t da16k_at_receive_frame_response                 (da16k_at_class_t at_class, uint32_t sent_ms, const char *expected_response);
+/*  Passes whatever has been received but not parsed yet on to the URC handlers, without waiting. Responses that
+    arrive after their command has timed out are dropped that way. */
+void        da16k_at_drop_late_responses                    (void);
+/*  Drops everything received but not parsed yet, including a partially received line, and whatever the UART has
+    buffered. Used to resynchronize after the baud rate has changed. */
+void        da16k_at_discard_input                          (void);
 /*  Copy out the full, final, parsed response string into a new buffer. Will allocate. 
     WARNING: Only call this after a previous call to send a message yielded success. */
 char       *da16k_at_get_response_str                       (void);
+/*  The full, final, parsed response in place, without copying. length (may be NULL) receives its length.
+    Only valid until the next command is sent. Same warning as above. */
+const char *da16k_at_get_response_view                      (size_t *length);
 /*  Fetches an integer return code from the full, final, parsed response.
     WARNING: Only call this after a previous call to send a message yielded success. */
 int         da16k_at_get_response_code                      (void);
@@ -0,0 +1,171 @@
+/*
+ * da16k_sched.c
+ *
+ * IoTConnect via Dialog DA16K module - AT transaction scheduling.
+ */
+
+#include "da16k_private.h"
+
+/* Runs a transaction with exclusive access to the AT channel */
+static da16k_err_t da16k_sched_run(da16k_at_transaction_t transaction, void *context) {
+    da16k_err_t ret;
+
+    da16k_at_channel_lock();
+    ret = transaction(context);
+    da16k_at_channel_unlock();
+
+    return ret;
+}
+
+#if defined(DA16K_CONFIG_FREERTOS)
+
+#include "task.h"
+#include "semphr.h"
+
+#if !defined(DA16K_CONFIG_SCHED_TASK_PRIORITY)
+#define DA16K_CONFIG_SCHED_TASK_PRIORITY        (tskIDLE_PRIORITY + 2)
+#endif
+
+#if !defined(DA16K_CONFIG_SCHED_TASK_STACK_WORDS)
+#define DA16K_CONFIG_SCHED_TASK_STACK_WORDS     1024
+#endif
+
+#if !defined(DA16K_CONFIG_SCHED_IDLE_POLL_MS)
+#define DA16K_CONFIG_SCHED_IDLE_POLL_MS         100
+#endif
+
+#if defined(configSUPPORT_STATIC_ALLOCATION) && (configSUPPORT_STATIC_ALLOCATION == 1)
+#define DA16K_SCHED_STATIC_SEMAPHORE
+#endif
+
+/*  A submitted transaction. It lives on the stack of the submitting task, which blocks until the owner task
+    has carried it out and signalled completion. */
+typedef struct da16k_sched_request {
+    struct da16k_sched_request *next;
+    da16k_priority_t            priority;
+    da16k_at_transaction_t      transaction;
+    void                       *context;
+    da16k_err_t                 result;
+    SemaphoreHandle_t           done;
+#if defined(DA16K_SCHED_STATIC_SEMAPHORE)
+    StaticSemaphore_t           done_buffer;
+#endif
+} da16k_sched_request_t;
+
+static TaskHandle_t             s_owner_task    = NULL;
+static da16k_sched_request_t   *s_queue_head    = NULL;     /* Sorted by priority, modified in critical sections */
+
+/* Inserts a request behind all queued requests of the same or a higher priority */
+static void da16k_sched_enqueue(da16k_sched_request_t *request) {
+    da16k_sched_request_t **link = &s_queue_head;
+
+    taskENTER_CRITICAL();
+
+    while (*link && (*link)->priority >= request->priority) {
+        link = &(*link)->next;
+    }
+
+    request->next   = *link;
+    *link           = request;
+
+    taskEXIT_CRITICAL();
+}
+
+static da16k_sched_request_t *da16k_sched_dequeue(void) {
+    da16k_sched_request_t *request;
+
+    taskENTER_CRITICAL();
+
+    request = s_queue_head;
+
+    if (request) {
+        s_queue_head = request->next;
+    }
+
+    taskEXIT_CRITICAL();
+
+    return request;
+}
+
+static void da16k_sched_owner(void *parameters) {
+    const TickType_t        idle_ticks = (DA16K_CONFIG_SCHED_IDLE_POLL_MS > 0) ? pdMS_TO_TICKS(DA16K_CONFIG_SCHED_IDLE_POLL_MS)
+                                                                                 : portMAX_DELAY;
+    da16k_sched_request_t  *request;
+
+    (void) parameters;
+
+    while (true) {
+        if (ulTaskNotifyTake(pdTRUE, idle_ticks) == 0) {
+            /* Nothing submitted for a while, pick up gateway events that arrived in the meantime */
+            (void) da16k_process_urcs(0);
+            continue;
+        }
+
+        while ((request = da16k_sched_dequeue()) != NULL) {
+            request->result = da16k_sched_run(request->transaction, request->context);
+            xSemaphoreGive(request->done);
+        }
+    }
+}
+
+da16k_err_t da16k_scheduler_start(void) {
+    if (s_owner_task) {
+        return DA16K_SUCCESS;
+    }
+
+    if (pdPASS != xTaskCreate(da16k_sched_owner, "da16k_sched", DA16K_CONFIG_SCHED_TASK_STACK_WORDS, NULL,
+                              DA16K_CONFIG_SCHED_TASK_PRIORITY, &s_owner_task)) {
+        DA16K_ERROR("Failed to create owner task\r\n");
+        s_owner_task = NULL;
+        return DA16K_OUT_OF_MEMORY;
+    }
+
+    return DA16K_SUCCESS;
+}
+
+da16k_err_t da16k_at_transact(da16k_priority_t priority, da16k_at_transaction_t transaction, void *context) {
+    da16k_sched_request_t request;
+
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, transaction);
+
+    /* Without the owner task, or if this is a transaction started from within another, run it right here */
+    if (s_owner_task == NULL || xTaskGetCurrentTaskHandle() == s_owner_task) {
+        return da16k_sched_run(transaction, context);
+    }
+
+    request.priority    = priority;
+    request.transaction = transaction;
+    request.context     = context;
+    request.result      = DA16K_SUCCESS;
+
+    /* A semaphore rather than a task notification, so the caller's own notifications stay untouched */
+#if defined(DA16K_SCHED_STATIC_SEMAPHORE)
+    request.done = xSemaphoreCreateBinaryStatic(&request.done_buffer);
+#else
+    request.done = xSemaphoreCreateBinary();
+    DA16K_RETURN_ON_NULL(DA16K_OUT_OF_MEMORY, request.done);
+#endif
+
+    da16k_sched_enqueue(&request);
+    xTaskNotifyGive(s_owner_task);
+
+    xSemaphoreTake(request.done, portMAX_DELAY);
+
+#if !defined(DA16K_SCHED_STATIC_SEMAPHORE)
+    vSemaphoreDelete(request.done);
+#endif
+
+    return request.result;
+}
+
+#else
+
+da16k_err_t da16k_at_transact(da16k_priority_t priority, da16k_at_transaction_t transaction, void *context) {
+    (void) priority;
+
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, transaction);
+
+    return da16k_sched_run(transaction, context);
+}
+
+#endif /* DA16K_CONFIG_FREERTOS */
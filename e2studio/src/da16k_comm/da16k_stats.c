@@ -0,0 +1,106 @@
+/*
+ * da16k_stats.c
+ *
+ * IoTConnect via Dialog DA16K module - AT layer statistics.
+ */
+
+#include "da16k_private.h"
+#include "da16k_uart.h"
+
+#include <string.h>
+
+/* Only updated within transactions, i.e. with the AT channel lock held */
+static da16k_stats_t    s_stats;
+static uint32_t         s_overruns_base = 0;    /* Port counter at the last reset */
+
+/* Bucket 0 for 0 ms, bucket i for [2^(i-1), 2^i) ms */
+static unsigned da16k_stats_bucket(uint32_t ms) {
+#if defined(__GNUC__)
+    unsigned bucket = (ms == 0) ? 0 : (unsigned) (32 - __builtin_clz(ms));
+#else
+    unsigned bucket = 0;
+
+    while (ms) {
+        ms >>= 1;
+        bucket++;
+    }
+#endif
+
+    return (bucket < DA16K_STATS_LATENCY_BUCKETS) ? bucket : (DA16K_STATS_LATENCY_BUCKETS - 1);
+}
+
+void da16k_stats_command(da16k_at_class_t at_class) {
+    s_stats.classes[at_class].commands++;
+}
+
+void da16k_stats_response(da16k_at_class_t at_class, da16k_err_t result, uint32_t elapsed_ms) {
+    da16k_class_stats_t *stats = &s_stats.classes[at_class];
+
+    switch (result) {
+        case DA16K_SUCCESS:
+            stats->ok++;
+            break;
+
+        case DA16K_TIMEOUT:
+            stats->timeouts++;
+            return;
+
+        case DA16K_AT_ERROR_CODE:
+            stats->errors++;
+            stats->last_error_code = (int32_t) da16k_at_get_response_code();
+            break;
+
+        case DA16K_AT_RESPONSE_TOO_LONG:
+            stats->failures++;
+            break;
+
+        default:
+            /* Not answered at all */
+            stats->failures++;
+            return;
+    }
+
+    stats->latency[da16k_stats_bucket(elapsed_ms)]++;
+}
+
+void da16k_stats_tx(size_t bytes) {
+    s_stats.bytes_tx += bytes;
+}
+
+void da16k_stats_rx(size_t bytes) {
+    s_stats.bytes_rx += bytes;
+}
+
+void da16k_stats_rx_truncated(void) {
+    s_stats.rx_truncated++;
+}
+
+void da16k_stats_urc(void) {
+    s_stats.urcs++;
+}
+
+void da16k_get_stats(da16k_stats_t *stats) {
+    if (stats == NULL) {
+        return;
+    }
+
+    da16k_at_channel_lock();
+
+    *stats              = s_stats;
+    stats->rx_overruns  = da16k_uart_rx_overruns() - s_overruns_base;
+
+    da16k_at_channel_unlock();
+}
+
+void da16k_reset_stats(void) {
+    da16k_at_channel_lock();
+
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_overruns_base = da16k_uart_rx_overruns();
+
+    da16k_at_channel_unlock();
+}
+
+uint32_t da16k_stats_bucket_ms(unsigned bucket) {
+    return (bucket == 0 || bucket >= DA16K_STATS_LATENCY_BUCKETS) ? 0 : (1u << (bucket - 1));
+}
@@ -12,20 +12,68 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdint.h>
-#include <limits.h>
+#include <string.h>
+
+#if defined(DA16K_CONFIG_FREERTOS)
+#include "task.h"
+#include "semphr.h"
+
+/* Serializes access to the AT gateway between tasks */
+static SemaphoreHandle_t s_at_channel_mutex = NULL;
+#endif
+
+/* Counted from any task, so the counters are only ever changed atomically */
+static da16k_heap_stats_t s_heap_stats = {0};
+
+static void da16k_heap_stat_add(uint32_t *stat) {
+    __atomic_fetch_add(stat, 1, __ATOMIC_RELAXED);
+}
 
 /* Wrappers for external functions that may be unreliable / redefined */
 
 void *da16k_malloc(size_t size) {
-    return DA16K_CONFIG_MALLOC_FN(size);
+    void *ret = DA16K_CONFIG_MALLOC_FN(size);
+
+    if (ret) {
+        da16k_heap_stat_add(&s_heap_stats.alloc_count);
+    } else {
+        da16k_heap_stat_add(&s_heap_stats.alloc_failures);
+    }
+
+    return ret;
 }
 
 void da16k_free(void *ptr) {
     if (ptr != NULL) {  /* some non-compliant C libraries may crash on freeing NULL pointers... */
         DA16K_CONFIG_FREE_FN(ptr);
+        da16k_heap_stat_add(&s_heap_stats.free_count);
     }
 }
 
+void da16k_get_heap_stats(da16k_heap_stats_t *stats) {
+    if (stats) {
+        stats->alloc_count      = __atomic_load_n(&s_heap_stats.alloc_count, __ATOMIC_RELAXED);
+        stats->free_count       = __atomic_load_n(&s_heap_stats.free_count, __ATOMIC_RELAXED);
+        stats->alloc_failures   = __atomic_load_n(&s_heap_stats.alloc_failures, __ATOMIC_RELAXED);
+    }
+}
+
+void da16k_reset_heap_stats(void) {
+    __atomic_store_n(&s_heap_stats.alloc_count, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&s_heap_stats.free_count, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&s_heap_stats.alloc_failures, 0, __ATOMIC_RELAXED);
+}
+
+uint32_t da16k_get_time_ms(void) {
+#if defined(DA16K_CONFIG_TIME_MS_FN)
+    return (uint32_t) DA16K_CONFIG_TIME_MS_FN();
+#elif defined(DA16K_CONFIG_FREERTOS)
+    return (uint32_t) (xTaskGetTickCount() * portTICK_PERIOD_MS);
+#else
+    return 0;   /* No time source: time budgets never expire, measured durations are 0 */
+#endif
+}
+
 char *da16k_strdup(const char *src) {
     size_t str_size = strlen(src) + 1; /* + 1 for null terminator */
     char *ret = da16k_malloc(str_size);
@@ -42,47 +90,220 @@ char *da16k_strndup(const char *src, size_t size) {
     char *ret = da16k_malloc(str_size);
 
     if (ret) {
-        memcpy(ret, src, str_size);
+        memcpy(ret, src, size);
         ret[size] = 0x00;
     }
 
     return ret;
 }
 
+bool da16k_at_channel_init(void) {
+#if defined(DA16K_CONFIG_FREERTOS)
+    if (s_at_channel_mutex == NULL) {
+        s_at_channel_mutex = xSemaphoreCreateRecursiveMutex();
+    }
+    return s_at_channel_mutex != NULL;
+#else
+    return true;
+#endif
+}
+
+void da16k_at_channel_lock(void) {
+#if defined(DA16K_CONFIG_FREERTOS)
+    if (s_at_channel_mutex) {
+        xSemaphoreTakeRecursive(s_at_channel_mutex, portMAX_DELAY);
+    }
+#endif
+}
+
+void da16k_at_channel_unlock(void) {
+#if defined(DA16K_CONFIG_FREERTOS)
+    if (s_at_channel_mutex) {
+        xSemaphoreGiveRecursive(s_at_channel_mutex);
+    }
+#endif
+}
+
+/* Lower case hex digits, looked up per nibble rather than formatting every byte with sprintf */
+static const char da16k_hex_digits[16] = "0123456789abcdef";
+
 /*  Converts a set of bytes to an ascii hex representation for use in the DA16K AT protocol
-    The protocol is BIG ENDIAN, so on little endian systems the endianness will be swapped in the output. */
-static bool da16k_bytes_to_ascii_hex(char *dst, void *src, size_t length) {
+    The protocol is BIG ENDIAN, so on little endian systems the endianness will be swapped in the output.
+    A null terminator is added. */
+static bool da16k_bytes_to_ascii_hex(char *dst, const void *src, size_t length) {
     const uint8_t *c_src = (const uint8_t *) src;
 
     DA16K_RETURN_ON_NULL(false, src);
     DA16K_RETURN_ON_NULL(false, dst);
 
-    if (length > INT_MAX) {
-        return false;
-    }
-
 #if defined(__ATCMD_LITTLE_ENDIAN__)
     for (size_t i = length; i > 0; i--) {
-        sprintf(dst, "%02x", c_src[i-1]);
-        dst += 2;
+        *dst++ = da16k_hex_digits[c_src[i-1] >> 4];
+        *dst++ = da16k_hex_digits[c_src[i-1] & 0x0f];
     }
 #elif defined(__ATCMD_BIG_ENDIAN__)
     for (size_t i = 0; i < length; i++) {
-        sprintf(dst, "%02x", c_src[i]);
-        dst += 2;
+        *dst++ = da16k_hex_digits[c_src[i] >> 4];
+        *dst++ = da16k_hex_digits[c_src[i] & 0x0f];
     }
 #else
     #error "Endianness unknown. Please define __ATCMD_LITTLE_ENDIAN__ or __ATCMD_BIG_ENDIAN__."
 #endif
 
+    *dst = 0x00;
+
     return true;
 }
 
 bool da16k_bool_to_ascii_hex (char *dst, bool value) {
     uint8_t temp = value ? 0x01 : 0x00;
-    return da16k_bytes_to_ascii_hex(dst, (void *) &temp, sizeof(uint8_t));
+    return da16k_bytes_to_ascii_hex(dst, &temp, sizeof(uint8_t));
+}
+
+bool da16k_float_to_ascii_hex (char *dst, float value) {
+    return da16k_bytes_to_ascii_hex(dst, &value, sizeof(float));
 }
 
 bool da16k_double_to_ascii_hex (char *dst, double value) {
-    return da16k_bytes_to_ascii_hex(dst, (void *) &value, sizeof(double));
+    return da16k_bytes_to_ascii_hex(dst, &value, sizeof(double));
+}
+
+void da16k_sha256_to_hex(char *dst, const uint8_t digest[DA16K_SHA256_SIZE]) {
+    for (size_t i = 0; i < DA16K_SHA256_SIZE; i++) {
+        *dst++ = da16k_hex_digits[digest[i] >> 4];
+        *dst++ = da16k_hex_digits[digest[i] & 0x0f];
+    }
+
+    *dst = 0x00;
+}
+
+/* Reflected polynomial 0xEDB88320, one nibble at a time: a 64 byte table instead of 1 KiB */
+static const uint32_t da16k_crc32_nibbles[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+};
+
+uint32_t da16k_crc32(uint32_t crc, const void *data, size_t length) {
+    const uint8_t *bytes = (const uint8_t *) data;
+
+    crc = ~crc;
+
+    for (size_t i = 0; i < length; i++) {
+        crc ^= bytes[i];
+        crc  = (crc >> 4) ^ da16k_crc32_nibbles[crc & 0x0f];
+        crc  = (crc >> 4) ^ da16k_crc32_nibbles[crc & 0x0f];
+    }
+
+    return ~crc;
+}
+
+void da16k_sleep_ms(uint32_t ms) {
+#if defined(DA16K_CONFIG_FREERTOS)
+    vTaskDelay(pdMS_TO_TICKS(ms));
+#else
+    uint32_t start = da16k_get_time_ms();
+
+    while ((da16k_get_time_ms() - start) < ms) {
+        /* Busy wait, there is nothing else to run */
+    }
+#endif
+}
+
+/* SHA-256 (FIPS 180-4) */
+static const uint32_t da16k_sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define DA16K_SHA256_ROTR(x, n)     (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void da16k_sha256_block(da16k_sha256_t *sha, const uint8_t *block) {
+    uint32_t w[64];
+    uint32_t s[8];
+
+    for (size_t i = 0; i < 16; i++) {
+        w[i] = ((uint32_t) block[i * 4] << 24) | ((uint32_t) block[i * 4 + 1] << 16) |
+               ((uint32_t) block[i * 4 + 2] << 8) | (uint32_t) block[i * 4 + 3];
+    }
+
+    for (size_t i = 16; i < 64; i++) {
+        uint32_t s0 = DA16K_SHA256_ROTR(w[i - 15], 7) ^ DA16K_SHA256_ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = DA16K_SHA256_ROTR(w[i - 2], 17) ^ DA16K_SHA256_ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    memcpy(s, sha->state, sizeof(s));
+
+    for (size_t i = 0; i < 64; i++) {
+        uint32_t t1 = s[7] + (DA16K_SHA256_ROTR(s[4], 6) ^ DA16K_SHA256_ROTR(s[4], 11) ^ DA16K_SHA256_ROTR(s[4], 25)) +
+                      ((s[4] & s[5]) ^ (~s[4] & s[6])) + da16k_sha256_k[i] + w[i];
+        uint32_t t2 = (DA16K_SHA256_ROTR(s[0], 2) ^ DA16K_SHA256_ROTR(s[0], 13) ^ DA16K_SHA256_ROTR(s[0], 22)) +
+                      ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+
+        memmove(&s[1], &s[0], 7 * sizeof(s[0]));
+        s[4] += t1;
+        s[0]  = t1 + t2;
+    }
+
+    for (size_t i = 0; i < 8; i++) {
+        sha->state[i] += s[i];
+    }
+}
+
+void da16k_sha256_init(da16k_sha256_t *sha) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+
+    memcpy(sha->state, initial, sizeof(initial));
+    sha->length = 0;
+    sha->used   = 0;
+}
+
+void da16k_sha256_update(da16k_sha256_t *sha, const void *data, size_t length) {
+    const uint8_t *bytes = (const uint8_t *) data;
+
+    sha->length += length;
+
+    while (length > 0) {
+        size_t count = sizeof(sha->block) - sha->used;
+
+        if (count > length) {
+            count = length;
+        }
+
+        memcpy(&sha->block[sha->used], bytes, count);
+        sha->used   += count;
+        bytes       += count;
+        length      -= count;
+
+        if (sha->used == sizeof(sha->block)) {
+            da16k_sha256_block(sha, sha->block);
+            sha->used = 0;
+        }
+    }
+}
+
+void da16k_sha256_final(da16k_sha256_t *sha, uint8_t digest[DA16K_SHA256_SIZE]) {
+    uint64_t    bits = sha->length * 8;
+    uint8_t     padding[sizeof(sha->block) + 8] = { 0x80 };
+    size_t      count = ((sha->used < 56) ? 56 : 120) - sha->used;
+
+    /* 0x80, zeroes up to 8 bytes before the end of a block, then the length in bits (big endian) */
+    for (size_t i = 0; i < 8; i++) {
+        padding[count + i] = (uint8_t) (bits >> (56 - 8 * i));
+    }
+
+    da16k_sha256_update(sha, padding, count + 8);
+
+    for (size_t i = 0; i < DA16K_SHA256_SIZE; i++) {
+        digest[i] = (uint8_t) (sha->state[i / 4] >> (24 - 8 * (i % 4)));
+    }
 }
@@ -0,0 +1,227 @@
+/*
+ * da16k_timing.c
+ *
+ * IoTConnect via Dialog DA16K module - round-trip time measurement and adaptive response timeouts.
+ */
+
+#include "da16k_private.h"
+
+#include <string.h>
+
+/* 0 = always use the initial timeouts (DA16K_UART_TIMEOUT_MS and network_timeout_ms), like earlier versions */
+#if !defined(DA16K_CONFIG_ADAPTIVE_TIMEOUTS)
+#define DA16K_CONFIG_ADAPTIVE_TIMEOUTS              1
+#endif
+
+/* Bounds for commands the gateway answers by itself (settings, queries, command fetches, certificates) */
+#if !defined(DA16K_CONFIG_LOCAL_TIMEOUT_FLOOR_MS)
+#define DA16K_CONFIG_LOCAL_TIMEOUT_FLOOR_MS         100
+#endif
+
+#if !defined(DA16K_CONFIG_LOCAL_TIMEOUT_CEILING_MS)
+#define DA16K_CONFIG_LOCAL_TIMEOUT_CEILING_MS       2000
+#endif
+
+/* Bounds for commands that wait for the network (telemetry, session and connection commands) */
+#if !defined(DA16K_CONFIG_NETWORK_TIMEOUT_FLOOR_MS)
+#define DA16K_CONFIG_NETWORK_TIMEOUT_FLOOR_MS       250
+#endif
+
+#if !defined(DA16K_CONFIG_NETWORK_TIMEOUT_CEILING_MS)
+#define DA16K_CONFIG_NETWORK_TIMEOUT_CEILING_MS     10000
+#endif
+
+/*  Estimator state per class, as in TCP (RFC 6298). srtt is kept times 8 and rttvar times 4, so the gains of 1/8 and
+    1/4 are shifts and no precision is lost to integer division. */
+typedef struct {
+    uint32_t    srtt8;
+    uint32_t    rttvar4;
+    uint32_t    backoff;        /* Timeouts since the last sample, each one doubles the timeout */
+    uint32_t    samples;
+    uint32_t    timeouts;
+    uint32_t    last_rtt_ms;
+} da16k_timing_class_t;
+
+/* Command prefixes of the classes other than DA16K_AT_CLASS_CONTROL */
+static const struct {
+    const char         *prefix;
+    da16k_at_class_t    at_class;
+} s_prefixes[] = {
+    { "AT+NWICEXMSG",   DA16K_AT_CLASS_TELEMETRY    },
+    { "AT+NWICGETCMD",  DA16K_AT_CLASS_COMMAND      },
+    { "AT+NWICSETUP",   DA16K_AT_CLASS_SESSION      },
+    { "AT+NWICSTOP",    DA16K_AT_CLASS_SESSION      },
+    { "AT+NWICRESET",   DA16K_AT_CLASS_SESSION      },
+    { "AT+NWICSTART",   DA16K_AT_CLASS_CONNECT      },
+    { "AT+WFJAPA",      DA16K_AT_CLASS_CONNECT      },
+};
+
+static da16k_timing_class_t s_classes[DA16K_AT_CLASS_COUNT];
+static uint32_t             s_network_initial_ms    = DA16K_DEFAULT_IOTC_TIMEOUT_MS;
+
+/* The exchange in progress. Only touched within transactions. */
+static da16k_at_class_t     s_current_class         = DA16K_AT_CLASS_CONTROL;
+static uint32_t             s_current_start_ms      = 0;
+static bool                 s_current_open          = false;
+static bool                 s_current_ambiguous     = false;    /* Follows a timeout, may be answered late */
+static bool                 s_timed_out             = false;    /* The last exchange timed out */
+
+static bool da16k_timing_is_local(da16k_at_class_t at_class) {
+    return at_class == DA16K_AT_CLASS_CONTROL || at_class == DA16K_AT_CLASS_COMMAND || at_class == DA16K_AT_CLASS_CERT;
+}
+
+static uint32_t da16k_timing_class_timeout_ms(da16k_at_class_t at_class) {
+    const da16k_timing_class_t *timing  = &s_classes[at_class];
+    bool                        local   = da16k_timing_is_local(at_class);
+    uint32_t                    floor   = local ? DA16K_CONFIG_LOCAL_TIMEOUT_FLOOR_MS   : DA16K_CONFIG_NETWORK_TIMEOUT_FLOOR_MS;
+    uint32_t                    ceiling = local ? DA16K_CONFIG_LOCAL_TIMEOUT_CEILING_MS : DA16K_CONFIG_NETWORK_TIMEOUT_CEILING_MS;
+    uint32_t                    timeout;
+
+    if (!DA16K_CONFIG_ADAPTIVE_TIMEOUTS || timing->samples == 0) {
+        /* Nothing measured yet */
+        timeout = local ? DA16K_UART_TIMEOUT_MS : s_network_initial_ms;
+    } else {
+        /* srtt + 4 * rttvar, at least one millisecond of variation for the clock granularity */
+        timeout = (timing->srtt8 >> 3) + ((timing->rttvar4 > 0) ? timing->rttvar4 : 1);
+    }
+
+    /*  Session and connection commands are one-offs that take very different times (AT+NWICSTOP without a session is
+        answered at once, AT+NWICSETUP waits for the network), so measuring one must not undercut the configured
+        timeout of another. Their timeouts only ever grow beyond network_timeout_ms. */
+    if (at_class == DA16K_AT_CLASS_SESSION || at_class == DA16K_AT_CLASS_CONNECT) {
+        floor   = (floor > s_network_initial_ms) ? floor : s_network_initial_ms;
+        ceiling = (ceiling > floor) ? ceiling : floor;
+    }
+
+    if (DA16K_CONFIG_ADAPTIVE_TIMEOUTS) {
+        if (timeout < floor) {
+            timeout = floor;
+        }
+
+        for (uint32_t i = 0; i < timing->backoff && timeout < ceiling; i++) {
+            timeout *= 2;
+        }
+
+        if (timeout > ceiling) {
+            timeout = ceiling;
+        }
+    }
+
+    return timeout;
+}
+
+static void da16k_timing_sample(da16k_timing_class_t *timing, uint32_t rtt_ms) {
+    if (timing->samples == 0) {
+        timing->srtt8   = rtt_ms << 3;
+        timing->rttvar4 = rtt_ms << 1;         /* rtt / 2 */
+    } else {
+        int32_t delta   = (int32_t) rtt_ms - (int32_t) (timing->srtt8 >> 3);
+        uint32_t error  = (uint32_t) ((delta < 0) ? -delta : delta);
+
+        /* rttvar += (|delta| - rttvar) / 4, srtt += delta / 8 */
+        timing->rttvar4 = timing->rttvar4 - (timing->rttvar4 >> 2) + error;
+        timing->srtt8   = (uint32_t) ((int32_t) timing->srtt8 + delta);
+    }
+
+    timing->samples++;
+    timing->backoff     = 0;
+    timing->last_rtt_ms = rtt_ms;
+}
+
+void da16k_timing_init(uint32_t network_timeout_ms) {
+    da16k_at_channel_lock();
+
+    memset(s_classes, 0, sizeof(s_classes));
+    s_network_initial_ms    = network_timeout_ms;
+    s_current_open          = false;
+    s_timed_out             = false;
+
+    da16k_at_channel_unlock();
+}
+
+da16k_at_class_t da16k_timing_classify(const char *command) {
+    for (size_t i = 0; command && i < (sizeof(s_prefixes) / sizeof(s_prefixes[0])); i++) {
+        if (strncmp(command, s_prefixes[i].prefix, strlen(s_prefixes[i].prefix)) == 0) {
+            return s_prefixes[i].at_class;
+        }
+    }
+
+    return DA16K_AT_CLASS_CONTROL;
+}
+
+bool da16k_timing_begin(da16k_at_class_t at_class) {
+    return da16k_timing_begin_at(at_class, da16k_get_time_ms());
+}
+
+bool da16k_timing_begin_at(da16k_at_class_t at_class, uint32_t start_ms) {
+    s_current_class     = at_class;
+    s_current_start_ms  = start_ms;
+    s_current_open      = true;
+    s_current_ambiguous = s_timed_out;
+    s_timed_out         = false;
+
+    da16k_stats_command(at_class);
+
+    return s_current_ambiguous;
+}
+
+void da16k_timing_end(da16k_err_t result) {
+    da16k_timing_class_t   *timing = &s_classes[s_current_class];
+    uint32_t                elapsed_ms;
+
+    if (!s_current_open) {
+        return;
+    }
+
+    s_current_open  = false;
+    elapsed_ms      = da16k_get_time_ms() - s_current_start_ms;
+
+    da16k_stats_response(s_current_class, result, elapsed_ms);
+
+    if (result == DA16K_TIMEOUT) {
+        /* Like TCP, only answered exchanges are measured. Each timeout doubles the next one until one is. */
+        timing->timeouts++;
+        timing->backoff++;
+        s_timed_out = true;
+        return;
+    }
+
+    /* The response may have been the late one to the command before (Karn's algorithm) */
+    if (s_current_ambiguous) {
+        return;
+    }
+
+    /* An "ERROR" or a truncated response was still answered in this time */
+    if (result == DA16K_SUCCESS || result == DA16K_AT_ERROR_CODE || result == DA16K_AT_RESPONSE_TOO_LONG) {
+        da16k_timing_sample(timing, elapsed_ms);
+    }
+}
+
+uint32_t da16k_timing_timeout_ms(void) {
+    return da16k_timing_class_timeout_ms(s_current_open ? s_current_class : DA16K_AT_CLASS_CONTROL);
+}
+
+da16k_err_t da16k_get_timing_stats(da16k_at_class_t at_class, da16k_timing_stats_t *stats) {
+    const da16k_timing_class_t *timing;
+
+    DA16K_RETURN_ON_NULL(DA16K_INVALID_PARAMETER, stats);
+
+    if ((unsigned) at_class >= DA16K_AT_CLASS_COUNT) {
+        return DA16K_INVALID_PARAMETER;
+    }
+
+    da16k_at_channel_lock();
+
+    timing = &s_classes[at_class];
+
+    stats->samples      = timing->samples;
+    stats->timeouts     = timing->timeouts;
+    stats->srtt_ms      = timing->srtt8 >> 3;
+    stats->rttvar_ms    = timing->rttvar4 >> 2;
+    stats->last_rtt_ms  = timing->last_rtt_ms;
+    stats->timeout_ms   = da16k_timing_class_timeout_ms(at_class);
+
+    da16k_at_channel_unlock();
+
+    return DA16K_SUCCESS;
+}
@@ -22,9 +22,35 @@
 #define DA16K_UART_BAUD_RATE        115200
 #define DA16K_UART_TIMEOUT_MS       500
 
+/* A single segment of a scatter-gather transmission */
+typedef struct {
+    const char *data;
+    size_t      length;
+} da16k_uart_iovec_t;
+
 bool        da16k_uart_init();
 bool        da16k_uart_send(const char *src, size_t length);
+/*  Sends all segments in order as one contiguous transmission. Returns once everything has been sent out.
+    Ports should hand the whole frame to the UART at once rather than send the segments one by one. */
+bool        da16k_uart_sendv(const da16k_uart_iovec_t *iov, size_t count);
 da16k_err_t da16k_uart_get_char(char *dst, uint32_t timeout_ms);
+/*  Reads up to length bytes into dst and stores the number of bytes read in received.
+    Waits until a complete line (\n) is available, the port's receive buffer is filling up, or the timeout elapses.
+    Whatever has been received by then is returned (this can be a partial line). DA16K_TIMEOUT is returned if nothing
+    was received at all. */
+da16k_err_t da16k_uart_read(char *dst, size_t length, size_t *received, uint32_t timeout_ms);
 void        da16k_uart_close(void);
+/*  Number of received bytes the port has lost so far, because of a hardware overrun or a full receive buffer.
+    Ports that cannot tell return 0. */
+uint32_t    da16k_uart_rx_overruns(void);
+/*  Changes the baud rate of the open UART, once everything sent so far has gone out. Ports that cannot do this return
+    false, the library then stays at DA16K_UART_BAUD_RATE. */
+bool        da16k_uart_set_baud(uint32_t baud_rate);
+
+#if defined(DA16K_CONFIG_POSIX)
+/*  Uses an already open descriptor (pipe, socket, pty) as AT channel instead of opening a device in da16k_uart_init.
+    The descriptor remains owned by the caller and is not closed by da16k_uart_close. */
+void        da16k_posix_uart_attach(int fd);
+#endif
 
 #endif /* DA16K_COMM_DA16K_UART_H_ */
@@ -0,0 +1,415 @@
+/*
+ * da16k_bench.c
+ *
+ * Benchmark of the da16k AT command library on a host. By default, the library talks to the simulated gateway
+ * (da16k_sim.c) through a socketpair. With -D, a real gateway or a pty served by da16k_sim is used instead.
+ *
+ * Reports throughput and latency percentiles of the setup sequence (cold: full configuration, warm: the gateway
+ * already has it), telemetry sends and command fetches.
+ */
+
+#include "da16k_sim.h"
+
+#if defined(DA16K_CONFIG_POSIX)
+
+#include "../da16k_uart.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+typedef struct {
+    const char *name;
+    uint32_t    count;          /* Operations measured */
+    uint32_t    failures;
+    uint32_t    units;          /* Items per operation for the throughput figure, e.g. tuples per message */
+    uint64_t   *samples_ns;
+    uint64_t    total_ns;
+} bench_result_t;
+
+#define BENCH_MAX_WINDOWS   8
+
+typedef struct {
+    uint32_t    iterations;
+    uint32_t    setup_iterations;
+    uint32_t    tuples;
+    uint32_t    delay_ms;
+    uint32_t    baud_rate;
+    uint32_t    switch_baud_rate;
+    uint32_t    connect_delay_ms;
+    bool        state_queries;  /* The simulator answers the warm start queries */
+    const char *script;
+    const char *device;
+    uint32_t    windows[BENCH_MAX_WINDOWS];     /* Pipelining windows to compare telemetry sends with */
+    size_t      window_count;
+} bench_options_t;
+
+static bool s_verbose = false;
+
+/* Library output (DA16K_PRINT), see da16k_host_config.h */
+void da16k_host_print(const char *format, ...) {
+    va_list args;
+
+    if (!s_verbose) {
+        return;
+    }
+
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+static uint64_t bench_time_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+static bool bench_result_init(bench_result_t *result, const char *name, uint32_t count, uint32_t units) {
+    memset(result, 0, sizeof(*result));
+
+    result->name        = name;
+    result->units       = units;
+    result->samples_ns  = calloc(count ? count : 1, sizeof(result->samples_ns[0]));
+
+    return result->samples_ns != NULL;
+}
+
+static void bench_record(bench_result_t *result, uint64_t start_ns, da16k_err_t ret) {
+    uint64_t elapsed = bench_time_ns() - start_ns;
+
+    result->samples_ns[result->count++]  = elapsed;
+    result->total_ns                    += elapsed;
+
+    if (ret != DA16K_SUCCESS) {
+        result->failures++;
+    }
+}
+
+static int bench_compare(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of the sorted samples, in microseconds */
+static double bench_percentile_us(const bench_result_t *result, double percentile) {
+    size_t rank = (size_t) ((percentile / 100.0) * result->count + 0.5);
+
+    if (rank < 1) {
+        rank = 1;
+    }
+
+    if (rank > result->count) {
+        rank = result->count;
+    }
+
+    return (double) result->samples_ns[rank - 1] / 1000.0;
+}
+
+static void bench_report(bench_result_t *result) {
+    double seconds = (double) result->total_ns / 1e9;
+
+    if (result->count == 0) {
+        return;
+    }
+
+    qsort(result->samples_ns, result->count, sizeof(result->samples_ns[0]), bench_compare);
+
+    printf("%-12s %8u %6u %11.1f %11.1f %9.1f %9.1f %9.1f %9.1f\n", result->name, (unsigned) result->count,
+           (unsigned) result->failures,
+           seconds > 0.0 ? result->count / seconds : 0.0,
+           seconds > 0.0 ? (double) result->count * result->units / seconds : 0.0,
+           bench_percentile_us(result, 50.0), bench_percentile_us(result, 90.0),
+           bench_percentile_us(result, 99.0), (double) result->samples_ns[result->count - 1] / 1000.0);
+
+    free(result->samples_ns);
+}
+
+/*  Configuration sequence: baud rate, WiFi, IoTConnect settings, reset and connection. With full_setup, everything is
+    sent, otherwise only what the gateway does not have yet (nothing, after the first iteration). */
+static void bench_setup(bench_result_t *result, uint32_t iterations, uint32_t baud_rate, bool full_setup) {
+    da16k_wifi_cfg_t    wifi  = { .ssid = "bench-ssid", .key = "bench-passphrase" };
+    da16k_iotc_cfg_t    iotc  = { .mode = DA16K_IOTC_AWS, .cpid = "bench-cpid", .duid = "bench-duid", .env = "bench-env" };
+    da16k_cfg_t         cfg   = { .iotc_config = &iotc, .wifi_config = &wifi, .baud_rate = baud_rate,
+                                  .full_setup = full_setup };
+    da16k_setup_stats_t stats;
+
+    for (uint32_t i = 0; i < iterations; i++) {
+        uint64_t start = bench_time_ns();
+        bench_record(result, start, da16k_init(&cfg));
+    }
+
+    da16k_get_setup_stats(&stats);
+
+    printf("%s: %u commands sent, %u skipped, %s\n", result->name, (unsigned) stats.commands_sent,
+           (unsigned) stats.commands_skipped, stats.warm ? "session kept" : "session restarted");
+}
+
+static void bench_send(bench_result_t *result, uint32_t iterations, uint32_t tuples) {
+    da16k_msg_t    *msg = da16k_create_msg();
+    char            key[16];
+
+    if (msg == NULL) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < tuples; i++) {
+        snprintf(key, sizeof(key), "key%u", (unsigned) i);
+        da16k_msg_add_num(msg, key, 1000.0 + i);
+    }
+
+    for (uint32_t i = 0; i < iterations; i++) {
+        uint64_t start = bench_time_ns();
+        bench_record(result, start, da16k_send_msg(msg));
+    }
+
+    da16k_destroy_msg(msg);
+}
+
+/* Fetches a command queued in the simulator before each call, or whatever the gateway has with an external device */
+static void bench_get_cmd(bench_result_t *result, uint32_t iterations, bool queue) {
+    da16k_cmd_t cmd;
+    da16k_err_t ret;
+
+    for (uint32_t i = 0; i < iterations; i++) {
+        uint64_t start;
+
+        if (queue) {
+            da16k_sim_queue_cmd("set_led_frequency 500");
+        }
+
+        start   = bench_time_ns();
+        ret     = da16k_get_cmd(&cmd);
+
+        if (ret == DA16K_SUCCESS) {
+            da16k_destroy_cmd(cmd);
+        }
+
+        bench_record(result, start, (ret == DA16K_NO_CMDS && !queue) ? DA16K_SUCCESS : ret);
+    }
+}
+
+/* The library's own view (da16k_get_stats): outcome and median response time bucket per command class */
+static void bench_report_at_stats(void) {
+    static const char * const   names[DA16K_AT_CLASS_COUNT] = { "control", "command", "telemetry", "session", "connect", "cert" };
+    da16k_stats_t               stats;
+
+    da16k_get_stats(&stats);
+
+    printf("class        commands      ok  timeout   error    fail  p50 bucket\n");
+
+    for (unsigned i = 0; i < DA16K_AT_CLASS_COUNT; i++) {
+        const da16k_class_stats_t  *cls     = &stats.classes[i];
+        uint32_t                    answered = 0;
+        uint32_t                    count    = 0;
+        unsigned                    bucket   = 0;
+
+        if (cls->commands == 0) {
+            continue;
+        }
+
+        for (unsigned b = 0; b < DA16K_STATS_LATENCY_BUCKETS; b++) {
+            answered += cls->latency[b];
+        }
+
+        while (bucket < (DA16K_STATS_LATENCY_BUCKETS - 1) && (count + cls->latency[bucket]) * 2 < answered) {
+            count += cls->latency[bucket++];
+        }
+
+        printf("%-10s %10u %7u %8u %7u %7u  >= %u ms\n", names[i], (unsigned) cls->commands, (unsigned) cls->ok,
+               (unsigned) cls->timeouts, (unsigned) cls->errors, (unsigned) cls->failures,
+               (unsigned) da16k_stats_bucket_ms(bucket));
+    }
+
+    printf("library: %llu bytes tx, %llu bytes rx, %u overruns, %u truncated lines\n",
+           (unsigned long long) stats.bytes_tx, (unsigned long long) stats.bytes_rx,
+           (unsigned) stats.rx_overruns, (unsigned) stats.rx_truncated);
+}
+
+static void bench_usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -n <count>   Telemetry sends and command fetches to measure (default 1000)\n"
+            "  -N <count>   Setup sequences to measure (default 20)\n"
+            "  -t <tuples>  Tuples per telemetry message (default 8)\n"
+            "  -d <ms>      Simulated gateway response delay (default 0)\n"
+            "  -b <baud>    Simulated UART baud rate pacing (default 0 = unpaced)\n"
+            "  -B <baud>    Baud rate to negotiate during setup (default 0 = none)\n"
+            "  -c <ms>      Simulated connection delay of WiFi join and IoTC setup/start/reset (default 0)\n"
+            "  -w <list>    Also send telemetry with these pipelining windows, e.g. 1,2,4,8\n"
+            "  -q           Simulated gateway answers the warm start queries (default: ERROR, like a stock gateway),\n"
+            "               only sent if the library is built with DA16K_CONFIG_WARM_START\n"
+            "  -s <script>  Simulator script\n"
+            "  -D <device>  Use a serial device / pty instead of the built-in simulator\n"
+            "  -v           Show library output\n", name);
+}
+
+/* Comma separated list of windows */
+static bool bench_parse_windows(const char *list, bench_options_t *options) {
+    char *end;
+
+    for (options->window_count = 0; *list; list = end + (*end == ',')) {
+        uint32_t window = (uint32_t) strtoul(list, &end, 10);
+
+        if (end == list || window == 0 || options->window_count == BENCH_MAX_WINDOWS) {
+            return false;
+        }
+
+        options->windows[options->window_count++] = window;
+    }
+
+    return options->window_count > 0;
+}
+
+static bool bench_parse_options(int argc, char **argv, bench_options_t *options) {
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:N:t:d:b:B:c:w:qs:D:vh")) != -1) {
+        switch (opt) {
+            case 'n': options->iterations       = (uint32_t) strtoul(optarg, NULL, 10); break;
+            case 'N': options->setup_iterations = (uint32_t) strtoul(optarg, NULL, 10); break;
+            case 't': options->tuples           = (uint32_t) strtoul(optarg, NULL, 10); break;
+            case 'd': options->delay_ms         = (uint32_t) strtoul(optarg, NULL, 10); break;
+            case 'b': options->baud_rate        = (uint32_t) strtoul(optarg, NULL, 10); break;
+            case 'B': options->switch_baud_rate = (uint32_t) strtoul(optarg, NULL, 10); break;
+            case 'c': options->connect_delay_ms = (uint32_t) strtoul(optarg, NULL, 10); break;
+            case 'w':
+                if (!bench_parse_windows(optarg, options)) {
+                    bench_usage(argv[0]);
+                    return false;
+                }
+                break;
+            case 'q': options->state_queries    = true;                                 break;
+            case 's': options->script           = optarg;                               break;
+            case 'D': options->device           = optarg;                               break;
+            case 'v': s_verbose                 = true;                                 break;
+            default:
+                bench_usage(argv[0]);
+                return false;
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char **argv) {
+    bench_options_t options = { .iterations = 1000, .setup_iterations = 20, .tuples = 8 };
+    bench_result_t  setup_cold, setup_warm, send, get_cmd, get_no_cmd;
+    bench_result_t  send_windowed[BENCH_MAX_WINDOWS];
+    char            send_windowed_names[BENCH_MAX_WINDOWS][16];
+    uint32_t        max_window  = 1;
+    uint32_t        setup_iterations;
+    int             fds[2];
+    bool            simulated;
+
+    if (!bench_parse_options(argc, argv, &options)) {
+        return EXIT_FAILURE;
+    }
+
+    simulated = (options.device == NULL);
+
+    for (size_t i = 0; i < options.window_count; i++) {
+        max_window = (options.windows[i] > max_window) ? options.windows[i] : max_window;
+    }
+
+    if (simulated) {
+        da16k_sim_set_timing(options.delay_ms, options.baud_rate);
+        da16k_sim_set_connect_delay(options.connect_delay_ms);
+        da16k_sim_set_state_queries(options.state_queries);
+
+        /* The simulated gateway keeps up with the largest window, unless scripted otherwise */
+        if (!da16k_sim_set_pipeline_depth(max_window)) {
+            fprintf(stderr, "Window %u is too large for the simulator\n", (unsigned) max_window);
+            return EXIT_FAILURE;
+        }
+
+        if ((options.script && !da16k_sim_load_script(options.script)) ||
+            socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0 || !da16k_sim_start(fds[1])) {
+            fprintf(stderr, "Failed to start the simulator\n");
+            return EXIT_FAILURE;
+        }
+
+        da16k_posix_uart_attach(fds[0]);
+    } else {
+        setenv("DA16K_UART_DEVICE", options.device, 1);
+    }
+
+    setup_iterations = options.setup_iterations ? options.setup_iterations : 1;
+
+    if (!bench_result_init(&setup_cold, "setup_cold", setup_iterations,         1)              ||
+        !bench_result_init(&setup_warm, "setup_warm", setup_iterations,         1)              ||
+        !bench_result_init(&send,       "send",     options.iterations,         options.tuples) ||
+        !bench_result_init(&get_cmd,    "get_cmd",  options.iterations,         1)              ||
+        !bench_result_init(&get_no_cmd, "get_none", options.iterations,         1)) {
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < options.window_count; i++) {
+        snprintf(send_windowed_names[i], sizeof(send_windowed_names[i]), "send_w%u", (unsigned) options.windows[i]);
+
+        if (!bench_result_init(&send_windowed[i], send_windowed_names[i], options.iterations, options.tuples)) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    bench_setup(&setup_cold, setup_iterations, options.switch_baud_rate, true);
+    bench_setup(&setup_warm, setup_iterations, options.switch_baud_rate, false);
+    bench_send(&send, options.iterations, options.tuples);
+
+    for (size_t i = 0; i < options.window_count; i++) {
+        if (da16k_set_msg_window(options.windows[i]) != DA16K_SUCCESS) {
+            fprintf(stderr, "Window %u is not supported by the library\n", (unsigned) options.windows[i]);
+            return EXIT_FAILURE;
+        }
+
+        bench_send(&send_windowed[i], options.iterations, options.tuples);
+    }
+
+    da16k_set_msg_window(1);
+    bench_get_cmd(&get_cmd, simulated ? options.iterations : 0, true);
+    bench_get_cmd(&get_no_cmd, options.iterations, false);
+
+    printf("%-12s %8s %6s %11s %11s %9s %9s %9s %9s\n", "operation", "count", "fail", "ops/s", "units/s",
+           "p50 us", "p90 us", "p99 us", "max us");
+    bench_report(&setup_cold);
+    bench_report(&setup_warm);
+    bench_report(&send);
+
+    for (size_t i = 0; i < options.window_count; i++) {
+        bench_report(&send_windowed[i]);
+    }
+
+    bench_report(&get_cmd);
+    bench_report(&get_no_cmd);
+    printf("baud rate: %lu\n", (unsigned long) da16k_get_baud_rate());
+    bench_report_at_stats();
+
+    da16k_deinit();
+
+    if (simulated) {
+        da16k_sim_stats_t stats;
+
+        da16k_sim_stop();
+        da16k_sim_get_stats(&stats);
+
+        printf("simulator: %u requests, %u telemetry frames (%u tuples, %u rejected), %u commands, %llu bytes rx, "
+               "%llu bytes tx\n", (unsigned) stats.requests, (unsigned) stats.telemetry_frames,
+               (unsigned) stats.telemetry_tuples, (unsigned) stats.frames_rejected, (unsigned) stats.cmds_delivered,
+               (unsigned long long) stats.bytes_rx, (unsigned long long) stats.bytes_tx);
+
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+#endif /* DA16K_CONFIG_POSIX */
@@ -0,0 +1,17 @@
+/*
+ * da16k_host_config.h
+ *
+ * Configuration of the da16k AT command library for host (Linux) builds, see the README.
+ */
+
+#ifndef DA16K_COMM_DA16K_HOST_CONFIG_H_
+#define DA16K_COMM_DA16K_HOST_CONFIG_H_
+
+/* POSIX platform (da16k_platform_posix.c) */
+#define DA16K_CONFIG_POSIX
+
+/* Library output is routed through the application, so benchmarks can silence the debug messages */
+#define DA16K_PRINT                 da16k_host_print
+void da16k_host_print(const char *format, ...);
+
+#endif /* DA16K_COMM_DA16K_HOST_CONFIG_H_ */
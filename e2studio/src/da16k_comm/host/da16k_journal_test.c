@@ -0,0 +1,324 @@
+/*
+ * da16k_journal_test.c
+ *
+ * Host test of the telemetry journal (da16k_journal.c) on a simulated flash in RAM. Power is cut at chosen flash
+ * operations to check recovery from torn records and from an interrupted wrap-around. Replayed telemetry goes to the
+ * simulated gateway (da16k_sim.c) through a socketpair.
+ *
+ * Exits with EXIT_FAILURE if any check fails.
+ */
+
+#include "da16k_sim.h"
+
+#if defined(DA16K_CONFIG_POSIX)
+
+#include "../da16k_uart.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define TEST_SECTOR_SIZE        1024
+#define TEST_SECTOR_COUNT       4
+#define TEST_PROGRAM_UNIT       16
+#define TEST_TUPLES             2       /* Per message, which the journal stores as one record */
+
+typedef struct {
+    uint8_t     memory[TEST_SECTOR_SIZE * TEST_SECTOR_COUNT];
+    bool        powered;
+    int32_t     programs_left;  /* Programs until the power is cut halfway through the next one (-1 = never) */
+    int32_t     erases_left;    /* Erases until the power is cut right after the next one (-1 = never) */
+    uint32_t    overwrites;     /* Programs of memory that had not been erased */
+} test_flash_t;
+
+static test_flash_t s_flash;
+static uint32_t     s_failures = 0;
+
+#define TEST_CHECK(condition)   test_check((condition), #condition, __LINE__)
+
+/* Library output (DA16K_PRINT), see da16k_host_config.h */
+void da16k_host_print(const char *format, ...) {
+    (void) format;
+}
+
+static void test_check(bool condition, const char *text, int line) {
+    if (!condition) {
+        printf("  line %d: %s failed\n", line, text);
+        s_failures++;
+    }
+}
+
+static da16k_err_t test_flash_read(void *context, uint32_t offset, void *dst, size_t length) {
+    test_flash_t *flash = context;
+
+    if (!flash->powered) {
+        return DA16K_STORAGE_ERROR;
+    }
+
+    memcpy(dst, &flash->memory[offset], length);
+
+    return DA16K_SUCCESS;
+}
+
+static da16k_err_t test_flash_program(void *context, uint32_t offset, const void *src, size_t length) {
+    test_flash_t *flash = context;
+
+    if (!flash->powered) {
+        return DA16K_STORAGE_ERROR;
+    }
+
+    for (size_t i = 0; i < length; i++) {
+        if (flash->memory[offset + i] != 0xFF) {
+            flash->overwrites++;
+            break;
+        }
+    }
+
+    /* A torn record: only the first half makes it to the flash */
+    if (flash->programs_left == 0) {
+        memcpy(&flash->memory[offset], src, length / 2);
+        flash->powered = false;
+        return DA16K_STORAGE_ERROR;
+    }
+
+    if (flash->programs_left > 0) {
+        flash->programs_left--;
+    }
+
+    memcpy(&flash->memory[offset], src, length);
+
+    return DA16K_SUCCESS;
+}
+
+static da16k_err_t test_flash_erase(void *context, uint32_t offset) {
+    test_flash_t *flash = context;
+
+    if (!flash->powered) {
+        return DA16K_STORAGE_ERROR;
+    }
+
+    memset(&flash->memory[offset], 0xFF, TEST_SECTOR_SIZE);
+
+    if (flash->erases_left == 0) {
+        flash->powered = false;
+        return DA16K_STORAGE_ERROR;
+    }
+
+    if (flash->erases_left > 0) {
+        flash->erases_left--;
+    }
+
+    return DA16K_SUCCESS;
+}
+
+static const da16k_journal_flash_t s_flash_desc = {
+    test_flash_read, test_flash_program, test_flash_erase, &s_flash, TEST_SECTOR_SIZE, TEST_SECTOR_COUNT, TEST_PROGRAM_UNIT
+};
+
+/* Restores the power and reopens the journal, like a restart of the device */
+static void test_reboot(da16k_journal_t *journal) {
+    s_flash.powered         = true;
+    s_flash.programs_left   = -1;
+    s_flash.erases_left     = -1;
+
+    TEST_CHECK(da16k_journal_open(journal, &s_flash_desc, 0) == DA16K_SUCCESS);
+}
+
+static void test_format(da16k_journal_t *journal) {
+    memset(s_flash.memory, 0xFF, sizeof(s_flash.memory));
+    s_flash.overwrites = 0;
+
+    test_reboot(journal);
+}
+
+static da16k_err_t test_append(da16k_journal_t *journal, uint32_t index) {
+    da16k_msg_t    *msg = da16k_create_msg();
+    da16k_err_t     ret;
+
+    if (msg == NULL) {
+        return DA16K_OUT_OF_MEMORY;
+    }
+
+    da16k_msg_add_num(msg, "index", index);
+    da16k_msg_add_bool(msg, "even", (index % 2) == 0);
+
+    ret = da16k_journal_append(journal, msg);
+
+    da16k_destroy_msg(msg);
+
+    return ret;
+}
+
+/* Replays everything, checks that all pending records reach the gateway and nothing is dropped on the way */
+static void test_replay_all(da16k_journal_t *journal) {
+    da16k_journal_stats_t   stats;
+    da16k_sim_stats_t       before;
+    da16k_sim_stats_t       after;
+    size_t                  pending = da16k_journal_pending(journal);
+    uint32_t                dropped = journal->stats.dropped;
+
+    da16k_sim_get_stats(&before);
+    TEST_CHECK(da16k_journal_replay(journal, 0, NULL) == DA16K_SUCCESS);
+    da16k_sim_get_stats(&after);
+    da16k_journal_get_stats(journal, &stats);
+
+    TEST_CHECK((after.telemetry_tuples - before.telemetry_tuples) == pending * TEST_TUPLES);
+    TEST_CHECK(stats.replayed == pending);
+    TEST_CHECK(stats.dropped == dropped);
+    TEST_CHECK(stats.pending == 0);
+
+    /* The progress is on flash */
+    test_reboot(journal);
+    TEST_CHECK(da16k_journal_pending(journal) == 0);
+}
+
+/* More records than fit: the oldest sectors are reused, their records dropped */
+static void test_wrap_around(void) {
+    da16k_journal_t         journal;
+    da16k_journal_stats_t   stats;
+    size_t                  pending;
+
+    test_format(&journal);
+
+    for (uint32_t i = 0; i < 100; i++) {
+        TEST_CHECK(test_append(&journal, i) == DA16K_SUCCESS);
+    }
+
+    da16k_journal_get_stats(&journal, &stats);
+    pending = stats.pending;
+
+    TEST_CHECK(stats.appended == 100);
+    TEST_CHECK(stats.dropped > 0);
+    TEST_CHECK(stats.pending + stats.dropped == 100);
+    TEST_CHECK(stats.erases > TEST_SECTOR_COUNT);
+
+    test_reboot(&journal);
+    TEST_CHECK(da16k_journal_pending(&journal) == pending);
+
+    test_replay_all(&journal);
+
+    /* Wraps around again after the replay */
+    for (uint32_t i = 0; i < 60; i++) {
+        TEST_CHECK(test_append(&journal, i) == DA16K_SUCCESS);
+    }
+
+    test_reboot(&journal);
+    test_replay_all(&journal);
+
+    TEST_CHECK(s_flash.overwrites == 0);
+}
+
+/* Power lost while a record is being programmed */
+static void test_torn_record(void) {
+    da16k_journal_t         journal;
+    da16k_journal_stats_t   stats;
+
+    test_format(&journal);
+
+    for (uint32_t i = 0; i < 5; i++) {
+        TEST_CHECK(test_append(&journal, i) == DA16K_SUCCESS);
+    }
+
+    s_flash.programs_left = 0;
+    TEST_CHECK(test_append(&journal, 5) != DA16K_SUCCESS);
+
+    test_reboot(&journal);
+    da16k_journal_get_stats(&journal, &stats);
+
+    TEST_CHECK(stats.corrupted == 1);
+    TEST_CHECK(stats.pending == 5);
+
+    /* The damaged sector is closed, writing goes on in the next one */
+    for (uint32_t i = 0; i < 5; i++) {
+        TEST_CHECK(test_append(&journal, 10 + i) == DA16K_SUCCESS);
+    }
+
+    test_reboot(&journal);
+    TEST_CHECK(da16k_journal_pending(&journal) == 10);
+
+    test_replay_all(&journal);
+
+    /* A torn acknowledgement leaves the replayed records pending, they are sent again */
+    for (uint32_t i = 0; i < 3; i++) {
+        TEST_CHECK(test_append(&journal, 20 + i) == DA16K_SUCCESS);
+    }
+
+    s_flash.programs_left = 0;
+    TEST_CHECK(da16k_journal_replay(&journal, 0, NULL) != DA16K_SUCCESS);
+
+    test_reboot(&journal);
+    TEST_CHECK(da16k_journal_pending(&journal) == 3);
+
+    test_replay_all(&journal);
+
+    TEST_CHECK(s_flash.overwrites == 0);
+}
+
+/*  Power lost right after the oldest sector was erased to make room, before the checkpoint acknowledging its
+    dropped records was written. Recovery must not count them as pending. */
+static void test_interrupted_wrap_around(void) {
+    da16k_journal_t journal;
+    uint32_t        appended = 0;
+
+    test_format(&journal);
+
+    /* Every sector is erased once before the first one is reused */
+    s_flash.erases_left = TEST_SECTOR_COUNT;
+
+    while (appended < 1000 && test_append(&journal, appended) == DA16K_SUCCESS) {
+        appended++;
+    }
+
+    TEST_CHECK(!s_flash.powered);
+
+    test_reboot(&journal);
+
+    TEST_CHECK(da16k_journal_pending(&journal) > 0);
+    TEST_CHECK(da16k_journal_pending(&journal) < appended);
+
+    test_replay_all(&journal);
+
+    TEST_CHECK(s_flash.overwrites == 0);
+}
+
+static void test_run(const char *name, void (*test)(void)) {
+    uint32_t failures = s_failures;
+
+    test();
+
+    printf("%-24s %s\n", name, (s_failures == failures) ? "ok" : "FAILED");
+}
+
+int main(void) {
+    da16k_cfg_t cfg = { 0 };
+    int         fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0 || !da16k_sim_start(fds[1])) {
+        fprintf(stderr, "Failed to start the simulator\n");
+        return EXIT_FAILURE;
+    }
+
+    da16k_posix_uart_attach(fds[0]);
+
+    if (da16k_init(&cfg) != DA16K_SUCCESS) {
+        fprintf(stderr, "Failed to initialize the library\n");
+        return EXIT_FAILURE;
+    }
+
+    test_run("wrap_around",             test_wrap_around);
+    test_run("torn_record",             test_torn_record);
+    test_run("interrupted_wrap_around", test_interrupted_wrap_around);
+
+    da16k_deinit();
+    da16k_sim_stop();
+
+    close(fds[0]);
+    close(fds[1]);
+
+    return s_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#endif /* DA16K_CONFIG_POSIX */
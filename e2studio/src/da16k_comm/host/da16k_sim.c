@@ -0,0 +1,787 @@
+/*
+ * da16k_sim.c
+ *
+ * Simulated DA16K AT gateway for host builds.
+ */
+
+#include "da16k_sim.h"
+#include "../da16k_private.h"
+
+#if defined(DA16K_CONFIG_POSIX)
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SIM_REQUEST_MAX_LENGTH      4096
+#define SIM_RESPONSE_MAX_LENGTH     1024
+#define SIM_PREFIX_MAX_LENGTH       64
+#define SIM_LINE_MAX_LENGTH         256
+#define SIM_POLL_INTERVAL_MS        100
+
+#define SIM_ESC                     '\x1B'
+#define SIM_ETX                     '\x03'
+
+#define SIM_MAX_PIPELINE_DEPTH      16
+
+#define SIM_CERT_TYPES              6
+#define SIM_CERT_PREFIX_LENGTH      3   /* "C<type>," */
+
+typedef struct {
+    char    prefix[SIM_PREFIX_MAX_LENGTH];
+    char    response[SIM_LINE_MAX_LENGTH];
+} sim_rule_t;
+
+/* Ring of lines, protected by s_lock */
+typedef struct {
+    char    lines[DA16K_SIM_MAX_QUEUED_CMDS][SIM_LINE_MAX_LENGTH];
+    size_t  head;
+    size_t  count;
+} sim_queue_t;
+
+/* A response that is due at due_us, pipelined gateways only */
+typedef struct {
+    char        response[SIM_RESPONSE_MAX_LENGTH];
+    size_t      length;
+    uint64_t    due_us;
+} sim_pending_t;
+
+/* Setting the gateway keeps until it is changed, answered on "<command>?" */
+typedef struct {
+    const char *command;
+    char        value[SIM_LINE_MAX_LENGTH];
+} sim_setting_t;
+
+/* Built-in behaviour of the gateway, checked in order after the rules */
+static const sim_rule_t s_builtin_rules[] = {
+    { "AT+NWICEXMSG",   "+NWICEXMSG:1\\nOK"         },
+    { "AT+WFJAPA",      "OK\\n+WFJAP:1"             },
+    { "AT+NWICSETUP",   "OK\\n+NWICSETUPEND:1"      },
+    { "AT+NWICSTART",   "OK\\n+NWICSTARTEND:1"      },
+    { "AT+NWICSTOP",    "OK\\n+NWICSTOPEND:1"       },
+    { "AT+NWICRESET",   "OK\\n+NWICRESETEND:1"      },
+    { "AT+NWIC",        "OK"                        },  /* Configuration: CT, AT, CPID, DUID, ENV */
+    { "AT",             "OK"                        },
+};
+
+static sim_rule_t           s_rules[DA16K_SIM_MAX_RULES];
+static size_t               s_rule_count        = 0;
+static sim_queue_t          s_cmds;
+static sim_queue_t          s_urcs;
+static pthread_mutex_t      s_lock              = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t             s_response_delay_ms = 0;
+static uint32_t             s_baud_rate         = 0;
+static uint32_t             s_max_baud_rate     = 0;    /* Highest rate AT+UART1 accepts (0 = any) */
+static uint32_t             s_pending_baud_rate = 0;    /* Switched to once the response to AT+UART1 is out */
+static uint32_t             s_msg_max_tuples    = 0;    /* AT+NWICEXMSG frame limits (0 = none) */
+static uint32_t             s_msg_max_length    = 0;
+static bool                 s_msg_caps_reported = false;
+static bool                 s_state_queries     = false;    /* Answers the warm start queries */
+static da16k_sim_stats_t    s_stats;
+
+/* Responses of a pipelined gateway that are not due yet, in the order they are sent out */
+static sim_pending_t        s_pending[SIM_MAX_PIPELINE_DEPTH];
+static size_t               s_pending_head      = 0;
+static size_t               s_pending_count     = 0;
+static uint32_t             s_pipeline_depth    = 1;
+
+/* Gateway state, survives the library reconnecting like it survives an MCU reset on a real gateway */
+static sim_setting_t        s_settings[]        = { { .command = "AT+NWICCT" },   { .command = "AT+NWICAT" },
+                                                    { .command = "AT+NWICCPID" }, { .command = "AT+NWICDUID" },
+                                                    { .command = "AT+NWICENV" } };
+static char                 s_wifi_ssid[SIM_LINE_MAX_LENGTH];
+static bool                 s_wifi_joined       = false;
+static bool                 s_iotc_connected    = false;
+static uint32_t             s_connect_delay_ms  = 0;    /* Added to responses that (re)establish connections */
+static uint32_t             s_extra_delay_ms    = 0;    /* Added to the current response */
+static bool                 s_offline           = false;
+static char                 s_cert_digests[SIM_CERT_TYPES][DA16K_SHA256_SIZE * 2 + 1];
+
+static pthread_t            s_thread;
+static bool                 s_thread_running    = false;
+static bool                 s_stop              = false;
+
+/* Request assembly. Certificates (ESC ... ETX) span several lines and are only hashed, not stored. */
+static char                 s_request[SIM_REQUEST_MAX_LENGTH];
+static size_t               s_request_len       = 0;
+static size_t               s_request_bytes     = 0;
+static bool                 s_in_certificate    = false;
+static char                 s_cert_prefix[SIM_CERT_PREFIX_LENGTH];
+static size_t               s_cert_prefix_len   = 0;
+static da16k_sha256_t       s_cert_sha;
+
+static void sim_copy(char *dst, size_t size, const char *src) {
+    snprintf(dst, size, "%s", src);
+}
+
+void da16k_sim_set_timing(uint32_t response_delay_ms, uint32_t baud_rate) {
+    s_response_delay_ms = response_delay_ms;
+    s_baud_rate         = baud_rate;
+}
+
+void da16k_sim_set_max_baud_rate(uint32_t baud_rate) {
+    s_max_baud_rate = baud_rate;
+}
+
+void da16k_sim_set_connect_delay(uint32_t delay_ms) {
+    s_connect_delay_ms = delay_ms;
+}
+
+bool da16k_sim_set_pipeline_depth(uint32_t depth) {
+    if (depth > SIM_MAX_PIPELINE_DEPTH) {
+        return false;
+    }
+
+    s_pipeline_depth = depth ? depth : 1;
+
+    return true;
+}
+
+void da16k_sim_set_msg_caps(uint32_t max_tuples, uint32_t max_line_length, bool report) {
+    s_msg_max_tuples    = max_tuples;
+    s_msg_max_length    = max_line_length;
+    s_msg_caps_reported = report;
+}
+
+void da16k_sim_set_state_queries(bool answer) {
+    s_state_queries = answer;
+}
+
+void da16k_sim_set_offline(bool offline) {
+    if (offline) {
+        s_wifi_joined       = false;
+        s_iotc_connected    = false;
+    }
+
+    __atomic_store_n(&s_offline, offline, __ATOMIC_RELEASE);
+}
+
+bool da16k_sim_add_rule(const char *prefix, const char *response) {
+    if (prefix == NULL || response == NULL || s_rule_count >= DA16K_SIM_MAX_RULES) {
+        return false;
+    }
+
+    sim_copy(s_rules[s_rule_count].prefix,   sizeof(s_rules[0].prefix),   prefix);
+    sim_copy(s_rules[s_rule_count].response, sizeof(s_rules[0].response), response);
+    s_rule_count++;
+
+    return true;
+}
+
+static bool sim_queue_push(sim_queue_t *queue, const char *line) {
+    bool ret = false;
+
+    if (line == NULL) {
+        return false;
+    }
+
+    pthread_mutex_lock(&s_lock);
+
+    if (queue->count < DA16K_SIM_MAX_QUEUED_CMDS) {
+        sim_copy(queue->lines[(queue->head + queue->count) % DA16K_SIM_MAX_QUEUED_CMDS], SIM_LINE_MAX_LENGTH, line);
+        queue->count++;
+        ret = true;
+    }
+
+    pthread_mutex_unlock(&s_lock);
+
+    return ret;
+}
+
+static bool sim_queue_pop(sim_queue_t *queue, char *dst) {
+    bool ret = false;
+
+    pthread_mutex_lock(&s_lock);
+
+    if (queue->count > 0) {
+        sim_copy(dst, SIM_LINE_MAX_LENGTH, queue->lines[queue->head]);
+        queue->head = (queue->head + 1) % DA16K_SIM_MAX_QUEUED_CMDS;
+        queue->count--;
+        ret = true;
+    }
+
+    pthread_mutex_unlock(&s_lock);
+
+    return ret;
+}
+
+bool da16k_sim_queue_cmd(const char *cmd) {
+    return sim_queue_push(&s_cmds, cmd);
+}
+
+bool da16k_sim_queue_urc(const char *line) {
+    return sim_queue_push(&s_urcs, line);
+}
+
+/* Splits off the first whitespace-separated word of *line, which then points to the rest (without leading whitespace) */
+static char *sim_next_word(char **line) {
+    char *word = *line;
+    char *end  = word + strcspn(word, " \t");
+
+    *line = end + strspn(end, " \t");
+
+    if (*end) {
+        *end = 0x00;
+    }
+
+    return word;
+}
+
+bool da16k_sim_load_script(const char *path) {
+    char        line[SIM_LINE_MAX_LENGTH + SIM_PREFIX_MAX_LENGTH];
+    unsigned    line_number = 0;
+    FILE       *file        = fopen(path, "r");
+    bool        ret         = true;
+
+    if (file == NULL) {
+        fprintf(stderr, "Cannot open script %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    while (ret && fgets(line, sizeof(line), file)) {
+        char *rest = line + strspn(line, " \t");
+        char *directive;
+
+        line_number++;
+        rest[strcspn(rest, "\r\n")] = 0x00;
+
+        if (*rest == 0x00 || *rest == '#') {
+            continue;
+        }
+
+        directive = sim_next_word(&rest);
+
+        if (strcmp(directive, "delay") == 0) {
+            s_response_delay_ms = (uint32_t) strtoul(rest, NULL, 10);
+        } else if (strcmp(directive, "baud") == 0) {
+            s_baud_rate = (uint32_t) strtoul(rest, NULL, 10);
+        } else if (strcmp(directive, "maxbaud") == 0) {
+            s_max_baud_rate = (uint32_t) strtoul(rest, NULL, 10);
+        } else if (strcmp(directive, "connectdelay") == 0) {
+            s_connect_delay_ms = (uint32_t) strtoul(rest, NULL, 10);
+        } else if (strcmp(directive, "pipeline") == 0) {
+            ret = da16k_sim_set_pipeline_depth((uint32_t) strtoul(rest, NULL, 10));
+        } else if (strcmp(directive, "msgcaps") == 0) {
+            uint32_t max_tuples = (uint32_t) strtoul(sim_next_word(&rest), NULL, 10);
+            uint32_t max_length = (uint32_t) strtoul(sim_next_word(&rest), NULL, 10);
+            da16k_sim_set_msg_caps(max_tuples, max_length, strcmp(sim_next_word(&rest), "silent") != 0);
+        } else if (strcmp(directive, "queries") == 0) {
+            da16k_sim_set_state_queries(true);
+        } else if (strcmp(directive, "on") == 0) {
+            char *prefix = sim_next_word(&rest);
+            ret = da16k_sim_add_rule(prefix, rest);
+        } else if (strcmp(directive, "cmd") == 0) {
+            ret = da16k_sim_queue_cmd(rest);
+        } else if (strcmp(directive, "urc") == 0) {
+            ret = da16k_sim_queue_urc(rest);
+        } else {
+            ret = false;
+        }
+
+        if (!ret) {
+            fprintf(stderr, "%s:%u: invalid directive '%s'\n", path, line_number, directive);
+        }
+    }
+
+    fclose(file);
+
+    return ret;
+}
+
+static void sim_sleep_us(uint64_t us) {
+    struct timespec duration = { .tv_sec = (time_t) (us / 1000000u), .tv_nsec = (long) ((us % 1000000u) * 1000u) };
+
+    while (nanosleep(&duration, &duration) != 0 && errno == EINTR) {
+    }
+}
+
+static uint64_t sim_now_us(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000u + (uint64_t) now.tv_nsec / 1000u;
+}
+
+/* Time the given number of bytes take on the simulated UART */
+static uint64_t sim_wire_time_us(size_t bytes) {
+    return s_baud_rate ? ((uint64_t) bytes * 10u * 1000000u) / s_baud_rate : 0;
+}
+
+static bool sim_write(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        data            += written;
+        length          -= (size_t) written;
+        s_stats.bytes_tx += (uint64_t) written;
+    }
+
+    return true;
+}
+
+/* Expands a rule response ("\n" separated lines) into CRLF terminated lines */
+static size_t sim_expand(char *dst, size_t size, const char *response) {
+    size_t length = 0;
+
+    while (*response && length + 3 < size) {
+        if (response[0] == '\\' && response[1] == 'n') {
+            dst[length++] = '\r';
+            dst[length++] = '\n';
+            response += 2;
+        } else {
+            dst[length++] = *response++;
+        }
+    }
+
+    dst[length++] = '\r';
+    dst[length++] = '\n';
+    dst[length]   = 0x00;
+
+    return length;
+}
+
+static const sim_rule_t *sim_find_rule(const sim_rule_t *rules, size_t count, bool reverse, const char *request) {
+    for (size_t i = 0; i < count; i++) {
+        const sim_rule_t *rule = &rules[reverse ? (count - 1 - i) : i];
+
+        if (strncmp(request, rule->prefix, strlen(rule->prefix)) == 0) {
+            return rule;
+        }
+    }
+
+    return NULL;
+}
+
+/* Builds the response to a complete request */
+/*  Settings, WiFi and IoTC session state. Returns 0 for requests that are only tracked here, or not handled at all,
+    the built-in rules answer those. */
+static size_t sim_state_response(char *dst, size_t size, const char *request) {
+    for (size_t i = 0; i < sizeof(s_settings) / sizeof(s_settings[0]); i++) {
+        size_t      length      = strlen(s_settings[i].command);
+        const char *argument    = &request[length];
+
+        if (strncmp(request, s_settings[i].command, length) != 0) {
+            continue;
+        }
+
+        if (strcmp(argument, "?") == 0) {
+            return s_state_queries ? (size_t) snprintf(dst, size, "%s:%s\r\nOK\r\n", &s_settings[i].command[2], s_settings[i].value)
+                                   : sim_expand(dst, size, "ERROR");
+        }
+
+        if (*argument == ' ') {
+            snprintf(s_settings[i].value, sizeof(s_settings[i].value), "%s", argument + 1);
+        }
+
+        return 0;
+    }
+
+    /* Unknown to gateways without the warm start queries */
+    if (!s_state_queries && (strncmp(request, "AT+NWICCERTSHA=", 15) == 0 || strcmp(request, "AT+NWICSTATUS") == 0 ||
+                             strcmp(request, "AT+WFJAP?") == 0)) {
+        return sim_expand(dst, size, "ERROR");
+    }
+
+    if (strncmp(request, "AT+NWICCERTSHA=", 15) == 0) {
+        unsigned type = (unsigned) strtoul(&request[15], NULL, 10);
+
+        return type < SIM_CERT_TYPES ? (size_t) snprintf(dst, size, "+NWICCERTSHA:%s\r\nOK\r\n", s_cert_digests[type])
+                                     : sim_expand(dst, size, "ERROR");
+    }
+
+    if (strcmp(request, "AT+NWICSTATUS") == 0) {
+        return (size_t) snprintf(dst, size, "+NWICSTATUS:%d\r\nOK\r\n", s_iotc_connected ? 1 : 0);
+    }
+
+    if (strcmp(request, "AT+WFJAP?") == 0) {
+        return s_wifi_joined ? (size_t) snprintf(dst, size, "+WFJAP:1,'%s'\r\nOK\r\n", s_wifi_ssid)
+                             : sim_expand(dst, size, "+WFJAP:0\\nOK");
+    }
+
+    if (strncmp(request, "AT+WFJAPA ", 10) == 0) {
+        snprintf(s_wifi_ssid, sizeof(s_wifi_ssid), "%.*s", (int) strcspn(&request[10], ","), &request[10]);
+        s_wifi_joined       = true;
+        s_iotc_connected    = false;
+        s_extra_delay_ms    = s_connect_delay_ms;
+    } else if (strcmp(request, "AT+NWICSETUP") == 0 || strcmp(request, "AT+NWICRESET") == 0) {
+        s_iotc_connected    = false;
+        s_extra_delay_ms    = s_connect_delay_ms;
+    } else if (strcmp(request, "AT+NWICSTART") == 0) {
+        s_iotc_connected    = true;
+        s_extra_delay_ms    = s_connect_delay_ms;
+    } else if (strcmp(request, "AT+NWICSTOP") == 0) {
+        s_iotc_connected    = false;
+    }
+
+    return 0;
+}
+
+/* Tuples of "AT+NWICEXMSG <type>,<key>,<value>,...", each one is terminated by the third comma */
+static uint32_t sim_msg_tuples(const char *request) {
+    uint32_t commas = 0;
+
+    for (const char *c = request; *c; c++) {
+        commas += (*c == ',');
+    }
+
+    return commas / 3;
+}
+
+static size_t sim_build_response(char *dst, size_t size, const char *request, bool certificate) {
+    const sim_rule_t   *rule;
+    char                cmd[SIM_LINE_MAX_LENGTH];
+    size_t              length;
+
+    if (certificate) {
+        uint8_t         digest[DA16K_SHA256_SIZE];
+        unsigned        type = (unsigned) (s_cert_prefix[1] - '0');
+
+        if (s_cert_prefix_len < SIM_CERT_PREFIX_LENGTH || s_cert_prefix[0] != 'C' || type >= SIM_CERT_TYPES ||
+            s_cert_prefix[2] != ',') {
+            return sim_expand(dst, size, "ERROR");
+        }
+
+        da16k_sha256_final(&s_cert_sha, digest);
+        da16k_sha256_to_hex(s_cert_digests[type], digest);
+        s_stats.certificates++;
+
+        return sim_expand(dst, size, "OK");
+    }
+
+    if (strncmp(request, "AT+NWICEXMSG", 12) == 0) {
+        uint32_t tuples = sim_msg_tuples(request);
+
+        if ((s_msg_max_tuples && tuples > s_msg_max_tuples) ||
+            (s_msg_max_length && strlen(request) > s_msg_max_length)) {
+            s_stats.frames_rejected++;
+            return sim_expand(dst, size, "ERROR");
+        }
+
+        s_stats.telemetry_frames++;
+        s_stats.telemetry_tuples += tuples;
+    }
+
+    /* Script rules override everything, later rules override earlier ones */
+    if ((rule = sim_find_rule(s_rules, s_rule_count, true, request)) != NULL) {
+        return sim_expand(dst, size, rule->response);
+    }
+
+    /* Unknown to gateways that do not report their limits */
+    if (strcmp(request, "AT+NWICMSGCAPS?") == 0) {
+        if (!s_msg_caps_reported) {
+            return sim_expand(dst, size, "ERROR");
+        }
+
+        return (size_t) snprintf(dst, size, "+NWICMSGCAPS:%u,%u\r\nOK\r\n", (unsigned) s_msg_max_tuples,
+                                 (unsigned) s_msg_max_length);
+    }
+
+    if (strncmp(request, "AT+NWICGETCMD", 13) == 0) {
+        if (!sim_queue_pop(&s_cmds, cmd)) {
+            return sim_expand(dst, size, "ERROR:-7");
+        }
+
+        s_stats.cmds_delivered++;
+
+        return (size_t) snprintf(dst, size, "+NWICGETCMD:%s\r\nOK\r\n", cmd);
+    }
+
+    /* Baud rate change, takes effect after the "OK". Only changes the pacing if the UART is paced at all. */
+    if (strncmp(request, "AT+UART1=", 9) == 0) {
+        uint32_t baud_rate = (uint32_t) strtoul(&request[9], NULL, 10);
+
+        if (baud_rate == 0 || (s_max_baud_rate && baud_rate > s_max_baud_rate)) {
+            return sim_expand(dst, size, "ERROR");
+        }
+
+        s_pending_baud_rate = s_baud_rate ? baud_rate : 0;
+        s_stats.baud_rate   = baud_rate;
+
+        return sim_expand(dst, size, "OK");
+    }
+
+    if ((length = sim_state_response(dst, size, request)) != 0) {
+        return length;
+    }
+
+    rule = sim_find_rule(s_builtin_rules, sizeof(s_builtin_rules) / sizeof(s_builtin_rules[0]), false, request);
+
+    return sim_expand(dst, size, rule ? rule->response : "ERROR");
+}
+
+/* Sends a response, followed by the queued unsolicited lines */
+static bool sim_send_response(int fd, const char *response, size_t length) {
+    char    urc_response[SIM_RESPONSE_MAX_LENGTH];
+    char    urc[SIM_LINE_MAX_LENGTH];
+
+    if (!sim_write(fd, response, length)) {
+        return false;
+    }
+
+    if (s_pending_baud_rate) {
+        s_baud_rate         = s_pending_baud_rate;
+        s_pending_baud_rate = 0;
+    }
+
+    while (sim_queue_pop(&s_urcs, urc)) {
+        length = sim_expand(urc_response, sizeof(urc_response), urc);
+        sim_sleep_us(sim_wire_time_us(length));
+
+        if (!sim_write(fd, urc_response, length)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Sends the pending responses that are due, or all of them up to the one due last if wait is set */
+static bool sim_send_due(int fd, bool wait) {
+    while (s_pending_count > 0) {
+        sim_pending_t  *pending = &s_pending[s_pending_head];
+        uint64_t        now     = sim_now_us();
+
+        if (pending->due_us > now) {
+            if (!wait) {
+                break;
+            }
+
+            sim_sleep_us(pending->due_us - now);
+        }
+
+        if (!sim_send_response(fd, pending->response, pending->length)) {
+            return false;
+        }
+
+        s_pending_head = (s_pending_head + 1) % SIM_MAX_PIPELINE_DEPTH;
+        s_pending_count--;
+        wait = false;
+    }
+
+    return true;
+}
+
+static bool sim_respond(int fd, bool certificate) {
+    char            response[SIM_RESPONSE_MAX_LENGTH];
+    sim_pending_t  *pending;
+    size_t          length;
+    uint32_t        delay_ms;
+    uint64_t        due_us;
+
+    if (__atomic_load_n(&s_offline, __ATOMIC_ACQUIRE)) {
+        return true;
+    }
+
+    length = sim_build_response(response, sizeof(response), s_request, certificate);
+
+    if (length >= sizeof(response)) {
+        length = sizeof(response) - 1;
+    }
+
+    s_stats.requests++;
+
+    /* The request has arrived at once, so account for its transmission time here as well */
+    delay_ms            = s_response_delay_ms + s_extra_delay_ms;
+    s_extra_delay_ms    = 0;
+
+    if (s_pipeline_depth <= 1) {
+        sim_sleep_us((uint64_t) delay_ms * 1000u + sim_wire_time_us(s_request_bytes + length));
+        return sim_send_response(fd, response, length);
+    }
+
+    /*  Pipelined: the gateway takes the next request while this one is in progress. Once depth requests are, it
+        stops reading until the oldest one has been answered. Responses go out in order. */
+    if (s_pending_count >= s_pipeline_depth && !sim_send_due(fd, true)) {
+        return false;
+    }
+
+    due_us = sim_now_us() + (uint64_t) delay_ms * 1000u + sim_wire_time_us(s_request_bytes + length);
+
+    if (s_pending_count > 0) {
+        uint64_t after_last = s_pending[(s_pending_head + s_pending_count - 1) % SIM_MAX_PIPELINE_DEPTH].due_us +
+                              sim_wire_time_us(length);
+
+        if (due_us < after_last) {
+            due_us = after_last;
+        }
+    }
+
+    pending         = &s_pending[(s_pending_head + s_pending_count) % SIM_MAX_PIPELINE_DEPTH];
+    pending->length = length;
+    pending->due_us = due_us;
+    memcpy(pending->response, response, length);
+    s_pending_count++;
+
+    return true;
+}
+
+static void sim_request_reset(void) {
+    s_request_len       = 0;
+    s_request_bytes     = 0;
+    s_in_certificate    = false;
+    s_cert_prefix_len   = 0;
+}
+
+/* Feeds a received byte into request assembly, responding once a request is complete */
+static bool sim_consume(int fd, char c) {
+    s_request_bytes++;
+
+    if (s_in_certificate) {
+        if (c == SIM_ETX) {
+            s_request[0] = 0x00;
+            if (!sim_respond(fd, true)) {
+                return false;
+            }
+            sim_request_reset();
+        } else if (s_cert_prefix_len < SIM_CERT_PREFIX_LENGTH) {
+            s_cert_prefix[s_cert_prefix_len++] = c;
+        } else {
+            da16k_sha256_update(&s_cert_sha, &c, 1);
+        }
+        return true;
+    }
+
+    if (c == SIM_ESC && s_request_len == 0) {
+        s_in_certificate = true;
+        da16k_sha256_init(&s_cert_sha);
+        return true;
+    }
+
+    if (c != '\n') {
+        if (s_request_len < sizeof(s_request) - 1) {
+            s_request[s_request_len++] = c;
+        }
+        return true;
+    }
+
+    while (s_request_len > 0 && s_request[s_request_len - 1] == '\r') {
+        s_request_len--;
+    }
+
+    s_request[s_request_len] = 0x00;
+
+    /* Empty lines are ignored, like the gateway does */
+    if (s_request_len > 0 && !sim_respond(fd, false)) {
+        return false;
+    }
+
+    sim_request_reset();
+
+    return true;
+}
+
+static void sim_serve(int fd) {
+    char chunk[512];
+
+    sim_request_reset();
+    s_pending_head  = 0;
+    s_pending_count = 0;
+
+    while (!__atomic_load_n(&s_stop, __ATOMIC_ACQUIRE)) {
+        struct pollfd   pfd         = { .fd = fd, .events = POLLIN };
+        int             timeout_ms  = SIM_POLL_INTERVAL_MS;
+        ssize_t         count;
+        int             ret;
+
+        if (!sim_send_due(fd, false)) {
+            break;
+        }
+
+        /* Wake up in time for the next pending response */
+        if (s_pending_count > 0) {
+            uint64_t due_us = s_pending[s_pending_head].due_us;
+            uint64_t now_us = sim_now_us();
+            uint64_t wait   = (due_us > now_us) ? ((due_us - now_us + 999u) / 1000u) : 0;
+
+            if (wait < (uint64_t) timeout_ms) {
+                timeout_ms = (int) wait;
+            }
+        }
+
+        ret = poll(&pfd, 1, timeout_ms);
+
+        if (ret < 0 && errno != EINTR) {
+            break;
+        }
+
+        if (ret <= 0) {
+            continue;
+        }
+
+        count = read(fd, chunk, sizeof(chunk));
+
+        if (count <= 0) {
+            if (count < 0 && (errno == EINTR || errno == EAGAIN)) {
+                continue;
+            }
+            break;  /* Hung up */
+        }
+
+        s_stats.bytes_rx += (uint64_t) count;
+
+        for (ssize_t i = 0; i < count; i++) {
+            if (!sim_consume(fd, chunk[i])) {
+                return;
+            }
+        }
+    }
+}
+
+static void *sim_thread(void *arg) {
+    sim_serve(*(int *) arg);
+    return NULL;
+}
+
+bool da16k_sim_start(int fd) {
+    static int thread_fd;
+
+    if (s_thread_running) {
+        return false;
+    }
+
+    thread_fd = fd;
+    __atomic_store_n(&s_stop, false, __ATOMIC_RELEASE);
+
+    if (pthread_create(&s_thread, NULL, sim_thread, &thread_fd) != 0) {
+        return false;
+    }
+
+    s_thread_running = true;
+
+    return true;
+}
+
+void da16k_sim_stop(void) {
+    __atomic_store_n(&s_stop, true, __ATOMIC_RELEASE);
+
+    if (s_thread_running) {
+        pthread_join(s_thread, NULL);
+        s_thread_running = false;
+    }
+}
+
+void da16k_sim_run(int fd) {
+    __atomic_store_n(&s_stop, false, __ATOMIC_RELEASE);
+    sim_serve(fd);
+}
+
+void da16k_sim_get_stats(da16k_sim_stats_t *stats) {
+    if (stats) {
+        *stats = s_stats;
+    }
+}
+
+#endif /* DA16K_CONFIG_POSIX */
@@ -0,0 +1,87 @@
+/*
+ * da16k_sim.h
+ *
+ * Simulated DA16K AT gateway for host builds. It serves the AT command protocol on a file descriptor (a pty or
+ * one end of a socketpair), so the library can be exercised and benchmarked without hardware.
+ *
+ * Only one simulator runs per process.
+ */
+
+#ifndef DA16K_COMM_DA16K_SIM_H_
+#define DA16K_COMM_DA16K_SIM_H_
+
+#include "../da16k_comm.h"
+
+#if defined(DA16K_CONFIG_POSIX)
+
+#define DA16K_SIM_MAX_RULES         32
+#define DA16K_SIM_MAX_QUEUED_CMDS   64
+
+typedef struct {
+    uint32_t    requests;           /* AT commands (and certificates) answered */
+    uint32_t    telemetry_frames;   /* AT+NWICEXMSG commands answered */
+    uint32_t    telemetry_tuples;   /* <type>,<key>,<value> tuples in the accepted AT+NWICEXMSG commands */
+    uint32_t    frames_rejected;    /* AT+NWICEXMSG commands answered "ERROR" for exceeding the frame limits */
+    uint32_t    cmds_delivered;     /* Queued commands handed out via AT+NWICGETCMD */
+    uint64_t    bytes_rx;           /* Received from the library */
+    uint64_t    bytes_tx;           /* Sent to the library */
+    uint32_t    baud_rate;          /* Last rate set with AT+UART1 (0 = never changed) */
+    uint32_t    certificates;       /* Certificates stored */
+} da16k_sim_stats_t;
+
+/*  Timing of the simulated gateway. Every response is delayed by response_delay_ms plus the time the request and the
+    response would take on a UART running at baud_rate (10 bits per byte, 0 = no pacing). */
+void        da16k_sim_set_timing        (uint32_t response_delay_ms, uint32_t baud_rate);
+/*  AT+UART1=<rate>,... is rejected with "ERROR" for rates above baud_rate (0 = any rate is accepted) */
+void        da16k_sim_set_max_baud_rate (uint32_t baud_rate);
+/*  Extra delay of the responses that establish connections (AT+WFJAPA, AT+NWICSETUP, AT+NWICSTART, AT+NWICRESET).
+    The WiFi network, the IoTC settings and the session state are kept across library restarts like on a real gateway. */
+void        da16k_sim_set_connect_delay (uint32_t delay_ms);
+/*  If answer is set, the state can be queried with AT+WFJAP?, AT+NWIC<setting>? and AT+NWICSTATUS, and so can the
+    fingerprints (SHA-256) of the stored certificates with AT+NWICCERTSHA=<type>. Otherwise these are answered
+    "ERROR" like on a stock gateway, the default. */
+void        da16k_sim_set_state_queries (bool answer);
+/*  Number of requests the gateway works on at the same time (1 = one after the other, the default, at most 16).
+    Each one is answered response_delay_ms after it arrived, in the order they arrived. Once depth requests are in
+    progress, the next one is only taken once the oldest one has been answered. Returns false if depth is too large. */
+bool        da16k_sim_set_pipeline_depth(uint32_t depth);
+/*  Frame limits of AT+NWICEXMSG: at most max_tuples tuples (0 = any number) in a command of at most max_line_length
+    characters without the \r\n (0 = any length). Longer commands are answered "ERROR". If report is set, the limits
+    are answered on AT+NWICMSGCAPS? as "+NWICMSGCAPS:<max_tuples>,<max_line_length>", otherwise AT+NWICMSGCAPS? is
+    unknown like on older gateways. By default there are no limits and none are reported. */
+void        da16k_sim_set_msg_caps      (uint32_t max_tuples, uint32_t max_line_length, bool report);
+/*  While offline, requests are not answered. Going offline drops the WiFi connection and the IoTC session, like a
+    reset of the gateway. Thread-safe. */
+void        da16k_sim_set_offline       (bool offline);
+/*  Adds a rule answering every command starting with prefix with response. Lines of the response are separated by
+    "\n" (a backslash followed by n), each one is sent terminated by \r\n. Rules take precedence over the built-in
+    behaviour and over earlier rules for the same prefix. */
+bool        da16k_sim_add_rule          (const char *prefix, const char *response);
+/*  Queues a cloud command ("<command> <parameters>") to be handed out by AT+NWICGETCMD. Thread-safe. */
+bool        da16k_sim_queue_cmd         (const char *cmd);
+/*  Queues a line the gateway sends on its own, right after the next response. Thread-safe. */
+bool        da16k_sim_queue_urc         (const char *line);
+/*  Loads a script, one directive per line ('#' starts a comment):
+        delay <ms>                  see da16k_sim_set_timing
+        baud <rate>                 see da16k_sim_set_timing
+        maxbaud <rate>              see da16k_sim_set_max_baud_rate
+        connectdelay <ms>           see da16k_sim_set_connect_delay
+        pipeline <depth>            see da16k_sim_set_pipeline_depth
+        msgcaps <tuples> <length> [silent]
+                                    see da16k_sim_set_msg_caps, reported unless silent
+        queries                     see da16k_sim_set_state_queries
+        on <prefix> <response>      see da16k_sim_add_rule
+        cmd <command> [parameters]  see da16k_sim_queue_cmd
+        urc <line>                  see da16k_sim_queue_urc */
+bool        da16k_sim_load_script       (const char *path);
+/*  Serves the AT protocol on fd in a background thread until da16k_sim_stop is called. */
+bool        da16k_sim_start             (int fd);
+void        da16k_sim_stop              (void);
+/*  Serves the AT protocol on fd in the calling thread until the other side hangs up. */
+void        da16k_sim_run               (int fd);
+/*  Statistics are updated by the simulator thread without locking, stop it first for exact figures. */
+void        da16k_sim_get_stats         (da16k_sim_stats_t *stats);
+
+#endif /* DA16K_CONFIG_POSIX */
+
+#endif /* DA16K_COMM_DA16K_SIM_H_ */
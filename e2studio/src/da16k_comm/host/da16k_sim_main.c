@@ -0,0 +1,68 @@
+/*
+ * da16k_sim_main.c
+ *
+ * Stand-alone simulated DA16K AT gateway on a pseudo terminal. Prints the pty path, which can then be used as the
+ * AT channel of any host build of the library (DA16K_UART_DEVICE=<path>) or by a terminal program.
+ *
+ * Usage: da16k_sim [script]
+ */
+
+#define _GNU_SOURCE     /* posix_openpt & friends */
+
+#include "da16k_sim.h"
+
+#if defined(DA16K_CONFIG_POSIX)
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+/* Output of the library helpers the simulator uses (DA16K_PRINT), see da16k_host_config.h */
+void da16k_host_print(const char *format, ...) {
+    va_list args;
+
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+int main(int argc, char **argv) {
+    struct termios  tty;
+    int             master  = posix_openpt(O_RDWR | O_NOCTTY);
+    int             slave;
+
+    if (argc > 1 && !da16k_sim_load_script(argv[1])) {
+        return EXIT_FAILURE;
+    }
+
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        perror("posix_openpt");
+        return EXIT_FAILURE;
+    }
+
+    /* Keep the slave side open ourselves, so clients can come and go without the master seeing a hangup */
+    slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+
+    if (slave < 0 || tcgetattr(slave, &tty) != 0) {
+        perror(ptsname(master));
+        return EXIT_FAILURE;
+    }
+
+    cfmakeraw(&tty);
+    tcsetattr(slave, TCSANOW, &tty);
+
+    printf("%s\n", ptsname(master));
+    fflush(stdout);
+
+    da16k_sim_run(master);
+
+    close(slave);
+    close(master);
+
+    return EXIT_SUCCESS;
+}
+
+#endif /* DA16K_CONFIG_POSIX */
@@ -3,43 +3,78 @@
 #include "common_init.h"
 #include "iotc_demo.h"
 #include "usb_console_main.h"
+#include "ospi_journal.h"
 
 /* Telemetry grabber & command handler code
  */
 
-static inline bool string_starts_with(const char *full_string, const char *to_check) {
-    return strncmp(to_check, full_string, strlen(to_check)) == 0;
-}
+/* Telemetry attributes sent by this demo - these must match the IoTConnect device template */
+#define IOTC_DEMO_TELEMETRY(X)              \
+    X(cpu_temperature,  FLOAT32)
+
+DA16K_SCHEMA_DEFINE(iotc_demo_schema, IOTC_DEMO_TELEMETRY);
+
+/* Only send the temperature if it moved by more than half a degree, or once a minute to show we're alive */
+static const da16k_filter_rule_t iotc_demo_filter_rules[iotc_demo_schema_key_count] = {
+    [DA16K_KEY_cpu_temperature] = { .deadband = 0.5, .deadband_percent = 0.0, .heartbeat_ms = 60000 },
+};
+static da16k_filter_state_t iotc_demo_filter_state[iotc_demo_schema_key_count];
+static da16k_filter_t iotc_demo_filter;
+
+/* Set while a filtered message waits in the send queue. The filter is left alone until its result is committed. */
+static volatile bool iotc_demo_send_in_flight = false;
+
+/* Telemetry is assembled in this buffer and handed to the library's background worker, so sending never blocks */
+static uint8_t iotc_demo_telemetry_buffer[DA16K_MSG_ARENA_SIZE(iotc_demo_schema_key_count, 0)];
 
-static inline bool command_has_params(const da16k_cmd_t *cmd) {
-    return cmd->parameters != NULL;
+/* Telemetry that cannot be sent is kept on the Octo-SPI flash and replayed once the gateway is back, at up to
+   2 frames per second and for up to a second per loop so fresh samples keep going out on time */
+#define IOTC_DEMO_JOURNAL_REPLAY_FPS        2
+#define IOTC_DEMO_JOURNAL_REPLAY_BUDGET_MS  1000
+
+static da16k_journal_t iotc_demo_journal;
+static bool iotc_demo_journal_ready = false;
+
+/* Called by the library's worker task once a queued message has been sent, or has failed */
+static void iotc_demo_on_sent(da16k_err_t result, void *context) {
+    da16k_filter_commit((da16k_filter_t *) context, result);
+    __atomic_store_n(&iotc_demo_send_in_flight, false, __ATOMIC_RELEASE);
 }
 
-static void iotc_demo_handle_command(const da16k_cmd_t *cmd) {
-    /* All commands we know need parameters. */
+/* Called by the library's supervisor task whenever the connection to the gateway or the cloud changes */
+static void iotc_demo_on_link_state(da16k_link_state_t previous, da16k_link_state_t state, void *context) {
+    FSP_PARAMETER_NOT_USED (previous);
+    FSP_PARAMETER_NOT_USED (context);
 
-    if (!command_has_params(cmd)) {
-        DA16K_PRINT("ERROR: Command '%s' needs a parameter!\r\n", cmd->command);
-        return;
-    }
+    static const char * const state_names[] = { "down", "UART up", "WiFi joined", "connected", "degraded" };
+
+    DA16K_PRINT("IoTConnect link: %s\r\n", state_names[state]);
+}
 
-    if        (string_starts_with(cmd->command, "set_led_frequency")) {
-        set_led_frequency((uint16_t) atoi(cmd->parameters));
+static void iotc_demo_set_led_frequency(const da16k_cmd_t *cmd, const da16k_cmd_param_t *param) {
+    FSP_PARAMETER_NOT_USED (cmd);
 
-    } else if (string_starts_with(cmd->command, "set_red_led")) {
+    set_led_frequency((uint16_t) param->integer);
+}
 
-        if        (string_starts_with(cmd->parameters, "on")) {
-            TURN_RED_ON
-        } else if (string_starts_with(cmd->parameters, "off")) {
-            TURN_RED_OFF
-        } else {
-            DA16K_PRINT("ERROR: unknown parameter for %s\r\n", cmd->command);
-        }
+static void iotc_demo_set_red_led(const da16k_cmd_t *cmd, const da16k_cmd_param_t *param) {
+    FSP_PARAMETER_NOT_USED (cmd);
 
+    if (param->boolean) {
+        TURN_RED_ON
     } else {
-        DA16K_PRINT("ERROR: Unknown command received: %s\r\n", cmd->command);
-        return;
+        TURN_RED_OFF
+    }
+}
+
+/* Called by the library's command listener task as soon as a command has been fetched */
+static void iotc_demo_on_command(const da16k_cmd_t *cmd, void *context) {
+    FSP_PARAMETER_NOT_USED (context);
+
+    DA16K_PRINT("Command received: %s, parameters: %s\r\n", cmd->command, cmd->parameters ? cmd->parameters : "<none>" );
 
+    if (da16k_dispatch_cmd(cmd) == DA16K_UNKNOWN_CMD) {
+        DA16K_PRINT("ERROR: Unknown command received: %s\r\n", cmd->command);
     }
 }
 
@@ -87,31 +122,85 @@ static da16k_wifi_cfg_t wifi_config = { IOTC_SSID, IOTC_PASSPHRASE, false, 0 };
 void iotc_demo_thread_entry(void *pvParameters) {
     FSP_PARAMETER_NOT_USED (pvParameters);
 
-    da16k_cfg_t da16k_config = { IOTC_CONFIG_PTR, WIFI_CONFIG_PTR, 0 };
-    da16k_err_t err = da16k_init(&da16k_config);
+    /* The supervisor keeps using the configuration, so it must outlive this function's stack frame */
+    static da16k_cfg_t da16k_config = { IOTC_CONFIG_PTR, WIFI_CONFIG_PTR, 0 };
+    da16k_err_t err = da16k_link_init(&da16k_config, iotc_demo_on_link_state, NULL);
+    da16k_msg_t *telemetry = NULL;
 
+    /* Only fails if the UART cannot be opened. The gateway itself is connected in the background, retrying as needed. */
     assert(err == DA16K_SUCCESS);
 
-    while (1) {
-        da16k_cmd_t current_cmd = {0};
-        float cpuTemp = 0.0;
+    err = da16k_scheduler_start();
+    assert(err == DA16K_SUCCESS);
 
-        err = da16k_get_cmd(&current_cmd);
+    err = da16k_async_start();
+    assert(err == DA16K_SUCCESS);
 
-        if (err == DA16K_SUCCESS) {
-            iotc_demo_handle_command(&current_cmd);
-            da16k_destroy_cmd(current_cmd);
-        }
+    err = da16k_link_start();
+    assert(err == DA16K_SUCCESS);
 
-        if (err == DA16K_SUCCESS) {
-            DA16K_PRINT("Command received: %s, parameters: %s\r\n", current_cmd.command, current_cmd.parameters ? current_cmd.parameters : "<none>" );
-        }
+    /* All commands we know need parameters. */
+    da16k_register_cmd_handler("set_led_frequency", iotc_demo_set_led_frequency, &da16k_cmd_param_int);
+    da16k_register_cmd_handler("set_red_led",       iotc_demo_set_red_led,       &da16k_cmd_param_bool);
+
+    err = da16k_cmd_listener_start(iotc_demo_on_command, NULL);
+    assert(err == DA16K_SUCCESS);
+
+    telemetry = da16k_create_msg_in_buffer(iotc_demo_telemetry_buffer, sizeof(iotc_demo_telemetry_buffer));
+    assert(telemetry != NULL);
+
+    da16k_filter_init(&iotc_demo_filter, iotc_demo_schema, iotc_demo_schema_key_count, iotc_demo_filter_rules, iotc_demo_filter_state);
+
+    /* Without a usable flash, telemetry is sent through the background worker and lost while the gateway is away */
+    const da16k_journal_flash_t *journal_flash = ospi_journal_flash();
+    iotc_demo_journal_ready = (journal_flash != NULL) &&
+                              (da16k_journal_open(&iotc_demo_journal, journal_flash, IOTC_DEMO_JOURNAL_REPLAY_FPS) == DA16K_SUCCESS);
+
+    while (1) {
+        float cpuTemp = 0.0;
 
         /* obtain sensor data */
 
         cpuTemp = get_cpu_temperature();
 
-        err = da16k_send_msg_direct_num("cpu_temperature", cpuTemp);
+        /* A sample taken while the previous one is still queued is skipped, it would be judged against a stale value */
+        if (!__atomic_load_n(&iotc_demo_send_in_flight, __ATOMIC_ACQUIRE)) {
+            da16k_filter_add_num(&iotc_demo_filter, telemetry, &iotc_demo_schema[DA16K_KEY_cpu_temperature], cpuTemp);
+        }
+
+        if (da16k_msg_get_count(telemetry) > 0) {
+            bool queued = false;
+
+            if (iotc_demo_journal_ready && da16k_link_get_state() < DA16K_LINK_CONNECTED) {
+                /* No point in trying while the link is down, the journal keeps it until it is back */
+                err = da16k_journal_append(&iotc_demo_journal, telemetry);
+            } else if (iotc_demo_journal_ready) {
+                /* Sent right away, or stored in the journal if the gateway cannot be reached */
+                err = da16k_journal_send_msg(&iotc_demo_journal, telemetry);
+            } else {
+                /* The message is copied into the send queue, so it can be reused right away. It is held back
+                   while the link is down, and dropped only once the queue is full. Queued is not sent yet: the
+                   filter learns the outcome from the callback. */
+                __atomic_store_n(&iotc_demo_send_in_flight, true, __ATOMIC_RELAXED);
+                err     = da16k_send_msg_async(telemetry, iotc_demo_on_sent, &iotc_demo_filter);
+                queued  = (err == DA16K_SUCCESS);
+
+                if (!queued) {
+                    __atomic_store_n(&iotc_demo_send_in_flight, false, __ATOMIC_RELAXED);
+                }
+            }
+
+            /* Sent, stored in the journal to be replayed, or not queued at all */
+            if (!queued) {
+                da16k_filter_commit(&iotc_demo_filter, err);
+            }
+            da16k_msg_reset(telemetry);
+        }
+
+        if (iotc_demo_journal_ready && da16k_journal_pending(&iotc_demo_journal) > 0 &&
+            da16k_link_get_state() >= DA16K_LINK_CONNECTED) {
+            da16k_journal_replay(&iotc_demo_journal, IOTC_DEMO_JOURNAL_REPLAY_BUDGET_MS, NULL);
+        }
 
         vTaskDelay(pdMS_TO_TICKS(5000));
     }
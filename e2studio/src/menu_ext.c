@@ -17,6 +17,7 @@
 #include "board_cfg.h"
 #include "ospi_commands.h"
 #include "menu_ext.h"
+#include "ospi_journal.h"
 #include "r_typedefs.h"
 #include "FreeRTOS.h"
 #include "FreeRTOSconfig.h"
@@ -154,7 +155,6 @@ typedef struct st_clk_settings
                                * where the first few sectors are 4k blocks. */
 
 
-static void reset_ospi_device (void);
 static void wait_for_write (void);
 static void write_en (bool is_dopi);
 static void oclk_change (clk_settings_t const * const clock_settings);
@@ -203,7 +203,7 @@ static clk_settings_t clk_200MHz =
  * Description  : .
  * Return Value : .
  *********************************************************************************************************************/
-static void reset_ospi_device(void)
+void reset_ospi_device(void)
 {
     R_BSP_PinAccessEnable();
     R_BSP_PinCfg(OSPI_RESET_PIN, ((uint32_t) IOPORT_CFG_PORT_DIRECTION_OUTPUT |
@@ -545,6 +545,9 @@ void ospi_performance_test(uint32_t data_size,
 
 #ifndef USE_TINY_TEST
 
+    /* The test reconfigures the device, keep the telemetry journal away from it meanwhile */
+    ospi_journal_suspend();
+
     if (FSP_SUCCESS == err)
     {
         err = ospi_flash_open_test(&erase_size);
@@ -610,6 +613,8 @@ void ospi_performance_test(uint32_t data_size,
 
     }
 
+    ospi_journal_resume();
+
 #else
 #endif
 
@@ -15,6 +15,8 @@
 
 extern test_fn ext_display_menu (void);
 
+extern void reset_ospi_device (void);
+
 extern void ospi_performance_test (uint32_t data_size,
                                     uint32_t * ospi_performance_write_result,
                                     uint32_t * ospi_performance_read_result);
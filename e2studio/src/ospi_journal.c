@@ -0,0 +1,404 @@
+/***********************************************************************************************************************
+ * File Name    : ospi_journal.c
+ * Description  : Telemetry journal storage on the external Octo-SPI flash (S28HL512T).
+ *
+ *                The device is used in its default SPI mode through g_ospi0. Reads go through the memory mapped
+ *                window of CS1, programming and erasing through the driver.
+ **********************************************************************************************************************/
+
+#include <string.h>
+#include "hal_data.h"
+#include "r_typedefs.h"
+#include "menu_ext.h"
+#include "ospi_journal.h"
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "task.h"
+
+#define OSPI_JOURNAL_READ_SFDP_COMMAND      (0x5AU)
+#define OSPI_JOURNAL_READ_SFDP_DUMMY_CYCLES (8U)
+#define OSPI_JOURNAL_SFDP_SIGNATURE         (0x50444653U)
+#define OSPI_JOURNAL_READ_REGISTER_COMMAND  (0x65U)
+#define OSPI_JOURNAL_CFR3V_ADDRESS          (0x800004U)
+#define OSPI_JOURNAL_CFR3V_UNHYSA_Msk       (0x08U)
+
+#define OSPI_JOURNAL_PROGRAM_TIMEOUT_MS     (10U)
+#define OSPI_JOURNAL_ERASE_TIMEOUT_MS       (500U)
+
+static uint8_t * const gp_ospi_journal = (uint8_t *)(void *)(0x90000000 + OSPI_JOURNAL_OFFSET);
+
+static SemaphoreHandle_t s_ospi_journal_mutex = NULL;
+static StaticSemaphore_t s_ospi_journal_mutex_buffer;
+static bool_t            s_ospi_journal_open  = false;
+
+static da16k_err_t ospi_journal_read (void * p_context, uint32_t offset, void * p_dst, size_t length);
+static da16k_err_t ospi_journal_program (void * p_context, uint32_t offset, const void * p_src, size_t length);
+static da16k_err_t ospi_journal_erase (void * p_context, uint32_t offset);
+
+static const da16k_journal_flash_t g_ospi_journal_flash =
+{
+    .read         = ospi_journal_read,
+    .program      = ospi_journal_program,
+    .erase        = ospi_journal_erase,
+    .context      = NULL,
+    .sector_size  = OSPI_JOURNAL_SECTOR_SIZE,
+    .sector_count = OSPI_JOURNAL_SECTOR_COUNT,
+    .program_unit = OSPI_JOURNAL_PROGRAM_UNIT,
+};
+
+/**********************************************************************************************************************
+ * Function Name: ospi_journal_lock
+ * Description  : Takes the device, creating the mutex on first use.
+ * Return Value : .
+ *********************************************************************************************************************/
+static void ospi_journal_lock(void)
+{
+    taskENTER_CRITICAL();
+    if (NULL == s_ospi_journal_mutex)
+    {
+        s_ospi_journal_mutex = xSemaphoreCreateMutexStatic(&s_ospi_journal_mutex_buffer);
+    }
+    taskEXIT_CRITICAL();
+
+    xSemaphoreTake(s_ospi_journal_mutex, portMAX_DELAY);
+}
+/**********************************************************************************************************************
+ End of function ospi_journal_lock
+ *********************************************************************************************************************/
+
+/**********************************************************************************************************************
+ * Function Name: ospi_journal_unlock
+ * Description  : .
+ * Return Value : .
+ *********************************************************************************************************************/
+static void ospi_journal_unlock(void)
+{
+    xSemaphoreGive(s_ospi_journal_mutex);
+}
+/**********************************************************************************************************************
+ End of function ospi_journal_unlock
+ *********************************************************************************************************************/
+
+/**********************************************************************************************************************
+ * Function Name: ospi_journal_open
+ * Description  : Resets the device into SPI mode and opens the driver, unless that has been done already.
+ *                Only the hybrid layout provides the 4 KB sectors the journal needs.
+ * Return Value : FSP_SUCCESS, or the driver error
+ *********************************************************************************************************************/
+static fsp_err_t ospi_journal_open(void)
+{
+    fsp_err_t err = FSP_SUCCESS;
+
+    spi_flash_direct_transfer_t tfr =
+    {
+        .command        = OSPI_JOURNAL_READ_SFDP_COMMAND,
+        .command_length = 1U,
+        .address        = 0U,
+        .address_length = 3U,
+        .data           = 0U,
+        .data_length    = 4U,
+        .dummy_cycles   = OSPI_JOURNAL_READ_SFDP_DUMMY_CYCLES
+    };
+
+    if (s_ospi_journal_open)
+    {
+        return FSP_SUCCESS;
+    }
+
+    /* Someone else may have left the driver open, possibly in another mode */
+    g_ospi0.p_api->close(g_ospi0.p_ctrl);
+    reset_ospi_device();
+
+    err = g_ospi0.p_api->open(g_ospi0.p_ctrl, g_ospi0.p_cfg);
+
+    if (FSP_SUCCESS == err)
+    {
+        err = g_ospi0.p_api->directTransfer(g_ospi0.p_ctrl, &tfr, SPI_FLASH_DIRECT_TRANSFER_DIR_READ);
+    }
+
+    if ((FSP_SUCCESS == err) && (OSPI_JOURNAL_SFDP_SIGNATURE != tfr.data))
+    {
+        err = FSP_ERR_NOT_INITIALIZED;
+    }
+
+    if (FSP_SUCCESS == err)
+    {
+        tfr = (spi_flash_direct_transfer_t)
+        {
+            .command        = OSPI_JOURNAL_READ_REGISTER_COMMAND,
+            .command_length = 1U,
+            .address        = OSPI_JOURNAL_CFR3V_ADDRESS,
+            .address_length = 3U,
+            .data           = 0U,
+            .data_length    = 1U,
+            .dummy_cycles   = 0U
+        };
+        err = g_ospi0.p_api->directTransfer(g_ospi0.p_ctrl, &tfr, SPI_FLASH_DIRECT_TRANSFER_DIR_READ);
+    }
+
+    if ((FSP_SUCCESS == err) && (tfr.data & OSPI_JOURNAL_CFR3V_UNHYSA_Msk))
+    {
+        err = FSP_ERR_UNSUPPORTED;
+    }
+
+    if (FSP_SUCCESS == err)
+    {
+        s_ospi_journal_open = true;
+    }
+    else
+    {
+        g_ospi0.p_api->close(g_ospi0.p_ctrl);
+    }
+
+    return (err);
+}
+/**********************************************************************************************************************
+ End of function ospi_journal_open
+ *********************************************************************************************************************/
+
+/**********************************************************************************************************************
+ * Function Name: ospi_journal_wait
+ * Description  : Waits for a program or erase operation to complete.
+ * Argument     : timeout_ms
+ * Return Value : FSP_SUCCESS, FSP_ERR_TIMEOUT or the driver error
+ *********************************************************************************************************************/
+static fsp_err_t ospi_journal_wait(uint32_t timeout_ms)
+{
+    spi_flash_status_t status = { 0 };
+    TickType_t         start  = xTaskGetTickCount();
+    fsp_err_t          err;
+
+    do
+    {
+        err = g_ospi0.p_api->statusGet(g_ospi0.p_ctrl, &status);
+
+        if ((FSP_SUCCESS == err) && status.write_in_progress)
+        {
+            if ((xTaskGetTickCount() - start) > pdMS_TO_TICKS(timeout_ms))
+            {
+                err = FSP_ERR_TIMEOUT;
+            }
+            else if (timeout_ms > OSPI_JOURNAL_PROGRAM_TIMEOUT_MS)
+            {
+                /* Erasing takes tens of milliseconds, let other tasks run meanwhile */
+                vTaskDelay(1);
+            }
+        }
+    }
+    while ((FSP_SUCCESS == err) && status.write_in_progress);
+
+    return (err);
+}
+/**********************************************************************************************************************
+ End of function ospi_journal_wait
+ *********************************************************************************************************************/
+
+/**********************************************************************************************************************
+ * Function Name: ospi_journal_invalidate
+ * Description  : Drops cached copies of the memory mapped flash after it was changed.
+ * Arguments    : offset
+ *              : length
+ * Return Value : .
+ *********************************************************************************************************************/
+static void ospi_journal_invalidate(uint32_t offset, size_t length)
+{
+#if defined(__DCACHE_PRESENT) && (__DCACHE_PRESENT == 1U)
+    SCB_InvalidateDCache_by_Addr(gp_ospi_journal + offset, (int32_t) length);
+#else
+    FSP_PARAMETER_NOT_USED(offset);
+    FSP_PARAMETER_NOT_USED(length);
+#endif
+}
+/**********************************************************************************************************************
+ End of function ospi_journal_invalidate
+ *********************************************************************************************************************/
+
+/**********************************************************************************************************************
+ * Function Name: ospi_journal_in_range
+ * Description  : .
+ * Arguments    : offset
+ *              : length
+ * Return Value : true if the range lies within the journal area
+ *********************************************************************************************************************/
+static bool_t ospi_journal_in_range(uint32_t offset, size_t length)
+{
+    return (offset < (OSPI_JOURNAL_SECTOR_SIZE * OSPI_JOURNAL_SECTOR_COUNT)) &&
+           (length <= ((OSPI_JOURNAL_SECTOR_SIZE * OSPI_JOURNAL_SECTOR_COUNT) - offset));
+}
+/**********************************************************************************************************************
+ End of function ospi_journal_in_range
+ *********************************************************************************************************************/
+
+/**********************************************************************************************************************
+ * Function Name: ospi_journal_read
+ * Description  : da16k_journal_flash_t read callback.
+ *********************************************************************************************************************/
+static da16k_err_t ospi_journal_read(void * p_context, uint32_t offset, void * p_dst, size_t length)
+{
+    da16k_err_t ret = DA16K_SUCCESS;
+
+    FSP_PARAMETER_NOT_USED(p_context);
+
+    if (!ospi_journal_in_range(offset, length))
+    {
+        return DA16K_INVALID_PARAMETER;
+    }
+
+    ospi_journal_lock();
+
+    if (FSP_SUCCESS == ospi_journal_open())
+    {
+        memcpy(p_dst, gp_ospi_journal + offset, length);
+    }
+    else
+    {
+        ret = DA16K_STORAGE_ERROR;
+    }
+
+    ospi_journal_unlock();
+
+    return ret;
+}
+/**********************************************************************************************************************
+ End of function ospi_journal_read
+ *********************************************************************************************************************/
+
+/**********************************************************************************************************************
+ * Function Name: ospi_journal_program
+ * Description  : da16k_journal_flash_t program callback. Writes never cross a page boundary.
+ *********************************************************************************************************************/
+static da16k_err_t ospi_journal_program(void * p_context, uint32_t offset, const void * p_src, size_t length)
+{
+    const uint8_t * p_data    = (const uint8_t *) p_src;
+    uint32_t        page_size = g_ospi0.p_cfg->page_size_bytes;
+    uint32_t        done      = 0;
+    fsp_err_t       err;
+
+    FSP_PARAMETER_NOT_USED(p_context);
+
+    if (!ospi_journal_in_range(offset, length))
+    {
+        return DA16K_INVALID_PARAMETER;
+    }
+
+    ospi_journal_lock();
+
+    err = ospi_journal_open();
+
+    while ((FSP_SUCCESS == err) && (done < length))
+    {
+        uint32_t address = OSPI_JOURNAL_OFFSET + offset + done;
+        uint32_t count   = page_size - (address % page_size);
+
+        if (count > (length - done))
+        {
+            count = length - done;
+        }
+
+        err = g_ospi0.p_api->write(g_ospi0.p_ctrl, p_data + done, gp_ospi_journal + offset + done, count);
+
+        if (FSP_SUCCESS == err)
+        {
+            err = ospi_journal_wait(OSPI_JOURNAL_PROGRAM_TIMEOUT_MS);
+        }
+
+        done += count;
+    }
+
+    ospi_journal_invalidate(offset, length);
+    ospi_journal_unlock();
+
+    return (FSP_SUCCESS == err) ? DA16K_SUCCESS : DA16K_STORAGE_ERROR;
+}
+/**********************************************************************************************************************
+ End of function ospi_journal_program
+ *********************************************************************************************************************/
+
+/**********************************************************************************************************************
+ * Function Name: ospi_journal_erase
+ * Description  : da16k_journal_flash_t erase callback.
+ *********************************************************************************************************************/
+static da16k_err_t ospi_journal_erase(void * p_context, uint32_t offset)
+{
+    fsp_err_t err;
+
+    FSP_PARAMETER_NOT_USED(p_context);
+
+    if (!ospi_journal_in_range(offset, OSPI_JOURNAL_SECTOR_SIZE) || (offset % OSPI_JOURNAL_SECTOR_SIZE))
+    {
+        return DA16K_INVALID_PARAMETER;
+    }
+
+    ospi_journal_lock();
+
+    err = ospi_journal_open();
+
+    if (FSP_SUCCESS == err)
+    {
+        err = g_ospi0.p_api->erase(g_ospi0.p_ctrl, gp_ospi_journal + offset, OSPI_JOURNAL_SECTOR_SIZE);
+    }
+
+    if (FSP_SUCCESS == err)
+    {
+        err = ospi_journal_wait(OSPI_JOURNAL_ERASE_TIMEOUT_MS);
+    }
+
+    ospi_journal_invalidate(offset, OSPI_JOURNAL_SECTOR_SIZE);
+    ospi_journal_unlock();
+
+    return (FSP_SUCCESS == err) ? DA16K_SUCCESS : DA16K_STORAGE_ERROR;
+}
+/**********************************************************************************************************************
+ End of function ospi_journal_erase
+ *********************************************************************************************************************/
+
+/**********************************************************************************************************************
+ * Function Name: ospi_journal_flash
+ * Description  : .
+ * Return Value : Flash descriptor for da16k_journal_open, NULL if the device cannot be used
+ *********************************************************************************************************************/
+const da16k_journal_flash_t * ospi_journal_flash(void)
+{
+    fsp_err_t err;
+
+    ospi_journal_lock();
+    err = ospi_journal_open();
+    ospi_journal_unlock();
+
+    return (FSP_SUCCESS == err) ? &g_ospi_journal_flash : NULL;
+}
+/**********************************************************************************************************************
+ End of function ospi_journal_flash
+ *********************************************************************************************************************/
+
+/**********************************************************************************************************************
+ * Function Name: ospi_journal_suspend
+ * Description  : Closes the driver and keeps the journal from using the device until ospi_journal_resume.
+ * Return Value : .
+ *********************************************************************************************************************/
+void ospi_journal_suspend(void)
+{
+    ospi_journal_lock();
+
+    if (s_ospi_journal_open)
+    {
+        g_ospi0.p_api->close(g_ospi0.p_ctrl);
+        s_ospi_journal_open = false;
+    }
+}
+/**********************************************************************************************************************
+ End of function ospi_journal_suspend
+ *********************************************************************************************************************/
+
+/**********************************************************************************************************************
+ * Function Name: ospi_journal_resume
+ * Description  : .
+ * Return Value : .
+ *********************************************************************************************************************/
+void ospi_journal_resume(void)
+{
+    ospi_journal_unlock();
+}
+/**********************************************************************************************************************
+ End of function ospi_journal_resume
+ *********************************************************************************************************************/
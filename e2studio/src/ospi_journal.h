@@ -0,0 +1,26 @@
+/***********************************************************************************************************************
+ * File Name    : ospi_journal.h
+ * Description  : Telemetry journal storage on the external Octo-SPI flash (S28HL512T).
+ **********************************************************************************************************************/
+
+#ifndef OSPI_JOURNAL_H_
+#define OSPI_JOURNAL_H_
+
+#include "da16k_comm/da16k_comm.h"
+
+/* The journal takes the upper half of the 4 KB parameter sectors at the bottom of the device (hybrid layout,
+ * CFR3V.UNHYSA = 0). The lower half is used by the Octo-SPI speed test. */
+#define OSPI_JOURNAL_OFFSET         (0x10000U)
+#define OSPI_JOURNAL_SECTOR_SIZE    (4096U)
+#define OSPI_JOURNAL_SECTOR_COUNT   (16U)
+#define OSPI_JOURNAL_PROGRAM_UNIT   (16U)       /* ECC unit, must not be programmed twice */
+
+/* Returns the flash descriptor for da16k_journal_open, or NULL if the device cannot be used for the journal */
+extern const da16k_journal_flash_t * ospi_journal_flash (void);
+
+/* Give the device to someone else (e.g. the speed test, which changes its mode) and take it back afterwards.
+ * The device is reset and reopened on the next journal access. */
+extern void ospi_journal_suspend (void);
+extern void ospi_journal_resume (void);
+
+#endif /* OSPI_JOURNAL_H_ */